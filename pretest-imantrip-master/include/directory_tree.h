@@ -2,7 +2,17 @@
 #define DIRECTORY_TREE_H
 
 #include <inttypes.h>
+#include <stdbool.h>
 #include <stddef.h>
+#include <sys/uio.h>
+
+/**
+ * A region that directory tree nodes, their names and their children arrays
+ * can be allocated from, instead of with a separate `malloc()` each.
+ * Allocations are bumped out of large contiguous blocks, so nodes built together
+ * sit together in memory, and the whole arena is freed at once.
+ */
+typedef struct tree_arena tree_arena_t;
 
 /** The possible types of a `node_t` (either a file or a directory) */
 typedef enum { FILE_TYPE, DIRECTORY_TYPE } node_type_t;
@@ -15,6 +25,11 @@ typedef struct {
      * If `type == DIRECTORY_TYPE`, the `node_t *` can be cast to a `directory_node_t *`.
      */
     node_type_t type;
+    /**
+     * Whether the node was allocated from a `tree_arena_t`,
+     * in which case the arena owns it, its name and (for a directory) its children array
+     */
+    bool in_arena;
     /** The name of the file or directory */
     char *name;
 } node_t;
@@ -27,6 +42,20 @@ typedef struct {
     size_t size;
     /** The file's contents. This points to a byte array of length `size`. */
     uint8_t *contents;
+    /**
+     * Whether the node owns `contents` and frees it.
+     * Otherwise, `contents` is borrowed (e.g. from a mapped disk image) and is read-only.
+     */
+    bool owns_contents;
+    /**
+     * The pieces of a fragmented file's contents, in order, whose sizes add up to `size`.
+     * Each piece is borrowed, but the node owns the array.
+     * This is `NULL` unless the file was created by `init_fragmented_file_node()`,
+     * in which case `contents` is `NULL` instead.
+     */
+    struct iovec *pieces;
+    /** The number of elements of `pieces` */
+    size_t num_pieces;
 } file_node_t;
 
 /** A node representing a directory in a directory tree */
@@ -38,12 +67,52 @@ typedef struct {
     /**
      * The directory's children. This points to an array
      * of `node_t *`s of length `num_children`.
-     * The children are sorted by their filenames (duplicates are not permitted).
+     * The children are sorted by their filenames (duplicates are not permitted),
+     * except after `append_child_directory_tree()` until `sort_directory_tree()`.
      * This can be `NULL` if `num_children == 0`.
      */
     node_t **children;
+    /** The number of children that fit in `children` before it must grow */
+    size_t capacity;
+    /** The arena that `children` is allocated from, or `NULL` if it is heap-allocated */
+    tree_arena_t *arena;
 } directory_node_t;
 
+/**
+ * Creates a new arena. It is initially empty.
+ *
+ * @return a heap-allocated pointer to the arena
+ */
+tree_arena_t *tree_arena_init(void);
+
+/**
+ * Allocates memory from an arena, suitably aligned for any node or array.
+ * It cannot be freed individually, only with the arena.
+ *
+ * @param arena the arena to allocate from
+ * @param size the number of bytes to allocate
+ * @return a pointer to the new memory
+ */
+void *tree_arena_alloc(tree_arena_t *arena, size_t size);
+
+/**
+ * Copies a string into an arena. Strings are packed without alignment,
+ * so short names (e.g. FAT16's 8.3 names) take up no more than their length.
+ *
+ * @param arena the arena to allocate from
+ * @param string the string to copy
+ * @return the copy
+ */
+char *tree_arena_strdup(tree_arena_t *arena, const char *string);
+
+/**
+ * Frees an arena and everything allocated from it, including all of its nodes.
+ * No node from the arena may be used afterwards.
+ *
+ * @param arena an arena returned from `tree_arena_init()`
+ */
+void tree_arena_free(tree_arena_t *arena);
+
 /**
  * Creates a new file node with the given filename and contents.
  *
@@ -57,6 +126,37 @@ typedef struct {
  */
 file_node_t *init_file_node(char *name, size_t size, uint8_t *contents);
 
+/**
+ * Creates a new file node whose contents are borrowed rather than copied.
+ * The contents are never written or freed through the node,
+ * so they must stay valid for as long as the node is used.
+ *
+ * @param name the filename of the file.
+ *   This string must be heap-allocated, and the function takes ownership of it.
+ * @param size the number of bytes in the file
+ * @param contents the bytes that make up the contents of the file,
+ *   an array of length `size` (e.g. a slice of a mapped disk image)
+ * @return a heap-allocated pointer to the file node
+ */
+file_node_t *init_borrowed_file_node(char *name, size_t size, const uint8_t *contents);
+
+/**
+ * Creates a new file node whose contents are borrowed pieces, e.g. the runs of
+ * clusters of a fragmented file in a mapped disk image.
+ * The pieces are written out in order, without first being copied together.
+ *
+ * @param name the filename of the file.
+ *   This string must be heap-allocated, and the function takes ownership of it.
+ * @param size the number of bytes in the file, the total size of the pieces
+ * @param pieces the pieces of the file's contents. This must be a heap-allocated
+ *   array of length `num_pieces`, and the function takes ownership of it,
+ *   but not of the bytes the pieces point to. It can be `NULL` if `size == 0`.
+ * @param num_pieces the number of pieces
+ * @return a heap-allocated pointer to the file node
+ */
+file_node_t *init_fragmented_file_node(char *name, size_t size, struct iovec *pieces,
+                                       size_t num_pieces);
+
 /**
  * Creates a new directory node with the given name.
  * The directory initially has no children.
@@ -68,6 +168,34 @@ file_node_t *init_file_node(char *name, size_t size, uint8_t *contents);
  */
 directory_node_t *init_directory_node(char *name);
 
+/**
+ * Creates a new file node in an arena, whose contents are borrowed pieces
+ * as for `init_fragmented_file_node()`.
+ *
+ * @param arena the arena to allocate the node from
+ * @param name the filename of the file. This must be allocated from the arena
+ *   (e.g. with `tree_arena_strdup()`) or outlive it.
+ * @param size the number of bytes in the file, the total size of the pieces
+ * @param pieces the pieces of the file's contents. This array must likewise be
+ *   allocated from the arena or outlive it. It can be `NULL` if `size == 0`.
+ * @param num_pieces the number of pieces
+ * @return a pointer to the file node, owned by the arena
+ */
+file_node_t *init_arena_file_node(tree_arena_t *arena, char *name, size_t size,
+                                  struct iovec *pieces, size_t num_pieces);
+
+/**
+ * Creates a new directory node in an arena. Its children array is allocated
+ * from the arena as it grows, and its children must be from the same arena.
+ *
+ * @param arena the arena to allocate the node from
+ * @param name the filename of the directory. This must be allocated from the arena
+ *   or outlive it. `name` can be `NULL` for the root directory,
+ *   and will be replaced by "ROOT".
+ * @return a pointer to the directory node, owned by the arena
+ */
+directory_node_t *init_arena_directory_node(tree_arena_t *arena, char *name);
+
 /**
  * Adds a child node to a directory.
  * The directory's children must remain in sorted order.
@@ -78,6 +206,36 @@ directory_node_t *init_directory_node(char *name);
  */
 void add_child_directory_tree(directory_node_t *dnode, node_t *child);
 
+/**
+ * Adds a child node to the end of a directory, without keeping its children sorted.
+ * This is for building a large directory at once: after adding all of them,
+ * sort the children once with `sort_directory_tree()`, rather than inserting each one
+ * into its sorted position. Until then, the directory must only be appended to.
+ *
+ * @param dnode the parent directory to add `child` to
+ * @param child the child file or directory to add to `dnode`.
+ *   This node must be heap-allocated, and the function takes ownership of it.
+ */
+void append_child_directory_tree(directory_node_t *dnode, node_t *child);
+
+/**
+ * Sorts the children of every directory in a directory tree by their filenames.
+ * This restores the order after `append_child_directory_tree()`.
+ *
+ * @param node the root of the directory tree. This may be a file or directory.
+ */
+void sort_directory_tree(node_t *node);
+
+/**
+ * Finds the child of a directory with a given filename, by binary search.
+ * The directory's children must be sorted.
+ *
+ * @param dnode the directory to search
+ * @param name the filename to look for
+ * @return the child named `name`, or `NULL` if there is none
+ */
+node_t *get_child_directory_tree(directory_node_t *dnode, const char *name);
+
 /**
  * Prints all the subdirectories and files in a directory tree.
  * See the project spec for the formatting requirements of this printed tree.
@@ -98,7 +256,10 @@ void create_directory_tree(node_t *node);
  * Recursively frees all nodes in a directory tree.
  *
  * @param node a file or directory node to free. This may be a file or directory.
- *   The node and all its descendants (if it's a directory) must be heap-allocated.
+ *   The node and all its descendants (if it's a directory) must be heap-allocated,
+ *   except for nodes from an arena, which are left for `tree_arena_free()`.
+ *   So freeing a tree built entirely in an arena does not even visit its nodes.
+ *   Borrowed file contents are not freed.
  */
 void free_directory_tree(node_t *node);
 
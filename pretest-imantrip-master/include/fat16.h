@@ -4,6 +4,7 @@
 #include <inttypes.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <sys/uio.h>
 
 /**
  * Represents the layout of a FAT16 BIOS Parameter Block on disk.
@@ -39,6 +40,51 @@ typedef struct __attribute__((__packed__)) {
     uint32_t file_size;
 } directory_entry_t;
 
+/**
+ * A FAT16 disk image mapped into memory.
+ * Its structures are read in place, and file contents are slices of the mapping,
+ * so nothing is copied out of the image.
+ */
+typedef struct {
+    /** The bytes of the image. These are read-only. */
+    const uint8_t *data;
+    /** The size of the image in bytes */
+    size_t size;
+    /** The BIOS Parameter Block, which points into `data` */
+    const bios_parameter_block_t *bpb;
+    /** The first File Allocation Table, which points into `data` */
+    const uint16_t *fat;
+    /** The number of entries in `fat` */
+    size_t fat_entries;
+} fat16_image_t;
+
+/**
+ * Maps a FAT16 disk image into memory.
+ *
+ * @param path the filename of the image
+ * @param image where to store the mapped image
+ * @return `true` if the image was mapped, `false` if it could not be opened
+ *   or is too small to contain a BIOS Parameter Block and File Allocation Table
+ */
+bool open_image(const char *path, fat16_image_t *image);
+
+/**
+ * Unmaps a FAT16 disk image. Slices of the image must not be used afterwards.
+ *
+ * @param image an image mapped by `open_image()`
+ */
+void close_image(fat16_image_t *image);
+
+/**
+ * Gets the bytes at a given position in a FAT16 disk image, without copying them.
+ *
+ * @param image the mapped image
+ * @param offset the index of the first byte
+ * @param size the number of bytes
+ * @return a pointer to the bytes in the mapping, or `NULL` if they extend past the image
+ */
+const void *get_image_slice(const fat16_image_t *image, size_t offset, size_t size);
+
 /**
  * Computes the position of the start of the root directory on a FAT16 disk.
  *
@@ -56,6 +102,40 @@ size_t get_root_directory_location(bios_parameter_block_t bpb);
  */
 size_t get_offset_from_cluster(size_t cluster, bios_parameter_block_t bpb);
 
+/**
+ * Computes the number of bytes in each cluster of a FAT16 disk.
+ *
+ * @param bpb the BIOS Parameter Block of the FAT16 disk
+ * @return the size of a cluster in bytes
+ */
+size_t get_cluster_size(bios_parameter_block_t bpb);
+
+/**
+ * Finds the cluster after a given one in its chain, using the File Allocation Table.
+ * If the chain is missing (the cluster is free, e.g. because its file was deleted)
+ * or invalid, the following cluster on the disk is assumed.
+ *
+ * @param image the mapped image
+ * @param cluster a cluster number
+ * @return the next cluster, or 0 if `cluster` is the last in its chain
+ */
+size_t get_next_cluster(const fat16_image_t *image, size_t cluster);
+
+/**
+ * Finds where a file's contents are stored in a FAT16 disk image by following its
+ * cluster chain. Runs of consecutive clusters are coalesced into a single piece.
+ *
+ * @param image the mapped image
+ * @param entry the file's directory entry
+ * @param pieces a heap-allocated array to store the pieces of the file in, in order,
+ *   which point into the mapping. It is grown as needed, so it can be reused
+ *   across files; it can start out as `NULL`.
+ * @param capacity the number of pieces `*pieces` has room for, which is updated as it grows
+ * @return the number of pieces, which is 0 if the file is empty
+ */
+size_t get_file_pieces(const fat16_image_t *image, directory_entry_t entry,
+                       struct iovec **pieces, size_t *capacity);
+
 /**
  * Computes whether a directory entry represents a subdirectory.
  *
@@ -73,6 +153,12 @@ bool is_directory(directory_entry_t entry);
  */
 bool is_hidden(directory_entry_t entry);
 
+/**
+ * The most bytes in a directory entry's filename, including the '\0':
+ * an 8-character name, a '.', and a 3-character extension.
+ */
+#define FILE_NAME_SIZE 13
+
 /**
  * Compute's a directory entry's filename.
  * If the entry is marked deleted, this will approximate its previous filename.
@@ -82,4 +168,12 @@ bool is_hidden(directory_entry_t entry);
  */
 char *get_file_name(directory_entry_t entry);
 
+/**
+ * Computes a directory entry's filename, like `get_file_name()`, into a buffer.
+ *
+ * @param entry the directory entry
+ * @param full where to store the entry's filename
+ */
+void copy_file_name(directory_entry_t entry, char full[FILE_NAME_SIZE]);
+
 #endif /* FAT16_H */
@@ -1,67 +1,261 @@
 #include "directory_tree.h"
 
 #include <assert.h>
+#include <fcntl.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
-void init_node(node_t *node, char *name, node_type_t type) {
+#include "thread_pool.h"
+
+/** The most pieces one `writev()` takes (`IOV_MAX` on Linux) */
+#define MAX_PIECES_PER_WRITE 1024
+
+/** The number of children a directory has room for once it has any */
+const size_t INITIAL_CAPACITY = 4;
+/** The size of each block of a `tree_arena_t`, unless an allocation needs a bigger one */
+const size_t ARENA_BLOCK_SIZE = 64 * 1024;
+const mode_t DIRECTORY_MODE = 0777;
+const mode_t FILE_MODE = 0666;
+/** The number of children each piece of work creates files for */
+const size_t FILES_PER_WORK = 16;
+/**
+ * The most directories whose files can be waiting on the thread pool at once,
+ * each of which is kept open meanwhile. Beyond this, files are written without the pool.
+ */
+const unsigned MAX_OPEN_DIRECTORIES = 256;
+
+typedef struct arena_block {
+    struct arena_block *next;
+    /** The number of bytes in `data`, and how many of them are allocated */
+    size_t size;
+    size_t used;
+    _Alignas(max_align_t) uint8_t data[];
+} arena_block_t;
+
+struct tree_arena {
+    /** The blocks of the arena, the one being allocated from first */
+    arena_block_t *blocks;
+};
+
+tree_arena_t *tree_arena_init(void) {
+    tree_arena_t *arena = malloc(sizeof(tree_arena_t));
+    assert(arena != NULL);
+    arena->blocks = NULL;
+    return arena;
+}
+
+void *arena_alloc_aligned(tree_arena_t *arena, size_t size, size_t alignment) {
+    arena_block_t *block = arena->blocks;
+    size_t offset = block == NULL ? 0 : (block->used + alignment - 1) & ~(alignment - 1);
+    if (block == NULL || offset + size > block->size) {
+        size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        block = malloc(sizeof(arena_block_t) + block_size);
+        assert(block != NULL);
+        block->size = block_size;
+        block->next = arena->blocks;
+        arena->blocks = block;
+        offset = 0;
+    }
+    block->used = offset + size;
+    return block->data + offset;
+}
+
+void *tree_arena_alloc(tree_arena_t *arena, size_t size) {
+    return arena_alloc_aligned(arena, size, _Alignof(max_align_t));
+}
+
+char *tree_arena_strdup(tree_arena_t *arena, const char *string) {
+    size_t size = strlen(string) + 1;
+    char *copy = arena_alloc_aligned(arena, size, 1);
+    memcpy(copy, string, size);
+    return copy;
+}
+
+void tree_arena_free(tree_arena_t *arena) {
+    arena_block_t *block = arena->blocks;
+    while (block != NULL) {
+        arena_block_t *next = block->next;
+        free(block);
+        block = next;
+    }
+    free(arena);
+}
+
+/** Allocates a node from an arena, or from the heap if the arena is `NULL` */
+void *alloc_node(tree_arena_t *arena, size_t size) {
+    if (arena != NULL) {
+        return tree_arena_alloc(arena, size);
+    }
+    void *node = malloc(size);
+    assert(node != NULL);
+    return node;
+}
+
+void init_node(node_t *node, tree_arena_t *arena, char *name, node_type_t type) {
     if (name == NULL) {
-        name = strdup("ROOT");
+        name = arena != NULL ? tree_arena_strdup(arena, "ROOT") : strdup("ROOT");
         assert(name != NULL);
     }
     node->name = name;
     node->type = type;
+    node->in_arena = arena != NULL;
 }
 
-file_node_t *init_file_node(char *name, size_t size, uint8_t *contents) {
-    file_node_t *node = malloc(sizeof(file_node_t));
-    assert(node != NULL);
-    init_node((node_t *) node, name, FILE_TYPE);
+file_node_t *init_file_node_in(tree_arena_t *arena, char *name, size_t size,
+                               uint8_t *contents) {
+    file_node_t *node = alloc_node(arena, sizeof(file_node_t));
+    init_node((node_t *) node, arena, name, FILE_TYPE);
     node->size = size;
     node->contents = contents;
+    node->owns_contents = arena == NULL;
+    node->pieces = NULL;
+    node->num_pieces = 0;
     return node;
 }
 
-directory_node_t *init_directory_node(char *name) {
-    directory_node_t *node = malloc(sizeof(directory_node_t));
-    assert(node != NULL);
-    init_node((node_t *) node, name, DIRECTORY_TYPE);
+directory_node_t *init_directory_node_in(tree_arena_t *arena, char *name) {
+    directory_node_t *node = alloc_node(arena, sizeof(directory_node_t));
+    init_node((node_t *) node, arena, name, DIRECTORY_TYPE);
     node->num_children = 0;
     node->children = NULL;
+    node->capacity = 0;
+    node->arena = arena;
     return node;
 }
 
-void add_child_directory_tree(directory_node_t *dnode, node_t *child) {
-    // Reallocates Space
-    if (dnode == NULL || child == NULL) {
+file_node_t *init_file_node(char *name, size_t size, uint8_t *contents) {
+    return init_file_node_in(NULL, name, size, contents);
+}
+
+file_node_t *init_borrowed_file_node(char *name, size_t size, const uint8_t *contents) {
+    file_node_t *node = init_file_node(name, size, (uint8_t *) contents);
+    node->owns_contents = false;
+    return node;
+}
+
+file_node_t *init_fragmented_file_node(char *name, size_t size, struct iovec *pieces,
+                                       size_t num_pieces) {
+    file_node_t *node = init_borrowed_file_node(name, size, NULL);
+    node->pieces = pieces;
+    node->num_pieces = num_pieces;
+    return node;
+}
+
+directory_node_t *init_directory_node(char *name) {
+    return init_directory_node_in(NULL, name);
+}
+
+file_node_t *init_arena_file_node(tree_arena_t *arena, char *name, size_t size,
+                                  struct iovec *pieces, size_t num_pieces) {
+    assert(arena != NULL);
+    file_node_t *node = init_file_node_in(arena, name, size, NULL);
+    node->pieces = pieces;
+    node->num_pieces = num_pieces;
+    return node;
+}
+
+directory_node_t *init_arena_directory_node(tree_arena_t *arena, char *name) {
+    assert(arena != NULL);
+    return init_directory_node_in(arena, name);
+}
+
+/** Makes room for one more child, doubling the capacity of the children array if needed */
+void reserve_child(directory_node_t *dnode, node_t *child) {
+    // A directory in an arena is freed with it, so its children must be too
+    assert(dnode->arena == NULL || child->in_arena);
+    if (dnode->num_children < dnode->capacity) {
         return;
     }
-    size_t size = dnode->num_children;
-    node_t **new_children =
-        (node_t **) realloc(dnode->children, (size + 1) * sizeof(node_t *));
-    dnode->children = new_children;
+    dnode->capacity = dnode->capacity > 0 ? dnode->capacity * 2 : INITIAL_CAPACITY;
+    if (dnode->arena != NULL) {
+        // The old array stays in the arena, but all of them add up to less than the last
+        node_t **children = tree_arena_alloc(dnode->arena, sizeof(node_t *[dnode->capacity]));
+        if (dnode->num_children > 0) {
+            memcpy(children, dnode->children, sizeof(node_t *[dnode->num_children]));
+        }
+        dnode->children = children;
+    }
+    else {
+        dnode->children = realloc(dnode->children, sizeof(node_t *[dnode->capacity]));
+        assert(dnode->children != NULL);
+    }
+}
 
-    // Insert new child
-    size_t position = 0;
-    while (position < dnode->num_children) {
-        if (strcmp(dnode->children[position]->name, child->name) < 0) {
-            position++;
+/** Finds the index of the first child whose name is not less than `name` */
+size_t find_child_position(directory_node_t *dnode, const char *name) {
+    size_t left = 0;
+    size_t right = dnode->num_children;
+    while (left < right) {
+        size_t mid = left + (right - left) / 2;
+        if (strcmp(dnode->children[mid]->name, name) < 0) {
+            left = mid + 1;
         }
         else {
-            break;
+            right = mid;
         }
     }
-    for (size_t i = dnode->num_children; i > position; i--) {
-        dnode->children[i] = dnode->children[i - 1];
+    return left;
+}
+
+void add_child_directory_tree(directory_node_t *dnode, node_t *child) {
+    if (dnode == NULL || child == NULL) {
+        return;
     }
+    reserve_child(dnode, child);
+
+    // Insert new child, shifting the children after it
+    size_t position = find_child_position(dnode, child->name);
+    memmove(&dnode->children[position + 1], &dnode->children[position],
+            sizeof(node_t *[dnode->num_children - position]));
     dnode->children[position] = child;
 
     // Update number of children
     dnode->num_children++;
 }
 
+void append_child_directory_tree(directory_node_t *dnode, node_t *child) {
+    if (dnode == NULL || child == NULL) {
+        return;
+    }
+    reserve_child(dnode, child);
+    dnode->children[dnode->num_children++] = child;
+}
+
+int compare_children(const void *a, const void *b) {
+    const node_t *child_a = *(node_t *const *) a;
+    const node_t *child_b = *(node_t *const *) b;
+    return strcmp(child_a->name, child_b->name);
+}
+
+void sort_directory_tree(node_t *node) {
+    if (node == NULL || node->type != DIRECTORY_TYPE) {
+        return;
+    }
+    directory_node_t *dnode = (directory_node_t *) node;
+    if (dnode->num_children > 1) {
+        qsort(dnode->children, dnode->num_children, sizeof(node_t *), compare_children);
+    }
+    for (size_t i = 0; i < dnode->num_children; i++) {
+        sort_directory_tree(dnode->children[i]);
+    }
+}
+
+node_t *get_child_directory_tree(directory_node_t *dnode, const char *name) {
+    size_t position = find_child_position(dnode, name);
+    if (position < dnode->num_children &&
+        strcmp(dnode->children[position]->name, name) == 0) {
+        return dnode->children[position];
+    }
+    return NULL;
+}
+
 void print_directory_helper(node_t *node, size_t level) {
     // Adds spaces for level
     for (size_t i = 0; i < level; i++) {
@@ -85,38 +279,174 @@ void print_directory_tree(node_t *node) {
     print_directory_helper(node, 0);
 }
 
-void helper_directory_tree(node_t *node, char *filename) {
-    char *dir_name = malloc(sizeof(char) * (strlen(filename) + strlen(node->name) + 2));
-    strcpy(dir_name, filename);
-    strcat(dir_name, "/");
-    strcat(dir_name, node->name);
-    if (node->type == DIRECTORY_TYPE) {
-        directory_node_t *dir_node = (directory_node_t *) node;
-        assert(mkdir(dir_name, 0777) == 0);
-        for (size_t i = 0; i < dir_node->num_children; i++) {
-            helper_directory_tree(dir_node->children[i], dir_name);
+/**
+ * Writes out the pieces of a file in as few system calls as possible,
+ * resuming after any partial writes.
+ */
+void write_pieces(int fd, const struct iovec *pieces, size_t num_pieces) {
+    struct iovec batch[MAX_PIECES_PER_WRITE];
+    size_t index = 0;
+    // How much of `pieces[index]` has already been written
+    size_t skip = 0;
+    while (index < num_pieces) {
+        size_t count = 0;
+        while (count < MAX_PIECES_PER_WRITE && index + count < num_pieces) {
+            batch[count] = pieces[index + count];
+            count++;
+        }
+        batch[0].iov_base = (uint8_t *) batch[0].iov_base + skip;
+        batch[0].iov_len -= skip;
+        ssize_t written = writev(fd, batch, count);
+        assert(written > 0);
+
+        // Skips past the pieces that were written completely
+        size_t done = skip + written;
+        while (index < num_pieces && done >= pieces[index].iov_len) {
+            done -= pieces[index].iov_len;
+            index++;
         }
+        skip = done;
     }
-    else {
-        file_node_t *file_node = (file_node_t *) node;
-        FILE *file = fopen(dir_name, "w");
-        assert(fwrite(file_node->contents, sizeof(char), file_node->size, file) ==
-               file_node->size);
-        assert(fclose(file) == 0);
+}
+
+/** Opens a file in a directory and writes all of its contents with a single call */
+void write_file(int directory_fd, file_node_t *file) {
+    int fd = openat(directory_fd, file->base.name, O_WRONLY | O_CREAT | O_TRUNC, FILE_MODE);
+    assert(fd >= 0);
+    if (file->pieces != NULL) {
+        write_pieces(fd, file->pieces, file->num_pieces);
     }
-    free(dir_name);
+    else if (file->size > 0) {
+        struct iovec whole = {.iov_base = file->contents, .iov_len = file->size};
+        write_pieces(fd, &whole, 1);
+    }
+    int result = close(fd);
+    assert(result == 0);
+}
+
+/** A created directory, kept open while files are being created in it */
+typedef struct {
+    int fd;
+    /** The work that still uses `fd`, plus one while its subdirectories are being created */
+    atomic_size_t references;
+    /**
+     * Limits how many directories have files waiting on the thread pool.
+     * This is `NULL` if this directory's files were written without the pool.
+     */
+    sem_t *open_directories;
+} open_directory_t;
+
+/** Work that creates some of the files in a directory */
+typedef struct {
+    open_directory_t *directory;
+    /** The children to create; any subdirectories among them are skipped */
+    node_t **children;
+    size_t num_children;
+} create_files_t;
+
+void release_directory(open_directory_t *directory) {
+    if (atomic_fetch_sub(&directory->references, 1) == 1) {
+        int result = close(directory->fd);
+        assert(result == 0);
+        if (directory->open_directories != NULL) {
+            sem_post(directory->open_directories);
+        }
+        free(directory);
+    }
+}
+
+void create_files(void *aux) {
+    create_files_t *work = aux;
+    for (size_t i = 0; i < work->num_children; i++) {
+        if (work->children[i]->type == FILE_TYPE) {
+            write_file(work->directory->fd, (file_node_t *) work->children[i]);
+        }
+    }
+    release_directory(work->directory);
+    free(work);
+}
+
+/**
+ * Creates a directory, relative to its parent's file descriptor,
+ * hands out the creation of its files to the thread pool,
+ * and then creates its subdirectories the same way.
+ */
+void create_directory(thread_pool_t *pool, sem_t *open_directories, int parent_fd,
+                      directory_node_t *dnode) {
+    int result = mkdirat(parent_fd, dnode->base.name, DIRECTORY_MODE);
+    assert(result == 0);
+    open_directory_t *directory = malloc(sizeof(open_directory_t));
+    assert(directory != NULL);
+    directory->fd = openat(parent_fd, dnode->base.name, O_RDONLY | O_DIRECTORY);
+    assert(directory->fd >= 0);
+    atomic_init(&directory->references, 1);
+
+    // If too many directories are waiting on the pool, this thread writes the files itself
+    bool use_pool = sem_trywait(open_directories) == 0;
+    directory->open_directories = use_pool ? open_directories : NULL;
+
+    for (size_t start = 0; start < dnode->num_children; start += FILES_PER_WORK) {
+        size_t end = start + FILES_PER_WORK < dnode->num_children ? start + FILES_PER_WORK
+                                                                   : dnode->num_children;
+        bool has_files = false;
+        for (size_t i = start; i < end && !has_files; i++) {
+            has_files = dnode->children[i]->type == FILE_TYPE;
+        }
+        if (!has_files) {
+            continue;
+        }
+        create_files_t *work = malloc(sizeof(create_files_t));
+        assert(work != NULL);
+        atomic_fetch_add(&directory->references, 1);
+        *work = (create_files_t){
+            .directory = directory,
+            .children = dnode->children + start,
+            .num_children = end - start,
+        };
+        if (use_pool) {
+            thread_pool_add_work(pool, create_files, work);
+        }
+        else {
+            create_files(work);
+        }
+    }
+    for (size_t i = 0; i < dnode->num_children; i++) {
+        if (dnode->children[i]->type == DIRECTORY_TYPE) {
+            create_directory(pool, open_directories, directory->fd,
+                             (directory_node_t *) dnode->children[i]);
+        }
+    }
+    release_directory(directory);
 }
 
 void create_directory_tree(node_t *node) {
-    if (node != NULL) {
-        helper_directory_tree(node, ".");
+    if (node == NULL) {
+        return;
     }
+    assert(node->type == DIRECTORY_TYPE);
+
+    // Directories are created by this thread, in order, and files by the pool
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    thread_pool_t *pool = thread_pool_init(num_cpus > 0 ? num_cpus : 1);
+    sem_t open_directories;
+    int result = sem_init(&open_directories, 0, MAX_OPEN_DIRECTORIES);
+    assert(result == 0);
+    create_directory(pool, &open_directories, AT_FDCWD, (directory_node_t *) node);
+    thread_pool_finish(pool);
+    sem_destroy(&open_directories);
 }
 
 void free_directory_tree(node_t *node) {
+    // An arena's nodes only have children from the same arena, and are freed with it
+    if (node->in_arena) {
+        return;
+    }
     if (node->type == FILE_TYPE) {
         file_node_t *fnode = (file_node_t *) node;
-        free(fnode->contents);
+        if (fnode->owns_contents) {
+            free(fnode->contents);
+        }
+        free(fnode->pieces);
     }
     else {
         assert(node->type == DIRECTORY_TYPE);
@@ -1,6 +1,10 @@
 #include <assert.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "fat16.h"
 
@@ -15,6 +19,56 @@ typedef enum {
 } fat_attribute_t;
 
 const char DELETED = 0xE5;
+const size_t MASTER_BOOT_RECORD_SIZE = 0x20B;
+const size_t FIRST_DATA_CLUSTER = 2;
+const uint16_t BAD_CLUSTER = 0xFFF7;
+const uint16_t END_OF_CHAIN = 0xFFF8;
+
+bool open_image(const char *path, fat16_image_t *image) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) < 0 ||
+        (size_t) info.st_size < MASTER_BOOT_RECORD_SIZE + sizeof(bios_parameter_block_t)) {
+        close(fd);
+        return false;
+    }
+    void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping stays valid once the file is closed
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    image->data = data;
+    image->size = info.st_size;
+    image->bpb = (const bios_parameter_block_t *) (image->data + MASTER_BOOT_RECORD_SIZE);
+
+    // The FAT follows the reserved sectors, after the sector with the Master Boot Record
+    size_t fat_size = (size_t) image->bpb->sectors_per_fat * image->bpb->bytes_per_sector;
+    image->fat = get_image_slice(
+        image, (1 + (size_t) image->bpb->reserved_sectors) * image->bpb->bytes_per_sector,
+        fat_size);
+    if (image->fat == NULL) {
+        close_image(image);
+        return false;
+    }
+    image->fat_entries = fat_size / sizeof(uint16_t);
+    return true;
+}
+
+void close_image(fat16_image_t *image) {
+    int result = munmap((void *) image->data, image->size);
+    assert(result == 0);
+}
+
+const void *get_image_slice(const fat16_image_t *image, size_t offset, size_t size) {
+    if (offset > image->size || size > image->size - offset) {
+        return NULL;
+    }
+    return image->data + offset;
+}
 
 size_t get_root_directory_location(bios_parameter_block_t bpb) {
     size_t fat_sectors = (size_t) bpb.num_fats * bpb.sectors_per_fat;
@@ -27,6 +81,57 @@ size_t get_offset_from_cluster(size_t cluster, bios_parameter_block_t bpb) {
            (cluster - 2) * bpb.sectors_per_cluster * bpb.bytes_per_sector;
 }
 
+size_t get_cluster_size(bios_parameter_block_t bpb) {
+    return (size_t) bpb.sectors_per_cluster * bpb.bytes_per_sector;
+}
+
+size_t get_next_cluster(const fat16_image_t *image, size_t cluster) {
+    uint16_t next = cluster < image->fat_entries ? image->fat[cluster] : 0;
+    if (next >= END_OF_CHAIN) {
+        return 0;
+    }
+    if (next < FIRST_DATA_CLUSTER || next == BAD_CLUSTER || next >= image->fat_entries) {
+        return cluster + 1;
+    }
+    return next;
+}
+
+size_t get_file_pieces(const fat16_image_t *image, directory_entry_t entry,
+                       struct iovec **pieces, size_t *capacity) {
+    size_t cluster_size = get_cluster_size(*image->bpb);
+    size_t num_pieces = 0;
+    size_t cluster = entry.first_cluster;
+    size_t remaining = entry.file_size;
+    while (remaining > 0) {
+        // Extends the run while the chain continues with the next cluster on the disk
+        size_t run_start = cluster;
+        size_t run_size = 0;
+        size_t next;
+        while (true) {
+            run_size += remaining - run_size < cluster_size ? remaining - run_size : cluster_size;
+            next = get_next_cluster(image, cluster);
+            if (run_size == remaining || next != cluster + 1) {
+                break;
+            }
+            cluster = next;
+        }
+        // An early end of the chain means it is damaged, so the rest is assumed to follow it
+        cluster = next != 0 ? next : cluster + 1;
+
+        if (num_pieces == *capacity) {
+            *capacity = *capacity > 0 ? *capacity * 2 : 1;
+            *pieces = realloc(*pieces, sizeof(struct iovec[*capacity]));
+            assert(*pieces != NULL);
+        }
+        const void *data =
+            get_image_slice(image, get_offset_from_cluster(run_start, *image->bpb), run_size);
+        assert(data != NULL);
+        (*pieces)[num_pieces++] = (struct iovec){.iov_base = (void *) data, .iov_len = run_size};
+        remaining -= run_size;
+    }
+    return num_pieces;
+}
+
 bool is_directory(directory_entry_t entry) {
     return (entry.attribute & SUBDIRECTORY) != 0;
 }
@@ -37,8 +142,13 @@ bool is_hidden(directory_entry_t entry) {
 }
 
 char *get_file_name(directory_entry_t entry) {
-    char *full = malloc(sizeof(entry.filename) + 1 + sizeof(entry.extension) + 1);
+    char *full = malloc(FILE_NAME_SIZE);
     assert(full != NULL);
+    copy_file_name(entry, full);
+    return full;
+}
+
+void copy_file_name(directory_entry_t entry, char full[FILE_NAME_SIZE]) {
     size_t full_index = 0;
     size_t filename_index = 0;
     while (filename_index < sizeof(entry.filename)) {
@@ -62,5 +172,4 @@ char *get_file_name(directory_entry_t entry) {
         }
     }
     full[full_index] = '\0';
-    return full;
 }
@@ -1,53 +1,88 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "directory_tree.h"
 #include "fat16.h"
 
-const size_t MASTER_BOOT_RECORD_SIZE = 0x20B;
+/** The state shared while building the directory tree of an image */
+typedef struct {
+    const fat16_image_t *image;
+    /** Where the tree's nodes, names and pieces are allocated */
+    tree_arena_t *arena;
+    /** A buffer that each file's pieces are found in, before being copied to the arena */
+    struct iovec *pieces;
+    size_t pieces_capacity;
+} recovery_t;
 
-void follow(FILE *disk, directory_node_t *node, bios_parameter_block_t bpb) {
-    directory_entry_t entry;
-    // Keeps going until encountering an entry beginning with '\0'
-    while (true) {
-        assert(fread(&entry, sizeof(entry), 1, disk) == 1);
+void follow_cluster_chain(recovery_t *recovery, directory_node_t *node, size_t cluster);
+
+/** Copies a directory entry's filename into the arena */
+char *get_arena_file_name(recovery_t *recovery, const directory_entry_t *entry) {
+    char name[FILE_NAME_SIZE];
+    copy_file_name(*entry, name);
+    return tree_arena_strdup(recovery->arena, name);
+}
+
+/**
+ * Adds the entries in one contiguous part of a directory to its node.
+ * Returns whether the directory continues after this part,
+ * i.e. no entry beginning with '\0' was found.
+ */
+bool follow(recovery_t *recovery, directory_node_t *node, size_t offset,
+            size_t num_entries) {
+    for (size_t i = 0; i < num_entries; i++, offset += sizeof(directory_entry_t)) {
+        // Reads the entry in place in the image
+        const directory_entry_t *entry =
+            get_image_slice(recovery->image, offset, sizeof(directory_entry_t));
+        assert(entry != NULL);
 
         // Checks if name starts with '\0'
-        if (entry.filename[0] == '\0') {
-            break;
+        if (entry->filename[0] == '\0') {
+            return false;
         }
 
-        // Current offset
-        long curr_offset = ftell(disk);
-
-        // Fseek
-        size_t offset = get_offset_from_cluster(entry.first_cluster, bpb);
-        fseek(disk, offset, SEEK_SET);
         // Skips hidden entries
-        if (is_hidden(entry)) {
-            fseek(disk, curr_offset, SEEK_SET);
+        if (is_hidden(*entry)) {
             continue;
         }
         // Directory Entry
-        else if (is_directory(entry)) {
+        if (is_directory(*entry)) {
             // Creates new directory node, attaches it to parent, recursively calls.
-            directory_node_t *new_dnode = init_directory_node(get_file_name(entry));
-            add_child_directory_tree(node, (node_t *) new_dnode);
-            follow(disk, new_dnode, bpb);
+            directory_node_t *new_dnode =
+                init_arena_directory_node(recovery->arena, get_arena_file_name(recovery, entry));
+            append_child_directory_tree(node, (node_t *) new_dnode);
+            follow_cluster_chain(recovery, new_dnode, entry->first_cluster);
         }
         // File Entry
         else {
-            // Reads the file size
-            uint8_t *file_size = malloc(sizeof(uint8_t) * entry.file_size);
-            assert(fread(file_size, entry.file_size, 1, disk) == 1);
+            // The contents are runs of clusters in the image, which are not copied
+            size_t num_pieces = get_file_pieces(recovery->image, *entry, &recovery->pieces,
+                                                &recovery->pieces_capacity);
+            struct iovec *pieces = NULL;
+            if (num_pieces > 0) {
+                pieces = tree_arena_alloc(recovery->arena, sizeof(struct iovec[num_pieces]));
+                memcpy(pieces, recovery->pieces, sizeof(struct iovec[num_pieces]));
+            }
             // Creates a new file node, attaches it to parent.
             file_node_t *new_fnode =
-                init_file_node(get_file_name(entry), entry.file_size, file_size);
-            add_child_directory_tree(node, (node_t *) new_fnode);
+                init_arena_file_node(recovery->arena, get_arena_file_name(recovery, entry),
+                                     entry->file_size, pieces, num_pieces);
+            append_child_directory_tree(node, (node_t *) new_fnode);
         }
-        // Reset location
-        fseek(disk, curr_offset, SEEK_SET);
+    }
+    return true;
+}
+
+/** Adds the entries of a subdirectory, which may be spread over many clusters */
+void follow_cluster_chain(recovery_t *recovery, directory_node_t *node, size_t cluster) {
+    const fat16_image_t *image = recovery->image;
+    size_t entries_per_cluster = get_cluster_size(*image->bpb) / sizeof(directory_entry_t);
+    while (cluster != 0 &&
+           follow(recovery, node, get_offset_from_cluster(cluster, *image->bpb),
+                  entries_per_cluster)) {
+        cluster = get_next_cluster(image, cluster);
     }
 }
 
@@ -57,29 +92,25 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    FILE *disk = fopen(argv[1], "r");
-    if (disk == NULL) {
+    // Maps the whole image, so the BPB and directory entries are read in place
+    fat16_image_t image;
+    if (!open_image(argv[1], &image)) {
         fprintf(stderr, "No such image file: %s\n", argv[1]);
         return 1;
     }
 
-    // Skip past Master Boot Record
-    fseek(disk, MASTER_BOOT_RECORD_SIZE, SEEK_SET);
-
-    // Fread BPB into BPB
-    bios_parameter_block_t bpb;
-    assert(fread(&bpb, sizeof(bpb), 1, disk) == 1);
-
-    // Skip past padding to the beginning of root directory
-    size_t location = get_root_directory_location(bpb);
-    fseek(disk, location, SEEK_SET);
-
-    directory_node_t *root = init_directory_node(NULL);
-    follow(disk, root, bpb);
+    // The root directory has a fixed size, rather than a cluster chain
+    recovery_t recovery = {.image = &image, .arena = tree_arena_init()};
+    directory_node_t *root = init_arena_directory_node(recovery.arena, NULL);
+    follow(&recovery, root, get_root_directory_location(*image.bpb),
+           image.bpb->max_root_entries);
+    free(recovery.pieces);
+    // The entries are appended as they are found, then each directory is sorted once
+    sort_directory_tree((node_t *) root);
     print_directory_tree((node_t *) root);
     create_directory_tree((node_t *) root);
-    free_directory_tree((node_t *) root);
+    // The whole tree is in the arena, and borrows file contents from the image
+    tree_arena_free(recovery.arena);
 
-    int result = fclose(disk);
-    assert(result == 0);
+    close_image(&image);
 }
@@ -9,32 +9,6 @@
 
 const unsigned MKDIR_MODE = 0777;
 
-/**
- * Performs a binary search to find the entry with the given name in a directory.
- * This assumes that the directory's entries are sorted by name.
- * Returns NULL if no matching entry is found.
- */
-node_t *get_child(directory_node_t *directory, char *name) {
-    size_t left = 0;
-    size_t right = directory->num_children;
-    while (left < right) {
-        size_t mid = (left + right) / 2;
-        node_t *mid_child = directory->children[mid];
-        int cmp = strcmp(name, mid_child->name);
-        if (cmp == 0) {
-            return mid_child;
-        }
-
-        if (cmp < 0) {
-            right = mid;
-        }
-        else /* cmp > 0 */ {
-            left = mid + 1;
-        }
-    }
-    return NULL;
-}
-
 /**
  * Adds a file with the given path and contents to the directory tree.
  * Builds any missing intermediate directories.
@@ -48,7 +22,7 @@ void add_file(directory_node_t *directory, char *path, char *contents) {
             *slash = '\0';
         }
 
-        node_t *child = get_child(directory, remaining_path);
+        node_t *child = get_child_directory_tree(directory, remaining_path);
         if (slash == NULL) {
             // This is the last part of the path, so it represents a file
             if (child != NULL) {
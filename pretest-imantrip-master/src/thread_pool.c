@@ -0,0 +1,101 @@
+#include "thread_pool.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+typedef struct work {
+    work_function_t function;
+    void *aux;
+    struct work *next;
+} work_t;
+
+struct thread_pool {
+    pthread_mutex_t lock;
+    /** Signaled when work is added or the pool is finishing */
+    pthread_cond_t changed;
+    /** The queue of work, oldest first */
+    work_t *head;
+    work_t *tail;
+    /** Whether thread_pool_finish() has been called */
+    bool finishing;
+    size_t num_worker_threads;
+    pthread_t *worker_threads;
+};
+
+/** Runs work until the pool is finishing and there is none left */
+static void *worker(void *p) {
+    thread_pool_t *pool = p;
+    while (true) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->head == NULL && !pool->finishing) {
+            pthread_cond_wait(&pool->changed, &pool->lock);
+        }
+        work_t *work = pool->head;
+        if (work == NULL) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        pool->head = work->next;
+        if (pool->head == NULL) {
+            pool->tail = NULL;
+        }
+        pthread_mutex_unlock(&pool->lock);
+
+        work->function(work->aux);
+        free(work);
+    }
+}
+
+thread_pool_t *thread_pool_init(size_t num_worker_threads) {
+    thread_pool_t *pool = malloc(sizeof(thread_pool_t));
+    assert(pool != NULL);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->changed, NULL);
+    pool->head = NULL;
+    pool->tail = NULL;
+    pool->finishing = false;
+    pool->num_worker_threads = num_worker_threads;
+    pool->worker_threads = malloc(sizeof(pthread_t[num_worker_threads]));
+    assert(pool->worker_threads != NULL);
+    for (size_t i = 0; i < num_worker_threads; i++) {
+        int result = pthread_create(&pool->worker_threads[i], NULL, worker, pool);
+        assert(result == 0);
+    }
+    return pool;
+}
+
+void thread_pool_add_work(thread_pool_t *pool, work_function_t function, void *aux) {
+    work_t *work = malloc(sizeof(work_t));
+    assert(work != NULL);
+    work->function = function;
+    work->aux = aux;
+    work->next = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->tail == NULL) {
+        pool->head = work;
+    }
+    else {
+        pool->tail->next = work;
+    }
+    pool->tail = work;
+    pthread_cond_signal(&pool->changed);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void thread_pool_finish(thread_pool_t *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->finishing = true;
+    pthread_cond_broadcast(&pool->changed);
+    pthread_mutex_unlock(&pool->lock);
+    for (size_t i = 0; i < pool->num_worker_threads; i++) {
+        int result = pthread_join(pool->worker_threads[i], NULL);
+        assert(result == 0);
+    }
+    pthread_cond_destroy(&pool->changed);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->worker_threads);
+    free(pool);
+}
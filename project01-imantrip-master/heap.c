@@ -1,28 +1,171 @@
 #include "heap.h"
 
+#include <assert.h>
+#include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
+
+/** The number of ints in each slab that arrays are bump-allocated from (256 KB) */
+const size_t SLAB_SIZE = 1 << 16;
+/** The minimum number of ints to allocate between two garbage collections (4 MB) */
+const size_t MIN_COLLECTION_THRESHOLD = 1 << 20;
+/** The number of references the reference table initially has room for */
+const int32_t INITIAL_CAPACITY = 16;
+
+/**
+ * A large block of memory that arrays are carved out of.
+ * Each array is stored as its length followed by its elements.
+ */
+typedef struct slab {
+    /** The next (older) slab in the heap's list of slabs */
+    struct slab *next;
+    /** The number of ints that fit in `data` */
+    size_t capacity;
+    /** The number of ints of `data` that have been allocated */
+    size_t used;
+    /** The arrays allocated from this slab */
+    int32_t data[];
+} slab_t;
 
 typedef struct heap {
-    /** Generic array of pointers. */
+    /**
+     * The array each reference refers to, indexed by reference.
+     * Entries for references that have been collected are `NULL`.
+     */
     int32_t **ptr;
-    /** How many pointers there are currently in the array. */
+    /** How many references have been handed out (the used length of `ptr`) */
     int32_t count;
+    /** How many entries `ptr`, `free_refs` and `marks` have room for */
+    int32_t capacity;
+    /** A stack of collected references that can be handed out again */
+    int32_t *free_refs;
+    /** The number of references in `free_refs` */
+    int32_t free_count;
+    /** Whether each reference is reachable, only meaningful during a collection */
+    bool *marks;
+    /** The slabs arrays are allocated from. Arrays are bump-allocated from the first. */
+    slab_t *slabs;
+    /** The number of ints allocated since the last collection */
+    size_t allocated;
+    /** The number of ints that can be allocated before the next collection */
+    size_t threshold;
 } heap_t;
 
 heap_t *heap_init() {
-    // The heap array is initially allocated to hold zero elements.
     heap_t *heap = malloc(sizeof(heap_t));
-    heap->ptr = NULL;
+    assert(heap != NULL);
     heap->count = 0;
+    heap->capacity = INITIAL_CAPACITY;
+    heap->ptr = malloc(sizeof(int32_t *) * heap->capacity);
+    heap->free_refs = malloc(sizeof(int32_t) * heap->capacity);
+    heap->marks = malloc(sizeof(bool) * heap->capacity);
+    assert(heap->ptr != NULL && heap->free_refs != NULL && heap->marks != NULL);
+    heap->free_count = 0;
+    heap->slabs = NULL;
+    heap->allocated = 0;
+    heap->threshold = MIN_COLLECTION_THRESHOLD;
     return heap;
 }
 
-int32_t heap_add(heap_t *heap, int32_t *ptr) {
-    heap->ptr = realloc(heap->ptr, (heap->count + 1) * sizeof(int32_t *));
-    heap->ptr[heap->count] = ptr;
-    int32_t temp = heap->count;
-    heap->count += 1;
-    return temp;
+/**
+ * Bump-allocates space for `size` ints from the heap's current slab,
+ * starting a new slab if the current one is full.
+ * Arrays larger than `SLAB_SIZE` get a slab of their own.
+ */
+static int32_t *slab_alloc(heap_t *heap, size_t size) {
+    slab_t *slab = heap->slabs;
+    if (slab == NULL || slab->capacity - slab->used < size) {
+        size_t capacity = size > SLAB_SIZE ? size : SLAB_SIZE;
+        slab = malloc(sizeof(slab_t) + sizeof(int32_t) * capacity);
+        assert(slab != NULL);
+        slab->capacity = capacity;
+        slab->used = 0;
+        slab->next = heap->slabs;
+        heap->slabs = slab;
+    }
+    int32_t *result = &slab->data[slab->used];
+    slab->used += size;
+    return result;
+}
+
+static void free_slabs(slab_t *slab) {
+    while (slab != NULL) {
+        slab_t *next = slab->next;
+        free(slab);
+        slab = next;
+    }
+}
+
+/** Gets an unused reference, growing the reference table geometrically if needed */
+static int32_t new_ref(heap_t *heap) {
+    if (heap->free_count > 0) {
+        return heap->free_refs[--heap->free_count];
+    }
+    if (heap->count == heap->capacity) {
+        heap->capacity *= 2;
+        heap->ptr = realloc(heap->ptr, sizeof(int32_t *) * heap->capacity);
+        heap->free_refs = realloc(heap->free_refs, sizeof(int32_t) * heap->capacity);
+        heap->marks = realloc(heap->marks, sizeof(bool) * heap->capacity);
+        assert(heap->ptr != NULL && heap->free_refs != NULL && heap->marks != NULL);
+    }
+    return heap->count++;
+}
+
+void heap_collect(heap_t *heap, const int32_t *roots, size_t num_roots) {
+    // Mark every array that some root might refer to
+    memset(heap->marks, false, sizeof(bool) * heap->count);
+    for (size_t i = 0; i < num_roots; i++) {
+        int32_t ref = roots[i];
+        if (0 <= ref && ref < heap->count) {
+            heap->marks[ref] = true;
+        }
+    }
+
+    /* Copy the marked arrays into fresh slabs, so the surviving arrays end up
+     * contiguous, and recycle the references of the unmarked ones. */
+    slab_t *old_slabs = heap->slabs;
+    heap->slabs = NULL;
+    size_t live = 0;
+    for (int32_t ref = 0; ref < heap->count; ref++) {
+        int32_t *array = heap->ptr[ref];
+        if (array == NULL) {
+            continue;
+        }
+        if (heap->marks[ref]) {
+            size_t size = array[0] + 1;
+            int32_t *copy = slab_alloc(heap, size);
+            memcpy(copy, array, sizeof(int32_t) * size);
+            heap->ptr[ref] = copy;
+            live += size;
+        }
+        else {
+            heap->ptr[ref] = NULL;
+            heap->free_refs[heap->free_count++] = ref;
+        }
+    }
+    free_slabs(old_slabs);
+
+    // Wait until at least as much as survived has been allocated again
+    heap->allocated = 0;
+    heap->threshold = live > MIN_COLLECTION_THRESHOLD ? live : MIN_COLLECTION_THRESHOLD;
+}
+
+int32_t heap_new_array(heap_t *heap, int32_t length, const int32_t *roots,
+                       size_t num_roots) {
+    assert(length >= 0);
+    size_t size = (size_t) length + 1;
+    if (heap->allocated + size > heap->threshold) {
+        heap_collect(heap, roots, num_roots);
+    }
+
+    int32_t *array = slab_alloc(heap, size);
+    array[0] = length;
+    memset(&array[1], 0, sizeof(int32_t) * length);
+    heap->allocated += size;
+
+    int32_t ref = new_ref(heap);
+    heap->ptr[ref] = array;
+    return ref;
 }
 
 int32_t *heap_get(heap_t *heap, int32_t ref) {
@@ -30,9 +173,9 @@ int32_t *heap_get(heap_t *heap, int32_t ref) {
 }
 
 void heap_free(heap_t *heap) {
-    for (int32_t i = 0; i < heap->count; i++) {
-        free(heap->ptr[i]);
-    }
+    free_slabs(heap->slabs);
     free(heap->ptr);
+    free(heap->free_refs);
+    free(heap->marks);
     free(heap);
-}
\ No newline at end of file
+}
@@ -0,0 +1,69 @@
+#ifndef HEAP_H
+#define HEAP_H
+
+#include <inttypes.h>
+#include <stddef.h>
+
+/**
+ * The JVM's heap of int arrays.
+ * Java code refers to an array by its reference, an index into the heap's
+ * reference table. Arrays are stored as their length followed by their elements,
+ * so `heap_get(heap, ref)[0]` is the length and the elements start at index 1.
+ *
+ * The heap collects garbage: once enough has been allocated, arrays that
+ * no root refers to are freed and the surviving arrays are compacted.
+ * A reference stays valid for as long as it is reachable from the roots,
+ * but the address `heap_get()` returns for it may change whenever
+ * `heap_new_array()` or `heap_collect()` is called.
+ */
+typedef struct heap heap_t;
+
+/**
+ * Creates a new heap with no arrays.
+ *
+ * @return a heap-allocated heap
+ */
+heap_t *heap_init();
+
+/**
+ * Allocates a new array of zeros on the heap.
+ * This may first run a garbage collection (see `heap_collect()`).
+ *
+ * @param heap the heap to allocate the array on
+ * @param length the number of elements in the array, which must be non-negative
+ * @param roots the values that might be references to live arrays
+ * @param num_roots the number of values in `roots`
+ * @return a reference to the new array
+ */
+int32_t heap_new_array(heap_t *heap, int32_t length, const int32_t *roots,
+                       size_t num_roots);
+
+/**
+ * Frees every array that none of the given roots refers to,
+ * then moves the remaining arrays next to each other.
+ * Roots are scanned conservatively: any root whose value is a reference
+ * keeps that reference's array alive, even if the root is really an int.
+ *
+ * @param heap the heap to collect garbage from
+ * @param roots the values that might be references to live arrays
+ * @param num_roots the number of values in `roots`
+ */
+void heap_collect(heap_t *heap, const int32_t *roots, size_t num_roots);
+
+/**
+ * Looks up the array a reference refers to.
+ *
+ * @param heap the heap containing the array
+ * @param ref a reference returned by `heap_new_array()` that is still reachable
+ * @return a pointer to the array's length, followed by its elements
+ */
+int32_t *heap_get(heap_t *heap, int32_t ref);
+
+/**
+ * Frees the heap and all the arrays on it.
+ *
+ * @param heap a heap returned by `heap_init()`
+ */
+void heap_free(heap_t *heap);
+
+#endif /* HEAP_H */
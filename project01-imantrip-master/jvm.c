@@ -6,6 +6,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <x86intrin.h>
 
 #include "heap.h"
 #include "read_class.h"
@@ -32,28 +35,335 @@ typedef struct {
     int32_t value;
 } optional_value_t;
 
+/** Which interpreter loop `main()` should use to run the class */
+typedef enum { SWITCH_INTERPRETER, THREADED_INTERPRETER } interpreter_t;
+
+/** The command-line flag that selects the threaded interpreter */
+const char THREADED_FLAG[] = "--threaded";
+/** The command-line flag that prints how many superinstructions each method used */
+const char FUSION_STATS_FLAG[] = "--fusion-stats";
+/** The command-line flag that compiles frequently invoked methods to machine code */
+const char JIT_FLAG[] = "--jit";
+/** The command-line flag that profiles the switch interpreter and reports at exit */
+const char PROFILE_FLAG[] = "--profile";
+
+/**
+ * Internal opcodes for the superinstructions created by `fuse_instructions()`.
+ * These use byte values that the JVM specification leaves unassigned,
+ * so they can index the same handler table as the real opcodes.
+ */
+typedef enum {
+    /** `iload a; iload b; if_icmp<cond>`: compares two locals and branches */
+    f_load_load_if_icmpeq = 0xcb,
+    f_load_load_if_icmpne,
+    f_load_load_if_icmplt,
+    f_load_load_if_icmpge,
+    f_load_load_if_icmpgt,
+    f_load_load_if_icmple,
+    /** `iload a; <constant c>; if_icmp<cond>`: compares a local with a constant */
+    f_load_push_if_icmpeq,
+    f_load_push_if_icmpne,
+    f_load_push_if_icmplt,
+    f_load_push_if_icmpge,
+    f_load_push_if_icmpgt,
+    f_load_push_if_icmple,
+    /** `iload a; <constant c>; iadd; istore d`: stores a local plus a constant */
+    f_load_push_iadd_store,
+    /** `iinc a c; goto`: increments a local and jumps (the end of most for loops) */
+    f_iinc_goto,
+} fused_instruction_t;
+
+/**
+ * A JVM instruction decoded ahead of time for the threaded interpreter.
+ * Operands are already reassembled from the bytecode, and branch targets
+ * point directly at the instruction to jump to.
+ */
+typedef struct instruction {
+    /** The address of the label in `execute_threaded()` that runs this instruction */
+    const void *handler;
+    /** The decoded operand (a constant, a local index, or a constant pool index) */
+    int32_t operand;
+    /** A second operand, used for the increment of `iinc` and by superinstructions */
+    int32_t operand2;
+    /** A third operand, only used by superinstructions */
+    int32_t operand3;
+    /** The instruction to jump to, only used for branches */
+    struct instruction *target;
+} instruction_t;
+
+/** A method's bytecode after it has been decoded into `instruction_t`s */
+typedef struct {
+    /** The number of decoded instructions, including the final `return` */
+    size_t length;
+    /** The decoded instructions, in the same order as the bytecode */
+    instruction_t *instructions;
+    /** The number of superinstructions `fuse_instructions()` created */
+    size_t fusion_count;
+} decoded_method_t;
+
+/** A Methodref constant resolved to the method it refers to */
+typedef struct {
+    /** The method, or `NULL` if the constant has not been resolved yet */
+    method_t *method;
+    /** The number of parameters the method takes */
+    uint16_t num_parameters;
+} resolved_method_t;
+
+/**
+ * A method compiled to x86-64 machine code by `jit_compile()`.
+ * It takes the start of the method's frame (like the interpreters' `locals`)
+ * and returns the method's return value, which is garbage if the method returns void.
+ */
+typedef int32_t (*native_method_t)(int32_t *locals);
+
+/** The JIT's bookkeeping for a method */
+typedef struct {
+    /** The number of times the method has been invoked */
+    uint32_t invocations;
+    /** The method's compiled code, or `NULL` if it has not been compiled */
+    native_method_t native;
+    /** The size of the executable mapping that holds `native` */
+    size_t native_size;
+    /** Whether the method returns an int (as opposed to void) */
+    bool returns_value;
+    /** Whether the method was found to use something the JIT doesn't support */
+    bool uncompilable;
+} jit_method_t;
+
+/** How often a branch instruction jumped */
+typedef struct {
+    /** The number of times the branch jumped to its target */
+    uint64_t taken;
+    /** The number of times the branch fell through to the next instruction */
+    uint64_t not_taken;
+} branch_profile_t;
+
+/** What `--profile` records about a method */
+typedef struct {
+    /** The number of times the method was invoked */
+    uint64_t invocations;
+    /** The rdtsc cycles spent running the method, including its callees */
+    uint64_t cycles;
+    /**
+     * The number of invocations of the method that are running. Only the outermost
+     * invocation of a recursive method is timed, so cycles aren't counted twice.
+     */
+    uint32_t active;
+    /** When the outermost running invocation started */
+    uint64_t start;
+    /** The counts for each branch, indexed by bytecode offset (`NULL` until needed) */
+    branch_profile_t *branches;
+} method_profile_t;
+
+/** The statistics `--profile` collects while the class runs */
+typedef struct {
+    /** The number of times each opcode was executed */
+    uint64_t opcode_counts[UINT8_MAX + 1];
+    /** The statistics for each method, indexed like `class->methods` */
+    method_profile_t *methods;
+} profile_t;
+
+/** The state shared by every method invocation */
+typedef struct {
+    /** The class file being run */
+    class_file_t *class;
+    /** The heap of arrays that references refer to */
+    heap_t *heap;
+    /**
+     * The JVM stack, which holds the frames of all active method invocations.
+     * A method's frame is its `max_locals` locals followed by its `max_stack`
+     * operand stack slots. A callee's frame starts at the arguments on top of
+     * its caller's operand stack, so the arguments become the callee's first locals
+     * without being copied, and calls allocate nothing.
+     */
+    int32_t *frames;
+    /** The end of the `frames` array */
+    int32_t *frames_end;
+    /**
+     * The methods that `invokestatic` instructions call, indexed by the 1-based
+     * constant pool index of their Methodref. Each entry is filled in the first time
+     * it is called, so later calls skip the constant pool and descriptor lookups.
+     */
+    resolved_method_t *resolved_methods;
+    /**
+     * The decoded form of each method, indexed like `class->methods`.
+     * Methods are decoded the first time they are invoked, so entries start `NULL`.
+     */
+    decoded_method_t **decoded_methods;
+    /** The interpreter that runs methods which have not been compiled */
+    interpreter_t interpreter;
+    /**
+     * The JIT's bookkeeping for each method, indexed like `class->methods`,
+     * or `NULL` if the JIT is disabled.
+     */
+    jit_method_t *jit_methods;
+    /** The statistics being collected, or `NULL` if profiling is disabled */
+    profile_t *profile;
+} runtime_t;
+
+/** The number of int slots in the JVM stack (4 MB) */
+const size_t FRAME_STACK_SIZE = 1 << 20;
+/** The number of times a method is interpreted before the JIT compiles it */
+const uint32_t JIT_THRESHOLD = 100;
+/** The number of branch sites the profile report lists */
+const size_t PROFILE_BRANCH_SITES = 20;
+
+/**
+ * The number of bytes each supported instruction occupies in the bytecode,
+ * including its operands. Unsupported instructions have length 0.
+ */
+const u1 INSTRUCTION_LENGTHS[UINT8_MAX + 1] = {
+    [i_nop] = 1,          [i_iconst_m1] = 1,   [i_iconst_0] = 1,    [i_iconst_1] = 1,
+    [i_iconst_2] = 1,     [i_iconst_3] = 1,    [i_iconst_4] = 1,    [i_iconst_5] = 1,
+    [i_bipush] = 2,       [i_sipush] = 3,      [i_ldc] = 2,         [i_iload] = 2,
+    [i_aload] = 2,        [i_iload_0] = 1,     [i_iload_1] = 1,     [i_iload_2] = 1,
+    [i_iload_3] = 1,      [i_aload_0] = 1,     [i_aload_1] = 1,     [i_aload_2] = 1,
+    [i_aload_3] = 1,      [i_iaload] = 1,      [i_istore] = 2,      [i_astore] = 2,
+    [i_istore_0] = 1,     [i_istore_1] = 1,    [i_istore_2] = 1,    [i_istore_3] = 1,
+    [i_astore_0] = 1,     [i_astore_1] = 1,    [i_astore_2] = 1,    [i_astore_3] = 1,
+    [i_iastore] = 1,      [i_dup] = 1,         [i_iadd] = 1,        [i_isub] = 1,
+    [i_imul] = 1,         [i_idiv] = 1,        [i_irem] = 1,        [i_ineg] = 1,
+    [i_ishl] = 1,         [i_ishr] = 1,        [i_iushr] = 1,       [i_iand] = 1,
+    [i_ior] = 1,          [i_ixor] = 1,        [i_iinc] = 3,        [i_ifeq] = 3,
+    [i_ifne] = 3,         [i_iflt] = 3,        [i_ifge] = 3,        [i_ifgt] = 3,
+    [i_ifle] = 3,         [i_if_icmpeq] = 3,   [i_if_icmpne] = 3,   [i_if_icmplt] = 3,
+    [i_if_icmpge] = 3,    [i_if_icmpgt] = 3,   [i_if_icmple] = 3,   [i_goto] = 3,
+    [i_ireturn] = 1,      [i_areturn] = 1,     [i_return] = 1,      [i_getstatic] = 3,
+    [i_invokevirtual] = 3, [i_invokestatic] = 3, [i_newarray] = 2,  [i_arraylength] = 1,
+};
+
+/** The mnemonic of each supported instruction, for the profile report */
+const char *const OPCODE_NAMES[UINT8_MAX + 1] = {
+    [i_nop] = "nop", [i_iconst_m1] = "iconst_m1", [i_iconst_0] = "iconst_0",
+    [i_iconst_1] = "iconst_1", [i_iconst_2] = "iconst_2", [i_iconst_3] = "iconst_3",
+    [i_iconst_4] = "iconst_4", [i_iconst_5] = "iconst_5", [i_bipush] = "bipush",
+    [i_sipush] = "sipush", [i_ldc] = "ldc", [i_iload] = "iload", [i_aload] = "aload",
+    [i_iload_0] = "iload_0", [i_iload_1] = "iload_1", [i_iload_2] = "iload_2",
+    [i_iload_3] = "iload_3", [i_aload_0] = "aload_0", [i_aload_1] = "aload_1",
+    [i_aload_2] = "aload_2", [i_aload_3] = "aload_3", [i_iaload] = "iaload",
+    [i_istore] = "istore", [i_astore] = "astore", [i_istore_0] = "istore_0",
+    [i_istore_1] = "istore_1", [i_istore_2] = "istore_2", [i_istore_3] = "istore_3",
+    [i_astore_0] = "astore_0", [i_astore_1] = "astore_1", [i_astore_2] = "astore_2",
+    [i_astore_3] = "astore_3", [i_iastore] = "iastore", [i_dup] = "dup",
+    [i_iadd] = "iadd", [i_isub] = "isub", [i_imul] = "imul", [i_idiv] = "idiv",
+    [i_irem] = "irem", [i_ineg] = "ineg", [i_ishl] = "ishl", [i_ishr] = "ishr",
+    [i_iushr] = "iushr", [i_iand] = "iand", [i_ior] = "ior", [i_ixor] = "ixor",
+    [i_iinc] = "iinc", [i_ifeq] = "ifeq", [i_ifne] = "ifne", [i_iflt] = "iflt",
+    [i_ifge] = "ifge", [i_ifgt] = "ifgt", [i_ifle] = "ifle",
+    [i_if_icmpeq] = "if_icmpeq", [i_if_icmpne] = "if_icmpne",
+    [i_if_icmplt] = "if_icmplt", [i_if_icmpge] = "if_icmpge",
+    [i_if_icmpgt] = "if_icmpgt", [i_if_icmple] = "if_icmple", [i_goto] = "goto",
+    [i_ireturn] = "ireturn", [i_areturn] = "areturn", [i_return] = "return",
+    [i_getstatic] = "getstatic", [i_invokevirtual] = "invokevirtual",
+    [i_invokestatic] = "invokestatic", [i_newarray] = "newarray",
+    [i_arraylength] = "arraylength",
+};
+
 int stack_help(int32_t *stack, size_t stack_size, int32_t val, size_t num) {
     stack[stack_size - num] = val;
     return stack_size - num + 1;
 }
 
+/**
+ * Checks that a method's frame fits in the JVM stack.
+ *
+ * @param runtime the runtime whose stack holds the frame
+ * @param locals the start of the frame (the method's locals)
+ * @param method the method the frame is for
+ */
+void check_frame(runtime_t *runtime, int32_t *locals, method_t *method) {
+    assert(locals + method->code.max_locals + method->code.max_stack <=
+               runtime->frames_end &&
+           "Stack overflow");
+}
+
+/**
+ * Allocates a new int array on the heap for a `newarray` instruction.
+ * The heap may collect garbage before allocating, and any value on the JVM stack
+ * could be a reference, so every slot of every active frame is used as a root.
+ *
+ * @param runtime the runtime whose heap to allocate on
+ * @param count the number of elements in the array
+ * @param stack_top the end of the used part of the JVM stack
+ *   (the top of the innermost method's operand stack)
+ * @return a reference to the new array
+ */
+int32_t new_array(runtime_t *runtime, int32_t count, int32_t *stack_top) {
+    assert(count >= 0);
+    return heap_new_array(runtime->heap, count, runtime->frames,
+                          stack_top - runtime->frames);
+}
+
+/**
+ * Looks up the method that an `invokestatic` instruction calls.
+ * The result is cached in `runtime->resolved_methods`,
+ * so only the first call through each Methodref searches the class.
+ *
+ * @param runtime the runtime whose class contains the Methodref
+ * @param index the 1-based constant pool index of the Methodref
+ * @return the resolved method and its number of parameters
+ */
+resolved_method_t *resolve_method(runtime_t *runtime, uint16_t index) {
+    resolved_method_t *resolved = &runtime->resolved_methods[index];
+    if (resolved->method == NULL) {
+        resolved->method = find_method_from_index(index, runtime->class);
+        assert(resolved->method != NULL && "Missing method");
+        resolved->num_parameters = get_number_of_parameters(resolved->method);
+    }
+    return resolved;
+}
+
+/**
+ * Records whether a conditional branch jumped, for `--profile`.
+ *
+ * @param runtime the runtime collecting the profile
+ * @param method the method containing the branch
+ * @param pc the bytecode offset of the branch instruction
+ * @param taken whether the branch jumped to its target
+ */
+void profile_branch(runtime_t *runtime, method_t *method, size_t pc, bool taken) {
+    method_profile_t *profile =
+        &runtime->profile->methods[method - runtime->class->methods];
+    if (profile->branches == NULL) {
+        profile->branches = calloc(method->code.code_length, sizeof(branch_profile_t));
+        assert(profile->branches != NULL);
+    }
+    if (taken) {
+        profile->branches[pc].taken++;
+    }
+    else {
+        profile->branches[pc].not_taken++;
+    }
+}
+
+optional_value_t invoke_method(runtime_t *runtime, method_t *method, int32_t *locals);
+
 /**
  * Runs a method's instructions until the method returns.
+ * This is inlined into `execute()` and `execute_profiled()` with a constant
+ * `profiling`, so the profiling code costs nothing when it is disabled.
  *
  * @param method the method to run
  * @param locals the array of local variables, including the method parameters.
  *   Except for parameters, the locals are uninitialized.
- * @param class the class file the method belongs to
- * @param heap an array of heap-allocated pointers, useful for references
+ *   This must be the start of a frame on `runtime`'s JVM stack;
+ *   the method's operand stack is placed right after its locals.
+ * @param runtime the class being run and its heap and JVM stack
+ * @param profiling whether to record instructions in `runtime->profile`
  * @return an optional int containing the method's return value
  */
-optional_value_t execute(method_t *method, int32_t *locals, class_file_t *class,
-                         heap_t *heap) {
+static inline __attribute__((always_inline)) optional_value_t
+interpret(method_t *method, int32_t *locals, runtime_t *runtime, bool profiling) {
     size_t program_counter = 0;
-    int32_t *operand_stack = calloc(sizeof(int32_t), (method->code.max_stack));
+    int32_t *operand_stack = locals + method->code.max_locals;
     int32_t stack_size = 0;
     while (program_counter < method->code.code_length) {
-        switch (method->code.code[program_counter]) {
+        size_t instruction_pc = program_counter;
+        u1 opcode = method->code.code[program_counter];
+        if (profiling) {
+            runtime->profile->opcode_counts[opcode]++;
+        }
+        switch (opcode) {
             case i_bipush: {
                 stack_size =
                     stack_help(operand_stack, stack_size,
@@ -70,7 +380,6 @@ optional_value_t execute(method_t *method, int32_t *locals, class_file_t *class,
             }
             case i_return: {
                 optional_value_t result = {.has_value = false};
-                free(operand_stack);
                 return result;
             }
             case i_getstatic: {
@@ -227,7 +536,8 @@ optional_value_t execute(method_t *method, int32_t *locals, class_file_t *class,
             case i_ldc: {
                 int32_t b = (int32_t) method->code.code[program_counter + 1];
                 operand_stack[stack_size] =
-                    ((CONSTANT_Integer_info *) class->constant_pool[b - 1].info)->bytes;
+                    ((CONSTANT_Integer_info *) runtime->class->constant_pool[b - 1].info)
+                        ->bytes;
                 stack_size++;
                 program_counter += 2;
                 break;
@@ -404,22 +714,18 @@ optional_value_t execute(method_t *method, int32_t *locals, class_file_t *class,
                 optional_value_t a;
                 a.value = operand_stack[stack_size - 1];
                 a.has_value = true;
-                free(operand_stack);
                 return a;
             }
             case i_invokestatic: {
                 uint8_t b1 = method->code.code[program_counter + 1];
                 uint8_t b2 = method->code.code[program_counter + 2];
-                int16_t index = (int16_t)((b1 << 8) | b2);
-                method_t *meth = find_method_from_index(index, class);
-                uint16_t len = get_number_of_parameters(meth);
-                int32_t *locals_queue = calloc(sizeof(int32_t), (meth->code.max_locals));
-                for (int32_t i = len - 1; i >= 0; i--) {
-                    locals_queue[i] = operand_stack[stack_size - 1];
-                    stack_size -= 1;
-                }
-                optional_value_t res = execute(meth, locals_queue, class, heap);
-                free(locals_queue);
+                uint16_t index = (uint16_t)((b1 << 8) | b2);
+                resolved_method_t *resolved = resolve_method(runtime, index);
+                method_t *meth = resolved->method;
+                // The arguments on the operand stack become the callee's first locals
+                stack_size -= resolved->num_parameters;
+                int32_t *callee_locals = &operand_stack[stack_size];
+                optional_value_t res = invoke_method(runtime, meth, callee_locals);
                 if (res.has_value) {
                     operand_stack[stack_size] = res.value;
                     stack_size += 1;
@@ -440,20 +746,14 @@ optional_value_t execute(method_t *method, int32_t *locals, class_file_t *class,
             }
             case i_newarray: {
                 int32_t count = operand_stack[stack_size - 1];
-                assert(count + 1 > 0);
-                int32_t *newarr = calloc(sizeof(int32_t), count + 1);
-                newarr[0] = count;
-                for (int i = 1; i < count + 1; i++) {
-                    newarr[i] = 0;
-                }
-                int32_t ref = heap_add(heap, newarr);
+                int32_t ref = new_array(runtime, count, &operand_stack[stack_size]);
                 operand_stack[stack_size - 1] = ref;
                 program_counter += 2;
                 break;
             }
             case i_arraylength: {
                 int32_t ref = operand_stack[stack_size - 1];
-                int32_t len = heap_get(heap, ref)[0];
+                int32_t len = heap_get(runtime->heap, ref)[0];
                 operand_stack[stack_size - 1] = len;
                 program_counter++;
                 break;
@@ -463,14 +763,13 @@ optional_value_t execute(method_t *method, int32_t *locals, class_file_t *class,
                 optional_value_t res;
                 res.value = ref;
                 res.has_value = true;
-                free(operand_stack);
                 return res;
             }
             case i_iastore: {
                 int32_t value = operand_stack[stack_size - 1];
                 int32_t index = operand_stack[stack_size - 2];
                 int32_t ref = operand_stack[stack_size - 3];
-                int32_t *arr = heap_get(heap, ref);
+                int32_t *arr = heap_get(runtime->heap, ref);
                 arr[index + 1] = value;
                 stack_size -= 3;
                 program_counter++;
@@ -479,7 +778,7 @@ optional_value_t execute(method_t *method, int32_t *locals, class_file_t *class,
             case i_iaload: {
                 int32_t index = operand_stack[stack_size - 1];
                 int32_t ref = operand_stack[stack_size - 2];
-                int32_t val = heap_get(heap, ref)[index + 1];
+                int32_t val = heap_get(runtime->heap, ref)[index + 1];
                 stack_size -= 2;
                 operand_stack[stack_size] = val;
                 stack_size++;
@@ -519,22 +818,1305 @@ optional_value_t execute(method_t *method, int32_t *locals, class_file_t *class,
                 program_counter++;
                 break;
         }
+        if (profiling && i_ifeq <= opcode && opcode <= i_if_icmple) {
+            profile_branch(runtime, method, instruction_pc,
+                           program_counter != instruction_pc + 3);
+        }
     }
 
     // Return void
     optional_value_t result = {.has_value = false};
-    free(operand_stack);
     return result;
 }
 
+/** Runs a method with the switch interpreter (see `interpret()`) */
+optional_value_t execute(method_t *method, int32_t *locals, runtime_t *runtime) {
+    return interpret(method, locals, runtime, false);
+}
+
+/**
+ * Runs a method with the switch interpreter (see `interpret()`),
+ * recording each instruction and branch in `runtime->profile`.
+ */
+optional_value_t execute_profiled(method_t *method, int32_t *locals, runtime_t *runtime) {
+    return interpret(method, locals, runtime, true);
+}
+
+/**
+ * Replaces common instruction sequences with superinstructions
+ * that do the same work with a single dispatch and without using the operand stack.
+ * A superinstruction overwrites the first instruction of its sequence and skips
+ * over the rest when it finishes. The rest are left unchanged, so a branch into
+ * the middle of a fused sequence still runs the original instructions.
+ *
+ * @param decoded the decoded method to rewrite
+ * @param handlers the label that implements each (real or fused) opcode
+ * @return the number of superinstructions created
+ */
+size_t fuse_instructions(decoded_method_t *decoded, const void *const *handlers) {
+    // Each comparison and the superinstructions that compare two locals or a constant
+    static const u1 COMPARISONS[][3] = {
+        {i_if_icmpeq, f_load_load_if_icmpeq, f_load_push_if_icmpeq},
+        {i_if_icmpne, f_load_load_if_icmpne, f_load_push_if_icmpne},
+        {i_if_icmplt, f_load_load_if_icmplt, f_load_push_if_icmplt},
+        {i_if_icmpge, f_load_load_if_icmpge, f_load_push_if_icmpge},
+        {i_if_icmpgt, f_load_load_if_icmpgt, f_load_push_if_icmpgt},
+        {i_if_icmple, f_load_load_if_icmple, f_load_push_if_icmple},
+    };
+
+    size_t fusion_count = 0;
+    instruction_t *instructions = decoded->instructions;
+    size_t i = 0;
+    while (i < decoded->length) {
+        // The number of instructions after `i` (the last one is always `return`)
+        size_t remaining = decoded->length - 1 - i;
+        instruction_t *instruction = &instructions[i];
+        size_t fused_length = 0;
+        if (remaining >= 2 && instruction[0].handler == handlers[i_iload] &&
+            (instruction[1].handler == handlers[i_iload] ||
+             instruction[1].handler == handlers[i_bipush])) {
+            bool is_load = instruction[1].handler == handlers[i_iload];
+            for (size_t j = 0; j < sizeof(COMPARISONS) / sizeof(*COMPARISONS); j++) {
+                if (instruction[2].handler == handlers[COMPARISONS[j][0]]) {
+                    instruction->handler = handlers[COMPARISONS[j][is_load ? 1 : 2]];
+                    instruction->operand2 = instruction[1].operand;
+                    instruction->target = instruction[2].target;
+                    fused_length = 3;
+                    break;
+                }
+            }
+        }
+        if (fused_length == 0 && remaining >= 3 &&
+            instruction[0].handler == handlers[i_iload] &&
+            instruction[1].handler == handlers[i_bipush] &&
+            instruction[2].handler == handlers[i_iadd] &&
+            instruction[3].handler == handlers[i_istore]) {
+            instruction->handler = handlers[f_load_push_iadd_store];
+            instruction->operand2 = instruction[1].operand;
+            instruction->operand3 = instruction[3].operand;
+            fused_length = 4;
+        }
+        if (fused_length == 0 && remaining >= 1 &&
+            instruction[0].handler == handlers[i_iinc] &&
+            instruction[1].handler == handlers[i_goto]) {
+            instruction->handler = handlers[f_iinc_goto];
+            instruction->target = instruction[1].target;
+            fused_length = 2;
+        }
+
+        if (fused_length > 0) {
+            fusion_count++;
+            i += fused_length;
+        }
+        else {
+            i++;
+        }
+    }
+    return fusion_count;
+}
+
+/**
+ * Decodes a method's bytecode into an array of `instruction_t`s.
+ * Each instruction's operands are read once here instead of on every execution:
+ * constants (including `ldc` entries) are resolved to their values,
+ * the implicit index of `iload_<n>`-style instructions becomes an explicit operand,
+ * and branch offsets become pointers to the target instruction.
+ * A `return` is appended so that falling off the end of the bytecode returns void.
+ * Finally, common instruction sequences are fused (see `fuse_instructions()`).
+ *
+ * @param method the method to decode
+ * @param class the class file the method belongs to
+ * @param handlers the label that implements each opcode in `execute_threaded()`
+ * @return a heap-allocated decoded method
+ */
+decoded_method_t *decode_method(method_t *method, class_file_t *class,
+                                const void *const *handlers) {
+    code_t *code = &method->code;
+
+    // Map the offset of each instruction in the bytecode to its decoded index
+    size_t *indices = malloc(sizeof(size_t) * code->code_length);
+    assert(code->code_length == 0 || indices != NULL);
+    size_t length = 0;
+    for (size_t pc = 0; pc < code->code_length; pc += INSTRUCTION_LENGTHS[code->code[pc]]) {
+        assert(INSTRUCTION_LENGTHS[code->code[pc]] > 0 && "Unsupported instruction");
+        indices[pc] = length++;
+    }
+
+    decoded_method_t *decoded = malloc(sizeof(decoded_method_t));
+    assert(decoded != NULL);
+    decoded->length = length + 1;
+    decoded->instructions = malloc(sizeof(instruction_t) * decoded->length);
+    assert(decoded->instructions != NULL);
+
+    instruction_t *instruction = decoded->instructions;
+    for (size_t pc = 0; pc < code->code_length; pc += INSTRUCTION_LENGTHS[code->code[pc]]) {
+        u1 opcode = code->code[pc];
+        u1 b1 = pc + 1 < code->code_length ? code->code[pc + 1] : 0;
+        u1 b2 = pc + 2 < code->code_length ? code->code[pc + 2] : 0;
+        instruction->handler = handlers[opcode];
+        instruction->operand = 0;
+        instruction->operand2 = 0;
+        instruction->operand3 = 0;
+        instruction->target = NULL;
+        switch (opcode) {
+            case i_iconst_m1:
+            case i_iconst_0:
+            case i_iconst_1:
+            case i_iconst_2:
+            case i_iconst_3:
+            case i_iconst_4:
+            case i_iconst_5:
+                instruction->operand = opcode - i_iconst_0;
+                break;
+            case i_bipush:
+                instruction->operand = (int8_t) b1;
+                break;
+            case i_sipush:
+                instruction->operand = (int16_t) ((b1 << 8) | b2);
+                break;
+            case i_ldc:
+                instruction->operand =
+                    ((CONSTANT_Integer_info *) class->constant_pool[b1 - 1].info)->bytes;
+                break;
+            case i_iload:
+            case i_aload:
+            case i_istore:
+            case i_astore:
+                instruction->operand = b1;
+                break;
+            case i_iload_0:
+            case i_iload_1:
+            case i_iload_2:
+            case i_iload_3:
+                instruction->operand = opcode - i_iload_0;
+                break;
+            case i_aload_0:
+            case i_aload_1:
+            case i_aload_2:
+            case i_aload_3:
+                instruction->operand = opcode - i_aload_0;
+                break;
+            case i_istore_0:
+            case i_istore_1:
+            case i_istore_2:
+            case i_istore_3:
+                instruction->operand = opcode - i_istore_0;
+                break;
+            case i_astore_0:
+            case i_astore_1:
+            case i_astore_2:
+            case i_astore_3:
+                instruction->operand = opcode - i_astore_0;
+                break;
+            case i_iinc:
+                instruction->operand = b1;
+                instruction->operand2 = (int8_t) b2;
+                break;
+            case i_invokestatic:
+                instruction->operand = (b1 << 8) | b2;
+                break;
+            case i_ifeq:
+            case i_ifne:
+            case i_iflt:
+            case i_ifge:
+            case i_ifgt:
+            case i_ifle:
+            case i_if_icmpeq:
+            case i_if_icmpne:
+            case i_if_icmplt:
+            case i_if_icmpge:
+            case i_if_icmpgt:
+            case i_if_icmple:
+            case i_goto: {
+                size_t target = pc + (int16_t) ((b1 << 8) | b2);
+                assert(target < code->code_length && "Branch target out of range");
+                instruction->target = &decoded->instructions[indices[target]];
+                break;
+            }
+        }
+        instruction++;
+    }
+
+    // Falling off the end of the method returns void
+    instruction->handler = handlers[i_return];
+    instruction->operand = 0;
+    instruction->operand2 = 0;
+    instruction->operand3 = 0;
+    instruction->target = NULL;
+
+    free(indices);
+    decoded->fusion_count = fuse_instructions(decoded, handlers);
+    return decoded;
+}
+
+/**
+ * Runs a method's instructions until the method returns, like `execute()`.
+ * Instead of switching on each bytecode, this decodes the method once
+ * (see `decode_method()`) and then jumps directly from each instruction's handler
+ * to the next instruction's handler using computed gotos.
+ *
+ * @param method the method to run
+ * @param locals the array of local variables, including the method parameters.
+ *   Except for parameters, the locals are uninitialized.
+ *   This must be the start of a frame on `runtime`'s JVM stack.
+ * @param runtime the class being run, its heap and JVM stack, and its decoded methods
+ * @return an optional int containing the method's return value
+ */
+optional_value_t execute_threaded(method_t *method, int32_t *locals, runtime_t *runtime) {
+    /* Each opcode's handler. Instructions that behave identically
+     * once decoded (e.g. `iload_1` and `aload 1`) share a handler. */
+    static const void *const HANDLERS[UINT8_MAX + 1] = {
+        [i_nop] = &&do_nop,
+        [i_getstatic] = &&do_nop,
+        [i_iconst_m1 ... i_iconst_5] = &&do_push,
+        [i_bipush] = &&do_push,
+        [i_sipush] = &&do_push,
+        [i_ldc] = &&do_push,
+        [i_iload] = &&do_load,
+        [i_aload] = &&do_load,
+        [i_iload_0 ... i_iload_3] = &&do_load,
+        [i_aload_0 ... i_aload_3] = &&do_load,
+        [i_istore] = &&do_store,
+        [i_astore] = &&do_store,
+        [i_istore_0 ... i_istore_3] = &&do_store,
+        [i_astore_0 ... i_astore_3] = &&do_store,
+        [i_iinc] = &&do_iinc,
+        [i_dup] = &&do_dup,
+        [i_iadd] = &&do_iadd,
+        [i_isub] = &&do_isub,
+        [i_imul] = &&do_imul,
+        [i_idiv] = &&do_idiv,
+        [i_irem] = &&do_irem,
+        [i_ineg] = &&do_ineg,
+        [i_ishl] = &&do_ishl,
+        [i_ishr] = &&do_ishr,
+        [i_iushr] = &&do_iushr,
+        [i_iand] = &&do_iand,
+        [i_ior] = &&do_ior,
+        [i_ixor] = &&do_ixor,
+        [i_ifeq] = &&do_ifeq,
+        [i_ifne] = &&do_ifne,
+        [i_iflt] = &&do_iflt,
+        [i_ifge] = &&do_ifge,
+        [i_ifgt] = &&do_ifgt,
+        [i_ifle] = &&do_ifle,
+        [i_if_icmpeq] = &&do_if_icmpeq,
+        [i_if_icmpne] = &&do_if_icmpne,
+        [i_if_icmplt] = &&do_if_icmplt,
+        [i_if_icmpge] = &&do_if_icmpge,
+        [i_if_icmpgt] = &&do_if_icmpgt,
+        [i_if_icmple] = &&do_if_icmple,
+        [i_goto] = &&do_goto,
+        [i_ireturn] = &&do_ireturn,
+        [i_areturn] = &&do_ireturn,
+        [i_return] = &&do_return,
+        [i_invokevirtual] = &&do_invokevirtual,
+        [i_invokestatic] = &&do_invokestatic,
+        [i_newarray] = &&do_newarray,
+        [i_arraylength] = &&do_arraylength,
+        [i_iaload] = &&do_iaload,
+        [i_iastore] = &&do_iastore,
+        [f_load_load_if_icmpeq] = &&do_load_load_if_icmpeq,
+        [f_load_load_if_icmpne] = &&do_load_load_if_icmpne,
+        [f_load_load_if_icmplt] = &&do_load_load_if_icmplt,
+        [f_load_load_if_icmpge] = &&do_load_load_if_icmpge,
+        [f_load_load_if_icmpgt] = &&do_load_load_if_icmpgt,
+        [f_load_load_if_icmple] = &&do_load_load_if_icmple,
+        [f_load_push_if_icmpeq] = &&do_load_push_if_icmpeq,
+        [f_load_push_if_icmpne] = &&do_load_push_if_icmpne,
+        [f_load_push_if_icmplt] = &&do_load_push_if_icmplt,
+        [f_load_push_if_icmpge] = &&do_load_push_if_icmpge,
+        [f_load_push_if_icmpgt] = &&do_load_push_if_icmpgt,
+        [f_load_push_if_icmple] = &&do_load_push_if_icmple,
+        [f_load_push_iadd_store] = &&do_load_push_iadd_store,
+        [f_iinc_goto] = &&do_iinc_goto,
+    };
+
+    size_t method_index = method - runtime->class->methods;
+    decoded_method_t *decoded = runtime->decoded_methods[method_index];
+    if (decoded == NULL) {
+        decoded = decode_method(method, runtime->class, HANDLERS);
+        runtime->decoded_methods[method_index] = decoded;
+    }
+
+    // `stack_top` points just past the top value of the operand stack
+    int32_t *stack_top = locals + method->code.max_locals;
+    instruction_t *ip = decoded->instructions;
+    optional_value_t result = {.has_value = false};
+
+// Jumps to the handler of the instruction at `ip`
+#define DISPATCH() goto *ip->handler
+// Moves on to the instruction after the current one
+#define NEXT()      \
+    do {            \
+        ip++;       \
+        DISPATCH(); \
+    } while (0)
+// Jumps to the current instruction's target if `condition` holds, otherwise moves on
+#define BRANCH_IF(condition) FUSED_BRANCH_IF(condition, 1)
+// Like `BRANCH_IF()`, but for a superinstruction that replaced `length` instructions
+#define FUSED_BRANCH_IF(condition, length)           \
+    do {                                             \
+        ip = (condition) ? ip->target : ip + length; \
+        DISPATCH();                                  \
+    } while (0)
+
+    DISPATCH();
+
+do_nop:
+    NEXT();
+do_push:
+    *stack_top++ = ip->operand;
+    NEXT();
+do_load:
+    *stack_top++ = locals[ip->operand];
+    NEXT();
+do_store:
+    locals[ip->operand] = *--stack_top;
+    NEXT();
+do_iinc:
+    locals[ip->operand] += ip->operand2;
+    NEXT();
+do_dup:
+    *stack_top = stack_top[-1];
+    stack_top++;
+    NEXT();
+do_iadd:
+    stack_top--;
+    stack_top[-1] += *stack_top;
+    NEXT();
+do_isub:
+    stack_top--;
+    stack_top[-1] -= *stack_top;
+    NEXT();
+do_imul:
+    stack_top--;
+    stack_top[-1] *= *stack_top;
+    NEXT();
+do_idiv:
+    stack_top--;
+    assert(*stack_top != 0);
+    stack_top[-1] /= *stack_top;
+    NEXT();
+do_irem:
+    stack_top--;
+    assert(*stack_top != 0);
+    stack_top[-1] %= *stack_top;
+    NEXT();
+do_ineg:
+    stack_top[-1] *= -1;
+    NEXT();
+do_ishl:
+    stack_top--;
+    assert(*stack_top >= 0);
+    stack_top[-1] <<= *stack_top;
+    NEXT();
+do_ishr:
+    stack_top--;
+    assert(*stack_top >= 0);
+    stack_top[-1] >>= *stack_top;
+    NEXT();
+do_iushr:
+    stack_top--;
+    assert(*stack_top >= 0);
+    stack_top[-1] = (unsigned) stack_top[-1] >> *stack_top;
+    NEXT();
+do_iand:
+    stack_top--;
+    stack_top[-1] &= *stack_top;
+    NEXT();
+do_ior:
+    stack_top--;
+    stack_top[-1] |= *stack_top;
+    NEXT();
+do_ixor:
+    stack_top--;
+    stack_top[-1] ^= *stack_top;
+    NEXT();
+do_ifeq:
+    stack_top--;
+    BRANCH_IF(stack_top[0] == 0);
+do_ifne:
+    stack_top--;
+    BRANCH_IF(stack_top[0] != 0);
+do_iflt:
+    stack_top--;
+    BRANCH_IF(stack_top[0] < 0);
+do_ifge:
+    stack_top--;
+    BRANCH_IF(stack_top[0] >= 0);
+do_ifgt:
+    stack_top--;
+    BRANCH_IF(stack_top[0] > 0);
+do_ifle:
+    stack_top--;
+    BRANCH_IF(stack_top[0] <= 0);
+do_if_icmpeq:
+    stack_top -= 2;
+    BRANCH_IF(stack_top[0] == stack_top[1]);
+do_if_icmpne:
+    stack_top -= 2;
+    BRANCH_IF(stack_top[0] != stack_top[1]);
+do_if_icmplt:
+    stack_top -= 2;
+    BRANCH_IF(stack_top[0] < stack_top[1]);
+do_if_icmpge:
+    stack_top -= 2;
+    BRANCH_IF(stack_top[0] >= stack_top[1]);
+do_if_icmpgt:
+    stack_top -= 2;
+    BRANCH_IF(stack_top[0] > stack_top[1]);
+do_if_icmple:
+    stack_top -= 2;
+    BRANCH_IF(stack_top[0] <= stack_top[1]);
+do_goto:
+    ip = ip->target;
+    DISPATCH();
+do_invokevirtual:
+    printf("%i\n", *--stack_top);
+    NEXT();
+do_invokestatic: {
+    resolved_method_t *resolved = resolve_method(runtime, ip->operand);
+    method_t *callee = resolved->method;
+    // The arguments on the operand stack become the callee's first locals
+    stack_top -= resolved->num_parameters;
+    optional_value_t res = invoke_method(runtime, callee, stack_top);
+    if (res.has_value) {
+        *stack_top++ = res.value;
+    }
+    NEXT();
+}
+do_newarray:
+    stack_top[-1] = new_array(runtime, stack_top[-1], stack_top);
+    NEXT();
+do_arraylength:
+    stack_top[-1] = heap_get(runtime->heap, stack_top[-1])[0];
+    NEXT();
+do_iaload:
+    stack_top--;
+    stack_top[-1] = heap_get(runtime->heap, stack_top[-1])[*stack_top + 1];
+    NEXT();
+do_iastore:
+    stack_top -= 3;
+    heap_get(runtime->heap, stack_top[0])[stack_top[1] + 1] = stack_top[2];
+    NEXT();
+do_load_load_if_icmpeq:
+    FUSED_BRANCH_IF(locals[ip->operand] == locals[ip->operand2], 3);
+do_load_load_if_icmpne:
+    FUSED_BRANCH_IF(locals[ip->operand] != locals[ip->operand2], 3);
+do_load_load_if_icmplt:
+    FUSED_BRANCH_IF(locals[ip->operand] < locals[ip->operand2], 3);
+do_load_load_if_icmpge:
+    FUSED_BRANCH_IF(locals[ip->operand] >= locals[ip->operand2], 3);
+do_load_load_if_icmpgt:
+    FUSED_BRANCH_IF(locals[ip->operand] > locals[ip->operand2], 3);
+do_load_load_if_icmple:
+    FUSED_BRANCH_IF(locals[ip->operand] <= locals[ip->operand2], 3);
+do_load_push_if_icmpeq:
+    FUSED_BRANCH_IF(locals[ip->operand] == ip->operand2, 3);
+do_load_push_if_icmpne:
+    FUSED_BRANCH_IF(locals[ip->operand] != ip->operand2, 3);
+do_load_push_if_icmplt:
+    FUSED_BRANCH_IF(locals[ip->operand] < ip->operand2, 3);
+do_load_push_if_icmpge:
+    FUSED_BRANCH_IF(locals[ip->operand] >= ip->operand2, 3);
+do_load_push_if_icmpgt:
+    FUSED_BRANCH_IF(locals[ip->operand] > ip->operand2, 3);
+do_load_push_if_icmple:
+    FUSED_BRANCH_IF(locals[ip->operand] <= ip->operand2, 3);
+do_load_push_iadd_store:
+    locals[ip->operand3] = locals[ip->operand] + ip->operand2;
+    ip += 4;
+    DISPATCH();
+do_iinc_goto:
+    locals[ip->operand] += ip->operand2;
+    ip = ip->target;
+    DISPATCH();
+do_ireturn:
+    result.has_value = true;
+    result.value = stack_top[-1];
+    goto done;
+do_return:
+    goto done;
+
+#undef DISPATCH
+#undef NEXT
+#undef BRANCH_IF
+#undef FUSED_BRANCH_IF
+
+done:
+    return result;
+}
+
+/** An x86-64 general-purpose register, numbered as in ModRM bytes */
+typedef enum { RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSI = 6, RDI = 7 } x86_register_t;
+
+/**
+ * The second byte of the `jcc rel32` instruction for each branch condition,
+ * in the order of the `if<cond>` and `if_icmp<cond>` opcodes (eq, ne, lt, ge, gt, le)
+ */
+const u1 JCC_OPCODES[] = {0x84, 0x85, 0x8c, 0x8d, 0x8f, 0x8e};
+
+/** A location in the generated code that needs the address of a label */
+typedef struct {
+    /** The offset of the `rel32` operand to fill in */
+    size_t offset;
+    /** The label to jump to (see `label_t`) */
+    size_t label;
+} fixup_t;
+
+/**
+ * Machine code being generated for a method.
+ * Labels 0 to `code_length - 1` mark the code for each bytecode offset,
+ * followed by the two error handlers in `jit_label_t`.
+ */
+typedef struct {
+    /** The generated code */
+    u1 *code;
+    /** The number of bytes generated so far */
+    size_t length;
+    /** The number of bytes `code` has room for */
+    size_t capacity;
+    /** The offset of each label in `code` */
+    size_t *labels;
+    /** The jumps whose targets still need to be filled in */
+    fixup_t *fixups;
+    /** The number of entries in `fixups` */
+    size_t fixup_count;
+} assembler_t;
+
+/** The labels after the bytecode offsets, as offsets from `code_length` */
+typedef enum { STACK_OVERFLOW_LABEL, DIVISION_BY_ZERO_LABEL, LABEL_COUNT } jit_label_t;
+
+/** The most bytes of machine code emitted for any one bytecode instruction */
+const size_t MAX_INSTRUCTION_CODE = 64;
+/** The bytes of machine code emitted outside any instruction (prologue and handlers) */
+const size_t METHOD_OVERHEAD_CODE = 128;
+
+static void emit_bytes(assembler_t *as, const u1 *bytes, size_t count) {
+    assert(as->length + count <= as->capacity && "JIT code buffer overflow");
+    memcpy(&as->code[as->length], bytes, count);
+    as->length += count;
+}
+
+/** Emits the given bytes, e.g. `EMIT(as, 0x5b, 0xc3)` for `pop %rbx; ret` */
+#define EMIT(as, ...)                                                                   \
+    emit_bytes(as, (const u1[]){__VA_ARGS__}, sizeof((const u1[]){__VA_ARGS__}))
+
+static void emit_int32(assembler_t *as, int32_t value) {
+    // x86 is little-endian, like the machine running the JIT
+    emit_bytes(as, (const u1 *) &value, sizeof(value));
+}
+
+static void emit_int64(assembler_t *as, uint64_t value) {
+    emit_bytes(as, (const u1 *) &value, sizeof(value));
+}
+
+/**
+ * Emits the ModRM byte and displacement for the operands `reg, slot(%rbx)`.
+ * `%rbx` holds the start of the frame, so `slot` is the index of an int in the frame.
+ * `reg` may also be the opcode extension of a single-operand instruction.
+ */
+static void emit_frame_operand(assembler_t *as, x86_register_t reg, size_t slot) {
+    EMIT(as, 0x80 | reg << 3 | RBX);
+    emit_int32(as, slot * sizeof(int32_t));
+}
+
+/** Emits `mov slot(%rbx), %reg` */
+static void emit_load(assembler_t *as, x86_register_t reg, size_t slot) {
+    EMIT(as, 0x8b);
+    emit_frame_operand(as, reg, slot);
+}
+
+/** Emits `mov %reg, slot(%rbx)` */
+static void emit_store(assembler_t *as, size_t slot, x86_register_t reg) {
+    EMIT(as, 0x89);
+    emit_frame_operand(as, reg, slot);
+}
+
+/** Emits `movl $value, slot(%rbx)` */
+static void emit_store_constant(assembler_t *as, size_t slot, int32_t value) {
+    EMIT(as, 0xc7);
+    emit_frame_operand(as, 0, slot);
+    emit_int32(as, value);
+}
+
+/** Emits `lea slot(%rbx), %reg`, the address of a frame slot */
+static void emit_frame_address(assembler_t *as, x86_register_t reg, size_t slot) {
+    EMIT(as, 0x48, 0x8d);
+    emit_frame_operand(as, reg, slot);
+}
+
+/** Emits `movabs $value, %reg` */
+static void emit_move_immediate(assembler_t *as, x86_register_t reg, uint64_t value) {
+    EMIT(as, 0x48, 0xb8 | reg);
+    emit_int64(as, value);
+}
+
+/** Emits a call to a C function (or compiled method) at an absolute address */
+static void emit_call_address(assembler_t *as, uint64_t address) {
+    emit_move_immediate(as, RAX, address);
+    EMIT(as, 0xff, 0xd0);
+}
+
+/** Emits a jump instruction (given by its opcode bytes) with a `rel32` to a label */
+static void emit_jump(assembler_t *as, const u1 *opcode, size_t opcode_length,
+                      size_t label) {
+    emit_bytes(as, opcode, opcode_length);
+    as->fixups[as->fixup_count++] = (fixup_t){.offset = as->length, .label = label};
+    emit_int32(as, 0);
+}
+
+/** Emits `jcc label` for the condition of an `if<cond>` or `if_icmp<cond>` */
+static void emit_conditional_jump(assembler_t *as, size_t condition, size_t label) {
+    emit_jump(as, (const u1[]){0x0f, JCC_OPCODES[condition]}, 2, label);
+}
+
+/**
+ * Checks whether a method descriptor only takes and returns ints
+ * (or booleans, bytes, chars and shorts, which the JVM also represents as ints).
+ */
+static bool is_int_only(const char *descriptor) {
+    assert(*descriptor == '(');
+    for (descriptor++; *descriptor != ')'; descriptor++) {
+        if (strchr("IZBCS", *descriptor) == NULL) {
+            return false;
+        }
+    }
+    return descriptor[1] != '\0' && strchr("IZBCSV", descriptor[1]) != NULL;
+}
+
+static bool returns_value(const char *descriptor) {
+    return strchr(descriptor, ')')[1] != 'V';
+}
+
+/**
+ * Computes how many values each instruction pushes onto the operand stack
+ * minus how many it pops, if the JIT can compile the instruction.
+ *
+ * @param runtime the runtime whose class the method belongs to
+ * @param code the method's bytecode
+ * @param pc the offset of the instruction in the bytecode
+ * @param effect set to the change in the operand stack's size
+ * @return whether the JIT supports the instruction
+ */
+static bool jit_stack_effect(runtime_t *runtime, const u1 *code, size_t pc,
+                             int32_t *effect) {
+    switch (code[pc]) {
+        case i_nop:
+        case i_iinc:
+        case i_ineg:
+        case i_goto:
+        case i_ireturn:
+        case i_return:
+            *effect = 0;
+            return true;
+        case i_iconst_m1:
+        case i_iconst_0:
+        case i_iconst_1:
+        case i_iconst_2:
+        case i_iconst_3:
+        case i_iconst_4:
+        case i_iconst_5:
+        case i_bipush:
+        case i_sipush:
+        case i_ldc:
+        case i_iload:
+        case i_iload_0:
+        case i_iload_1:
+        case i_iload_2:
+        case i_iload_3:
+        case i_dup:
+            *effect = 1;
+            return true;
+        case i_istore:
+        case i_istore_0:
+        case i_istore_1:
+        case i_istore_2:
+        case i_istore_3:
+        case i_iadd:
+        case i_isub:
+        case i_imul:
+        case i_idiv:
+        case i_irem:
+        case i_ishl:
+        case i_ishr:
+        case i_iushr:
+        case i_iand:
+        case i_ior:
+        case i_ixor:
+        case i_ifeq:
+        case i_ifne:
+        case i_iflt:
+        case i_ifge:
+        case i_ifgt:
+        case i_ifle:
+            *effect = -1;
+            return true;
+        case i_if_icmpeq:
+        case i_if_icmpne:
+        case i_if_icmplt:
+        case i_if_icmpge:
+        case i_if_icmpgt:
+        case i_if_icmple:
+            *effect = -2;
+            return true;
+        case i_invokestatic: {
+            resolved_method_t *resolved =
+                resolve_method(runtime, (uint16_t) ((code[pc + 1] << 8) | code[pc + 2]));
+            const char *descriptor = resolved->method->descriptor;
+            if (!is_int_only(descriptor)) {
+                return false;
+            }
+            *effect = returns_value(descriptor) - resolved->num_parameters;
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+/**
+ * Computes the size of the operand stack before each instruction of a method.
+ * The JVM guarantees this is the same on every path to an instruction,
+ * so the compiled code can give each stack entry a fixed slot in the frame.
+ *
+ * @param runtime the runtime whose class the method belongs to
+ * @param method the method to analyze
+ * @param depths set to the operand stack size before each bytecode offset,
+ *   or -1 for offsets that are not the start of a reachable instruction
+ * @return whether the JIT supports every reachable instruction
+ */
+static bool jit_stack_depths(runtime_t *runtime, method_t *method, int32_t *depths) {
+    const code_t *code = &method->code;
+    for (size_t pc = 0; pc < code->code_length; pc++) {
+        depths[pc] = -1;
+    }
+    // Each offset is added to the worklist only the first time it is reached
+    size_t *worklist = malloc(sizeof(size_t) * code->code_length);
+    assert(worklist != NULL);
+    size_t worklist_size = 0;
+    depths[0] = 0;
+    worklist[worklist_size++] = 0;
+    bool supported = true;
+    while (worklist_size > 0) {
+        size_t pc = worklist[--worklist_size];
+        u1 opcode = code->code[pc];
+        int32_t effect;
+        if (!jit_stack_effect(runtime, code->code, pc, &effect)) {
+            supported = false;
+            break;
+        }
+        int32_t depth = depths[pc] + effect;
+        assert(0 <= depth && depth <= code->max_stack && "Invalid operand stack size");
+
+        size_t successors[2];
+        size_t successor_count = 0;
+        if (opcode != i_goto && opcode != i_ireturn && opcode != i_return) {
+            successors[successor_count++] = pc + INSTRUCTION_LENGTHS[opcode];
+        }
+        if ((i_ifeq <= opcode && opcode <= i_if_icmple) || opcode == i_goto) {
+            successors[successor_count++] =
+                pc + (int16_t) ((code->code[pc + 1] << 8) | code->code[pc + 2]);
+        }
+        for (size_t i = 0; i < successor_count; i++) {
+            size_t successor = successors[i];
+            assert(successor < code->code_length && "Branch target out of range");
+            if (depths[successor] < 0) {
+                depths[successor] = depth;
+                worklist[worklist_size++] = successor;
+            }
+            assert(depths[successor] == depth && "Inconsistent operand stack size");
+        }
+    }
+    free(worklist);
+    return supported;
+}
+
+/** Called by compiled code when a frame would not fit in the JVM stack */
+static void jit_stack_overflow(void) {
+    assert(false && "Stack overflow");
+    abort();
+}
+
+/** Called by compiled code for an `idiv` or `irem` by 0 */
+static void jit_division_by_zero(void) {
+    assert(false && "Division by zero");
+    abort();
+}
+
+/**
+ * Called by compiled code to invoke a method that had not been compiled
+ * when the caller was, so it can be interpreted or compiled as needed.
+ */
+static int32_t jit_invoke(runtime_t *runtime, method_t *method, int32_t *locals) {
+    return invoke_method(runtime, method, locals).value;
+}
+
+/**
+ * Emits the machine code for one instruction.
+ * The operand stack entries are slots of the frame after the locals,
+ * so `top` is the frame slot of the value on top of the stack.
+ */
+static void jit_instruction(runtime_t *runtime, method_t *method, assembler_t *as,
+                            size_t pc, size_t top) {
+    const u1 *code = &method->code.code[pc];
+    switch (code[0]) {
+        case i_nop:
+            break;
+        case i_iconst_m1:
+        case i_iconst_0:
+        case i_iconst_1:
+        case i_iconst_2:
+        case i_iconst_3:
+        case i_iconst_4:
+        case i_iconst_5:
+            emit_store_constant(as, top + 1, code[0] - i_iconst_0);
+            break;
+        case i_bipush:
+            emit_store_constant(as, top + 1, (int8_t) code[1]);
+            break;
+        case i_sipush:
+            emit_store_constant(as, top + 1, (int16_t) ((code[1] << 8) | code[2]));
+            break;
+        case i_ldc: {
+            cp_info *constant = &runtime->class->constant_pool[code[1] - 1];
+            int32_t value = ((CONSTANT_Integer_info *) constant->info)->bytes;
+            emit_store_constant(as, top + 1, value);
+            break;
+        }
+        case i_iload:
+        case i_iload_0:
+        case i_iload_1:
+        case i_iload_2:
+        case i_iload_3:
+        case i_dup: {
+            size_t source = code[0] == i_iload  ? code[1]
+                            : code[0] == i_dup ? top
+                                               : (size_t) (code[0] - i_iload_0);
+            emit_load(as, RAX, source);
+            emit_store(as, top + 1, RAX);
+            break;
+        }
+        case i_istore:
+        case i_istore_0:
+        case i_istore_1:
+        case i_istore_2:
+        case i_istore_3:
+            emit_load(as, RAX, top);
+            emit_store(as, code[0] == i_istore ? code[1] : (size_t) (code[0] - i_istore_0),
+                       RAX);
+            break;
+        case i_iinc:
+            // add $c, index(%rbx)
+            EMIT(as, 0x81);
+            emit_frame_operand(as, 0, code[1]);
+            emit_int32(as, (int8_t) code[2]);
+            break;
+        case i_iadd:
+        case i_isub:
+        case i_imul:
+        case i_iand:
+        case i_ior:
+        case i_ixor:
+            emit_load(as, RAX, top - 1);
+            switch (code[0]) {
+                case i_iadd:
+                    EMIT(as, 0x03);
+                    break;
+                case i_isub:
+                    EMIT(as, 0x2b);
+                    break;
+                case i_imul:
+                    EMIT(as, 0x0f, 0xaf);
+                    break;
+                case i_iand:
+                    EMIT(as, 0x23);
+                    break;
+                case i_ior:
+                    EMIT(as, 0x0b);
+                    break;
+                default:
+                    EMIT(as, 0x33);
+                    break;
+            }
+            emit_frame_operand(as, RAX, top);
+            emit_store(as, top - 1, RAX);
+            break;
+        case i_idiv:
+        case i_irem:
+            emit_load(as, RAX, top - 1);
+            emit_load(as, RCX, top);
+            // test %ecx, %ecx; je division_by_zero
+            EMIT(as, 0x85, 0xc9);
+            emit_conditional_jump(as, 0,
+                                  method->code.code_length + DIVISION_BY_ZERO_LABEL);
+            // cltd; idiv %ecx
+            EMIT(as, 0x99, 0xf7, 0xf9);
+            emit_store(as, top - 1, code[0] == i_idiv ? RAX : RDX);
+            break;
+        case i_ishl:
+        case i_ishr:
+        case i_iushr:
+            emit_load(as, RAX, top - 1);
+            emit_load(as, RCX, top);
+            // shl, sar or shr %cl, %eax (which use the low 5 bits of %cl, as Java does)
+            EMIT(as, 0xd3, code[0] == i_ishl ? 0xe0 : code[0] == i_ishr ? 0xf8 : 0xe8);
+            emit_store(as, top - 1, RAX);
+            break;
+        case i_ineg:
+            EMIT(as, 0xf7);
+            emit_frame_operand(as, 3, top);
+            break;
+        case i_ifeq:
+        case i_ifne:
+        case i_iflt:
+        case i_ifge:
+        case i_ifgt:
+        case i_ifle:
+            // cmpl $0, top(%rbx)
+            EMIT(as, 0x83);
+            emit_frame_operand(as, 7, top);
+            EMIT(as, 0x00);
+            emit_conditional_jump(as, code[0] - i_ifeq,
+                                  pc + (int16_t) ((code[1] << 8) | code[2]));
+            break;
+        case i_if_icmpeq:
+        case i_if_icmpne:
+        case i_if_icmplt:
+        case i_if_icmpge:
+        case i_if_icmpgt:
+        case i_if_icmple:
+            emit_load(as, RAX, top - 1);
+            EMIT(as, 0x3b);
+            emit_frame_operand(as, RAX, top);
+            emit_conditional_jump(as, code[0] - i_if_icmpeq,
+                                  pc + (int16_t) ((code[1] << 8) | code[2]));
+            break;
+        case i_goto:
+            emit_jump(as, (const u1[]){0xe9}, 1, pc + (int16_t) ((code[1] << 8) | code[2]));
+            break;
+        case i_ireturn:
+            emit_load(as, RAX, top);
+            // pop %rbx; ret
+            EMIT(as, 0x5b, 0xc3);
+            break;
+        case i_return:
+            EMIT(as, 0x5b, 0xc3);
+            break;
+        case i_invokestatic: {
+            resolved_method_t *resolved =
+                resolve_method(runtime, (uint16_t) ((code[1] << 8) | code[2]));
+            method_t *callee = resolved->method;
+            // The arguments on the operand stack become the callee's first locals
+            size_t callee_locals = top + 1 - resolved->num_parameters;
+            jit_method_t *callee_jit =
+                &runtime->jit_methods[callee - runtime->class->methods];
+            if (callee == method) {
+                // Recursive calls go straight to the start of this code
+                emit_frame_address(as, RDI, callee_locals);
+                EMIT(as, 0xe8);
+                emit_int32(as, -(int32_t) (as->length + sizeof(int32_t)));
+            }
+            else if (callee_jit->native != NULL) {
+                emit_frame_address(as, RDI, callee_locals);
+                emit_call_address(as, (uintptr_t) callee_jit->native);
+            }
+            else {
+                emit_move_immediate(as, RDI, (uintptr_t) runtime);
+                emit_move_immediate(as, RSI, (uintptr_t) callee);
+                emit_frame_address(as, RDX, callee_locals);
+                emit_call_address(as, (uintptr_t) jit_invoke);
+            }
+            if (returns_value(callee->descriptor)) {
+                emit_store(as, callee_locals, RAX);
+            }
+            break;
+        }
+        default:
+            assert(false && "Instruction not supported by the JIT");
+    }
+}
+
+/**
+ * Compiles a method to x86-64 machine code, if it only takes and returns ints
+ * and only uses instructions that operate on ints. Arrays and printing are left
+ * to the interpreters, and so are methods that call methods using references.
+ *
+ * The compiled code uses the same frame layout as the interpreters: each local
+ * and operand stack entry stays in its slot on the JVM stack (addressed from
+ * `%rbx`), and callees' frames start at their arguments. So compiled and
+ * interpreted methods can call each other, and the heap still finds every root.
+ *
+ * @param runtime the runtime whose class the method belongs to
+ * @param method the method to compile
+ * @param jit the method's JIT bookkeeping, which is filled in if it is compiled
+ * @return whether the method was compiled
+ */
+static bool jit_compile(runtime_t *runtime, method_t *method, jit_method_t *jit) {
+    if (!is_int_only(method->descriptor)) {
+        return false;
+    }
+    const code_t *code = &method->code;
+    int32_t *depths = malloc(sizeof(int32_t) * code->code_length);
+    assert(depths != NULL);
+    if (!jit_stack_depths(runtime, method, depths)) {
+        free(depths);
+        return false;
+    }
+
+    assembler_t as = {
+        .capacity = METHOD_OVERHEAD_CODE + MAX_INSTRUCTION_CODE * code->code_length,
+        .labels = malloc(sizeof(size_t) * (code->code_length + LABEL_COUNT)),
+        .fixups = malloc(sizeof(fixup_t) * (code->code_length + 1)),
+    };
+    as.code = malloc(as.capacity);
+    assert(as.code != NULL && as.labels != NULL && as.fixups != NULL);
+
+    // push %rbx; mov %rdi, %rbx
+    EMIT(&as, 0x53, 0x48, 0x89, 0xfb);
+    // Check that the frame fits in the JVM stack, like `check_frame()`
+    emit_frame_address(&as, RAX, code->max_locals + code->max_stack);
+    emit_move_immediate(&as, RCX, (uintptr_t) runtime->frames_end);
+    // cmp %rcx, %rax; ja stack_overflow
+    EMIT(&as, 0x48, 0x39, 0xc8);
+    emit_jump(&as, (const u1[]){0x0f, 0x87}, 2, code->code_length + STACK_OVERFLOW_LABEL);
+
+    for (size_t pc = 0; pc < code->code_length; pc += INSTRUCTION_LENGTHS[code->code[pc]]) {
+        as.labels[pc] = as.length;
+        // Unreachable instructions are skipped, since nothing jumps to them
+        if (depths[pc] >= 0) {
+            jit_instruction(runtime, method, &as, pc,
+                            code->max_locals + depths[pc] - 1);
+        }
+        else if (INSTRUCTION_LENGTHS[code->code[pc]] == 0) {
+            break;
+        }
+    }
+    // Falling off the end of the method returns void, as in the interpreters
+    EMIT(&as, 0x5b, 0xc3);
+    as.labels[code->code_length + STACK_OVERFLOW_LABEL] = as.length;
+    emit_call_address(&as, (uintptr_t) jit_stack_overflow);
+    as.labels[code->code_length + DIVISION_BY_ZERO_LABEL] = as.length;
+    emit_call_address(&as, (uintptr_t) jit_division_by_zero);
+
+    for (size_t i = 0; i < as.fixup_count; i++) {
+        fixup_t *fixup = &as.fixups[i];
+        int32_t displacement =
+            as.labels[fixup->label] - (fixup->offset + sizeof(int32_t));
+        memcpy(&as.code[fixup->offset], &displacement, sizeof(displacement));
+    }
+
+    /* The generated code is position-independent, so it can be copied into
+     * its own mapping, which is made executable and never written again. */
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t size = (as.length + page_size - 1) / page_size * page_size;
+    void *native = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                        -1, 0);
+    assert(native != MAP_FAILED && "Failed to map JIT code");
+    memcpy(native, as.code, as.length);
+    int error = mprotect(native, size, PROT_READ | PROT_EXEC);
+    assert(error == 0 && "Failed to make JIT code executable");
+
+    jit->native = (native_method_t) native;
+    jit->native_size = size;
+    jit->returns_value = returns_value(method->descriptor);
+    free(as.code);
+    free(as.labels);
+    free(as.fixups);
+    free(depths);
+    return true;
+}
+
+/**
+ * Invokes a method, running its compiled code if the JIT has compiled it
+ * and interpreting it otherwise. With the JIT enabled, a method is compiled
+ * once it has been invoked `JIT_THRESHOLD` times.
+ * When profiling, this also counts and times the invocation.
+ *
+ * @param runtime the class being run and its heap and JVM stack
+ * @param method the method to invoke
+ * @param locals the start of the method's frame on the JVM stack,
+ *   which starts with the method's parameters
+ * @return an optional int containing the method's return value
+ */
+optional_value_t invoke_method(runtime_t *runtime, method_t *method, int32_t *locals) {
+    check_frame(runtime, locals, method);
+    size_t index = method - runtime->class->methods;
+    method_profile_t *profile = NULL;
+    if (runtime->profile != NULL) {
+        profile = &runtime->profile->methods[index];
+        profile->invocations++;
+        if (profile->active++ == 0) {
+            profile->start = __rdtsc();
+        }
+    }
+
+    optional_value_t result;
+    jit_method_t *jit = runtime->jit_methods != NULL ? &runtime->jit_methods[index] : NULL;
+    if (jit != NULL && jit->native == NULL && !jit->uncompilable &&
+        ++jit->invocations >= JIT_THRESHOLD) {
+        jit->uncompilable = !jit_compile(runtime, method, jit);
+    }
+    if (jit != NULL && jit->native != NULL) {
+        result.has_value = jit->returns_value;
+        result.value = jit->native(locals);
+    }
+    else if (runtime->interpreter == THREADED_INTERPRETER) {
+        result = execute_threaded(method, locals, runtime);
+    }
+    else if (profile != NULL) {
+        result = execute_profiled(method, locals, runtime);
+    }
+    else {
+        result = execute(method, locals, runtime);
+    }
+
+    if (profile != NULL && --profile->active == 0) {
+        profile->cycles += __rdtsc() - profile->start;
+    }
+    return result;
+}
+
+/** A line of the profile report */
+typedef struct {
+    /** The statistic the report is sorted by */
+    uint64_t count;
+    /** The opcode or the index of the method the line is about */
+    size_t index;
+    /** The bytecode offset of the branch the line is about */
+    size_t pc;
+} profile_entry_t;
+
+/** Orders profile entries by decreasing `count` */
+static int compare_profile_entries(const void *a, const void *b) {
+    uint64_t count_a = ((const profile_entry_t *) a)->count;
+    uint64_t count_b = ((const profile_entry_t *) b)->count;
+    return (count_a < count_b) - (count_a > count_b);
+}
+
+/**
+ * Prints the statistics collected by `--profile` to stderr: every executed opcode
+ * by execution count, every invoked method by inclusive cycles,
+ * and the `PROFILE_BRANCH_SITES` most executed branches with how often they jumped.
+ *
+ * @param runtime the runtime that collected the profile
+ * @param method_count the number of methods in the class
+ */
+void print_profile(runtime_t *runtime, size_t method_count) {
+    profile_t *profile = runtime->profile;
+    method_t *methods = runtime->class->methods;
+
+    profile_entry_t opcodes[UINT8_MAX + 1];
+    size_t opcode_count = 0;
+    uint64_t instructions = 0;
+    for (size_t opcode = 0; opcode <= UINT8_MAX; opcode++) {
+        if (profile->opcode_counts[opcode] > 0) {
+            opcodes[opcode_count++] = (profile_entry_t){
+                .count = profile->opcode_counts[opcode],
+                .index = opcode,
+            };
+            instructions += profile->opcode_counts[opcode];
+        }
+    }
+    qsort(opcodes, opcode_count, sizeof(profile_entry_t), compare_profile_entries);
+    fprintf(stderr, "Opcodes (%" PRIu64 " instructions executed):\n", instructions);
+    for (size_t i = 0; i < opcode_count; i++) {
+        fprintf(stderr, "  %-14s %14" PRIu64 " %6.2f%%\n", OPCODE_NAMES[opcodes[i].index],
+                opcodes[i].count, 100.0 * opcodes[i].count / instructions);
+    }
+
+    profile_entry_t *entries = malloc(sizeof(profile_entry_t) * method_count);
+    assert(entries != NULL);
+    size_t entry_count = 0;
+    size_t branch_capacity = 0;
+    for (size_t i = 0; i < method_count; i++) {
+        if (profile->methods[i].invocations > 0) {
+            entries[entry_count++] =
+                (profile_entry_t){.count = profile->methods[i].cycles, .index = i};
+        }
+        if (profile->methods[i].branches != NULL) {
+            branch_capacity += methods[i].code.code_length;
+        }
+    }
+    qsort(entries, entry_count, sizeof(profile_entry_t), compare_profile_entries);
+    fprintf(stderr, "\nMethods (by inclusive cycles):\n");
+    for (size_t i = 0; i < entry_count; i++) {
+        method_profile_t *method = &profile->methods[entries[i].index];
+        fprintf(stderr, "  %14" PRIu64 " cycles %12" PRIu64 " calls %12" PRIu64
+                        " cycles/call  %s%s\n",
+                method->cycles, method->invocations, method->cycles / method->invocations,
+                methods[entries[i].index].name, methods[entries[i].index].descriptor);
+    }
+    free(entries);
+
+    entries = malloc(sizeof(profile_entry_t) * branch_capacity);
+    assert(branch_capacity == 0 || entries != NULL);
+    entry_count = 0;
+    for (size_t i = 0; i < method_count; i++) {
+        branch_profile_t *branches = profile->methods[i].branches;
+        if (branches == NULL) {
+            continue;
+        }
+        for (size_t pc = 0; pc < methods[i].code.code_length; pc++) {
+            uint64_t executions = branches[pc].taken + branches[pc].not_taken;
+            if (executions > 0) {
+                entries[entry_count++] =
+                    (profile_entry_t){.count = executions, .index = i, .pc = pc};
+            }
+        }
+    }
+    qsort(entries, entry_count, sizeof(profile_entry_t), compare_profile_entries);
+    fprintf(stderr, "\nBranches (by executions):\n");
+    for (size_t i = 0; i < entry_count && i < PROFILE_BRANCH_SITES; i++) {
+        method_t *method = &methods[entries[i].index];
+        branch_profile_t *branch =
+            &profile->methods[entries[i].index].branches[entries[i].pc];
+        fprintf(stderr, "  %14" PRIu64 " executions %6.2f%% taken  %s%s @ %zu (%s)\n",
+                entries[i].count, 100.0 * branch->taken / entries[i].count, method->name,
+                method->descriptor, entries[i].pc,
+                OPCODE_NAMES[method->code.code[entries[i].pc]]);
+    }
+    free(entries);
+}
+
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "USAGE: %s <class file>\n", argv[0]);
+    interpreter_t interpreter = SWITCH_INTERPRETER;
+    bool show_fusions = false;
+    bool jit = false;
+    bool profile = false;
+    int arg = 1;
+    for (; arg < argc - 1; arg++) {
+        if (strcmp(argv[arg], THREADED_FLAG) == 0) {
+            interpreter = THREADED_INTERPRETER;
+        }
+        else if (strcmp(argv[arg], FUSION_STATS_FLAG) == 0) {
+            show_fusions = true;
+        }
+        else if (strcmp(argv[arg], JIT_FLAG) == 0) {
+            jit = true;
+        }
+        else if (strcmp(argv[arg], PROFILE_FLAG) == 0) {
+            profile = true;
+        }
+        else {
+            break;
+        }
+    }
+    if (arg != argc - 1) {
+        fprintf(stderr, "USAGE: %s [%s | %s] [%s] [%s] <class file>\n", argv[0],
+                THREADED_FLAG, PROFILE_FLAG, FUSION_STATS_FLAG, JIT_FLAG);
+        return 1;
+    }
+    // Only the switch interpreter records opcodes and branches
+    if (profile && (interpreter == THREADED_INTERPRETER || jit)) {
+        fprintf(stderr, "%s can't be combined with %s or %s\n", PROFILE_FLAG,
+                THREADED_FLAG, JIT_FLAG);
         return 1;
     }
 
     // Open the class file for reading
-    FILE *class_file = fopen(argv[1], "r");
+    FILE *class_file = fopen(argv[argc - 1], "r");
     assert(class_file != NULL && "Failed to open file");
 
     // Parse the class file
@@ -542,20 +2124,80 @@ int main(int argc, char *argv[]) {
     int error = fclose(class_file);
     assert(error == 0 && "Failed to close file");
 
-    // The heap array is initially allocated to hold zero elements.
     heap_t *heap = heap_init();
 
     // Execute the main method
     method_t *main_method = find_method(MAIN_METHOD, MAIN_DESCRIPTOR, class);
     assert(main_method != NULL && "Missing main() method");
+    size_t constant_count = 0;
+    while (class->constant_pool[constant_count].info != NULL) {
+        constant_count++;
+    }
+    size_t method_count = 0;
+    while (class->methods[method_count].name != NULL) {
+        method_count++;
+    }
+    runtime_t runtime = {
+        .class = class,
+        .heap = heap,
+        .frames = malloc(sizeof(int32_t) * FRAME_STACK_SIZE),
+        // Constant pool indices are 1-based
+        .resolved_methods = calloc(constant_count + 1, sizeof(resolved_method_t)),
+        .decoded_methods = calloc(method_count, sizeof(decoded_method_t *)),
+        .interpreter = interpreter,
+        .jit_methods = jit ? calloc(method_count, sizeof(jit_method_t)) : NULL,
+        .profile = profile ? calloc(1, sizeof(profile_t)) : NULL,
+    };
+    assert(runtime.frames != NULL);
+    assert(runtime.resolved_methods != NULL);
+    assert(runtime.decoded_methods != NULL);
+    assert(!jit || runtime.jit_methods != NULL);
+    if (profile) {
+        assert(runtime.profile != NULL);
+        runtime.profile->methods = calloc(method_count, sizeof(method_profile_t));
+        assert(runtime.profile->methods != NULL);
+    }
+    runtime.frames_end = runtime.frames + FRAME_STACK_SIZE;
+
     /* In a real JVM, locals[0] would contain a reference to String[] args.
      * But since TeenyJVM doesn't support Objects, we leave it uninitialized. */
-    int32_t locals[main_method->code.max_locals];
+    int32_t *locals = runtime.frames;
+    check_frame(&runtime, locals, main_method);
     // Initialize all local variables to 0
-    memset(locals, 0, sizeof(locals));
-    optional_value_t result = execute(main_method, locals, class, heap);
+    memset(locals, 0, sizeof(int32_t) * main_method->code.max_locals);
+    optional_value_t result = invoke_method(&runtime, main_method, locals);
     assert(!result.has_value && "main() should return void");
 
+    if (profile) {
+        print_profile(&runtime, method_count);
+        for (size_t i = 0; i < method_count; i++) {
+            free(runtime.profile->methods[i].branches);
+        }
+        free(runtime.profile->methods);
+        free(runtime.profile);
+    }
+
+    // Free the decoded and compiled methods and the JVM stack
+    for (size_t i = 0; i < method_count; i++) {
+        if (jit && runtime.jit_methods[i].native != NULL) {
+            jit_method_t *compiled = &runtime.jit_methods[i];
+            munmap((void *) compiled->native, compiled->native_size);
+        }
+        if (runtime.decoded_methods[i] != NULL) {
+            if (show_fusions) {
+                fprintf(stderr, "%s%s: %zu superinstructions\n", class->methods[i].name,
+                        class->methods[i].descriptor,
+                        runtime.decoded_methods[i]->fusion_count);
+            }
+            free(runtime.decoded_methods[i]->instructions);
+            free(runtime.decoded_methods[i]);
+        }
+    }
+    free(runtime.decoded_methods);
+    free(runtime.jit_methods);
+    free(runtime.resolved_methods);
+    free(runtime.frames);
+
     // Free the internal data structures
     free_class(class);
 
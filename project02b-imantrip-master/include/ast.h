@@ -18,6 +18,17 @@ typedef char var_name_t;
 /** The type of a TeenyBASIC value */
 typedef int64_t value_t;
 
+/**
+ * Multiplies `left` by 2 to the power of `right` (a left shift).
+ * Only `optimize_ast()` produces this; `right` is a NUM node from 1 to 62.
+ */
+#define SHIFT_LEFT_OP 'L'
+/**
+ * Divides `left` by 2 to the power of `right`, rounding toward 0 like '/' does.
+ * Only `optimize_ast()` produces this; `right` is a NUM node from 1 to 62.
+ */
+#define SHIFT_RIGHT_OP 'R'
+
 /** The base struct for all nodes */
 typedef struct {
     /**
@@ -44,7 +55,10 @@ typedef struct {
  */
 typedef struct {
     node_t base;
-    /** The operator, either '+', '-', '*', '/', '<', '=', or '> */
+    /**
+     * The operator, either '+', '-', '*', '/', '<', '=', or '>',
+     * or `SHIFT_LEFT_OP` or `SHIFT_RIGHT_OP` after optimization
+     */
     char op;
     /** The left-hand side of the expression */
     node_t *left;
@@ -122,7 +136,13 @@ node_t *init_binary_node(char op, node_t *left, node_t *right);
 /** Constructs a var_node_t */
 node_t *init_var_node(var_name_t name);
 
-/** Constructs a sequence_node_t */
+/**
+ * Constructs a sequence_node_t.
+ *
+ * @param statement_count the number of statements
+ * @param statements a heap-allocated array of the statements, which the node takes ownership of.
+ *   In arena mode, the statements are copied into the node and the array is freed.
+ */
 node_t *init_sequence_node(size_t statement_count, node_t **statements);
 
 /** Constructs a print_node_t */
@@ -137,9 +157,22 @@ node_t *init_if_node(binary_node_t *condition, node_t *if_branch, node_t *else_b
 /** Constructs a while_node_t */
 node_t *init_while_node(binary_node_t *condition, node_t *body);
 
-/** Frees an AST node and all its descendants */
+/**
+ * Frees an AST node and all its descendants.
+ * Does nothing in arena mode, since arena nodes are only freed by `ast_arena_free()`.
+ */
 void free_ast(node_t *node);
 
+/**
+ * Starts arena mode, where the `init_*_node()` functions bump-allocate nodes
+ * from large chunks instead of calling malloc() for each one.
+ * Nodes allocated before arena mode must not be freed until it ends.
+ */
+void ast_arena_begin(void);
+
+/** Frees every node allocated in arena mode at once and ends arena mode */
+void ast_arena_free(void);
+
 /** Prints a string representation of an AST node to stderr */
 void print_ast(node_t *node);
 
@@ -2,9 +2,21 @@
 #define COMPILE_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #include "ast.h"
 
+/** A TeenyBASIC program compiled to machine code in memory */
+typedef struct {
+    /** Runs the program */
+    void (*basic_main)(void);
+    /** The executable memory holding the machine code */
+    void *code;
+    /** The number of bytes of machine code */
+    size_t size;
+} jit_program_t;
+
 /**
  * Prints x86-64 assembly code that implements the given TeenyBASIC AST.
  *
@@ -14,4 +26,22 @@
  */
 bool compile_ast(node_t *node);
 
+/**
+ * Compiles a TeenyBASIC AST straight to x86-64 machine code in memory,
+ * with the same instructions `compile_ast()` prints, so it can run in-process.
+ *
+ * @param node the statement to compile, as for `compile_ast()`
+ * @param print_int the function PRINT statements call
+ * @return the compiled program, to free with `free_jit_program()`,
+ *   or NULL if compilation fails
+ */
+jit_program_t *compile_ast_jit(node_t *node, void (*print_int)(int64_t));
+
+/**
+ * Frees a program compiled by `compile_ast_jit()`, including its machine code.
+ *
+ * @param program the program to free
+ */
+void free_jit_program(jit_program_t *program);
+
 #endif /* COMPILE_H */
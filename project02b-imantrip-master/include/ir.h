@@ -0,0 +1,146 @@
+#ifndef IR_H
+#define IR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "ast.h"
+
+/**
+ * A virtual register. Registers 0 to 25 hold the TeenyBASIC variables A to Z
+ * and may be assigned any number of times. The registers after them hold
+ * temporary values of expressions; each is assigned once and used in the same block.
+ */
+typedef size_t ir_register_t;
+
+/** The number of virtual registers that hold variables */
+#define IR_VARIABLE_COUNT 26
+
+/** The virtual register holding a TeenyBASIC variable */
+#define IR_VARIABLE(name) ((ir_register_t) ((name) - 'A'))
+
+/** An input to an instruction: either a virtual register or a constant */
+typedef struct {
+    bool is_constant;
+    /** The register the value is in, if it isn't constant */
+    ir_register_t reg;
+    /** The value, if it is constant */
+    value_t value;
+} ir_operand_t;
+
+typedef enum {
+    /** `dest = left` */
+    IR_COPY,
+    /** `dest = left op right`, where `op` is an operator of `binary_node_t` */
+    IR_BINARY,
+    /** `print_int(left)` */
+    IR_PRINT
+} ir_opcode_t;
+
+/** A three-address instruction */
+typedef struct {
+    ir_opcode_t opcode;
+    /** The operator of an IR_BINARY instruction */
+    char op;
+    /** The register written by an IR_COPY or IR_BINARY instruction */
+    ir_register_t dest;
+    ir_operand_t left;
+    /** The right operand of an IR_BINARY instruction */
+    ir_operand_t right;
+} ir_instruction_t;
+
+typedef enum {
+    /** Continue at `target` */
+    IR_JUMP,
+    /** Continue at `target` if `left op right`, otherwise at `else_target` */
+    IR_BRANCH,
+    /** Return from `basic_main()` */
+    IR_RETURN
+} ir_terminator_type_t;
+
+/** The control flow at the end of a basic block */
+typedef struct {
+    ir_terminator_type_t type;
+    /** The comparison ('<', '=', or '>') of an IR_BRANCH */
+    char op;
+    ir_operand_t left;
+    ir_operand_t right;
+    /** The index of the block to continue at (if the comparison holds) */
+    size_t target;
+    /** The index of the block an IR_BRANCH continues at if the comparison fails */
+    size_t else_target;
+} ir_terminator_t;
+
+/** A straight-line sequence of instructions, ending in a jump, branch, or return */
+typedef struct {
+    ir_instruction_t *instructions;
+    size_t instruction_count;
+    size_t instruction_capacity;
+    ir_terminator_t terminator;
+    /** The number of WHILE loops the block is in */
+    size_t loop_depth;
+} ir_block_t;
+
+/**
+ * A whole TeenyBASIC program in three-address form.
+ * Block 0 runs first, and the blocks are laid out in order,
+ * so a jump to the next block can fall through.
+ */
+typedef struct {
+    ir_block_t *blocks;
+    size_t block_count;
+    size_t block_capacity;
+    /** The number of virtual registers used, including the variable registers */
+    size_t register_count;
+} ir_function_t;
+
+/**
+ * Lowers a TeenyBASIC AST into three-address code.
+ * The first block sets every variable to 0.
+ *
+ * @param node the program's statement (a SEQUENCE, PRINT, LET, IF, or WHILE)
+ * @return the lowered program, or NULL if the AST is invalid
+ */
+ir_function_t *ir_lower(node_t *node);
+
+/**
+ * Optimizes three-address code in place, with copy propagation
+ * within each block and global dead-code elimination.
+ *
+ * @param function the program to optimize
+ */
+void ir_optimize(ir_function_t *function);
+
+/**
+ * Computes which virtual registers are live at the start and end of each block.
+ *
+ * @param function the program to analyze
+ * @param live_in set to an array with `register_count` flags for each block,
+ *   indexed by `block * register_count + reg`, which the caller must free
+ * @param live_out likewise, for the end of each block
+ */
+void ir_liveness(ir_function_t *function, bool **live_in, bool **live_out);
+
+/**
+ * Checks whether an instruction might crash the program (i.e. it might
+ * divide by 0 or INT64_MIN by -1), so it must run even if its result is unused.
+ */
+bool ir_may_trap(const ir_instruction_t *instruction);
+
+/**
+ * Prints three-address code in a readable form, for debugging.
+ *
+ * @param function the program to print
+ * @param stream the file to print to
+ */
+void print_ir(ir_function_t *function, FILE *stream);
+
+/**
+ * Frees three-address code.
+ *
+ * @param function a program returned by `ir_lower()`
+ */
+void free_ir(ir_function_t *function);
+
+#endif /* IR_H */
@@ -0,0 +1,28 @@
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+
+#include "ast.h"
+
+/**
+ * Simplifies a TeenyBASIC AST before it is compiled, without changing what it prints.
+ * This folds constant subexpressions, simplifies identities like `x + 0`, `x * 1`,
+ * and `x * 0`, replaces multiplying and dividing by powers of two with shifts,
+ * and propagates constants assigned by LET statements until the variable
+ * might be reassigned. IF and WHILE statements whose conditions become constant
+ * are replaced by the branch that runs.
+ *
+ * WHILE loops are then optimized using variables the program doesn't use.
+ * Loop-invariant subexpressions are computed into new variables before the loop,
+ * and products `I * k` of an induction variable `I` (updated once per iteration
+ * by `LET I = I + c`) and an invariant `k` become new variables that are
+ * incremented by `c * k` whenever `I` is updated.
+ *
+ * Every variable is assumed to start out as 0, as in `compile_ast()`.
+ *
+ * @param node the statement to optimize, which the optimizer takes ownership of.
+ *   Any nodes that are no longer needed are freed.
+ * @return the optimized statement
+ */
+node_t *optimize_ast(node_t *node);
+
+#endif /* OPTIMIZE_H */
@@ -1,11 +1,57 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#include <stdbool.h>
 #include <stdio.h>
 
 #include "ast.h"
 
-/** Parses the next statement from the provided TeenyBASIC file into an AST */
+/**
+ * Parses TeenyBASIC source code held in memory, one statement at a time.
+ * The tokenizer scans the source directly, so there is no per-character I/O.
+ */
+typedef struct parser parser_t;
+
+/**
+ * Creates a parser for source code that is already in memory.
+ *
+ * @param source the source code, which doesn't need to be NUL-terminated
+ *   and must not be freed until the parser is
+ * @param length the number of bytes of source code
+ * @return a heap-allocated parser, to free with `parser_free()`
+ */
+parser_t *parser_init_buffer(const char *source, size_t length);
+
+/**
+ * Creates a parser for the rest of a file.
+ * Regular files are memory-mapped; other streams (e.g. pipes)
+ * are read into memory in large blocks.
+ * The stream can be closed once the parser is created.
+ *
+ * @param stream the file to parse
+ * @return a heap-allocated parser, to free with `parser_free()`
+ */
+parser_t *parser_init_file(FILE *stream);
+
+/**
+ * Parses the next statement into an AST.
+ *
+ * @param parser the parser to read from
+ * @return the statement, or NULL at the end of the source or on a parse error
+ */
+node_t *parser_next(parser_t *parser);
+
+/** Checks whether the parser stopped because of a parse error (which it printed to stderr) */
+bool parser_failed(parser_t *parser);
+
+/** Frees a parser (but not the ASTs it returned) */
+void parser_free(parser_t *parser);
+
+/**
+ * Parses the next statement from the provided TeenyBASIC file into an AST.
+ * The first call on a stream reads the rest of it with `parser_init_file()`,
+ * so the stream must not be read otherwise until this returns NULL.
+ */
 node_t *parse(FILE *stream);
 
 #endif /* PARSER_H */
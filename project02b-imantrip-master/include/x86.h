@@ -0,0 +1,158 @@
+#ifndef X86_H
+#define X86_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** The x86-64 general-purpose registers, numbered as in their encodings */
+typedef enum {
+    RAX,
+    RCX,
+    RDX,
+    RBX,
+    RSP,
+    RBP,
+    RSI,
+    RDI,
+    R8,
+    R9,
+    R10,
+    R11,
+    R12,
+    R13,
+    R14,
+    R15
+} x86_register_t;
+
+typedef enum {
+    /** A register */
+    X86_REGISTER,
+    /** The memory at `offset(%rbp)` */
+    X86_STACK_SLOT,
+    /** A constant */
+    X86_IMMEDIATE
+} x86_operand_type_t;
+
+/** An instruction operand */
+typedef struct {
+    x86_operand_type_t type;
+    x86_register_t reg;
+    int32_t offset;
+    int64_t immediate;
+} x86_operand_t;
+
+typedef enum { X86_ADD, X86_SUB, X86_IMUL, X86_CMP } x86_arithmetic_t;
+
+typedef enum { X86_SHL, X86_SHR, X86_SAR } x86_shift_t;
+
+/** Conditions for jumps and `setcc`, numbered as in their encodings */
+typedef enum {
+    X86_EQUAL = 0x4,
+    X86_NOT_EQUAL = 0x5,
+    X86_LESS = 0xC,
+    X86_GREATER_EQUAL = 0xD,
+    X86_LESS_EQUAL = 0xE,
+    X86_GREATER = 0xF,
+    /** An unconditional jump */
+    X86_ALWAYS = 0x10
+} x86_condition_t;
+
+/**
+ * Emits x86-64 instructions, either as AT&T-syntax assembly printed to stdout
+ * or as machine code in memory. Labels are numbered by the caller.
+ */
+typedef struct assembler assembler_t;
+
+/**
+ * Creates an assembler that prints assembly code to stdout.
+ *
+ * @return a heap-allocated assembler, to free with `assembler_free()`
+ */
+assembler_t *assembler_init_text(void);
+
+/**
+ * Creates an assembler that encodes machine code into a buffer.
+ *
+ * @param print_int the function for `x86_call_print_int()` to call
+ * @return a heap-allocated assembler, to free with `assembler_free()`
+ */
+assembler_t *assembler_init_binary(void (*print_int)(int64_t));
+
+static inline x86_operand_t x86_reg(x86_register_t reg) {
+    return (x86_operand_t) {.type = X86_REGISTER, .reg = reg};
+}
+
+static inline x86_operand_t x86_stack_slot(int32_t offset) {
+    return (x86_operand_t) {.type = X86_STACK_SLOT, .offset = offset};
+}
+
+static inline x86_operand_t x86_immediate(int64_t immediate) {
+    return (x86_operand_t) {.type = X86_IMMEDIATE, .immediate = immediate};
+}
+
+/** Checks whether a value can be used as a (sign-extended 32-bit) immediate */
+static inline bool x86_fits_immediate(int64_t value) {
+    return INT32_MIN <= value && value <= INT32_MAX;
+}
+
+/** Checks whether two operands are the same register or stack slot */
+bool x86_same_location(x86_operand_t operand1, x86_operand_t operand2);
+
+/**
+ * `movq source, destination`, or `movabsq` for an immediate that doesn't fit
+ * in 32 bits (which needs a register destination).
+ * At most one of the operands can be a stack slot.
+ */
+void x86_mov(assembler_t *assembler, x86_operand_t source, x86_operand_t destination);
+
+/**
+ * `addq`, `subq`, `imulq`, or `cmpq` with a register destination.
+ * An immediate source must fit in 32 bits.
+ */
+void x86_arithmetic(assembler_t *assembler, x86_arithmetic_t op, x86_operand_t source,
+                    x86_register_t destination);
+
+/** Shifts a register by a constant amount (from 1 to 63) */
+void x86_shift(assembler_t *assembler, x86_shift_t op, uint8_t amount,
+               x86_register_t destination);
+
+/** `cqto` then `idivq divisor`, dividing `%rax` (the divisor can't be an immediate) */
+void x86_divide(assembler_t *assembler, x86_operand_t divisor);
+
+/** Sets `%rax` to 1 if a condition holds after a comparison, otherwise 0 */
+void x86_set_condition(assembler_t *assembler, x86_condition_t condition);
+
+/** Jumps to a label if a condition holds (or always, for `X86_ALWAYS`) */
+void x86_jump(assembler_t *assembler, x86_condition_t condition, size_t label);
+
+/** Defines a label at the current position */
+void x86_label(assembler_t *assembler, size_t label);
+
+/** Calls `print_int()`, with the argument in `%rdi` */
+void x86_call_print_int(assembler_t *assembler);
+
+void x86_push(assembler_t *assembler, x86_register_t reg);
+void x86_pop(assembler_t *assembler, x86_register_t reg);
+
+/** `leaq offset(%rbp), destination` */
+void x86_load_address(assembler_t *assembler, int32_t offset, x86_register_t destination);
+
+/** `leave` then `ret` */
+void x86_leave_return(assembler_t *assembler);
+
+/**
+ * Finishes assembling machine code, copying it into executable memory.
+ * All jumps are resolved, so every label they target must be defined.
+ * Does nothing for a text assembler.
+ *
+ * @param assembler the assembler to finish
+ * @param size set to the number of bytes of machine code
+ * @return the code, which must be freed with `munmap()`, or NULL on failure
+ */
+void *assembler_finish(assembler_t *assembler, size_t *size);
+
+/** Frees an assembler (but not the code returned by `assembler_finish()`) */
+void assembler_free(assembler_t *assembler);
+
+#endif /* X86_H */
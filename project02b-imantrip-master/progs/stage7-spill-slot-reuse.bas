@@ -0,0 +1,26 @@
+    # Keeps more variables live than there are registers, so some are spilled
+    # and a spilled variable's stack slot is freed and handed to another one
+
+#15001130
+LET X = 0
+WHILE X < 3
+    LET X = X + 1
+END WHILE
+LET A = X * 5
+LET B = X + 11
+LET C = X + 12
+LET D = X + 13
+LET E = X + 14
+LET F = X + 15
+LET G = X + 16
+LET H = X + 17
+LET I = X + 18
+LET J = X + 19
+LET K = X + 20
+LET S = A + B
+LET Z = S * 7
+LET N = Z + 2
+WHILE N < 1000
+    LET N = N + B + C + D + E + F + G + H + I + J + K
+END WHILE
+PRINT N + A * 1000000
@@ -0,0 +1,135 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ast.h"
+#include "parser.h"
+
+// The number of seconds in a nanosecond
+const double SEC_PER_NS = 1e-9;
+// The number of bytes in a megabyte
+const double BYTES_PER_MB = 1e6;
+// The programs are repeated until the input is at least this many bytes
+const size_t MIN_INPUT_SIZE = 32 * 1000 * 1000;
+
+// Where a benchmark run reads the source code from
+typedef enum { FROM_BUFFER, FROM_FILE, FROM_STREAM } source_t;
+
+const char *SOURCE_NAMES[] = {
+    [FROM_BUFFER] = "in-memory buffer",
+    [FROM_FILE] = "memory-mapped file",
+    [FROM_STREAM] = "buffered stream",
+};
+
+char *read_file(const char *path, size_t *length) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        exit(1);
+    }
+    fseek(file, 0, SEEK_END);
+    *length = ftell(file);
+    rewind(file);
+    char *contents = malloc(*length);
+    assert(contents != NULL);
+    size_t read = fread(contents, 1, *length, file);
+    assert(read == *length);
+    fclose(file);
+    return contents;
+}
+
+// Parses the whole input once, returning the number of top-level statements
+size_t parse_all(source_t source, char *input, size_t length, FILE *file) {
+    FILE *stream = NULL;
+    parser_t *parser;
+    if (source == FROM_BUFFER) {
+        parser = parser_init_buffer(input, length);
+    }
+    else if (source == FROM_FILE) {
+        rewind(file);
+        parser = parser_init_file(file);
+    }
+    else {
+        // A memory stream has no file descriptor, so it can't be memory-mapped
+        stream = fmemopen(input, length, "r");
+        assert(stream != NULL);
+        parser = parser_init_file(stream);
+    }
+
+    ast_arena_begin();
+    size_t statement_count = 0;
+    while (parser_next(parser) != NULL) {
+        statement_count++;
+    }
+    assert(!parser_failed(parser));
+    ast_arena_free();
+    parser_free(parser);
+    if (stream != NULL) {
+        fclose(stream);
+    }
+    return statement_count;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "USAGE: %s <program file>...\n", argv[0]);
+        return 1;
+    }
+
+    // Concatenate the programs, repeating them to make a large input
+    size_t length = 0, capacity = MIN_INPUT_SIZE;
+    char *input = malloc(capacity);
+    assert(input != NULL);
+    while (length < MIN_INPUT_SIZE) {
+        for (int i = 1; i < argc; i++) {
+            size_t program_length;
+            char *program = read_file(argv[i], &program_length);
+            if (length + program_length + 1 > capacity) {
+                capacity = 2 * (length + program_length + 1);
+                input = realloc(input, capacity);
+                assert(input != NULL);
+            }
+            memcpy(input + length, program, program_length);
+            length += program_length;
+            input[length++] = '\n';
+            free(program);
+        }
+    }
+    FILE *file = tmpfile();
+    assert(file != NULL);
+    size_t written = fwrite(input, 1, length, file);
+    assert(written == length);
+    fflush(file);
+
+    size_t expected_count = 0;
+    for (source_t source = FROM_BUFFER; source <= FROM_STREAM; source++) {
+        // Rerun the parser for at least a second and at least 3 times, keeping the fastest run
+        double duration_sum = 0, best_duration = 0;
+        size_t runs = 0;
+        while (duration_sum < 1.0 || runs < 3) {
+            struct timespec start, end;
+            clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+            size_t statement_count = parse_all(source, input, length, file);
+            clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end);
+            double duration =
+                end.tv_sec - start.tv_sec + (end.tv_nsec - start.tv_nsec) * SEC_PER_NS;
+
+            if (expected_count == 0) {
+                expected_count = statement_count;
+            }
+            assert(statement_count == expected_count);
+            if (runs == 0 || duration < best_duration) {
+                best_duration = duration;
+            }
+            duration_sum += duration;
+            runs++;
+        }
+        printf("%s: %.1f MB/s (%.1f MB, %zu statements, best of %zu runs)\n",
+               SOURCE_NAMES[source], length / BYTES_PER_MB / best_duration,
+               length / BYTES_PER_MB, expected_count, runs);
+    }
+    fclose(file);
+    free(input);
+}
@@ -1,6 +1,9 @@
+#define _GNU_SOURCE
 #include <assert.h>
 #include <inttypes.h>
 #include <math.h>
+#include <sched.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,32 +13,232 @@
 const double SEC_PER_NS = 1e-9;
 // The prefix of the executable name this will be compiled into
 const char TIME_EXECUTABLE_PREFIX[] = "bin/time-";
+// basic_main() is rerun for at least this many seconds and at least MIN_RUNS times
+const double MIN_TOTAL_DURATION = 1.0;
+const size_t MIN_RUNS = 3;
+// Each timed run calls basic_main() enough times to take at least this many seconds,
+// so programs faster than the clock's resolution still get meaningful samples
+const double MIN_RUN_DURATION = 1e-4;
+// The z-score of the confidence interval used to detect regressions (99%, two-sided)
+const double REGRESSION_Z_SCORE = 2.576;
+// The slowdown (as a fraction) that is tolerated by default before reporting a regression
+const double DEFAULT_TOLERANCE = 0.05;
+// The number of runs that the array of durations initially has room for
+const size_t INITIAL_DURATIONS_CAPACITY = 64;
 
 // basic_main() is the assembly function produced by the compiler
 void basic_main(void);
 
-double time_main(void) {
-    // Compute the amount of CPU time used by basic_main()
+// Settings from the command line
+typedef struct {
+    // The number of untimed calls to basic_main() before timing it
+    size_t warmup;
+    // CLOCK_PROCESS_CPUTIME_ID (CPU time) or CLOCK_MONOTONIC (wall-clock time)
+    clockid_t clock;
+    // The core to pin the process to, or -1 for the one it starts on
+    int cpu;
+    // A CSV file to append the statistics to, or NULL
+    const char *history_path;
+    // A CSV file of reference times to check for a regression against, or NULL
+    const char *reference_path;
+    // The slowdown (as a fraction) that is tolerated before reporting a regression
+    double tolerance;
+} options_t;
+
+void usage(char *program) {
+    fprintf(stderr,
+            "USAGE: %s [--warmup <calls>] [--clock cpu|wall] [--cpu <core>]\n"
+            "    [--history <csv file>] [--reference <csv file>] [--tolerance <fraction>]\n",
+            program);
+    exit(1);
+}
+
+options_t parse_options(int argc, char *argv[]) {
+    options_t options = {
+        .warmup = 1,
+        .clock = CLOCK_PROCESS_CPUTIME_ID,
+        .cpu = -1,
+        .history_path = NULL,
+        .reference_path = NULL,
+        .tolerance = DEFAULT_TOLERANCE,
+    };
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 == argc) {
+            usage(argv[0]);
+        }
+        char *option = argv[i], *value = argv[++i], *end;
+        if (strcmp(option, "--warmup") == 0) {
+            options.warmup = strtoul(value, &end, 10);
+        }
+        else if (strcmp(option, "--clock") == 0) {
+            if (strcmp(value, "cpu") == 0) {
+                options.clock = CLOCK_PROCESS_CPUTIME_ID;
+            }
+            else if (strcmp(value, "wall") == 0) {
+                options.clock = CLOCK_MONOTONIC;
+            }
+            else {
+                usage(argv[0]);
+            }
+            end = value + strlen(value);
+        }
+        else if (strcmp(option, "--cpu") == 0) {
+            options.cpu = strtol(value, &end, 10);
+        }
+        else if (strcmp(option, "--history") == 0) {
+            options.history_path = value;
+            end = value + strlen(value);
+        }
+        else if (strcmp(option, "--reference") == 0) {
+            options.reference_path = value;
+            end = value + strlen(value);
+        }
+        else if (strcmp(option, "--tolerance") == 0) {
+            options.tolerance = strtod(value, &end);
+        }
+        else {
+            usage(argv[0]);
+        }
+        if (*value == '\0' || *end != '\0') {
+            usage(argv[0]);
+        }
+    }
+    return options;
+}
+
+// Pins the process to a core, so it isn't migrated (and its caches lost) between runs
+void pin_to_cpu(int cpu) {
+    if (cpu < 0) {
+        cpu = sched_getcpu();
+        if (cpu < 0) {
+            return;
+        }
+    }
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+        fprintf(stderr, "Failed to pin to CPU %d, timing without pinning\n", cpu);
+    }
+}
+
+double time_main(clockid_t clock, size_t calls) {
+    // Compute the amount of time used by `calls` calls to basic_main()
     struct timespec start, end;
-    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
-    basic_main();
-    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end);
+    clock_gettime(clock, &start);
+    for (size_t i = 0; i < calls; i++) {
+        basic_main();
+    }
+    clock_gettime(clock, &end);
     // Compute the duration in seconds
     return end.tv_sec - start.tv_sec + (end.tv_nsec - start.tv_nsec) * SEC_PER_NS;
 }
 
+int compare_durations(const void *duration1, const void *duration2) {
+    double difference = *(const double *) duration1 - *(const double *) duration2;
+    return (difference > 0) - (difference < 0);
+}
+
+// Gets a percentile of sorted durations, using the nearest-rank method
+double percentile(double *sorted_durations, size_t runs, double percent) {
+    size_t rank = ceil(percent / 100 * runs);
+    return sorted_durations[rank > 0 ? rank - 1 : 0];
+}
+
+void write_history(const char *path, const char *test_name, options_t *options,
+                   size_t calls_per_run, size_t runs, double *sorted_durations,
+                   double mean_log_duration, double variance_log_duration) {
+    FILE *history = fopen(path, "a");
+    if (history == NULL) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        exit(2);
+    }
+    // Write the header if the file is new
+    if (ftell(history) == 0) {
+        fprintf(history,
+                "test_name,timestamp,clock,warmup,calls_per_run,runs,min,median,p90,p99,"
+                "mean_log_duration,variance_log_duration\n");
+    }
+    fprintf(history, "%s,%lld,%s,%zu,%zu,%zu,%e,%e,%e,%e,%f,%e\n", test_name,
+            (long long) time(NULL), options->clock == CLOCK_MONOTONIC ? "wall" : "cpu",
+            options->warmup, calls_per_run, runs, sorted_durations[0],
+            percentile(sorted_durations, runs, 50), percentile(sorted_durations, runs, 90),
+            percentile(sorted_durations, runs, 99), mean_log_duration, variance_log_duration);
+    fclose(history);
+}
+
+// Checks whether this test is slower than its reference time by more than the tolerance,
+// with REGRESSION_Z_SCORE confidence. Tests without a reference time never regress.
+bool check_regression(const char *path, const char *test_name, double tolerance,
+                      double mean_log_duration, double variance_log_duration) {
+    FILE *reference = fopen(path, "r");
+    if (reference == NULL) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        exit(2);
+    }
+    char line[256], name[256];
+    double reference_mean, reference_variance;
+    bool found = false;
+    while (fgets(line, sizeof(line), reference) != NULL) {
+        // The header doesn't match, since its fields aren't numbers
+        if (sscanf(line, "%255[^,],%lf,%lf", name, &reference_mean, &reference_variance) == 3 &&
+            strcmp(name, test_name) == 0) {
+            found = true;
+            break;
+        }
+    }
+    fclose(reference);
+    if (!found) {
+        fprintf(stderr, "%s has no reference time\n", test_name);
+        return false;
+    }
+
+    // Durations are compared as logs, so this is the log of the slowdown
+    double slowdown = mean_log_duration - reference_mean;
+    double interval = REGRESSION_Z_SCORE * sqrt(variance_log_duration + reference_variance);
+    fprintf(stderr, "%s is %.3fx the reference time (between %.3fx and %.3fx)\n", test_name,
+            exp(slowdown), exp(slowdown - interval), exp(slowdown + interval));
+    if (slowdown - interval > log1p(tolerance)) {
+        fprintf(stderr, "REGRESSION: %s is more than %g%% slower than the reference\n",
+                test_name, tolerance * 100);
+        return true;
+    }
+    return false;
+}
+
 int main(int argc, char *argv[]) {
     assert(argc > 0);
     assert(strncmp(argv[0], TIME_EXECUTABLE_PREFIX, strlen(TIME_EXECUTABLE_PREFIX)) == 0);
     char *test_name = argv[0] + strlen(TIME_EXECUTABLE_PREFIX);
+    options_t options = parse_options(argc, argv);
+    pin_to_cpu(options.cpu);
+
+    for (size_t i = 0; i < options.warmup; i++) {
+        basic_main();
+    }
+    // Find how many calls to basic_main() each run needs to last `MIN_RUN_DURATION`
+    size_t calls_per_run = 1;
+    while (time_main(options.clock, calls_per_run) < MIN_RUN_DURATION) {
+        calls_per_run *= 2;
+    }
 
     // Rerun basic_main() for at least a second and at least 3 times
+    size_t capacity = INITIAL_DURATIONS_CAPACITY;
+    double *durations = malloc(sizeof(double) * capacity);
+    assert(durations != NULL);
     double duration_sum = 0;
     double duration_log_sum = 0, duration_log_square_sum = 0;
     size_t runs = 0;
-    while (duration_sum < 1.0 || runs < 3) {
-        double duration = time_main();
-        duration_sum += duration;
+    while (duration_sum < MIN_TOTAL_DURATION || runs < MIN_RUNS) {
+        double run_duration = time_main(options.clock, calls_per_run);
+        duration_sum += run_duration;
+        double duration = run_duration / calls_per_run;
+        if (runs == capacity) {
+            capacity *= 2;
+            durations = realloc(durations, sizeof(double) * capacity);
+            assert(durations != NULL);
+        }
+        durations[runs] = duration;
         double log_duration = log(duration);
         duration_log_sum += log_duration;
         duration_log_square_sum += log_duration * log_duration;
@@ -54,4 +257,19 @@ int main(int argc, char *argv[]) {
         test_name, mean_log_duration, variance_log_duration);
     fprintf(stderr, "%s mean duration: %e seconds (+/- %e x)\n", test_name,
             exp(mean_log_duration), expm1(sqrt(variance_log_duration)));
+
+    qsort(durations, runs, sizeof(double), compare_durations);
+    fprintf(stderr, "%s min %e, median %e, p90 %e, p99 %e seconds (%zu runs of %zu calls)\n",
+            test_name, durations[0], percentile(durations, runs, 50),
+            percentile(durations, runs, 90), percentile(durations, runs, 99), runs,
+            calls_per_run);
+    if (options.history_path != NULL) {
+        write_history(options.history_path, test_name, &options, calls_per_run, runs, durations,
+                      mean_log_duration, variance_log_duration);
+    }
+    bool regressed = options.reference_path != NULL &&
+                     check_regression(options.reference_path, test_name, options.tolerance,
+                                      mean_log_duration, variance_log_duration);
+    free(durations);
+    return regressed ? 3 : 0;
 }
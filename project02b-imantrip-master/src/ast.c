@@ -0,0 +1,280 @@
+#include "ast.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** The number of bytes of nodes that each arena chunk has room for */
+const size_t ARENA_CHUNK_SIZE = 64 * 1024;
+/** The number of spaces that each nested block is indented by in `print_ast()` */
+const int PRINT_INDENT = 4;
+
+/** A contiguous block of memory that arena nodes are bump-allocated from */
+typedef struct arena_chunk {
+    /** The previously allocated chunk, or NULL for the first one */
+    struct arena_chunk *next;
+    /** The number of bytes in `data` */
+    size_t size;
+    /** The number of bytes in `data` that have been allocated */
+    size_t used;
+    max_align_t data[];
+} arena_chunk_t;
+
+/** Whether nodes are being allocated in the arena */
+static bool arena_active = false;
+/** The chunk that nodes are currently allocated from, or NULL if none yet */
+static arena_chunk_t *arena_chunks = NULL;
+
+static arena_chunk_t *new_chunk(size_t size, arena_chunk_t *next) {
+    arena_chunk_t *chunk = malloc(sizeof(arena_chunk_t) + size);
+    assert(chunk != NULL);
+    chunk->next = next;
+    chunk->size = size;
+    chunk->used = 0;
+    return chunk;
+}
+
+/** Bump-allocates bytes from the current arena chunk, starting a new one if it is full */
+static void *arena_allocate(size_t size) {
+    size = (size + sizeof(max_align_t) - 1) & ~(sizeof(max_align_t) - 1);
+    if (size > ARENA_CHUNK_SIZE) {
+        // Give oversized allocations their own chunk, behind the current one,
+        // so the current chunk's free space can still be used
+        if (arena_chunks == NULL) {
+            arena_chunks = new_chunk(ARENA_CHUNK_SIZE, NULL);
+        }
+        arena_chunk_t *chunk = new_chunk(size, arena_chunks->next);
+        arena_chunks->next = chunk;
+        chunk->used = size;
+        return chunk->data;
+    }
+    if (arena_chunks == NULL || arena_chunks->size - arena_chunks->used < size) {
+        arena_chunks = new_chunk(ARENA_CHUNK_SIZE, arena_chunks);
+    }
+    void *allocation = (char *) arena_chunks->data + arena_chunks->used;
+    arena_chunks->used += size;
+    return allocation;
+}
+
+/** Allocates a node either in the arena or on the heap */
+static void *allocate_node(size_t size) {
+    if (arena_active) {
+        return arena_allocate(size);
+    }
+    void *node = malloc(size);
+    assert(node != NULL);
+    return node;
+}
+
+void ast_arena_begin(void) {
+    assert(!arena_active);
+    arena_active = true;
+}
+
+void ast_arena_free(void) {
+    assert(arena_active);
+    while (arena_chunks != NULL) {
+        arena_chunk_t *next = arena_chunks->next;
+        free(arena_chunks);
+        arena_chunks = next;
+    }
+    arena_active = false;
+}
+
+node_t *init_num_node(value_t value) {
+    num_node_t *node = allocate_node(sizeof(num_node_t));
+    node->base.type = NUM;
+    node->value = value;
+    return (node_t *) node;
+}
+
+node_t *init_binary_node(char op, node_t *left, node_t *right) {
+    binary_node_t *node = allocate_node(sizeof(binary_node_t));
+    node->base.type = BINARY_OP;
+    node->op = op;
+    node->left = left;
+    node->right = right;
+    return (node_t *) node;
+}
+
+node_t *init_var_node(var_name_t name) {
+    var_node_t *node = allocate_node(sizeof(var_node_t));
+    node->base.type = VAR;
+    node->name = name;
+    return (node_t *) node;
+}
+
+node_t *init_sequence_node(size_t statement_count, node_t **statements) {
+    sequence_node_t *node;
+    if (arena_active) {
+        // Store the statements right after the node instead of in a separate array
+        node = arena_allocate(sizeof(sequence_node_t) + sizeof(node_t *) * statement_count);
+        node_t **inline_statements = (node_t **) (node + 1);
+        // An empty sequence (e.g. from `optimize_ast()`) may have no statements array
+        if (statement_count > 0) {
+            memcpy(inline_statements, statements, sizeof(node_t *) * statement_count);
+        }
+        free(statements);
+        statements = inline_statements;
+    }
+    else {
+        node = allocate_node(sizeof(sequence_node_t));
+    }
+    node->base.type = SEQUENCE;
+    node->statement_count = statement_count;
+    node->statements = statements;
+    return (node_t *) node;
+}
+
+node_t *init_print_node(node_t *expr) {
+    print_node_t *node = allocate_node(sizeof(print_node_t));
+    node->base.type = PRINT;
+    node->expr = expr;
+    return (node_t *) node;
+}
+
+node_t *init_let_node(var_name_t var, node_t *value) {
+    let_node_t *node = allocate_node(sizeof(let_node_t));
+    node->base.type = LET;
+    node->var = var;
+    node->value = value;
+    return (node_t *) node;
+}
+
+node_t *init_if_node(binary_node_t *condition, node_t *if_branch, node_t *else_branch) {
+    if_node_t *node = allocate_node(sizeof(if_node_t));
+    node->base.type = IF;
+    node->condition = condition;
+    node->if_branch = if_branch;
+    node->else_branch = else_branch;
+    return (node_t *) node;
+}
+
+node_t *init_while_node(binary_node_t *condition, node_t *body) {
+    while_node_t *node = allocate_node(sizeof(while_node_t));
+    node->base.type = WHILE;
+    node->condition = condition;
+    node->body = body;
+    return (node_t *) node;
+}
+
+void free_ast(node_t *node) {
+    // Arena nodes are only freed all at once, by ast_arena_free()
+    if (node == NULL || arena_active) {
+        return;
+    }
+
+    switch (node->type) {
+        case BINARY_OP: {
+            binary_node_t *binary = (binary_node_t *) node;
+            free_ast(binary->left);
+            free_ast(binary->right);
+            break;
+        }
+        case SEQUENCE: {
+            sequence_node_t *sequence = (sequence_node_t *) node;
+            for (size_t i = 0; i < sequence->statement_count; i++) {
+                free_ast(sequence->statements[i]);
+            }
+            free(sequence->statements);
+            break;
+        }
+        case PRINT:
+            free_ast(((print_node_t *) node)->expr);
+            break;
+        case LET:
+            free_ast(((let_node_t *) node)->value);
+            break;
+        case IF: {
+            if_node_t *if_node = (if_node_t *) node;
+            free_ast((node_t *) if_node->condition);
+            free_ast(if_node->if_branch);
+            free_ast(if_node->else_branch);
+            break;
+        }
+        case WHILE: {
+            while_node_t *while_node = (while_node_t *) node;
+            free_ast((node_t *) while_node->condition);
+            free_ast(while_node->body);
+            break;
+        }
+        default:
+            break;
+    }
+    free(node);
+}
+
+static void print_indented(node_t *node, int indent) {
+    switch (node->type) {
+        case NUM:
+            fprintf(stderr, "%" PRId64, ((num_node_t *) node)->value);
+            break;
+        case BINARY_OP: {
+            binary_node_t *binary = (binary_node_t *) node;
+            fprintf(stderr, "(");
+            print_indented(binary->left, indent);
+            if (binary->op == SHIFT_LEFT_OP) {
+                fprintf(stderr, " << ");
+            }
+            else if (binary->op == SHIFT_RIGHT_OP) {
+                fprintf(stderr, " >> ");
+            }
+            else {
+                fprintf(stderr, " %c ", binary->op);
+            }
+            print_indented(binary->right, indent);
+            fprintf(stderr, ")");
+            break;
+        }
+        case VAR:
+            fprintf(stderr, "%c", ((var_node_t *) node)->name);
+            break;
+        case SEQUENCE: {
+            sequence_node_t *sequence = (sequence_node_t *) node;
+            for (size_t i = 0; i < sequence->statement_count; i++) {
+                print_indented(sequence->statements[i], indent);
+            }
+            break;
+        }
+        case PRINT:
+            fprintf(stderr, "%*sPRINT ", indent, "");
+            print_indented(((print_node_t *) node)->expr, indent);
+            fprintf(stderr, "\n");
+            break;
+        case LET: {
+            let_node_t *let = (let_node_t *) node;
+            fprintf(stderr, "%*sLET %c = ", indent, "", let->var);
+            print_indented(let->value, indent);
+            fprintf(stderr, "\n");
+            break;
+        }
+        case IF: {
+            if_node_t *if_node = (if_node_t *) node;
+            fprintf(stderr, "%*sIF ", indent, "");
+            print_indented((node_t *) if_node->condition, indent);
+            fprintf(stderr, "\n");
+            print_indented(if_node->if_branch, indent + PRINT_INDENT);
+            if (if_node->else_branch != NULL) {
+                fprintf(stderr, "%*sELSE\n", indent, "");
+                print_indented(if_node->else_branch, indent + PRINT_INDENT);
+            }
+            fprintf(stderr, "%*sEND IF\n", indent, "");
+            break;
+        }
+        case WHILE: {
+            while_node_t *while_node = (while_node_t *) node;
+            fprintf(stderr, "%*sWHILE ", indent, "");
+            print_indented((node_t *) while_node->condition, indent);
+            fprintf(stderr, "\n");
+            print_indented(while_node->body, indent + PRINT_INDENT);
+            fprintf(stderr, "%*sEND WHILE\n", indent, "");
+            break;
+        }
+    }
+}
+
+void print_ast(node_t *node) {
+    print_indented(node, 0);
+}
@@ -0,0 +1,632 @@
+#include "compile.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "ir.h"
+#include "x86.h"
+
+/**
+ * The callee-saved registers, which can hold values that are live across calls
+ * to `print_int()`. `%rbp` is left out because it holds the frame pointer for
+ * the stack slots.
+ */
+const x86_register_t CALLEE_SAVED_REGISTERS[] = {RBX, R12, R13, R14, R15};
+#define CALLEE_SAVED_COUNT (sizeof(CALLEE_SAVED_REGISTERS) / sizeof(*CALLEE_SAVED_REGISTERS))
+
+/**
+ * The caller-saved registers that can hold values that are not live across calls.
+ * `%rax` holds intermediate results, `%rdx` is clobbered by `idivq`,
+ * and `SCRATCH_REGISTER` is reserved, so none of them are here.
+ */
+const x86_register_t CALLER_SAVED_REGISTERS[] = {RCX, RSI, RDI, R8, R9, R10};
+#define CALLER_SAVED_COUNT (sizeof(CALLER_SAVED_REGISTERS) / sizeof(*CALLER_SAVED_REGISTERS))
+#define PHYSICAL_REGISTER_COUNT (CALLEE_SAVED_COUNT + CALLER_SAVED_COUNT)
+
+/** A register for values that are only needed by the next instruction */
+const x86_register_t SCRATCH_REGISTER = R11;
+
+/**
+ * How much more a use inside a WHILE loop counts than a use outside it,
+ * since it probably runs many times.
+ */
+const uint64_t LOOP_WEIGHT = 8;
+/** Loops nested deeper than this don't increase the weight further (avoids overflow) */
+const size_t MAX_WEIGHTED_LOOP_DEPTH = 16;
+
+/** Indicates that an interval has no physical register, so it is in a stack slot */
+#define NO_REGISTER ((size_t) -1)
+
+/** The range of positions where a virtual register is live, and where it is kept */
+typedef struct {
+    /** Whether the register appears in the program at all */
+    bool used;
+    /** The first and last positions (see `compute_intervals()`) where it is live */
+    size_t start, end;
+    /** How often the register is used, weighting uses in loops more heavily */
+    uint64_t weight;
+    /** Whether the register holds a value across a call to `print_int()` */
+    bool crosses_call;
+    /**
+     * The index of the physical register assigned to it, in `CALLEE_SAVED_REGISTERS`
+     * followed by `CALLER_SAVED_REGISTERS`, or `NO_REGISTER` if it was spilled
+     */
+    size_t physical;
+    /** The stack slot it was spilled to (numbered from 0), if it has no register */
+    size_t slot;
+} interval_t;
+
+/** A stack slot whose interval has ended, so it can be given to another one */
+typedef struct {
+    size_t slot;
+    /** The end of the last interval spilled to the slot */
+    size_t end;
+} free_slot_t;
+
+/** Where every virtual register is kept while the program runs */
+typedef struct {
+    interval_t *intervals;
+    /** Whether each callee-saved register is used, so it must be saved and restored */
+    bool saved[CALLEE_SAVED_COUNT];
+    /** The number of callee-saved registers that are saved */
+    size_t saved_count;
+    /** The number of stack slots used for spilled registers */
+    size_t slot_count;
+} allocation_t;
+
+static x86_register_t physical_register(size_t physical) {
+    return physical < CALLEE_SAVED_COUNT
+               ? CALLEE_SAVED_REGISTERS[physical]
+               : CALLER_SAVED_REGISTERS[physical - CALLEE_SAVED_COUNT];
+}
+
+static void extend_interval(interval_t *interval, size_t position) {
+    if (!interval->used) {
+        interval->used = true;
+        interval->start = interval->end = position;
+    }
+    else if (position < interval->start) {
+        interval->start = position;
+    }
+    else if (position > interval->end) {
+        interval->end = position;
+    }
+}
+
+static void add_use(interval_t *intervals, const ir_operand_t *operand, size_t position,
+                    uint64_t weight) {
+    if (!operand->is_constant) {
+        extend_interval(&intervals[operand->reg], position);
+        intervals[operand->reg].weight += weight;
+    }
+}
+
+/**
+ * Computes the live interval of each virtual register.
+ * Positions number the start of each block, each instruction, and each terminator
+ * in layout order. A register that is live into or out of a block is live from
+ * the block's start or until its terminator.
+ */
+static interval_t *compute_intervals(ir_function_t *function) {
+    size_t register_count = function->register_count;
+    interval_t *intervals = calloc(register_count, sizeof(interval_t));
+    assert(intervals != NULL);
+    bool *live_in, *live_out;
+    ir_liveness(function, &live_in, &live_out);
+
+    size_t position_count = 0;
+    for (size_t b = 0; b < function->block_count; b++) {
+        position_count += function->blocks[b].instruction_count + 2;
+    }
+    // The number of calls at positions before each position
+    size_t *calls_before = malloc(sizeof(size_t) * (position_count + 1));
+    assert(calls_before != NULL);
+
+    size_t position = 0;
+    calls_before[0] = 0;
+    for (size_t b = 0; b < function->block_count; b++) {
+        ir_block_t *block = &function->blocks[b];
+        uint64_t weight = 1;
+        for (size_t depth = 0; depth < block->loop_depth && depth < MAX_WEIGHTED_LOOP_DEPTH;
+             depth++) {
+            weight *= LOOP_WEIGHT;
+        }
+
+        size_t block_start = position;
+        size_t block_end = block_start + block->instruction_count + 1;
+        for (ir_register_t reg = 0; reg < register_count; reg++) {
+            if (live_in[b * register_count + reg]) {
+                extend_interval(&intervals[reg], block_start);
+            }
+            if (live_out[b * register_count + reg]) {
+                extend_interval(&intervals[reg], block_end);
+            }
+        }
+        calls_before[position + 1] = calls_before[position];
+        position++;
+
+        for (size_t i = 0; i < block->instruction_count; i++, position++) {
+            ir_instruction_t *instruction = &block->instructions[i];
+            add_use(intervals, &instruction->left, position, weight);
+            if (instruction->opcode == IR_BINARY) {
+                add_use(intervals, &instruction->right, position, weight);
+            }
+            if (instruction->opcode == IR_PRINT) {
+                calls_before[position + 1] = calls_before[position] + 1;
+                continue;
+            }
+            extend_interval(&intervals[instruction->dest], position);
+            intervals[instruction->dest].weight += weight;
+            calls_before[position + 1] = calls_before[position];
+        }
+
+        if (block->terminator.type == IR_BRANCH) {
+            add_use(intervals, &block->terminator.left, position, weight);
+            add_use(intervals, &block->terminator.right, position, weight);
+        }
+        calls_before[position + 1] = calls_before[position];
+        position++;
+    }
+
+    // A value used by a call (or defined after it) doesn't need to survive it
+    for (ir_register_t reg = 0; reg < register_count; reg++) {
+        interval_t *interval = &intervals[reg];
+        interval->crosses_call =
+            interval->used && calls_before[interval->end] > calls_before[interval->start + 1];
+    }
+    free(calls_before);
+    free(live_in);
+    free(live_out);
+    return intervals;
+}
+
+/** The intervals that `compare_starts()` compares the registers of */
+static interval_t *sorted_intervals;
+
+static int compare_starts(const void *a, const void *b) {
+    size_t start_a = sorted_intervals[*(const ir_register_t *) a].start,
+           start_b = sorted_intervals[*(const ir_register_t *) b].start;
+    return (start_a > start_b) - (start_a < start_b);
+}
+
+/** Tries to find a free physical register an interval can use */
+static size_t find_free_register(const interval_t *interval,
+                                 const bool in_use[PHYSICAL_REGISTER_COUNT]) {
+    // Prefer caller-saved registers, so the callee-saved ones are left for values
+    // that live across calls (and don't need saving and restoring)
+    if (!interval->crosses_call) {
+        for (size_t physical = CALLEE_SAVED_COUNT; physical < PHYSICAL_REGISTER_COUNT;
+             physical++) {
+            if (!in_use[physical]) {
+                return physical;
+            }
+        }
+    }
+    for (size_t physical = 0; physical < CALLEE_SAVED_COUNT; physical++) {
+        if (!in_use[physical]) {
+            return physical;
+        }
+    }
+    return NO_REGISTER;
+}
+
+/**
+ * Picks the stack slot for a spilled interval. A free slot is only reused
+ * if its last interval ended before this one starts: a spilled victim started
+ * before the current position, so it may overlap intervals that have since ended.
+ */
+static size_t take_free_slot(const interval_t *spilled, free_slot_t *free_slots,
+                             size_t *free_slot_count, allocation_t *allocation) {
+    for (size_t i = 0; i < *free_slot_count; i++) {
+        if (free_slots[i].end < spilled->start) {
+            size_t slot = free_slots[i].slot;
+            free_slots[i] = free_slots[--*free_slot_count];
+            return slot;
+        }
+    }
+    return allocation->slot_count++;
+}
+
+/**
+ * Assigns each virtual register a physical register or a stack slot,
+ * using linear-scan register allocation. Intervals are visited in order of
+ * their start, and when no suitable register is free, the lightest interval
+ * (by loop-weighted use count) among the competing ones is spilled.
+ * Stack slots are reused by intervals that start after the last ones in them end.
+ */
+static void allocate_registers(ir_function_t *function, allocation_t *allocation) {
+    size_t register_count = function->register_count;
+    interval_t *intervals = compute_intervals(function);
+    allocation->intervals = intervals;
+    memset(allocation->saved, false, sizeof(allocation->saved));
+    allocation->saved_count = 0;
+    allocation->slot_count = 0;
+
+    ir_register_t *order = malloc(sizeof(ir_register_t) * register_count);
+    // The intervals that have been allocated but haven't ended yet
+    ir_register_t *active = malloc(sizeof(ir_register_t) * register_count);
+    free_slot_t *free_slots = malloc(sizeof(free_slot_t) * register_count);
+    assert(order != NULL && active != NULL && free_slots != NULL);
+    size_t interval_count = 0;
+    for (ir_register_t reg = 0; reg < register_count; reg++) {
+        if (intervals[reg].used) {
+            order[interval_count++] = reg;
+        }
+    }
+    sorted_intervals = intervals;
+    qsort(order, interval_count, sizeof(ir_register_t), compare_starts);
+
+    bool in_use[PHYSICAL_REGISTER_COUNT] = {false};
+    size_t active_count = 0, free_slot_count = 0;
+    for (size_t i = 0; i < interval_count; i++) {
+        interval_t *interval = &intervals[order[i]];
+
+        // Free the registers and slots of intervals that have ended
+        size_t still_active = 0;
+        for (size_t j = 0; j < active_count; j++) {
+            interval_t *other = &intervals[active[j]];
+            if (other->end >= interval->start) {
+                active[still_active++] = active[j];
+            }
+            else if (other->physical != NO_REGISTER) {
+                in_use[other->physical] = false;
+            }
+            else {
+                free_slots[free_slot_count++] =
+                    (free_slot_t) {.slot = other->slot, .end = other->end};
+            }
+        }
+        active_count = still_active;
+
+        interval->physical = find_free_register(interval, in_use);
+        if (interval->physical == NO_REGISTER) {
+            // Take the register of a lighter interval that could use it, if there is one
+            interval_t *victim = NULL;
+            for (size_t j = 0; j < active_count; j++) {
+                interval_t *other = &intervals[active[j]];
+                if (other->physical != NO_REGISTER &&
+                    (!interval->crosses_call || other->physical < CALLEE_SAVED_COUNT) &&
+                    other->weight < interval->weight &&
+                    (victim == NULL || other->weight < victim->weight)) {
+                    victim = other;
+                }
+            }
+            interval_t *spilled = interval;
+            if (victim != NULL) {
+                interval->physical = victim->physical;
+                victim->physical = NO_REGISTER;
+                spilled = victim;
+            }
+            spilled->slot = take_free_slot(spilled, free_slots, &free_slot_count, allocation);
+        }
+        if (interval->physical != NO_REGISTER) {
+            in_use[interval->physical] = true;
+            if (interval->physical < CALLEE_SAVED_COUNT) {
+                allocation->saved[interval->physical] = true;
+            }
+        }
+        active[active_count++] = order[i];
+    }
+
+    for (size_t physical = 0; physical < CALLEE_SAVED_COUNT; physical++) {
+        allocation->saved_count += allocation->saved[physical];
+    }
+    free(order);
+    free(active);
+    free(free_slots);
+}
+
+/** The register allocation for the program being compiled */
+static allocation_t allocation;
+/** Where the program's code is emitted */
+static assembler_t *assembler;
+
+/** Gets the operand for a virtual register's location */
+static x86_operand_t location(ir_register_t reg) {
+    interval_t *interval = &allocation.intervals[reg];
+    assert(interval->used);
+    if (interval->physical != NO_REGISTER) {
+        return x86_reg(physical_register(interval->physical));
+    }
+    // Slots go below the saved registers; see `compile_prologue()`
+    return x86_stack_slot(
+        -(int32_t) (sizeof(value_t) * (allocation.saved_count + interval->slot + 1)));
+}
+
+/**
+ * Gets an operand for an IR operand that can be the source of an instruction.
+ * Constants too big to be immediates are first moved to `scratch`.
+ */
+static x86_operand_t get_source(const ir_operand_t *operand, x86_register_t scratch) {
+    if (!operand->is_constant) {
+        return location(operand->reg);
+    }
+    if (!x86_fits_immediate(operand->value)) {
+        x86_mov(assembler, x86_immediate(operand->value), x86_reg(scratch));
+        return x86_reg(scratch);
+    }
+    return x86_immediate(operand->value);
+}
+
+/** Moves an IR operand into a register */
+static void load(const ir_operand_t *operand, x86_register_t reg) {
+    x86_operand_t source = get_source(operand, reg);
+    if (!x86_same_location(source, x86_reg(reg))) {
+        x86_mov(assembler, source, x86_reg(reg));
+    }
+}
+
+/**
+ * Applies a binary operator to `%rax` and `source`, leaving the result in `%rax`.
+ *
+ * @param op the operator of a `binary_node_t`
+ * @param source the right side, which isn't `%rdx`
+ * @return whether `op` was a valid operator
+ */
+static bool compile_operator(char op, x86_operand_t source) {
+    switch (op) {
+        case '+':
+            x86_arithmetic(assembler, X86_ADD, source, RAX);
+            return true;
+        case '-':
+            x86_arithmetic(assembler, X86_SUB, source, RAX);
+            return true;
+        case '*':
+            x86_arithmetic(assembler, X86_IMUL, source, RAX);
+            return true;
+        case '/':
+            // idivq can't take an immediate divisor
+            if (source.type == X86_IMMEDIATE) {
+                x86_mov(assembler, source, x86_reg(SCRATCH_REGISTER));
+                source = x86_reg(SCRATCH_REGISTER);
+            }
+            x86_divide(assembler, source);
+            return true;
+        case '<':
+        case '=':
+        case '>':
+            x86_arithmetic(assembler, X86_CMP, source, RAX);
+            x86_set_condition(assembler, op == '<'   ? X86_LESS
+                                         : op == '=' ? X86_EQUAL
+                                                     : X86_GREATER);
+            return true;
+        case SHIFT_LEFT_OP:
+            assert(source.type == X86_IMMEDIATE);
+            x86_shift(assembler, X86_SHL, source.immediate, RAX);
+            return true;
+        case SHIFT_RIGHT_OP:
+            // sarq rounds down, so add 2^k - 1 first if the value is negative
+            assert(source.type == X86_IMMEDIATE);
+            x86_mov(assembler, x86_reg(RAX), x86_reg(RDX));
+            x86_shift(assembler, X86_SAR, 63, RDX);
+            x86_shift(assembler, X86_SHR, 64 - source.immediate, RDX);
+            x86_arithmetic(assembler, X86_ADD, x86_reg(RDX), RAX);
+            x86_shift(assembler, X86_SAR, source.immediate, RAX);
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool compile_binary(const ir_instruction_t *instruction) {
+    x86_operand_t destination = location(instruction->dest);
+    x86_operand_t source = get_source(&instruction->right, SCRATCH_REGISTER);
+    char op = instruction->op;
+    bool in_place = op == '+' || op == '-' || op == '*' || op == SHIFT_LEFT_OP;
+    if (in_place && destination.type == X86_REGISTER &&
+        !x86_same_location(source, destination)) {
+        // Compute the result in place, without going through %rax
+        load(&instruction->left, destination.reg);
+        if (op == SHIFT_LEFT_OP) {
+            x86_shift(assembler, X86_SHL, source.immediate, destination.reg);
+        }
+        else {
+            x86_arithmetic(assembler, op == '+' ? X86_ADD : op == '-' ? X86_SUB : X86_IMUL,
+                           source, destination.reg);
+        }
+        return true;
+    }
+    load(&instruction->left, RAX);
+    if (!compile_operator(op, source)) {
+        return false;
+    }
+    x86_mov(assembler, x86_reg(RAX), destination);
+    return true;
+}
+
+static void compile_copy(const ir_instruction_t *instruction) {
+    x86_operand_t destination = location(instruction->dest);
+    const ir_operand_t *value = &instruction->left;
+    if (destination.type == X86_REGISTER) {
+        load(value, destination.reg);
+        return;
+    }
+
+    // Memory-to-memory moves aren't allowed, so go through %rax
+    x86_operand_t source = get_source(value, RAX);
+    if (!x86_same_location(source, destination)) {
+        if (source.type == X86_STACK_SLOT) {
+            x86_mov(assembler, source, x86_reg(RAX));
+            source = x86_reg(RAX);
+        }
+        x86_mov(assembler, source, destination);
+    }
+}
+
+/**
+ * Compiles a block's branch, falling through to the next block when possible.
+ *
+ * @return whether the comparison was valid
+ */
+static bool compile_branch(const ir_terminator_t *branch, size_t next_block) {
+    x86_condition_t condition, inverse;
+    switch (branch->op) {
+        case '<':
+            condition = X86_LESS, inverse = X86_GREATER_EQUAL;
+            break;
+        case '=':
+            condition = X86_EQUAL, inverse = X86_NOT_EQUAL;
+            break;
+        case '>':
+            condition = X86_GREATER, inverse = X86_LESS_EQUAL;
+            break;
+        default:
+            return false;
+    }
+
+    x86_register_t left = RAX;
+    if (!branch->left.is_constant && location(branch->left.reg).type == X86_REGISTER) {
+        left = location(branch->left.reg).reg;
+    }
+    else {
+        load(&branch->left, RAX);
+    }
+    x86_arithmetic(assembler, X86_CMP, get_source(&branch->right, SCRATCH_REGISTER), left);
+    if (branch->target == next_block) {
+        x86_jump(assembler, inverse, branch->else_target);
+    }
+    else {
+        x86_jump(assembler, condition, branch->target);
+        if (branch->else_target != next_block) {
+            x86_jump(assembler, X86_ALWAYS, branch->else_target);
+        }
+    }
+    return true;
+}
+
+/**
+ * Sets up `basic_main()`'s stack frame: saves `%rbp` and the callee-saved registers
+ * that are used, and makes room for the stack slots of spilled registers.
+ * `%rsp` ends up 16-byte aligned, as calls to `print_int()` require.
+ */
+static void compile_prologue(void) {
+    x86_push(assembler, RBP);
+    x86_mov(assembler, x86_reg(RSP), x86_reg(RBP));
+    for (size_t physical = 0; physical < CALLEE_SAVED_COUNT; physical++) {
+        if (allocation.saved[physical]) {
+            x86_push(assembler, CALLEE_SAVED_REGISTERS[physical]);
+        }
+    }
+    size_t frame_size = allocation.saved_count + allocation.slot_count;
+    size_t slots = allocation.slot_count + frame_size % 2;
+    if (slots > 0) {
+        x86_arithmetic(assembler, X86_SUB, x86_immediate(sizeof(value_t) * slots), RSP);
+    }
+}
+
+/** Restores the registers saved by `compile_prologue()` and returns */
+static void compile_epilogue(void) {
+    if (allocation.saved_count > 0) {
+        x86_load_address(assembler, -(int32_t) (sizeof(value_t) * allocation.saved_count),
+                         RSP);
+    }
+    for (size_t physical = CALLEE_SAVED_COUNT; physical > 0; physical--) {
+        if (allocation.saved[physical - 1]) {
+            x86_pop(assembler, CALLEE_SAVED_REGISTERS[physical - 1]);
+        }
+    }
+    x86_leave_return(assembler);
+}
+
+/**
+ * Compiles a basic block, falling through to the next block when possible.
+ * Each block's label is its index.
+ *
+ * @param function the program the block is in
+ * @param b the index of the block
+ * @return true iff compilation succeeds
+ */
+static bool compile_block(ir_function_t *function, size_t b) {
+    ir_block_t *block = &function->blocks[b];
+    x86_label(assembler, b);
+    for (size_t i = 0; i < block->instruction_count; i++) {
+        ir_instruction_t *instruction = &block->instructions[i];
+        switch (instruction->opcode) {
+            case IR_COPY:
+                compile_copy(instruction);
+                break;
+            case IR_BINARY:
+                if (!compile_binary(instruction)) {
+                    return false;
+                }
+                break;
+            case IR_PRINT:
+                load(&instruction->left, RDI);
+                x86_call_print_int(assembler);
+                break;
+        }
+    }
+
+    ir_terminator_t *terminator = &block->terminator;
+    switch (terminator->type) {
+        case IR_JUMP:
+            if (terminator->target != b + 1) {
+                x86_jump(assembler, X86_ALWAYS, terminator->target);
+            }
+            return true;
+        case IR_BRANCH:
+            return compile_branch(terminator, b + 1);
+        case IR_RETURN:
+            compile_epilogue();
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Compiles a program, emitting it with `assembler`.
+ *
+ * @return true iff compilation succeeds
+ */
+static bool compile_program(node_t *node) {
+    ir_function_t *function = ir_lower(node);
+    if (function == NULL) {
+        return false;
+    }
+    ir_optimize(function);
+    allocate_registers(function, &allocation);
+
+    compile_prologue();
+    bool success = true;
+    for (size_t b = 0; b < function->block_count && success; b++) {
+        success = compile_block(function, b);
+    }
+    free(allocation.intervals);
+    free_ir(function);
+    return success;
+}
+
+bool compile_ast(node_t *node) {
+    assembler = assembler_init_text();
+    bool success = compile_program(node);
+    assembler_free(assembler);
+    return success;
+}
+
+jit_program_t *compile_ast_jit(node_t *node, void (*print_int)(int64_t)) {
+    assembler = assembler_init_binary(print_int);
+    if (!compile_program(node)) {
+        assembler_free(assembler);
+        return NULL;
+    }
+    jit_program_t *program = malloc(sizeof(jit_program_t));
+    assert(program != NULL);
+    void *code = assembler_finish(assembler, &program->size);
+    assembler_free(assembler);
+    if (code == NULL) {
+        free(program);
+        return NULL;
+    }
+    program->code = code;
+    program->basic_main = (void (*)(void)) code;
+    return program;
+}
+
+void free_jit_program(jit_program_t *program) {
+    munmap(program->code, program->size);
+    free(program);
+}
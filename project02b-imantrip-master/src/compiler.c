@@ -0,0 +1,120 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ast.h"
+#include "compile.h"
+#include "ir.h"
+#include "optimize.h"
+#include "parser.h"
+
+/** The number of statements the program's SEQUENCE node initially has room for */
+const size_t INITIAL_CAPACITY = 16;
+/** Prints the optimized three-address code to stderr, for debugging */
+#define DUMP_IR_FLAG "--dump-ir"
+/** Compiles the program to machine code in memory and runs it, instead of printing it */
+#define JIT_FLAG "--jit"
+
+/** The runtime's print_int() (runtime/print_int.s), for JIT-compiled programs to call */
+void print_int(int64_t value);
+
+void usage(char *program) {
+    fprintf(stderr, "USAGE: %s [" DUMP_IR_FLAG "] [" JIT_FLAG "] <program file>\n", program);
+    exit(1);
+}
+
+/**
+ * Parses every statement in a TeenyBASIC file.
+ *
+ * @param program the file to read from
+ * @return a SEQUENCE node with the program's statements, or NULL on a parse error
+ */
+node_t *parse_program(FILE *program) {
+    parser_t *parser = parser_init_file(program);
+    size_t statement_count = 0;
+    size_t capacity = INITIAL_CAPACITY;
+    node_t **statements = malloc(sizeof(node_t *) * capacity);
+    assert(statements != NULL);
+    node_t *statement;
+    while ((statement = parser_next(parser)) != NULL) {
+        if (statement_count == capacity) {
+            capacity *= 2;
+            statements = realloc(statements, sizeof(node_t *) * capacity);
+            assert(statements != NULL);
+        }
+        statements[statement_count++] = statement;
+    }
+    node_t *sequence = init_sequence_node(statement_count, statements);
+    if (parser_failed(parser)) {
+        free_ast(sequence);
+        sequence = NULL;
+    }
+    parser_free(parser);
+    return sequence;
+}
+
+int main(int argc, char *argv[]) {
+    bool dump_ir = false, jit = false;
+    for (int i = 1; i < argc - 1; i++) {
+        if (strcmp(argv[i], DUMP_IR_FLAG) == 0) {
+            dump_ir = true;
+        }
+        else if (strcmp(argv[i], JIT_FLAG) == 0) {
+            jit = true;
+        }
+        else {
+            usage(argv[0]);
+        }
+    }
+    if (argc < 2) {
+        usage(argv[0]);
+    }
+
+    char *path = argv[argc - 1];
+    FILE *program = fopen(path, "r");
+    if (program == NULL) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return 2;
+    }
+    // The AST is built once and freed at exit, so skip per-node allocation and freeing
+    ast_arena_begin();
+    node_t *ast = parse_program(program);
+    fclose(program);
+    if (ast == NULL) {
+        ast_arena_free();
+        return 4;
+    }
+
+    ast = optimize_ast(ast);
+    if (dump_ir) {
+        ir_function_t *function = ir_lower(ast);
+        if (function != NULL) {
+            ir_optimize(function);
+            print_ir(function, stderr);
+            free_ir(function);
+        }
+    }
+
+    if (jit) {
+        jit_program_t *compiled = compile_ast_jit(ast, print_int);
+        ast_arena_free();
+        if (compiled == NULL) {
+            fprintf(stderr, "Compilation failed\n");
+            return 3;
+        }
+        compiled->basic_main();
+        free_jit_program(compiled);
+        return 0;
+    }
+
+    printf("# The code below is your compiled program\n");
+    printf(".globl basic_main\n");
+    printf("basic_main:\n");
+    bool success = compile_ast(ast);
+    ast_arena_free();
+    if (!success) {
+        fprintf(stderr, "Compilation failed\n");
+        return 3;
+    }
+}
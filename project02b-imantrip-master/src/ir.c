@@ -0,0 +1,553 @@
+#include "ir.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** The number of blocks or instructions an array initially has room for */
+const size_t INITIAL_IR_CAPACITY = 16;
+
+/** The state of `ir_lower()` */
+typedef struct {
+    ir_function_t *function;
+    /** The block that instructions are being added to */
+    size_t current;
+    /** The number of WHILE loops around the statement being lowered */
+    size_t loop_depth;
+} lowering_t;
+
+static ir_operand_t constant_operand(value_t value) {
+    return (ir_operand_t) {.is_constant = true, .value = value};
+}
+
+static ir_operand_t register_operand(ir_register_t reg) {
+    return (ir_operand_t) {.is_constant = false, .reg = reg};
+}
+
+/** Adds an empty block that returns, and gets its index */
+static size_t new_block(ir_function_t *function, size_t loop_depth) {
+    if (function->block_count == function->block_capacity) {
+        function->block_capacity *= 2;
+        function->blocks =
+            realloc(function->blocks, sizeof(ir_block_t) * function->block_capacity);
+        assert(function->blocks != NULL);
+    }
+    ir_block_t *block = &function->blocks[function->block_count];
+    block->instruction_count = 0;
+    block->instruction_capacity = INITIAL_IR_CAPACITY;
+    block->instructions = malloc(sizeof(ir_instruction_t) * block->instruction_capacity);
+    assert(block->instructions != NULL);
+    block->terminator = (ir_terminator_t) {.type = IR_RETURN};
+    block->loop_depth = loop_depth;
+    return function->block_count++;
+}
+
+/** Adds an instruction to the end of the block being lowered */
+static void emit(lowering_t *lowering, ir_instruction_t instruction) {
+    ir_block_t *block = &lowering->function->blocks[lowering->current];
+    if (block->instruction_count == block->instruction_capacity) {
+        block->instruction_capacity *= 2;
+        block->instructions = realloc(block->instructions, sizeof(ir_instruction_t) *
+                                                               block->instruction_capacity);
+        assert(block->instructions != NULL);
+    }
+    block->instructions[block->instruction_count++] = instruction;
+}
+
+static void set_jump(ir_function_t *function, size_t block, size_t target) {
+    function->blocks[block].terminator =
+        (ir_terminator_t) {.type = IR_JUMP, .target = target};
+}
+
+/**
+ * Lowers an expression, adding the instructions that compute it to the current block.
+ *
+ * @param lowering the lowering state
+ * @param node the expression
+ * @param result set to the operand holding the expression's value
+ * @return whether the expression was valid
+ */
+static bool lower_expression(lowering_t *lowering, node_t *node, ir_operand_t *result) {
+    switch (node->type) {
+        case NUM:
+            *result = constant_operand(((num_node_t *) node)->value);
+            return true;
+        case VAR:
+            *result = register_operand(IR_VARIABLE(((var_node_t *) node)->name));
+            return true;
+        case BINARY_OP: {
+            binary_node_t *binary = (binary_node_t *) node;
+            ir_instruction_t instruction = {.opcode = IR_BINARY, .op = binary->op};
+            if (!lower_expression(lowering, binary->left, &instruction.left) ||
+                !lower_expression(lowering, binary->right, &instruction.right)) {
+                return false;
+            }
+            instruction.dest = lowering->function->register_count++;
+            emit(lowering, instruction);
+            *result = register_operand(instruction.dest);
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+/**
+ * Lowers the operands of an IF or WHILE condition into the current block
+ * and makes the block end with a branch on the comparison.
+ * The caller fills in the branch's targets.
+ */
+static bool lower_condition(lowering_t *lowering, binary_node_t *condition) {
+    if (condition->op != '<' && condition->op != '=' && condition->op != '>') {
+        return false;
+    }
+    ir_terminator_t branch = {.type = IR_BRANCH, .op = condition->op};
+    if (!lower_expression(lowering, condition->left, &branch.left) ||
+        !lower_expression(lowering, condition->right, &branch.right)) {
+        return false;
+    }
+    lowering->function->blocks[lowering->current].terminator = branch;
+    return true;
+}
+
+static bool lower_statement(lowering_t *lowering, node_t *node);
+
+static bool lower_let(lowering_t *lowering, let_node_t *let) {
+    ir_register_t dest = IR_VARIABLE(let->var);
+    if (let->value->type == BINARY_OP) {
+        // Compute the value directly into the variable instead of copying a temporary
+        binary_node_t *binary = (binary_node_t *) let->value;
+        ir_instruction_t instruction = {.opcode = IR_BINARY, .op = binary->op, .dest = dest};
+        if (!lower_expression(lowering, binary->left, &instruction.left) ||
+            !lower_expression(lowering, binary->right, &instruction.right)) {
+            return false;
+        }
+        emit(lowering, instruction);
+        return true;
+    }
+    ir_instruction_t instruction = {.opcode = IR_COPY, .dest = dest};
+    if (!lower_expression(lowering, let->value, &instruction.left)) {
+        return false;
+    }
+    emit(lowering, instruction);
+    return true;
+}
+
+static bool lower_if(lowering_t *lowering, if_node_t *if_node) {
+    ir_function_t *function = lowering->function;
+    if (!lower_condition(lowering, if_node->condition)) {
+        return false;
+    }
+    size_t condition_block = lowering->current;
+
+    size_t if_block = new_block(function, lowering->loop_depth);
+    lowering->current = if_block;
+    if (!lower_statement(lowering, if_node->if_branch)) {
+        return false;
+    }
+    size_t if_end = lowering->current;
+
+    // Without an ELSE branch, a false condition goes straight to the end block
+    size_t else_block = function->block_count, else_end = else_block;
+    if (if_node->else_branch != NULL) {
+        new_block(function, lowering->loop_depth);
+        lowering->current = else_block;
+        if (!lower_statement(lowering, if_node->else_branch)) {
+            return false;
+        }
+        else_end = lowering->current;
+        set_jump(function, else_end, function->block_count);
+    }
+
+    size_t end_block = new_block(function, lowering->loop_depth);
+    ir_terminator_t *branch = &function->blocks[condition_block].terminator;
+    branch->target = if_block;
+    branch->else_target = else_block;
+    set_jump(function, if_end, end_block);
+    lowering->current = end_block;
+    return true;
+}
+
+static bool lower_while(lowering_t *lowering, while_node_t *while_node) {
+    // The condition goes after the body, so each iteration only takes one branch
+    ir_function_t *function = lowering->function;
+    size_t before = lowering->current;
+    lowering->loop_depth++;
+    size_t body_block = new_block(function, lowering->loop_depth);
+    lowering->current = body_block;
+    if (!lower_statement(lowering, while_node->body)) {
+        return false;
+    }
+    size_t body_end = lowering->current;
+
+    size_t condition_block = new_block(function, lowering->loop_depth);
+    set_jump(function, before, condition_block);
+    set_jump(function, body_end, condition_block);
+    lowering->current = condition_block;
+    if (!lower_condition(lowering, while_node->condition)) {
+        return false;
+    }
+    lowering->loop_depth--;
+
+    size_t end_block = new_block(function, lowering->loop_depth);
+    ir_terminator_t *branch = &function->blocks[condition_block].terminator;
+    branch->target = body_block;
+    branch->else_target = end_block;
+    lowering->current = end_block;
+    return true;
+}
+
+/**
+ * Lowers a statement, adding its instructions to the current block.
+ * When the statement is an IF or WHILE, the current block becomes the
+ * block that runs after it.
+ *
+ * @return whether the statement was valid
+ */
+static bool lower_statement(lowering_t *lowering, node_t *node) {
+    switch (node->type) {
+        case SEQUENCE: {
+            sequence_node_t *sequence = (sequence_node_t *) node;
+            for (size_t i = 0; i < sequence->statement_count; i++) {
+                if (!lower_statement(lowering, sequence->statements[i])) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        case PRINT: {
+            ir_instruction_t instruction = {.opcode = IR_PRINT};
+            if (!lower_expression(lowering, ((print_node_t *) node)->expr,
+                                  &instruction.left)) {
+                return false;
+            }
+            emit(lowering, instruction);
+            return true;
+        }
+        case LET:
+            return lower_let(lowering, (let_node_t *) node);
+        case IF:
+            return lower_if(lowering, (if_node_t *) node);
+        case WHILE:
+            return lower_while(lowering, (while_node_t *) node);
+        default:
+            return false;
+    }
+}
+
+ir_function_t *ir_lower(node_t *node) {
+    ir_function_t *function = malloc(sizeof(ir_function_t));
+    assert(function != NULL);
+    function->block_count = 0;
+    function->block_capacity = INITIAL_IR_CAPACITY;
+    function->blocks = malloc(sizeof(ir_block_t) * function->block_capacity);
+    assert(function->blocks != NULL);
+    function->register_count = IR_VARIABLE_COUNT;
+
+    lowering_t lowering = {.function = function, .current = new_block(function, 0)};
+    // Every variable starts out as 0; dead-code elimination removes the unneeded ones
+    for (ir_register_t var = 0; var < IR_VARIABLE_COUNT; var++) {
+        emit(&lowering, (ir_instruction_t) {
+                            .opcode = IR_COPY, .dest = var, .left = constant_operand(0)});
+    }
+    if (!lower_statement(&lowering, node)) {
+        free_ir(function);
+        return NULL;
+    }
+    return function;
+}
+
+/** Replaces an operand with the operand its register is known to be a copy of */
+static void propagate_operand(ir_operand_t *operand, const bool *known,
+                              const ir_operand_t *copies) {
+    if (!operand->is_constant && known[operand->reg]) {
+        *operand = copies[operand->reg];
+    }
+}
+
+/**
+ * Replaces uses of registers that were copied from other registers or constants
+ * with the originals, within each block. This lets dead-code elimination remove
+ * the copies.
+ */
+static void propagate_copies(ir_function_t *function) {
+    size_t register_count = function->register_count;
+    // Whether each register is known to hold `copies[reg]`
+    bool *known = calloc(register_count, sizeof(bool));
+    ir_operand_t *copies = malloc(sizeof(ir_operand_t) * register_count);
+    // The registers that are currently known, so they can be reset quickly
+    ir_register_t *known_registers = malloc(sizeof(ir_register_t) * register_count);
+    assert(known != NULL && copies != NULL && known_registers != NULL);
+
+    for (size_t b = 0; b < function->block_count; b++) {
+        ir_block_t *block = &function->blocks[b];
+        size_t known_count = 0;
+        for (size_t i = 0; i < block->instruction_count; i++) {
+            ir_instruction_t *instruction = &block->instructions[i];
+            propagate_operand(&instruction->left, known, copies);
+            if (instruction->opcode == IR_BINARY) {
+                propagate_operand(&instruction->right, known, copies);
+            }
+            if (instruction->opcode == IR_PRINT) {
+                continue;
+            }
+
+            // Assigning the register invalidates copies of and from it
+            ir_register_t dest = instruction->dest;
+            size_t kept = 0;
+            for (size_t j = 0; j < known_count; j++) {
+                ir_register_t reg = known_registers[j];
+                if (reg == dest || (!copies[reg].is_constant && copies[reg].reg == dest)) {
+                    known[reg] = false;
+                }
+                else {
+                    known_registers[kept++] = reg;
+                }
+            }
+            known_count = kept;
+            if (instruction->opcode == IR_COPY &&
+                (instruction->left.is_constant || instruction->left.reg != dest)) {
+                known[dest] = true;
+                copies[dest] = instruction->left;
+                known_registers[known_count++] = dest;
+            }
+        }
+        if (block->terminator.type == IR_BRANCH) {
+            propagate_operand(&block->terminator.left, known, copies);
+            propagate_operand(&block->terminator.right, known, copies);
+        }
+        for (size_t j = 0; j < known_count; j++) {
+            known[known_registers[j]] = false;
+        }
+    }
+    free(known);
+    free(copies);
+    free(known_registers);
+}
+
+bool ir_may_trap(const ir_instruction_t *instruction) {
+    if (instruction->opcode != IR_BINARY || instruction->op != '/') {
+        return false;
+    }
+    const ir_operand_t *divisor = &instruction->right;
+    return !(divisor->is_constant && divisor->value != 0 && divisor->value != -1);
+}
+
+static void mark_use(bool *live, const ir_operand_t *operand) {
+    if (!operand->is_constant) {
+        live[operand->reg] = true;
+    }
+}
+
+/** Marks the registers used by a block's terminator as live */
+static void mark_terminator_uses(bool *live, const ir_terminator_t *terminator) {
+    if (terminator->type == IR_BRANCH) {
+        mark_use(live, &terminator->left);
+        mark_use(live, &terminator->right);
+    }
+}
+
+/**
+ * Updates the set of live registers from after an instruction to before it.
+ */
+static void step_liveness(bool *live, const ir_instruction_t *instruction) {
+    if (instruction->opcode != IR_PRINT) {
+        live[instruction->dest] = false;
+    }
+    mark_use(live, &instruction->left);
+    if (instruction->opcode == IR_BINARY) {
+        mark_use(live, &instruction->right);
+    }
+}
+
+void ir_liveness(ir_function_t *function, bool **live_in_result, bool **live_out_result) {
+    size_t register_count = function->register_count;
+    size_t size = function->block_count * register_count;
+    bool *live_in = calloc(size, sizeof(bool));
+    bool *live_out = calloc(size, sizeof(bool));
+    bool *live = malloc(sizeof(bool) * register_count);
+    assert(live_in != NULL && live_out != NULL && live != NULL);
+
+    // Iterate to a fixed point, visiting blocks backward since liveness flows backward
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t b = function->block_count; b > 0; b--) {
+            ir_block_t *block = &function->blocks[b - 1];
+            bool *out = &live_out[(b - 1) * register_count];
+            const ir_terminator_t *terminator = &block->terminator;
+            size_t successors[2];
+            size_t successor_count = 0;
+            if (terminator->type != IR_RETURN) {
+                successors[successor_count++] = terminator->target;
+            }
+            if (terminator->type == IR_BRANCH) {
+                successors[successor_count++] = terminator->else_target;
+            }
+            for (size_t i = 0; i < successor_count; i++) {
+                bool *in = &live_in[successors[i] * register_count];
+                for (ir_register_t reg = 0; reg < register_count; reg++) {
+                    out[reg] |= in[reg];
+                }
+            }
+
+            memcpy(live, out, sizeof(bool) * register_count);
+            mark_terminator_uses(live, terminator);
+            for (size_t i = block->instruction_count; i > 0; i--) {
+                step_liveness(live, &block->instructions[i - 1]);
+            }
+            bool *in = &live_in[(b - 1) * register_count];
+            if (memcmp(in, live, sizeof(bool) * register_count) != 0) {
+                memcpy(in, live, sizeof(bool) * register_count);
+                changed = true;
+            }
+        }
+    }
+    free(live);
+    *live_in_result = live_in;
+    *live_out_result = live_out;
+}
+
+/**
+ * Removes instructions whose results are never used, unless they might crash.
+ *
+ * @return whether any instructions were removed
+ */
+static bool eliminate_dead_code(ir_function_t *function) {
+    bool *live_in, *live_out;
+    ir_liveness(function, &live_in, &live_out);
+    size_t register_count = function->register_count;
+    bool *live = malloc(sizeof(bool) * register_count);
+    assert(live != NULL);
+
+    bool removed = false;
+    for (size_t b = 0; b < function->block_count; b++) {
+        ir_block_t *block = &function->blocks[b];
+        memcpy(live, &live_out[b * register_count], sizeof(bool) * register_count);
+        mark_terminator_uses(live, &block->terminator);
+
+        // Walk backward, compacting the surviving instructions toward the end
+        size_t kept = block->instruction_count;
+        for (size_t i = block->instruction_count; i > 0; i--) {
+            ir_instruction_t *instruction = &block->instructions[i - 1];
+            bool self_copy = instruction->opcode == IR_COPY &&
+                             !instruction->left.is_constant &&
+                             instruction->left.reg == instruction->dest;
+            if (instruction->opcode != IR_PRINT &&
+                ((!live[instruction->dest] && !ir_may_trap(instruction)) || self_copy)) {
+                removed = true;
+                continue;
+            }
+            step_liveness(live, instruction);
+            block->instructions[--kept] = *instruction;
+        }
+        block->instruction_count -= kept;
+        memmove(block->instructions, &block->instructions[kept],
+                sizeof(ir_instruction_t) * block->instruction_count);
+    }
+    free(live);
+    free(live_in);
+    free(live_out);
+    return removed;
+}
+
+void ir_optimize(ir_function_t *function) {
+    propagate_copies(function);
+    while (eliminate_dead_code(function)) {
+    }
+}
+
+static void print_register(ir_register_t reg, FILE *stream) {
+    if (reg < IR_VARIABLE_COUNT) {
+        fprintf(stream, "%c", (char) ('A' + reg));
+    }
+    else {
+        fprintf(stream, "t%zu", reg - IR_VARIABLE_COUNT);
+    }
+}
+
+static void print_operand(const ir_operand_t *operand, FILE *stream) {
+    if (operand->is_constant) {
+        fprintf(stream, "%" PRId64, operand->value);
+    }
+    else {
+        print_register(operand->reg, stream);
+    }
+}
+
+static const char *operator_name(char op) {
+    switch (op) {
+        case SHIFT_LEFT_OP:
+            return "<<";
+        case SHIFT_RIGHT_OP:
+            return ">>";
+        case '+':
+            return "+";
+        case '-':
+            return "-";
+        case '*':
+            return "*";
+        case '/':
+            return "/";
+        case '<':
+            return "<";
+        case '=':
+            return "=";
+        case '>':
+            return ">";
+        default:
+            return "?";
+    }
+}
+
+void print_ir(ir_function_t *function, FILE *stream) {
+    for (size_t b = 0; b < function->block_count; b++) {
+        ir_block_t *block = &function->blocks[b];
+        fprintf(stream, "block %zu (loop depth %zu):\n", b, block->loop_depth);
+        for (size_t i = 0; i < block->instruction_count; i++) {
+            ir_instruction_t *instruction = &block->instructions[i];
+            fprintf(stream, "    ");
+            if (instruction->opcode == IR_PRINT) {
+                fprintf(stream, "print ");
+                print_operand(&instruction->left, stream);
+            }
+            else {
+                print_register(instruction->dest, stream);
+                fprintf(stream, " = ");
+                print_operand(&instruction->left, stream);
+                if (instruction->opcode == IR_BINARY) {
+                    fprintf(stream, " %s ", operator_name(instruction->op));
+                    print_operand(&instruction->right, stream);
+                }
+            }
+            fprintf(stream, "\n");
+        }
+
+        ir_terminator_t *terminator = &block->terminator;
+        switch (terminator->type) {
+            case IR_JUMP:
+                fprintf(stream, "    jump block %zu\n", terminator->target);
+                break;
+            case IR_BRANCH:
+                fprintf(stream, "    if ");
+                print_operand(&terminator->left, stream);
+                fprintf(stream, " %s ", operator_name(terminator->op));
+                print_operand(&terminator->right, stream);
+                fprintf(stream, " jump block %zu else block %zu\n", terminator->target,
+                        terminator->else_target);
+                break;
+            case IR_RETURN:
+                fprintf(stream, "    return\n");
+                break;
+        }
+    }
+}
+
+void free_ir(ir_function_t *function) {
+    for (size_t b = 0; b < function->block_count; b++) {
+        free(function->blocks[b].instructions);
+    }
+    free(function->blocks);
+    free(function);
+}
@@ -0,0 +1,826 @@
+#include "optimize.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** The number of TeenyBASIC variables ('A' to 'Z') */
+#define VARIABLE_COUNT 26
+
+/** The largest power of two that is a positive `value_t` is 2 to this power */
+const value_t MAX_SHIFT = 62;
+
+/** What is known about the variables' values at some point in the program */
+typedef struct {
+    /** Whether each variable (indexed by `name - 'A'`) is known to hold `values[i]` */
+    bool known[VARIABLE_COUNT];
+    /** Each variable's value, only meaningful if `known` */
+    value_t values[VARIABLE_COUNT];
+} constants_t;
+
+/** A set of variables, where bit `name - 'A'` is set if the variable is in the set */
+typedef uint32_t variables_t;
+
+static variables_t variable_set(var_name_t name) {
+    return (variables_t) 1 << (name - 'A');
+}
+
+/** Gets the variables an expression reads */
+static variables_t used_variables(node_t *node) {
+    switch (node->type) {
+        case VAR:
+            return variable_set(((var_node_t *) node)->name);
+        case BINARY_OP: {
+            binary_node_t *binary = (binary_node_t *) node;
+            return used_variables(binary->left) | used_variables(binary->right);
+        }
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Gets the variables a statement reads or assigns.
+ *
+ * @param node the statement
+ * @param assigned_only whether to only include variables the statement might assign
+ */
+static variables_t statement_variables(node_t *node, bool assigned_only) {
+    switch (node->type) {
+        case SEQUENCE: {
+            sequence_node_t *sequence = (sequence_node_t *) node;
+            variables_t variables = 0;
+            for (size_t i = 0; i < sequence->statement_count; i++) {
+                variables |= statement_variables(sequence->statements[i], assigned_only);
+            }
+            return variables;
+        }
+        case PRINT:
+            return assigned_only ? 0 : used_variables(((print_node_t *) node)->expr);
+        case LET: {
+            let_node_t *let = (let_node_t *) node;
+            return variable_set(let->var) | (assigned_only ? 0 : used_variables(let->value));
+        }
+        case IF: {
+            if_node_t *if_node = (if_node_t *) node;
+            variables_t variables = statement_variables(if_node->if_branch, assigned_only);
+            if (if_node->else_branch != NULL) {
+                variables |= statement_variables(if_node->else_branch, assigned_only);
+            }
+            if (!assigned_only) {
+                variables |= used_variables((node_t *) if_node->condition);
+            }
+            return variables;
+        }
+        case WHILE: {
+            while_node_t *while_node = (while_node_t *) node;
+            variables_t variables = statement_variables(while_node->body, assigned_only);
+            if (!assigned_only) {
+                variables |= used_variables((node_t *) while_node->condition);
+            }
+            return variables;
+        }
+        default:
+            return 0;
+    }
+}
+
+/** Gets the variables a statement might assign */
+static variables_t assigned_variables(node_t *node) {
+    return statement_variables(node, true);
+}
+
+/** Checks whether a node is a NUM, and if so, gets its value */
+static bool get_num(node_t *node, value_t *value) {
+    if (node->type != NUM) {
+        return false;
+    }
+    *value = ((num_node_t *) node)->value;
+    return true;
+}
+
+static bool is_num(node_t *node, value_t value) {
+    value_t num = 0;
+    return get_num(node, &num) && num == value;
+}
+
+/**
+ * Gets the exponent of a power of two that can be shifted by.
+ *
+ * @return k if `value` is 2 to the power k for 1 <= k <= `MAX_SHIFT`, otherwise 0
+ */
+static value_t get_shift(value_t value) {
+    if (value < 2 || (value & (value - 1)) != 0) {
+        return 0;
+    }
+    value_t shift = __builtin_ctzll(value);
+    return shift <= MAX_SHIFT ? shift : 0;
+}
+
+/**
+ * Checks whether evaluating an expression could crash the program,
+ * i.e. it divides by something that might be 0 or -1 (INT64_MIN / -1 overflows).
+ * Such expressions must still be evaluated, even if their values are unused.
+ */
+static bool may_trap(node_t *node) {
+    if (node->type != BINARY_OP) {
+        return false;
+    }
+    binary_node_t *binary = (binary_node_t *) node;
+    value_t divisor;
+    if (binary->op == '/' &&
+        !(get_num(binary->right, &divisor) && divisor != 0 && divisor != -1)) {
+        return true;
+    }
+    return may_trap(binary->left) || may_trap(binary->right);
+}
+
+/**
+ * Computes the result of a binary operation on two constants,
+ * with the same wraparound behavior as the compiled code.
+ *
+ * @return false if the operation would crash at run time, so it can't be folded
+ */
+static bool evaluate(char op, value_t left, value_t right, value_t *result) {
+    // Unsigned arithmetic wraps around instead of overflowing
+    uint64_t left_bits = left, right_bits = right;
+    switch (op) {
+        case '+':
+            *result = (value_t) (left_bits + right_bits);
+            return true;
+        case '-':
+            *result = (value_t) (left_bits - right_bits);
+            return true;
+        case '*':
+            *result = (value_t) (left_bits * right_bits);
+            return true;
+        case '/':
+            if (right == 0 || (left == INT64_MIN && right == -1)) {
+                return false;
+            }
+            *result = left / right;
+            return true;
+        case '<':
+            *result = left < right;
+            return true;
+        case '=':
+            *result = left == right;
+            return true;
+        case '>':
+            *result = left > right;
+            return true;
+        case SHIFT_LEFT_OP:
+            *result = (value_t) (left_bits << right);
+            return true;
+        case SHIFT_RIGHT_OP:
+            *result = left / ((value_t) 1 << right);
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * Frees a binary node except for one of its children.
+ *
+ * @param binary the node to free
+ * @param child `&binary->left` or `&binary->right`
+ * @return the child that was kept
+ */
+static node_t *keep_child(binary_node_t *binary, node_t **child) {
+    node_t *kept = *child;
+    // A placeholder, so free_ast() doesn't free the kept child
+    *child = init_num_node(0);
+    free_ast((node_t *) binary);
+    return kept;
+}
+
+/** Frees a node and returns a NUM node in its place */
+static node_t *replace_with_num(node_t *node, value_t value) {
+    free_ast(node);
+    return init_num_node(value);
+}
+
+static node_t *optimize_expression(node_t *node, const constants_t *constants);
+
+static node_t *optimize_binary(binary_node_t *binary, const constants_t *constants) {
+    binary->left = optimize_expression(binary->left, constants);
+    binary->right = optimize_expression(binary->right, constants);
+    value_t left = 0, right = 0, result;
+    bool left_constant = get_num(binary->left, &left);
+    bool right_constant = get_num(binary->right, &right);
+    if (left_constant && right_constant && evaluate(binary->op, left, right, &result)) {
+        return replace_with_num((node_t *) binary, result);
+    }
+
+    switch (binary->op) {
+        case '+':
+            if (is_num(binary->left, 0)) {
+                return keep_child(binary, &binary->right);
+            }
+            if (is_num(binary->right, 0)) {
+                return keep_child(binary, &binary->left);
+            }
+            break;
+        case '-':
+            if (is_num(binary->right, 0)) {
+                return keep_child(binary, &binary->left);
+            }
+            if (binary->left->type == VAR && binary->right->type == VAR &&
+                ((var_node_t *) binary->left)->name == ((var_node_t *) binary->right)->name) {
+                return replace_with_num((node_t *) binary, 0);
+            }
+            break;
+        case '*': {
+            if (is_num(binary->right, 1)) {
+                return keep_child(binary, &binary->left);
+            }
+            if (is_num(binary->left, 1)) {
+                return keep_child(binary, &binary->right);
+            }
+            if ((is_num(binary->left, 0) && !may_trap(binary->right)) ||
+                (is_num(binary->right, 0) && !may_trap(binary->left))) {
+                return replace_with_num((node_t *) binary, 0);
+            }
+            // Put a power of two on the right, so it can become a shift
+            if (left_constant && get_shift(left) != 0) {
+                node_t *power = binary->left;
+                binary->left = binary->right;
+                binary->right = power;
+                right = left;
+                right_constant = true;
+            }
+            value_t shift;
+            if (right_constant && (shift = get_shift(right)) != 0) {
+                binary->op = SHIFT_LEFT_OP;
+                ((num_node_t *) binary->right)->value = shift;
+            }
+            break;
+        }
+        case '/': {
+            if (is_num(binary->right, 1)) {
+                return keep_child(binary, &binary->left);
+            }
+            value_t shift;
+            if (right_constant && (shift = get_shift(right)) != 0) {
+                binary->op = SHIFT_RIGHT_OP;
+                ((num_node_t *) binary->right)->value = shift;
+            }
+            break;
+        }
+    }
+    return (node_t *) binary;
+}
+
+/**
+ * Optimizes an expression.
+ *
+ * @param node the expression, which is freed if it is replaced
+ * @param constants the variables known to be constant where the expression is evaluated
+ * @return the optimized expression
+ */
+static node_t *optimize_expression(node_t *node, const constants_t *constants) {
+    switch (node->type) {
+        case VAR: {
+            size_t var = ((var_node_t *) node)->name - 'A';
+            if (constants->known[var]) {
+                return replace_with_num(node, constants->values[var]);
+            }
+            return node;
+        }
+        case BINARY_OP:
+            return optimize_binary((binary_node_t *) node, constants);
+        default:
+            return node;
+    }
+}
+
+/**
+ * Optimizes the sides of an IF or WHILE condition.
+ * The condition itself stays a comparison, but its value may become known.
+ *
+ * @param condition the condition to optimize
+ * @param constants the variables known to be constant where the condition is checked
+ * @param value set to whether the condition holds, if that is known
+ * @return whether the condition's value is known
+ */
+static bool optimize_condition(binary_node_t *condition, const constants_t *constants,
+                               bool *value) {
+    condition->left = optimize_expression(condition->left, constants);
+    condition->right = optimize_expression(condition->right, constants);
+    value_t left = 0, right = 0, result;
+    if (get_num(condition->left, &left) && get_num(condition->right, &right) &&
+        evaluate(condition->op, left, right, &result)) {
+        *value = result;
+        return true;
+    }
+    return false;
+}
+
+/** Marks the given variables as unknown */
+static void forget_variables(constants_t *constants, variables_t variables) {
+    for (size_t var = 0; var < VARIABLE_COUNT; var++) {
+        if (variables & variable_set('A' + var)) {
+            constants->known[var] = false;
+        }
+    }
+}
+
+/** Keeps only the constants that are the same in both `constants` and `other` */
+static void merge_constants(constants_t *constants, const constants_t *other) {
+    for (size_t var = 0; var < VARIABLE_COUNT; var++) {
+        constants->known[var] = constants->known[var] && other->known[var] &&
+                                constants->values[var] == other->values[var];
+    }
+}
+
+static node_t *empty_statement(void) {
+    return init_sequence_node(0, NULL);
+}
+
+static node_t *optimize_statement(node_t *node, constants_t *constants);
+
+static node_t *optimize_if(if_node_t *if_node, constants_t *constants) {
+    bool value;
+    if (optimize_condition(if_node->condition, constants, &value)) {
+        // Only one branch can run, so replace the IF statement with it
+        node_t **branch = value ? &if_node->if_branch : &if_node->else_branch;
+        node_t *taken = *branch != NULL ? *branch : empty_statement();
+        *branch = empty_statement();
+        free_ast((node_t *) if_node);
+        return optimize_statement(taken, constants);
+    }
+
+    constants_t else_constants = *constants;
+    if_node->if_branch = optimize_statement(if_node->if_branch, constants);
+    if (if_node->else_branch != NULL) {
+        if_node->else_branch = optimize_statement(if_node->else_branch, &else_constants);
+    }
+    merge_constants(constants, &else_constants);
+    return (node_t *) if_node;
+}
+
+static node_t *optimize_while(while_node_t *while_node, constants_t *constants) {
+    // Anything the body assigns might have changed by the time the condition is checked
+    forget_variables(constants, assigned_variables(while_node->body));
+    bool value;
+    if (optimize_condition(while_node->condition, constants, &value) && !value) {
+        free_ast((node_t *) while_node);
+        return empty_statement();
+    }
+
+    constants_t body_constants = *constants;
+    while_node->body = optimize_statement(while_node->body, &body_constants);
+    return (node_t *) while_node;
+}
+
+/**
+ * Optimizes a statement.
+ *
+ * @param node the statement, which is freed if it is replaced
+ * @param constants the variables known to be constant before the statement runs.
+ *   This is updated to the variables known to be constant after it runs.
+ * @return the optimized statement
+ */
+static node_t *optimize_statement(node_t *node, constants_t *constants) {
+    switch (node->type) {
+        case SEQUENCE: {
+            sequence_node_t *sequence = (sequence_node_t *) node;
+            for (size_t i = 0; i < sequence->statement_count; i++) {
+                sequence->statements[i] =
+                    optimize_statement(sequence->statements[i], constants);
+            }
+            return node;
+        }
+        case PRINT: {
+            print_node_t *print = (print_node_t *) node;
+            print->expr = optimize_expression(print->expr, constants);
+            return node;
+        }
+        case LET: {
+            let_node_t *let = (let_node_t *) node;
+            let->value = optimize_expression(let->value, constants);
+            size_t var = let->var - 'A';
+            constants->known[var] = get_num(let->value, &constants->values[var]);
+            return node;
+        }
+        case IF:
+            return optimize_if((if_node_t *) node, constants);
+        case WHILE:
+            return optimize_while((while_node_t *) node, constants);
+        default:
+            return node;
+    }
+}
+
+/** A WHILE loop that code is being moved out of */
+typedef struct {
+    /** The variables the program doesn't use, which can hold new values */
+    variables_t *unused;
+    /** The variables the loop might assign */
+    variables_t assigned;
+    /** LET statements of new variables, which run right before the loop */
+    node_t *preheader[VARIABLE_COUNT];
+    size_t preheader_count;
+    /** The induction variable whose products are being replaced */
+    var_name_t induction;
+    /** The factors the induction variable is multiplied by in the replaced products */
+    node_t *factors[VARIABLE_COUNT];
+    /** The variables that replace the products with each factor */
+    var_name_t products[VARIABLE_COUNT];
+    size_t product_count;
+} loop_t;
+
+/** An expression transformation applied by `rewrite_expressions()` */
+typedef node_t *(*rewrite_t)(node_t *node, loop_t *loop);
+
+static bool is_var(node_t *node, var_name_t name) {
+    return node->type == VAR && ((var_node_t *) node)->name == name;
+}
+
+/** Checks whether two expressions are the same, so they always have the same value */
+static bool same_expression(node_t *node1, node_t *node2) {
+    if (node1->type != node2->type) {
+        return false;
+    }
+    switch (node1->type) {
+        case NUM:
+            return ((num_node_t *) node1)->value == ((num_node_t *) node2)->value;
+        case VAR:
+            return ((var_node_t *) node1)->name == ((var_node_t *) node2)->name;
+        case BINARY_OP: {
+            binary_node_t *binary1 = (binary_node_t *) node1,
+                          *binary2 = (binary_node_t *) node2;
+            return binary1->op == binary2->op &&
+                   same_expression(binary1->left, binary2->left) &&
+                   same_expression(binary1->right, binary2->right);
+        }
+        default:
+            return false;
+    }
+}
+
+/** Copies a NUM or VAR node */
+static node_t *copy_operand(node_t *node) {
+    if (node->type == NUM) {
+        return init_num_node(((num_node_t *) node)->value);
+    }
+    return init_var_node(((var_node_t *) node)->name);
+}
+
+/**
+ * Picks a variable the program doesn't use to hold a new value.
+ *
+ * @return false if every variable is already used
+ */
+static bool new_variable(loop_t *loop, var_name_t *var) {
+    if (*loop->unused == 0) {
+        return false;
+    }
+    *var = 'A' + __builtin_ctz(*loop->unused);
+    *loop->unused &= ~variable_set(*var);
+    return true;
+}
+
+/** Adds `LET var = value` to the statements that run before the loop */
+static void add_to_preheader(loop_t *loop, var_name_t var, node_t *value) {
+    assert(loop->preheader_count < VARIABLE_COUNT);
+    loop->preheader[loop->preheader_count++] = init_let_node(var, value);
+}
+
+/**
+ * Replaces every expression in a statement with the result of a transformation.
+ * Both sides of IF and WHILE conditions are transformed, but not the comparisons.
+ */
+static void rewrite_expressions(node_t *node, rewrite_t rewrite, loop_t *loop) {
+    switch (node->type) {
+        case SEQUENCE: {
+            sequence_node_t *sequence = (sequence_node_t *) node;
+            for (size_t i = 0; i < sequence->statement_count; i++) {
+                rewrite_expressions(sequence->statements[i], rewrite, loop);
+            }
+            break;
+        }
+        case PRINT: {
+            print_node_t *print = (print_node_t *) node;
+            print->expr = rewrite(print->expr, loop);
+            break;
+        }
+        case LET: {
+            let_node_t *let = (let_node_t *) node;
+            let->value = rewrite(let->value, loop);
+            break;
+        }
+        case IF: {
+            if_node_t *if_node = (if_node_t *) node;
+            if_node->condition->left = rewrite(if_node->condition->left, loop);
+            if_node->condition->right = rewrite(if_node->condition->right, loop);
+            rewrite_expressions(if_node->if_branch, rewrite, loop);
+            if (if_node->else_branch != NULL) {
+                rewrite_expressions(if_node->else_branch, rewrite, loop);
+            }
+            break;
+        }
+        case WHILE: {
+            while_node_t *while_node = (while_node_t *) node;
+            while_node->condition->left = rewrite(while_node->condition->left, loop);
+            while_node->condition->right = rewrite(while_node->condition->right, loop);
+            rewrite_expressions(while_node->body, rewrite, loop);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+/**
+ * Moves the largest loop-invariant subexpressions of an expression before the loop.
+ * Each one is computed into a new variable, which replaces it in the loop.
+ * Expressions that might crash are left alone, since the loop might not evaluate them.
+ */
+static node_t *hoist_invariants(node_t *node, loop_t *loop) {
+    if (node->type != BINARY_OP) {
+        return node;
+    }
+    binary_node_t *binary = (binary_node_t *) node;
+    if ((used_variables(node) & loop->assigned) != 0 || may_trap(node)) {
+        binary->left = hoist_invariants(binary->left, loop);
+        binary->right = hoist_invariants(binary->right, loop);
+        return node;
+    }
+
+    size_t i;
+    for (i = 0; i < loop->preheader_count; i++) {
+        let_node_t *let = (let_node_t *) loop->preheader[i];
+        if (same_expression(let->value, node)) {
+            break;
+        }
+    }
+    var_name_t var;
+    if (i < loop->preheader_count) {
+        var = ((let_node_t *) loop->preheader[i])->var;
+        free_ast(node);
+    }
+    else if (new_variable(loop, &var)) {
+        add_to_preheader(loop, var, node);
+    }
+    else {
+        return node;
+    }
+    return init_var_node(var);
+}
+
+/**
+ * Replaces products of the loop's induction variable and a loop-invariant factor
+ * with new variables. Each new variable starts out as the product before the loop
+ * and is kept up to date by `reduce_strength()`.
+ */
+static node_t *replace_products(node_t *node, loop_t *loop) {
+    if (node->type != BINARY_OP) {
+        return node;
+    }
+    binary_node_t *binary = (binary_node_t *) node;
+    node_t *factor = NULL;
+    if (binary->op == '*') {
+        if (is_var(binary->left, loop->induction)) {
+            factor = binary->right;
+        }
+        else if (is_var(binary->right, loop->induction)) {
+            factor = binary->left;
+        }
+    }
+    bool invariant = factor != NULL &&
+                     (factor->type == NUM ||
+                      (factor->type == VAR && (used_variables(factor) & loop->assigned) == 0));
+    if (!invariant) {
+        binary->left = replace_products(binary->left, loop);
+        binary->right = replace_products(binary->right, loop);
+        return node;
+    }
+
+    size_t i;
+    for (i = 0; i < loop->product_count; i++) {
+        if (same_expression(loop->factors[i], factor)) {
+            break;
+        }
+    }
+    if (i == loop->product_count) {
+        var_name_t product;
+        if (!new_variable(loop, &product)) {
+            return node;
+        }
+        node_t *copy = copy_operand(factor);
+        add_to_preheader(loop, product,
+                         init_binary_node('*', init_var_node(loop->induction), copy));
+        loop->factors[i] = copy;
+        loop->products[i] = product;
+        loop->assigned |= variable_set(product);
+        loop->product_count++;
+    }
+    free_ast(node);
+    return init_var_node(loop->products[i]);
+}
+
+/**
+ * Finds the statement that updates a loop's induction variable.
+ * An induction variable is assigned exactly once in the loop, by a statement
+ * like `LET I = I + 3` that runs every iteration (i.e. it isn't in an IF or WHILE).
+ *
+ * @param slot where the loop body is stored
+ * @param var the variable to look for
+ * @param step set to the amount the variable changes by each iteration
+ * @return where the updating statement is stored, or NULL if `var` isn't an
+ *   induction variable
+ */
+static node_t **find_induction_update(node_t **slot, var_name_t var, value_t *step) {
+    node_t *node = *slot;
+    if (node->type == SEQUENCE) {
+        sequence_node_t *sequence = (sequence_node_t *) node;
+        for (size_t i = 0; i < sequence->statement_count; i++) {
+            node_t **update = find_induction_update(&sequence->statements[i], var, step);
+            if (update != NULL) {
+                return update;
+            }
+        }
+        return NULL;
+    }
+    if (node->type != LET || ((let_node_t *) node)->var != var) {
+        return NULL;
+    }
+
+    node_t *value = ((let_node_t *) node)->value;
+    if (value->type != BINARY_OP) {
+        return NULL;
+    }
+    binary_node_t *binary = (binary_node_t *) value;
+    if (binary->op == '+' && is_var(binary->left, var) && get_num(binary->right, step)) {
+        return slot;
+    }
+    if (binary->op == '+' && is_var(binary->right, var) && get_num(binary->left, step)) {
+        return slot;
+    }
+    if (binary->op == '-' && is_var(binary->left, var) && get_num(binary->right, step)) {
+        *step = (value_t) -(uint64_t) *step;
+        return slot;
+    }
+    return NULL;
+}
+
+/**
+ * Counts how many LET statements assign a variable.
+ */
+static size_t count_assignments(node_t *node, var_name_t var) {
+    switch (node->type) {
+        case SEQUENCE: {
+            sequence_node_t *sequence = (sequence_node_t *) node;
+            size_t count = 0;
+            for (size_t i = 0; i < sequence->statement_count; i++) {
+                count += count_assignments(sequence->statements[i], var);
+            }
+            return count;
+        }
+        case LET:
+            return ((let_node_t *) node)->var == var;
+        case IF: {
+            if_node_t *if_node = (if_node_t *) node;
+            size_t count = count_assignments(if_node->if_branch, var);
+            if (if_node->else_branch != NULL) {
+                count += count_assignments(if_node->else_branch, var);
+            }
+            return count;
+        }
+        case WHILE:
+            return count_assignments(((while_node_t *) node)->body, var);
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Replaces products of each of a loop's induction variables and loop-invariant
+ * factors with new variables. Since `I` changes by `step` each iteration,
+ * `I * k` changes by `step * k`, so the multiplication becomes an addition
+ * right after `I`'s update.
+ */
+static void reduce_strength(while_node_t *while_node, loop_t *loop) {
+    for (var_name_t var = 'A'; var < 'A' + VARIABLE_COUNT; var++) {
+        value_t step;
+        node_t **update;
+        if (!(loop->assigned & variable_set(var)) ||
+            count_assignments(while_node->body, var) != 1 ||
+            (update = find_induction_update(&while_node->body, var, &step)) == NULL) {
+            continue;
+        }
+
+        loop->induction = var;
+        loop->product_count = 0;
+        while_node->condition->left = replace_products(while_node->condition->left, loop);
+        while_node->condition->right = replace_products(while_node->condition->right, loop);
+        rewrite_expressions(while_node->body, replace_products, loop);
+        if (loop->product_count == 0) {
+            continue;
+        }
+
+        // Follow the induction variable's update with an update of each product
+        node_t **statements = malloc(sizeof(node_t *) * (loop->product_count + 1));
+        assert(statements != NULL);
+        statements[0] = *update;
+        for (size_t i = 0; i < loop->product_count; i++) {
+            node_t *factor = loop->factors[i];
+            node_t *increment;
+            value_t value;
+            if (get_num(factor, &value)) {
+                increment = init_num_node((value_t) ((uint64_t) step * (uint64_t) value));
+            }
+            else if (step == 1) {
+                increment = copy_operand(factor);
+            }
+            else {
+                increment = init_binary_node('*', copy_operand(factor), init_num_node(step));
+            }
+            var_name_t product = loop->products[i];
+            statements[i + 1] = init_let_node(
+                product, init_binary_node('+', init_var_node(product), increment));
+        }
+        *update = init_sequence_node(loop->product_count + 1, statements);
+    }
+}
+
+static node_t *optimize_loops(node_t *node, variables_t *unused);
+
+/**
+ * Moves loop-invariant computations out of a WHILE loop and reduces the strength
+ * of multiplications by its induction variables, then does the same to inner loops.
+ *
+ * @return the loop, or a SEQUENCE of the statements to run before it and the loop
+ */
+static node_t *optimize_loop(while_node_t *while_node, variables_t *unused) {
+    loop_t loop = {
+        .unused = unused,
+        .assigned = assigned_variables(while_node->body),
+        .preheader_count = 0,
+    };
+    reduce_strength(while_node, &loop);
+    while_node->condition->left = hoist_invariants(while_node->condition->left, &loop);
+    while_node->condition->right = hoist_invariants(while_node->condition->right, &loop);
+    rewrite_expressions(while_node->body, hoist_invariants, &loop);
+
+    // Inner loops are optimized afterward, so they don't recompute what was hoisted here
+    while_node->body = optimize_loops(while_node->body, unused);
+    if (loop.preheader_count == 0) {
+        return (node_t *) while_node;
+    }
+
+    node_t **statements = malloc(sizeof(node_t *) * (loop.preheader_count + 1));
+    assert(statements != NULL);
+    memcpy(statements, loop.preheader, sizeof(node_t *) * loop.preheader_count);
+    statements[loop.preheader_count] = (node_t *) while_node;
+    return init_sequence_node(loop.preheader_count + 1, statements);
+}
+
+/**
+ * Optimizes the WHILE loops in a statement with `optimize_loop()`.
+ *
+ * @param node the statement, which is freed if it is replaced
+ * @param unused the variables the program doesn't use, which is updated
+ *   as variables are used to hold hoisted values
+ * @return the optimized statement
+ */
+static node_t *optimize_loops(node_t *node, variables_t *unused) {
+    switch (node->type) {
+        case SEQUENCE: {
+            sequence_node_t *sequence = (sequence_node_t *) node;
+            for (size_t i = 0; i < sequence->statement_count; i++) {
+                sequence->statements[i] = optimize_loops(sequence->statements[i], unused);
+            }
+            return node;
+        }
+        case IF: {
+            if_node_t *if_node = (if_node_t *) node;
+            if_node->if_branch = optimize_loops(if_node->if_branch, unused);
+            if (if_node->else_branch != NULL) {
+                if_node->else_branch = optimize_loops(if_node->else_branch, unused);
+            }
+            return node;
+        }
+        case WHILE:
+            return optimize_loop((while_node_t *) node, unused);
+        default:
+            return node;
+    }
+}
+
+node_t *optimize_ast(node_t *node) {
+    // Every variable starts out as 0
+    constants_t constants;
+    for (size_t var = 0; var < VARIABLE_COUNT; var++) {
+        constants.known[var] = true;
+        constants.values[var] = 0;
+    }
+    node = optimize_statement(node, &constants);
+
+    variables_t unused = ~statement_variables(node, false) & (variable_set('Z') * 2 - 1);
+    return optimize_loops(node, &unused);
+}
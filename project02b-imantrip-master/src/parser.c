@@ -0,0 +1,499 @@
+#include "parser.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/** The number of bytes to read at a time from a stream that can't be memory-mapped */
+const size_t READ_BLOCK_SIZE = 64 * 1024;
+/** The number of statements that an IF or WHILE body initially has room for */
+const size_t INITIAL_BLOCK_CAPACITY = 4;
+
+struct parser {
+    /** The next character to parse */
+    const char *position;
+    /** The end of the source code */
+    const char *end;
+    /** The line that `position` is on, for error messages */
+    size_t line;
+    /** Whether a parse error has been reported */
+    bool failed;
+    /** The memory holding the source code if the parser owns it, otherwise NULL */
+    void *memory;
+    /** The number of bytes in `memory` if it is memory-mapped, or 0 if it is heap-allocated */
+    size_t mapped_size;
+};
+
+static parser_t *new_parser(const char *source, size_t length) {
+    parser_t *parser = malloc(sizeof(parser_t));
+    assert(parser != NULL);
+    parser->position = source;
+    parser->end = source + length;
+    parser->line = 1;
+    parser->failed = false;
+    parser->memory = NULL;
+    parser->mapped_size = 0;
+    return parser;
+}
+
+parser_t *parser_init_buffer(const char *source, size_t length) {
+    return new_parser(source, length);
+}
+
+parser_t *parser_init_file(FILE *stream) {
+    int descriptor = fileno(stream);
+    off_t start = ftello(stream);
+    struct stat info;
+    if (start >= 0 && fstat(descriptor, &info) == 0 && S_ISREG(info.st_mode) &&
+        info.st_size > start) {
+        size_t size = info.st_size;
+        void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+        if (mapping != MAP_FAILED) {
+            madvise(mapping, size, MADV_SEQUENTIAL);
+            // Consume the stream, as if the whole file had been read from it
+            fseeko(stream, 0, SEEK_END);
+            parser_t *parser = new_parser((char *) mapping + start, size - start);
+            parser->memory = mapping;
+            parser->mapped_size = size;
+            return parser;
+        }
+    }
+
+    size_t length = 0;
+    size_t capacity = READ_BLOCK_SIZE;
+    char *buffer = malloc(capacity);
+    assert(buffer != NULL);
+    while (true) {
+        if (capacity - length < READ_BLOCK_SIZE) {
+            capacity *= 2;
+            buffer = realloc(buffer, capacity);
+            assert(buffer != NULL);
+        }
+        size_t read = fread(buffer + length, 1, READ_BLOCK_SIZE, stream);
+        length += read;
+        if (read < READ_BLOCK_SIZE) {
+            break;
+        }
+    }
+    parser_t *parser = new_parser(buffer, length);
+    parser->memory = buffer;
+    return parser;
+}
+
+bool parser_failed(parser_t *parser) {
+    return parser->failed;
+}
+
+void parser_free(parser_t *parser) {
+    if (parser->mapped_size > 0) {
+        munmap(parser->memory, parser->mapped_size);
+    }
+    else {
+        free(parser->memory);
+    }
+    free(parser);
+}
+
+/** Reports a parse error on the current line and returns NULL */
+static void *parse_error(parser_t *parser, const char *message) {
+    if (!parser->failed) {
+        fprintf(stderr, "Parse error on line %zu: %s\n", parser->line, message);
+        parser->failed = true;
+    }
+    return NULL;
+}
+
+/** Gets the character `offset` characters ahead, or '\0' past the end of the source */
+static inline char peek_at(parser_t *parser, size_t offset) {
+    return (size_t) (parser->end - parser->position) > offset ? parser->position[offset] : '\0';
+}
+
+static inline char peek(parser_t *parser) {
+    return peek_at(parser, 0);
+}
+
+static inline bool is_digit(char c) {
+    return '0' <= c && c <= '9';
+}
+
+static inline bool is_letter(char c) {
+    return 'A' <= c && c <= 'Z';
+}
+
+/** Gets the value of a hexadecimal digit, or -1 if the character isn't one */
+static inline int hex_digit(char c) {
+    if (is_digit(c)) {
+        return c - '0';
+    }
+    if ('a' <= c && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if ('A' <= c && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+/** Skips spaces and a comment, stopping at the end of the line */
+static void skip_spaces(parser_t *parser) {
+    const char *position = parser->position, *end = parser->end;
+    while (position < end && (*position == ' ' || *position == '\t' || *position == '\r')) {
+        position++;
+    }
+    if (position < end && *position == '#') {
+        const char *newline = memchr(position, '\n', end - position);
+        position = newline == NULL ? end : newline;
+    }
+    parser->position = position;
+}
+
+/** Skips any number of blank lines and comments */
+static void skip_lines(parser_t *parser) {
+    while (true) {
+        skip_spaces(parser);
+        if (peek(parser) != '\n') {
+            break;
+        }
+        parser->position++;
+        parser->line++;
+    }
+}
+
+/** Consumes a character if it is next (after any spaces) */
+static bool accept(parser_t *parser, char c) {
+    skip_spaces(parser);
+    if (peek(parser) != c) {
+        return false;
+    }
+    parser->position++;
+    return true;
+}
+
+/** Checks whether a keyword is next (and isn't just the start of a longer word) */
+static bool at_keyword(parser_t *parser, const char *keyword) {
+    size_t length = strlen(keyword);
+    return (size_t) (parser->end - parser->position) >= length &&
+           memcmp(parser->position, keyword, length) == 0 &&
+           !is_letter(peek_at(parser, length));
+}
+
+/** Consumes a keyword if it is next (after any spaces) */
+static bool accept_keyword(parser_t *parser, const char *keyword) {
+    skip_spaces(parser);
+    if (!at_keyword(parser, keyword)) {
+        return false;
+    }
+    parser->position += strlen(keyword);
+    return true;
+}
+
+/** Consumes the end of the current line, which must not have anything else on it */
+static bool expect_line_end(parser_t *parser) {
+    skip_spaces(parser);
+    if (parser->position == parser->end) {
+        return true;
+    }
+    if (*parser->position != '\n') {
+        parse_error(parser, "expected the end of the line");
+        return false;
+    }
+    parser->position++;
+    parser->line++;
+    return true;
+}
+
+static node_t *parse_expression(parser_t *parser);
+
+/** Parses a decimal or hexadecimal literal, which can be negative */
+static node_t *parse_number(parser_t *parser) {
+    bool negative = accept(parser, '-');
+    if (!is_digit(peek(parser))) {
+        return parse_error(parser, "expected an expression");
+    }
+
+    // Literals wrap around like TeenyBASIC arithmetic, so -2^63 can be written
+    uint64_t value = 0;
+    const char *position = parser->position, *end = parser->end;
+    if (peek(parser) == '0' && (peek_at(parser, 1) == 'x' || peek_at(parser, 1) == 'X') &&
+        hex_digit(peek_at(parser, 2)) >= 0) {
+        position += 2;
+        int digit;
+        while (position < end && (digit = hex_digit(*position)) >= 0) {
+            value = value * 16 + digit;
+            position++;
+        }
+    }
+    else {
+        while (position < end && is_digit(*position)) {
+            value = value * 10 + (*position - '0');
+            position++;
+        }
+    }
+    parser->position = position;
+    return init_num_node((value_t) (negative ? -value : value));
+}
+
+/** Parses a number, a variable, or a parenthesized expression */
+static node_t *parse_factor(parser_t *parser) {
+    if (accept(parser, '(')) {
+        node_t *expression = parse_expression(parser);
+        if (expression == NULL) {
+            return NULL;
+        }
+        if (!accept(parser, ')')) {
+            free_ast(expression);
+            return parse_error(parser, "expected ')'");
+        }
+        return expression;
+    }
+
+    char c = peek(parser);
+    if (is_letter(c) && !is_letter(peek_at(parser, 1))) {
+        parser->position++;
+        return init_var_node(c);
+    }
+    return parse_number(parser);
+}
+
+/**
+ * Parses a left-associative chain of binary operations.
+ *
+ * @param parser the parser to read from
+ * @param parse_operand parses each operand
+ * @param op1 one of the operators in the chain
+ * @param op2 the other operator in the chain
+ * @return the expression, or NULL on a parse error
+ */
+static node_t *parse_operations(parser_t *parser, node_t *(*parse_operand)(parser_t *),
+                                char op1, char op2) {
+    node_t *left = parse_operand(parser);
+    while (left != NULL) {
+        skip_spaces(parser);
+        char op = peek(parser);
+        if (op != op1 && op != op2) {
+            break;
+        }
+        parser->position++;
+        node_t *right = parse_operand(parser);
+        if (right == NULL) {
+            free_ast(left);
+            return NULL;
+        }
+        left = init_binary_node(op, left, right);
+    }
+    return left;
+}
+
+static node_t *parse_term(parser_t *parser) {
+    return parse_operations(parser, parse_factor, '*', '/');
+}
+
+static node_t *parse_sum(parser_t *parser) {
+    return parse_operations(parser, parse_term, '+', '-');
+}
+
+/** Parses an arithmetic expression, optionally compared with another one */
+static node_t *parse_expression(parser_t *parser) {
+    node_t *left = parse_sum(parser);
+    if (left == NULL) {
+        return NULL;
+    }
+    skip_spaces(parser);
+    char op = peek(parser);
+    if (op != '<' && op != '=' && op != '>') {
+        return left;
+    }
+    parser->position++;
+    node_t *right = parse_sum(parser);
+    if (right == NULL) {
+        free_ast(left);
+        return NULL;
+    }
+    return init_binary_node(op, left, right);
+}
+
+/** Parses the condition of an IF or WHILE statement and the end of its line */
+static binary_node_t *parse_condition(parser_t *parser) {
+    node_t *condition = parse_expression(parser);
+    if (condition == NULL) {
+        return NULL;
+    }
+    binary_node_t *binary = (binary_node_t *) condition;
+    if (condition->type != BINARY_OP ||
+        (binary->op != '<' && binary->op != '=' && binary->op != '>')) {
+        free_ast(condition);
+        return parse_error(parser, "expected a comparison");
+    }
+    if (!expect_line_end(parser)) {
+        free_ast(condition);
+        return NULL;
+    }
+    return binary;
+}
+
+static node_t *parse_statement(parser_t *parser);
+
+/**
+ * Parses the statements in the body of an IF or WHILE statement,
+ * up to (but not including) the ELSE or END that ends it.
+ */
+static node_t *parse_block(parser_t *parser) {
+    size_t statement_count = 0;
+    size_t capacity = INITIAL_BLOCK_CAPACITY;
+    node_t **statements = malloc(sizeof(node_t *) * capacity);
+    assert(statements != NULL);
+    while (true) {
+        skip_lines(parser);
+        if (at_keyword(parser, "END") || at_keyword(parser, "ELSE")) {
+            return init_sequence_node(statement_count, statements);
+        }
+
+        node_t *statement = parser->position == parser->end
+                                ? parse_error(parser, "expected END")
+                                : parse_statement(parser);
+        if (statement == NULL) {
+            for (size_t i = 0; i < statement_count; i++) {
+                free_ast(statements[i]);
+            }
+            free(statements);
+            return NULL;
+        }
+        if (statement_count == capacity) {
+            capacity *= 2;
+            statements = realloc(statements, sizeof(node_t *) * capacity);
+            assert(statements != NULL);
+        }
+        statements[statement_count++] = statement;
+    }
+}
+
+/** Parses `END <keyword>` and the end of its line */
+static bool expect_end(parser_t *parser, const char *keyword) {
+    if (!accept_keyword(parser, "END") || !accept_keyword(parser, keyword)) {
+        parse_error(parser, strcmp(keyword, "IF") == 0 ? "expected END IF" : "expected END WHILE");
+        return false;
+    }
+    return expect_line_end(parser);
+}
+
+static node_t *parse_if(parser_t *parser) {
+    binary_node_t *condition = parse_condition(parser);
+    if (condition == NULL) {
+        return NULL;
+    }
+    node_t *if_branch = parse_block(parser);
+    if (if_branch == NULL) {
+        free_ast((node_t *) condition);
+        return NULL;
+    }
+    node_t *else_branch = NULL;
+    if (accept_keyword(parser, "ELSE")) {
+        if (!expect_line_end(parser) || (else_branch = parse_block(parser)) == NULL) {
+            free_ast((node_t *) condition);
+            free_ast(if_branch);
+            return NULL;
+        }
+    }
+    node_t *if_node = init_if_node(condition, if_branch, else_branch);
+    if (!expect_end(parser, "IF")) {
+        free_ast(if_node);
+        return NULL;
+    }
+    return if_node;
+}
+
+static node_t *parse_while(parser_t *parser) {
+    binary_node_t *condition = parse_condition(parser);
+    if (condition == NULL) {
+        return NULL;
+    }
+    node_t *body = parse_block(parser);
+    if (body == NULL) {
+        free_ast((node_t *) condition);
+        return NULL;
+    }
+    node_t *while_node = init_while_node(condition, body);
+    if (!expect_end(parser, "WHILE")) {
+        free_ast(while_node);
+        return NULL;
+    }
+    return while_node;
+}
+
+/** Parses a statement (and the end of its line), starting at its keyword */
+static node_t *parse_statement(parser_t *parser) {
+    if (accept_keyword(parser, "PRINT")) {
+        node_t *expr = parse_expression(parser);
+        if (expr == NULL) {
+            return NULL;
+        }
+        if (!expect_line_end(parser)) {
+            free_ast(expr);
+            return NULL;
+        }
+        return init_print_node(expr);
+    }
+    if (accept_keyword(parser, "LET")) {
+        skip_spaces(parser);
+        var_name_t var = peek(parser);
+        if (!is_letter(var) || is_letter(peek_at(parser, 1))) {
+            return parse_error(parser, "expected a variable");
+        }
+        parser->position++;
+        if (!accept(parser, '=')) {
+            return parse_error(parser, "expected '='");
+        }
+        node_t *value = parse_expression(parser);
+        if (value == NULL) {
+            return NULL;
+        }
+        if (!expect_line_end(parser)) {
+            free_ast(value);
+            return NULL;
+        }
+        return init_let_node(var, value);
+    }
+    if (accept_keyword(parser, "IF")) {
+        return parse_if(parser);
+    }
+    if (accept_keyword(parser, "WHILE")) {
+        return parse_while(parser);
+    }
+    return parse_error(parser, "expected a statement");
+}
+
+node_t *parser_next(parser_t *parser) {
+    if (parser->failed) {
+        return NULL;
+    }
+    skip_lines(parser);
+    if (parser->position == parser->end) {
+        return NULL;
+    }
+    return parse_statement(parser);
+}
+
+/** The stream that `parse()` is reading from, or NULL if none */
+static FILE *parse_stream = NULL;
+/** The parser for `parse_stream` */
+static parser_t *stream_parser = NULL;
+
+node_t *parse(FILE *stream) {
+    if (stream != parse_stream) {
+        if (stream_parser != NULL) {
+            parser_free(stream_parser);
+        }
+        parse_stream = stream;
+        stream_parser = parser_init_file(stream);
+    }
+    node_t *statement = parser_next(stream_parser);
+    if (statement == NULL) {
+        parser_free(stream_parser);
+        parse_stream = NULL;
+        stream_parser = NULL;
+    }
+    return statement;
+}
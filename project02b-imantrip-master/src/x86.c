@@ -0,0 +1,423 @@
+#include "x86.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/** The number of bytes, labels, or jumps a buffer initially has room for */
+const size_t INITIAL_ASSEMBLER_CAPACITY = 256;
+
+/** Indicates a label that hasn't been defined yet */
+#define UNDEFINED_LABEL ((size_t) -1)
+
+const char *const REGISTER_NAMES[] = {
+    "%rax", "%rcx", "%rdx", "%rbx", "%rsp", "%rbp", "%rsi", "%rdi",
+    "%r8",  "%r9",  "%r10", "%r11", "%r12", "%r13", "%r14", "%r15",
+};
+
+/** A jump whose 32-bit displacement must be filled in once its label is defined */
+typedef struct {
+    /** The offset of the displacement in the code */
+    size_t offset;
+    size_t label;
+} fixup_t;
+
+struct assembler {
+    /** Whether machine code is being encoded, rather than assembly printed */
+    bool binary;
+    void (*print_int)(int64_t);
+    uint8_t *code;
+    size_t code_size;
+    size_t code_capacity;
+    /** The code offset of each label, or `UNDEFINED_LABEL` */
+    size_t *labels;
+    size_t label_capacity;
+    fixup_t *fixups;
+    size_t fixup_count;
+    size_t fixup_capacity;
+};
+
+static assembler_t *assembler_init(bool binary, void (*print_int)(int64_t)) {
+    assembler_t *assembler = malloc(sizeof(assembler_t));
+    assert(assembler != NULL);
+    assembler->binary = binary;
+    assembler->print_int = print_int;
+    assembler->code_size = 0;
+    assembler->code_capacity = INITIAL_ASSEMBLER_CAPACITY;
+    assembler->code = malloc(assembler->code_capacity);
+    assembler->label_capacity = INITIAL_ASSEMBLER_CAPACITY;
+    assembler->labels = malloc(sizeof(size_t) * assembler->label_capacity);
+    assembler->fixup_count = 0;
+    assembler->fixup_capacity = INITIAL_ASSEMBLER_CAPACITY;
+    assembler->fixups = malloc(sizeof(fixup_t) * assembler->fixup_capacity);
+    assert(assembler->code != NULL && assembler->labels != NULL &&
+           assembler->fixups != NULL);
+    for (size_t label = 0; label < assembler->label_capacity; label++) {
+        assembler->labels[label] = UNDEFINED_LABEL;
+    }
+    return assembler;
+}
+
+assembler_t *assembler_init_text(void) {
+    return assembler_init(false, NULL);
+}
+
+assembler_t *assembler_init_binary(void (*print_int)(int64_t)) {
+    return assembler_init(true, print_int);
+}
+
+static void emit_byte(assembler_t *assembler, uint8_t byte) {
+    if (assembler->code_size == assembler->code_capacity) {
+        assembler->code_capacity *= 2;
+        assembler->code = realloc(assembler->code, assembler->code_capacity);
+        assert(assembler->code != NULL);
+    }
+    assembler->code[assembler->code_size++] = byte;
+}
+
+static void emit_bytes(assembler_t *assembler, uint64_t value, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        emit_byte(assembler, value >> (8 * i));
+    }
+}
+
+/**
+ * Emits an instruction's REX prefix, opcode, ModRM byte, and displacement.
+ *
+ * @param opcode the opcode bytes, most significant first (e.g. 0x0FAF)
+ * @param opcode_size the number of opcode bytes
+ * @param reg the register (or opcode extension) in the ModRM reg field
+ * @param rm the register or stack slot in the ModRM r/m field
+ * @param wide whether the instruction operates on 64 bits (REX.W)
+ */
+static void emit_modrm(assembler_t *assembler, uint32_t opcode, size_t opcode_size,
+                       uint8_t reg, x86_operand_t rm, bool wide) {
+    uint8_t base = rm.type == X86_REGISTER ? rm.reg : RBP;
+    uint8_t rex = 0x40 | (wide ? 0x08 : 0) | (reg >= 8 ? 0x04 : 0) | (base >= 8 ? 0x01 : 0);
+    if (rex != 0x40) {
+        emit_byte(assembler, rex);
+    }
+    for (size_t i = opcode_size; i > 0; i--) {
+        emit_byte(assembler, opcode >> (8 * (i - 1)));
+    }
+
+    uint8_t reg_bits = (reg & 7) << 3;
+    if (rm.type == X86_REGISTER) {
+        emit_byte(assembler, 0xC0 | reg_bits | (rm.reg & 7));
+    }
+    else if (INT8_MIN <= rm.offset && rm.offset <= INT8_MAX) {
+        emit_byte(assembler, 0x40 | reg_bits | RBP);
+        emit_byte(assembler, rm.offset);
+    }
+    else {
+        emit_byte(assembler, 0x80 | reg_bits | RBP);
+        emit_bytes(assembler, (uint32_t) rm.offset, 4);
+    }
+}
+
+/** Writes an operand in AT&T syntax */
+static void format_operand(x86_operand_t operand, char *buffer, size_t size) {
+    switch (operand.type) {
+        case X86_REGISTER:
+            snprintf(buffer, size, "%s", REGISTER_NAMES[operand.reg]);
+            break;
+        case X86_STACK_SLOT:
+            snprintf(buffer, size, "%" PRId32 "(%%rbp)", operand.offset);
+            break;
+        case X86_IMMEDIATE:
+            snprintf(buffer, size, "$%" PRId64, operand.immediate);
+            break;
+    }
+}
+
+/** Prints a two-operand instruction in AT&T syntax */
+static void print_instruction(const char *mnemonic, x86_operand_t source,
+                              x86_operand_t destination) {
+    char source_text[32], destination_text[32];
+    format_operand(source, source_text, sizeof(source_text));
+    format_operand(destination, destination_text, sizeof(destination_text));
+    printf("    %s %s, %s\n", mnemonic, source_text, destination_text);
+}
+
+bool x86_same_location(x86_operand_t operand1, x86_operand_t operand2) {
+    if (operand1.type != operand2.type) {
+        return false;
+    }
+    switch (operand1.type) {
+        case X86_REGISTER:
+            return operand1.reg == operand2.reg;
+        case X86_STACK_SLOT:
+            return operand1.offset == operand2.offset;
+        default:
+            return false;
+    }
+}
+
+void x86_mov(assembler_t *assembler, x86_operand_t source, x86_operand_t destination) {
+    assert(destination.type != X86_IMMEDIATE);
+    assert(source.type != X86_STACK_SLOT || destination.type != X86_STACK_SLOT);
+    bool wide_immediate =
+        source.type == X86_IMMEDIATE && !x86_fits_immediate(source.immediate);
+    assert(!wide_immediate || destination.type == X86_REGISTER);
+    if (!assembler->binary) {
+        print_instruction(wide_immediate ? "movabsq" : "movq", source, destination);
+        return;
+    }
+
+    if (wide_immediate) {
+        // REX.W B8+r io
+        emit_byte(assembler, 0x48 | (destination.reg >= 8 ? 0x01 : 0));
+        emit_byte(assembler, 0xB8 | (destination.reg & 7));
+        emit_bytes(assembler, source.immediate, 8);
+    }
+    else if (source.type == X86_IMMEDIATE) {
+        emit_modrm(assembler, 0xC7, 1, 0, destination, true);
+        emit_bytes(assembler, (uint32_t) source.immediate, 4);
+    }
+    else if (source.type == X86_REGISTER) {
+        emit_modrm(assembler, 0x89, 1, source.reg, destination, true);
+    }
+    else {
+        emit_modrm(assembler, 0x8B, 1, destination.reg, source, true);
+    }
+}
+
+void x86_arithmetic(assembler_t *assembler, x86_arithmetic_t op, x86_operand_t source,
+                    x86_register_t destination) {
+    assert(source.type != X86_IMMEDIATE || x86_fits_immediate(source.immediate));
+    if (!assembler->binary) {
+        const char *const MNEMONICS[] = {
+            [X86_ADD] = "addq", [X86_SUB] = "subq", [X86_IMUL] = "imulq", [X86_CMP] = "cmpq"};
+        print_instruction(MNEMONICS[op], source, x86_reg(destination));
+        return;
+    }
+
+    if (op == X86_IMUL) {
+        if (source.type == X86_IMMEDIATE) {
+            // imul r64, r/m64, imm32
+            emit_modrm(assembler, 0x69, 1, destination, x86_reg(destination), true);
+            emit_bytes(assembler, (uint32_t) source.immediate, 4);
+        }
+        else {
+            emit_modrm(assembler, 0x0FAF, 2, destination, source, true);
+        }
+        return;
+    }
+
+    // The "r64, r/m64" opcode and the "r/m64, imm32" extension of each operation
+    const uint8_t OPCODES[] = {[X86_ADD] = 0x03, [X86_SUB] = 0x2B, [X86_CMP] = 0x3B};
+    const uint8_t EXTENSIONS[] = {[X86_ADD] = 0, [X86_SUB] = 5, [X86_CMP] = 7};
+    if (source.type == X86_IMMEDIATE) {
+        emit_modrm(assembler, 0x81, 1, EXTENSIONS[op], x86_reg(destination), true);
+        emit_bytes(assembler, (uint32_t) source.immediate, 4);
+    }
+    else {
+        emit_modrm(assembler, OPCODES[op], 1, destination, source, true);
+    }
+}
+
+void x86_shift(assembler_t *assembler, x86_shift_t op, uint8_t amount,
+               x86_register_t destination) {
+    if (!assembler->binary) {
+        const char *const MNEMONICS[] = {[X86_SHL] = "shlq", [X86_SHR] = "shrq", [X86_SAR] = "sarq"};
+        print_instruction(MNEMONICS[op], x86_immediate(amount), x86_reg(destination));
+        return;
+    }
+
+    // C1 /ext ib
+    const uint8_t EXTENSIONS[] = {[X86_SHL] = 4, [X86_SHR] = 5, [X86_SAR] = 7};
+    emit_modrm(assembler, 0xC1, 1, EXTENSIONS[op], x86_reg(destination), true);
+    emit_byte(assembler, amount);
+}
+
+void x86_divide(assembler_t *assembler, x86_operand_t divisor) {
+    assert(divisor.type != X86_IMMEDIATE);
+    if (!assembler->binary) {
+        char divisor_text[32];
+        format_operand(divisor, divisor_text, sizeof(divisor_text));
+        printf("    cqto\n");
+        printf("    idivq %s\n", divisor_text);
+        return;
+    }
+
+    emit_byte(assembler, 0x48);
+    emit_byte(assembler, 0x99);
+    emit_modrm(assembler, 0xF7, 1, 7, divisor, true);
+}
+
+static const char *condition_suffix(x86_condition_t condition) {
+    switch (condition) {
+        case X86_EQUAL:
+            return "e";
+        case X86_NOT_EQUAL:
+            return "ne";
+        case X86_LESS:
+            return "l";
+        case X86_GREATER_EQUAL:
+            return "ge";
+        case X86_LESS_EQUAL:
+            return "le";
+        case X86_GREATER:
+            return "g";
+        default:
+            assert(false && "Invalid condition");
+            return NULL;
+    }
+}
+
+void x86_set_condition(assembler_t *assembler, x86_condition_t condition) {
+    assert(condition != X86_ALWAYS);
+    if (!assembler->binary) {
+        printf("    set%s %%al\n", condition_suffix(condition));
+        printf("    movzbq %%al, %%rax\n");
+        return;
+    }
+
+    // setcc %al (0F 90+cc), then movzbq %al, %rax (REX.W 0F B6)
+    emit_modrm(assembler, 0x0F90 | condition, 2, 0, x86_reg(RAX), false);
+    emit_modrm(assembler, 0x0FB6, 2, RAX, x86_reg(RAX), true);
+}
+
+void x86_jump(assembler_t *assembler, x86_condition_t condition, size_t label) {
+    if (!assembler->binary) {
+        if (condition == X86_ALWAYS) {
+            printf("    jmp .L%zu\n", label);
+        }
+        else {
+            printf("    j%s .L%zu\n", condition_suffix(condition), label);
+        }
+        return;
+    }
+
+    if (condition == X86_ALWAYS) {
+        emit_byte(assembler, 0xE9);
+    }
+    else {
+        emit_byte(assembler, 0x0F);
+        emit_byte(assembler, 0x80 | condition);
+    }
+    if (assembler->fixup_count == assembler->fixup_capacity) {
+        assembler->fixup_capacity *= 2;
+        assembler->fixups =
+            realloc(assembler->fixups, sizeof(fixup_t) * assembler->fixup_capacity);
+        assert(assembler->fixups != NULL);
+    }
+    assembler->fixups[assembler->fixup_count++] =
+        (fixup_t) {.offset = assembler->code_size, .label = label};
+    emit_bytes(assembler, 0, 4);
+}
+
+void x86_label(assembler_t *assembler, size_t label) {
+    if (!assembler->binary) {
+        printf(".L%zu:\n", label);
+        return;
+    }
+
+    if (label >= assembler->label_capacity) {
+        size_t old_capacity = assembler->label_capacity;
+        while (label >= assembler->label_capacity) {
+            assembler->label_capacity *= 2;
+        }
+        assembler->labels =
+            realloc(assembler->labels, sizeof(size_t) * assembler->label_capacity);
+        assert(assembler->labels != NULL);
+        for (size_t i = old_capacity; i < assembler->label_capacity; i++) {
+            assembler->labels[i] = UNDEFINED_LABEL;
+        }
+    }
+    assembler->labels[label] = assembler->code_size;
+}
+
+void x86_call_print_int(assembler_t *assembler) {
+    if (!assembler->binary) {
+        printf("    call print_int\n");
+        return;
+    }
+
+    // The code may be too far from print_int() for a 32-bit displacement,
+    // so call through the scratch register %r11 instead
+    x86_mov(assembler, x86_immediate((int64_t) (uintptr_t) assembler->print_int),
+            x86_reg(R11));
+    emit_modrm(assembler, 0xFF, 1, 2, x86_reg(R11), false);
+}
+
+void x86_push(assembler_t *assembler, x86_register_t reg) {
+    if (!assembler->binary) {
+        printf("    pushq %s\n", REGISTER_NAMES[reg]);
+        return;
+    }
+    if (reg >= 8) {
+        emit_byte(assembler, 0x41);
+    }
+    emit_byte(assembler, 0x50 | (reg & 7));
+}
+
+void x86_pop(assembler_t *assembler, x86_register_t reg) {
+    if (!assembler->binary) {
+        printf("    popq %s\n", REGISTER_NAMES[reg]);
+        return;
+    }
+    if (reg >= 8) {
+        emit_byte(assembler, 0x41);
+    }
+    emit_byte(assembler, 0x58 | (reg & 7));
+}
+
+void x86_load_address(assembler_t *assembler, int32_t offset, x86_register_t destination) {
+    if (!assembler->binary) {
+        print_instruction("leaq", x86_stack_slot(offset), x86_reg(destination));
+        return;
+    }
+    emit_modrm(assembler, 0x8D, 1, destination, x86_stack_slot(offset), true);
+}
+
+void x86_leave_return(assembler_t *assembler) {
+    if (!assembler->binary) {
+        printf("    leave\n");
+        printf("    ret\n");
+        return;
+    }
+    emit_byte(assembler, 0xC9);
+    emit_byte(assembler, 0xC3);
+}
+
+void *assembler_finish(assembler_t *assembler, size_t *size) {
+    if (!assembler->binary) {
+        *size = 0;
+        return NULL;
+    }
+
+    for (size_t i = 0; i < assembler->fixup_count; i++) {
+        fixup_t *fixup = &assembler->fixups[i];
+        assert(fixup->label < assembler->label_capacity &&
+               assembler->labels[fixup->label] != UNDEFINED_LABEL);
+        // Displacements are relative to the end of the jump instruction
+        int32_t displacement =
+            (int32_t) (assembler->labels[fixup->label] - (fixup->offset + 4));
+        memcpy(&assembler->code[fixup->offset], &displacement, sizeof(displacement));
+    }
+
+    // Write the code while the memory is writable, then make it executable instead
+    void *code = mmap(NULL, assembler->code_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) {
+        return NULL;
+    }
+    memcpy(code, assembler->code, assembler->code_size);
+    if (mprotect(code, assembler->code_size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(code, assembler->code_size);
+        return NULL;
+    }
+    *size = assembler->code_size;
+    return code;
+}
+
+void assembler_free(assembler_t *assembler) {
+    free(assembler->code);
+    free(assembler->labels);
+    free(assembler->fixups);
+    free(assembler);
+}
@@ -36,6 +36,18 @@
 	"rm.rep", \
 	"xterm.rep"
 
+/*
+ * These synthetic traces make up the stress suite, which the driver runs
+ * instead of the default tracefiles with the -s flag. They are tens of
+ * millions of ops each, so they aren't shipped; write them into TRACEDIR
+ * with "gentrace -S traces" (the presets are in gentrace.c).
+ */
+#define STRESS_TRACEFILES \
+	"stress-geometric.rep", \
+	"stress-bimodal.rep", \
+	"stress-login.rep", \
+	"stress-churn.rep"
+
 /*
  * Students get 0 points for this point or below (ops / sec)
  */
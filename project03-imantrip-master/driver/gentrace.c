@@ -0,0 +1,592 @@
+/*
+ * gentrace.c - Synthetic malloc trace generator
+ *
+ * Writes a .rep trace in the format the drivers read: four header lines,
+ * then one "a id size", "f id", or "r id size" request per line.
+ *
+ * Block sizes come from a size distribution, and each block is freed when
+ * its lifetime (in ops, from a lifetime distribution) runs out, or earlier
+ * if the live payload would otherwise exceed the live-set target. At the
+ * end, every block still live is freed, so the trace is balanced. Ids are
+ * reused once their block is freed, so the drivers' per-id arrays only
+ * need to be as large as the largest live set, and traces can have
+ * hundreds of millions of ops.
+ *
+ * Size distributions (-s):
+ *     geometric:<mean>               sizes 1, 2, ..., with the given mean
+ *     bimodal:<small>,<large>,<p>    <large> with probability <p>, else <small>
+ *     hist:<file>                    a recorded histogram, "<size> <count>" per line
+ *     trace:<file>                   the alloc/realloc sizes in an existing trace
+ * Lifetime distributions (-L), in ops:
+ *     exp:<mean>                     exponential
+ *     uniform:<min>,<max>            uniform
+ *     pareto:<min>,<alpha>           heavy-tailed: most blocks die young, a few live long
+ *
+ * With -S <dir>, instead writes the whole stress suite (STRESS_TRACEFILES
+ * in config.h) into <dir>, from the presets below.
+ */
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+
+/* Misc constants */
+#define MAXLINE 1024           /* max string size */
+#define HEADER_WIDTH 20        /* header fields are padded, so they can be rewritten at the end */
+#define OUTBUF_SIZE (1 << 20)  /* bytes of requests buffered before each write */
+#define MAX_SIZE (1 << 30)     /* largest block size generated */
+
+/* Defaults for the command line options */
+#define DEFAULT_NUM_OPS 1000000
+#define DEFAULT_LIVE_BYTES (16 << 20)
+#define DEFAULT_SIZES "geometric:64"
+#define DEFAULT_LIFETIMES "exp:10000"
+
+typedef enum {GEOMETRIC, BIMODAL, HISTOGRAM} size_dist_type;
+typedef enum {EXPONENTIAL, UNIFORM, PARETO} lifetime_dist_type;
+
+/* A distribution of block sizes */
+typedef struct {
+    size_dist_type type;
+    double mean;              /* GEOMETRIC */
+    size_t small, large;      /* BIMODAL */
+    double p_large;
+    int num_buckets;          /* HISTOGRAM: sizes[i] with weight weights[i] - weights[i - 1] */
+    size_t *sizes;
+    uint64_t *weights;        /* cumulative */
+} size_dist_t;
+
+/* A distribution of block lifetimes, in ops */
+typedef struct {
+    lifetime_dist_type type;
+    double a, b;              /* mean; min, max; or min, alpha */
+} lifetime_dist_t;
+
+/* Everything needed to generate one trace */
+typedef struct {
+    char *name;               /* file name, for the presets */
+    uint64_t num_ops;
+    uint64_t live_bytes;      /* live-set target */
+    char *sizes;
+    char *lifetimes;
+    double realloc_fraction;  /* fraction of ops that reallocate a live block */
+    uint64_t seed;
+} trace_spec_t;
+
+/*
+ * The stress suite. Keep these in sync with STRESS_TRACEFILES in config.h.
+ * trace:login.rep is relative to the trace directory (-t).
+ */
+static trace_spec_t stress_presets[] = {
+    /* Many small, mostly short-lived blocks */
+    {"stress-geometric.rep", 20000000, 64 << 20, "geometric:48", "exp:20000", 0.0, 1},
+    /* Small blocks mixed with pages, with heavy-tailed lifetimes */
+    {"stress-bimodal.rep", 20000000, 128 << 20, "bimodal:32,4096,0.05", "pareto:100,1.2", 0.0, 2},
+    /* login.rep's sizes at scale, with some reallocation */
+    {"stress-login.rep", 20000000, 32 << 20, "trace:login.rep", "exp:5000", 0.02, 3},
+    /* Rapid churn of larger blocks, which stresses coalescing */
+    {"stress-churn.rep", 20000000, 16 << 20, "geometric:512", "uniform:1,200", 0.05, 4},
+};
+#define NUM_STRESS_PRESETS (sizeof(stress_presets) / sizeof(stress_presets[0]))
+
+/* A live block, in the heap of blocks ordered by when they die */
+typedef struct {
+    uint64_t death;           /* op after which the block is freed */
+    uint32_t id;
+} live_block_t;
+
+static char tracedir[MAXLINE] = TRACEDIR;
+static uint64_t rng_state;
+
+/* The output buffer */
+static FILE *outfile;
+static char outbuf[OUTBUF_SIZE];
+static size_t outbuf_used = 0;
+
+/* Prototypes */
+static void generate(trace_spec_t *spec, char *path);
+static void parse_sizes(char *spec, size_dist_t *dist);
+static void parse_lifetimes(char *spec, lifetime_dist_t *dist);
+static void usage(void);
+static void app_error(char *msg);
+static void unix_error(char *msg);
+
+int main(int argc, char **argv)
+{
+    char c;
+    char *outpath = NULL;
+    char *stress_dir = NULL;
+    trace_spec_t spec = {NULL, DEFAULT_NUM_OPS, DEFAULT_LIVE_BYTES,
+                         DEFAULT_SIZES, DEFAULT_LIFETIMES, 0.0, 1};
+
+    while ((c = getopt(argc, argv, "o:n:l:s:L:r:x:S:t:h")) != EOF) {
+        switch (c) {
+        case 'o': /* Output trace file */
+            outpath = optarg;
+            break;
+        case 'n': /* Number of ops */
+            spec.num_ops = strtoull(optarg, NULL, 10);
+            break;
+        case 'l': /* Live-set target in bytes, with an optional K, M, or G suffix */
+        {
+            char *end;
+            spec.live_bytes = strtoull(optarg, &end, 10);
+            if (*end == 'K' || *end == 'k')
+                spec.live_bytes <<= 10;
+            else if (*end == 'M' || *end == 'm')
+                spec.live_bytes <<= 20;
+            else if (*end == 'G' || *end == 'g')
+                spec.live_bytes <<= 30;
+            break;
+        }
+        case 's': /* Size distribution */
+            spec.sizes = optarg;
+            break;
+        case 'L': /* Lifetime distribution */
+            spec.lifetimes = optarg;
+            break;
+        case 'r': /* Fraction of ops that are reallocs */
+            spec.realloc_fraction = atof(optarg);
+            break;
+        case 'x': /* Random seed */
+            spec.seed = strtoull(optarg, NULL, 10);
+            break;
+        case 'S': /* Write the stress suite into a directory */
+            stress_dir = optarg;
+            break;
+        case 't': /* Directory where trace:<file> sizes are read from */
+            if (strlen(optarg) >= MAXLINE - 1)
+                app_error("Trace directory name is too long");
+            strcpy(tracedir, optarg);
+            if (tracedir[strlen(tracedir) - 1] != '/')
+                strcat(tracedir, "/");
+            break;
+        case 'h':
+        default:
+            usage();
+        }
+    }
+
+    if (stress_dir != NULL) {
+        for (size_t i = 0; i < NUM_STRESS_PRESETS; i++) {
+            char *path = malloc(strlen(stress_dir) + strlen(stress_presets[i].name) + 2);
+            if (path == NULL)
+                unix_error("malloc failed in main");
+            sprintf(path, "%s/%s", stress_dir, stress_presets[i].name);
+            printf("Writing %s\n", path);
+            generate(&stress_presets[i], path);
+            free(path);
+        }
+    }
+    else {
+        if (outpath == NULL || spec.num_ops == 0 || spec.live_bytes == 0 ||
+            spec.realloc_fraction < 0 || spec.realloc_fraction >= 1)
+            usage();
+        generate(&spec, outpath);
+    }
+    exit(0);
+}
+
+/*
+ * random_u64, random_double - xorshift64* pseudo-random numbers, so a seed
+ *     always generates the same trace
+ */
+static uint64_t random_u64(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+/* A random double in (0, 1] */
+static double random_double(void)
+{
+    return ((random_u64() >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * sample_size - Pick a block size from a size distribution
+ */
+static size_t sample_size(size_dist_t *dist)
+{
+    size_t size;
+    switch (dist->type) {
+    case GEOMETRIC:
+        /* The number of trials until the first success, with p = 1 / mean */
+        if (dist->mean <= 1)
+            return 1;
+        size = (size_t) ceil(log(random_double()) / log1p(-1 / dist->mean));
+        break;
+    case BIMODAL:
+        size = random_double() <= dist->p_large ? dist->large : dist->small;
+        break;
+    case HISTOGRAM:
+    default:
+    {
+        uint64_t target = random_u64() % dist->weights[dist->num_buckets - 1];
+        int lo = 0, hi = dist->num_buckets - 1;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (dist->weights[mid] > target)
+                hi = mid;
+            else
+                lo = mid + 1;
+        }
+        size = dist->sizes[lo];
+        break;
+    }
+    }
+    if (size < 1)
+        size = 1;
+    return size > MAX_SIZE ? MAX_SIZE : size;
+}
+
+/*
+ * sample_lifetime - Pick a block lifetime (in ops) from a lifetime distribution
+ */
+static uint64_t sample_lifetime(lifetime_dist_t *dist)
+{
+    double lifetime;
+    switch (dist->type) {
+    case EXPONENTIAL:
+        lifetime = -log(random_double()) * dist->a;
+        break;
+    case UNIFORM:
+        lifetime = dist->a + (dist->b - dist->a) * (1 - random_double());
+        break;
+    case PARETO:
+    default:
+        lifetime = dist->a / pow(random_double(), 1 / dist->b);
+        break;
+    }
+    return lifetime < 1 ? 1 : lifetime > 1e18 ? (uint64_t) 1e18 : (uint64_t) lifetime;
+}
+
+/*
+ * Min-heap of live blocks by death
+ */
+static void heap_push(live_block_t *heap, size_t *count, live_block_t block)
+{
+    size_t i = (*count)++;
+    while (i > 0 && heap[(i - 1) / 2].death > block.death) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = block;
+}
+
+static live_block_t heap_pop(live_block_t *heap, size_t *count)
+{
+    live_block_t top = heap[0];
+    live_block_t last = heap[--*count];
+    size_t i = 0;
+    while (2 * i + 1 < *count) {
+        size_t child = 2 * i + 1;
+        if (child + 1 < *count && heap[child + 1].death < heap[child].death)
+            child++;
+        if (heap[child].death >= last.death)
+            break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = last;
+    return top;
+}
+
+/*
+ * Buffered output of requests, since fprintf() is too slow for huge traces
+ */
+static void flush_output(void)
+{
+    if (fwrite(outbuf, 1, outbuf_used, outfile) != outbuf_used)
+        unix_error("Failed to write the trace");
+    outbuf_used = 0;
+}
+
+static void put_number(uint64_t n)
+{
+    char digits[20];
+    int count = 0;
+    do {
+        digits[count++] = '0' + n % 10;
+        n /= 10;
+    } while (n > 0);
+    while (count > 0)
+        outbuf[outbuf_used++] = digits[--count];
+}
+
+static void put_op(char type, uint32_t id, size_t size)
+{
+    if (outbuf_used + 64 > OUTBUF_SIZE)
+        flush_output();
+    outbuf[outbuf_used++] = type;
+    outbuf[outbuf_used++] = ' ';
+    put_number(id);
+    if (type != 'f') {
+        outbuf[outbuf_used++] = ' ';
+        put_number(size);
+    }
+    outbuf[outbuf_used++] = '\n';
+}
+
+static void write_header(uint64_t num_ids, uint64_t num_ops)
+{
+    /* The same header as the recorded traces that are checked for correctness */
+    fprintf(outfile, "%*d\n%*llu\n%*llu\n%*d\n", HEADER_WIDTH, 1,
+            HEADER_WIDTH, (unsigned long long) num_ids,
+            HEADER_WIDTH, (unsigned long long) num_ops, HEADER_WIDTH, 0);
+}
+
+/*
+ * generate - Write the trace described by spec to path
+ */
+static void generate(trace_spec_t *spec, char *path)
+{
+    size_dist_t sizes;
+    lifetime_dist_t lifetimes;
+    parse_sizes(spec->sizes, &sizes);
+    parse_lifetimes(spec->lifetimes, &lifetimes);
+    rng_state = spec->seed * 0x9E3779B97F4A7C15ULL + 1;
+
+    if ((outfile = fopen(path, "w")) == NULL) {
+        char msg[MAXLINE + 64];
+        sprintf(msg, "Could not open %s", path);
+        unix_error(msg);
+    }
+    /* Reserve room for the header, which is rewritten once the counts are known */
+    write_header(0, 0);
+
+    /* The live blocks, and the size and a free list (through free_ids) of each id */
+    size_t capacity = 1024, num_live = 0;
+    live_block_t *heap = malloc(capacity * sizeof(live_block_t));
+    uint32_t *block_sizes = malloc(capacity * sizeof(uint32_t));
+    uint32_t *free_ids = malloc(capacity * sizeof(uint32_t));
+    if (heap == NULL || block_sizes == NULL || free_ids == NULL)
+        unix_error("malloc failed in generate");
+    size_t num_free_ids = 0;
+    uint32_t num_ids = 0;
+    uint64_t live_bytes = 0, num_ops = 0;
+
+    /* Stop once freeing the live blocks would bring the trace to num_ops */
+    while (num_ops + num_live < spec->num_ops) {
+        if (num_live > 0 && (heap[0].death <= num_ops || live_bytes >= spec->live_bytes)) {
+            live_block_t block = heap_pop(heap, &num_live);
+            put_op('f', block.id, 0);
+            live_bytes -= block_sizes[block.id];
+            free_ids[num_free_ids++] = block.id;
+        }
+        else if (num_live > 0 && random_double() <= spec->realloc_fraction) {
+            uint32_t id = heap[random_u64() % num_live].id;
+            size_t size = sample_size(&sizes);
+            put_op('r', id, size);
+            live_bytes += size - block_sizes[id];
+            block_sizes[id] = size;
+        }
+        else {
+            uint32_t id;
+            if (num_free_ids > 0)
+                id = free_ids[--num_free_ids];
+            else {
+                if (num_ids == UINT32_MAX)
+                    app_error("Too many live blocks");
+                id = num_ids++;
+                if (num_ids > capacity) {
+                    capacity *= 2;
+                    heap = realloc(heap, capacity * sizeof(live_block_t));
+                    block_sizes = realloc(block_sizes, capacity * sizeof(uint32_t));
+                    free_ids = realloc(free_ids, capacity * sizeof(uint32_t));
+                    if (heap == NULL || block_sizes == NULL || free_ids == NULL)
+                        unix_error("realloc failed in generate");
+                }
+            }
+            size_t size = sample_size(&sizes);
+            live_block_t block = {num_ops + sample_lifetime(&lifetimes), id};
+            heap_push(heap, &num_live, block);
+            put_op('a', id, size);
+            live_bytes += size;
+            block_sizes[id] = size;
+        }
+        num_ops++;
+    }
+
+    /* Free the blocks that are still live, in the order they would have died */
+    while (num_live > 0) {
+        put_op('f', heap_pop(heap, &num_live).id, 0);
+        num_ops++;
+    }
+    flush_output();
+    rewind(outfile);
+    write_header(num_ids, num_ops);
+    if (fclose(outfile) != 0)
+        unix_error("Failed to write the trace");
+
+    free(heap);
+    free(block_sizes);
+    free(free_ids);
+    if (sizes.type == HISTOGRAM) {
+        free(sizes.sizes);
+        free(sizes.weights);
+    }
+}
+
+/*
+ * add_bucket - Add a weighted size to a histogram being read in
+ */
+static void add_bucket(size_dist_t *dist, int *capacity, size_t size, uint64_t weight)
+{
+    if (weight == 0)
+        return;
+    if (dist->num_buckets == *capacity) {
+        *capacity = *capacity == 0 ? 256 : 2 * *capacity;
+        dist->sizes = realloc(dist->sizes, *capacity * sizeof(size_t));
+        dist->weights = realloc(dist->weights, *capacity * sizeof(uint64_t));
+        if (dist->sizes == NULL || dist->weights == NULL)
+            unix_error("realloc failed in add_bucket");
+    }
+    uint64_t total = dist->num_buckets > 0 ? dist->weights[dist->num_buckets - 1] : 0;
+    dist->sizes[dist->num_buckets] = size;
+    dist->weights[dist->num_buckets] = total + weight;
+    dist->num_buckets++;
+}
+
+/*
+ * read_histogram - Read a size histogram, either "<size> <count>" lines
+ *     ('#' starts a comment) or the alloc/realloc sizes in a trace
+ */
+static void read_histogram(char *path, int from_trace, size_dist_t *dist)
+{
+    FILE *file;
+    char line[MAXLINE];
+    int capacity = 0;
+
+    if ((file = fopen(path, "r")) == NULL) {
+        char msg[MAXLINE + 64];
+        sprintf(msg, "Could not open %s", path);
+        unix_error(msg);
+    }
+    dist->num_buckets = 0;
+    dist->sizes = NULL;
+    dist->weights = NULL;
+    int line_number = 0;
+    while (fgets(line, MAXLINE, file) != NULL) {
+        unsigned long long size, count;
+        int id;
+        char type;
+        line_number++;
+        if (from_trace) {
+            /* One bucket per request is fine: sampling is a binary search */
+            if (line_number > 4 && sscanf(line, " %c %d %llu", &type, &id, &size) == 3 &&
+                (type == 'a' || type == 'r'))
+                add_bucket(dist, &capacity, size, 1);
+        }
+        else if (sscanf(line, "%llu %llu", &size, &count) == 2)
+            add_bucket(dist, &capacity, size, count);
+        else if (line[strspn(line, " \t\r\n")] != '#' && line[strspn(line, " \t\r\n")] != '\0')
+            app_error("Bogus line in size histogram");
+    }
+    fclose(file);
+    if (dist->num_buckets == 0)
+        app_error("Empty size histogram");
+}
+
+/*
+ * parse_sizes - Parse a size distribution from the command line
+ */
+static void parse_sizes(char *spec, size_dist_t *dist)
+{
+    char path[MAXLINE];
+    unsigned long small, large;
+    if (sscanf(spec, "geometric:%lf", &dist->mean) == 1 && dist->mean > 0)
+        dist->type = GEOMETRIC;
+    else if (sscanf(spec, "bimodal:%lu,%lu,%lf", &small, &large, &dist->p_large) == 3 &&
+             0 <= dist->p_large && dist->p_large <= 1) {
+        dist->type = BIMODAL;
+        dist->small = small;
+        dist->large = large;
+    }
+    else if (strncmp(spec, "hist:", 5) == 0) {
+        dist->type = HISTOGRAM;
+        read_histogram(spec + 5, 0, dist);
+    }
+    else if (strncmp(spec, "trace:", 6) == 0) {
+        if (strlen(tracedir) + strlen(spec + 6) + 1 > MAXLINE)
+            app_error("Trace path is too long");
+        /* Absolute paths aren't relative to the trace directory */
+        strcpy(path, spec[6] == '/' ? "" : tracedir);
+        strcat(path, spec + 6);
+        dist->type = HISTOGRAM;
+        read_histogram(path, 1, dist);
+    }
+    else {
+        fprintf(stderr, "Bogus size distribution: %s\n", spec);
+        usage();
+    }
+}
+
+/*
+ * parse_lifetimes - Parse a lifetime distribution from the command line
+ */
+static void parse_lifetimes(char *spec, lifetime_dist_t *dist)
+{
+    if (sscanf(spec, "exp:%lf", &dist->a) == 1 && dist->a > 0)
+        dist->type = EXPONENTIAL;
+    else if (sscanf(spec, "uniform:%lf,%lf", &dist->a, &dist->b) == 2 &&
+             0 <= dist->a && dist->a <= dist->b)
+        dist->type = UNIFORM;
+    else if (sscanf(spec, "pareto:%lf,%lf", &dist->a, &dist->b) == 2 &&
+             dist->a > 0 && dist->b > 0)
+        dist->type = PARETO;
+    else {
+        fprintf(stderr, "Bogus lifetime distribution: %s\n", spec);
+        usage();
+    }
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: gentrace [-h] -o <file> [-n <ops>] [-l <live bytes>] [-s <sizes>]\n"
+            "                [-L <lifetimes>] [-r <fraction>] [-x <seed>] [-t <dir>]\n"
+            "       gentrace [-t <dir>] -S <dir>\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h               Print this message.\n");
+    fprintf(stderr, "\t-l <live bytes>  Live-set target, with optional K/M/G suffix (default %d).\n",
+            DEFAULT_LIVE_BYTES);
+    fprintf(stderr, "\t-L <lifetimes>   exp:<mean>, uniform:<min>,<max>, or pareto:<min>,<alpha>\n"
+            "\t                 (in ops, default %s).\n", DEFAULT_LIFETIMES);
+    fprintf(stderr, "\t-n <ops>         Number of requests (default %d).\n", DEFAULT_NUM_OPS);
+    fprintf(stderr, "\t-o <file>        Write the trace to <file>.\n");
+    fprintf(stderr, "\t-r <fraction>    Fraction of requests that are reallocs (default 0).\n");
+    fprintf(stderr, "\t-s <sizes>       geometric:<mean>, bimodal:<small>,<large>,<p>, hist:<file>,\n"
+            "\t                 or trace:<file> (default %s).\n", DEFAULT_SIZES);
+    fprintf(stderr, "\t-S <dir>         Write the stress suite into <dir>.\n");
+    fprintf(stderr, "\t-t <dir>         Directory that trace:<file> is relative to.\n");
+    fprintf(stderr, "\t-x <seed>        Random seed (default 1).\n");
+    exit(1);
+}
+
+/*
+ * app_error - Report an arbitrary application error
+ */
+static void app_error(char *msg)
+{
+    printf("%s\n", msg);
+    exit(1);
+}
+
+/*
+ * unix_error - Report a Unix-style error
+ */
+static void unix_error(char *msg)
+{
+    printf("%s: %s\n", msg, strerror(errno));
+    exit(1);
+}
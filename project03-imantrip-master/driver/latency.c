@@ -0,0 +1,98 @@
+/*
+ * latency.c - Per-operation latency histograms
+ *
+ * Unlike fcyc(), which reports the K best times of a whole run, this
+ * records the time of every operation, so rare slow operations (such as
+ * a malloc that walks a long free list) show up in the tail percentiles.
+ */
+#include <string.h>
+
+#include "latency.h"
+
+/* Number of empty timings used to measure the cost of the timer itself */
+#define CALIBRATION_SAMPLES 10000
+
+/* Cycles spent in latency_start() and latency_stop(), subtracted from each latency */
+static uint64_t overhead = 0;
+
+/*
+ * init_latency - Measure the timer's overhead, as its fastest empty timing
+ */
+void init_latency(void)
+{
+    uint64_t best = UINT64_MAX;
+    for (int i = 0; i < CALIBRATION_SAMPLES; i++) {
+        uint64_t start = latency_start();
+        uint64_t stop = latency_stop();
+        if (stop - start < best)
+            best = stop - start;
+    }
+    overhead = best;
+}
+
+/*
+ * bucket_index - The histogram bucket that holds a latency
+ */
+static int bucket_index(uint64_t cycles)
+{
+    if (cycles < LAT_SUB_BUCKETS)
+        return cycles;
+    int msb = 63 - __builtin_clzll(cycles);
+    int shift = msb - LAT_SUB_BUCKET_BITS;
+    return (shift + 1) * LAT_SUB_BUCKETS + ((cycles >> shift) & (LAT_SUB_BUCKETS - 1));
+}
+
+/*
+ * bucket_max - The largest latency in a histogram bucket
+ */
+static uint64_t bucket_max(int index)
+{
+    if (index < LAT_SUB_BUCKETS)
+        return index;
+    int shift = index / LAT_SUB_BUCKETS - 1;
+    uint64_t sub_bucket = LAT_SUB_BUCKETS + index % LAT_SUB_BUCKETS;
+    return ((sub_bucket + 1) << shift) - 1;
+}
+
+/*
+ * latency_clear - Empty a histogram
+ */
+void latency_clear(latency_hist_t *hist)
+{
+    memset(hist, 0, sizeof(*hist));
+}
+
+/*
+ * latency_record - Add the latency between two cycle counter readings to a histogram
+ */
+void latency_record(latency_hist_t *hist, uint64_t start, uint64_t stop)
+{
+    uint64_t cycles = stop - start;
+    cycles = cycles > overhead ? cycles - overhead : 0;
+    hist->counts[bucket_index(cycles)]++;
+    hist->count++;
+    hist->total += cycles;
+    if (cycles > hist->max)
+        hist->max = cycles;
+}
+
+/*
+ * latency_percentile - Estimate a percentile of the latencies in a histogram
+ *     (using the nearest-rank method), as the top of the bucket it falls in
+ */
+uint64_t latency_percentile(latency_hist_t *hist, double percent)
+{
+    double exact_rank = percent / 100 * hist->count;
+    uint64_t rank = (uint64_t) exact_rank;
+    if (rank < exact_rank)
+        rank++;
+    if (rank == 0)
+        rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < LAT_BUCKETS; i++) {
+        seen += hist->counts[i];
+        if (seen >= rank)
+            return bucket_max(i) < hist->max ? bucket_max(i) : hist->max;
+    }
+    return hist->max;
+}
@@ -0,0 +1,49 @@
+/*
+ * latency.h - Per-operation latency histograms, timed with the cycle counter
+ */
+#ifndef __LATENCY_H_
+#define __LATENCY_H_
+
+#include <stdint.h>
+
+/*
+ * Latencies are bucketed log-linearly: exactly below LAT_SUB_BUCKETS cycles,
+ * then LAT_SUB_BUCKETS buckets per power of 2, so every bucket is within
+ * 1 / LAT_SUB_BUCKETS (about 6%) of the latencies in it.
+ */
+#define LAT_SUB_BUCKET_BITS 4
+#define LAT_SUB_BUCKETS (1 << LAT_SUB_BUCKET_BITS)
+#define LAT_BUCKETS ((64 - LAT_SUB_BUCKET_BITS + 1) * LAT_SUB_BUCKETS)
+
+typedef struct {
+    uint64_t counts[LAT_BUCKETS];
+    uint64_t count;     /* number of latencies recorded */
+    uint64_t total;     /* sum of the latencies, in cycles */
+    uint64_t max;       /* largest latency, in cycles */
+} latency_hist_t;
+
+/*
+ * latency_start, latency_stop - Read the cycle counter before and after
+ *     the timed code. The fences keep the timed code from being reordered
+ *     outside of the two reads.
+ */
+static inline uint64_t latency_start(void)
+{
+    uint32_t lo, hi;
+    asm volatile("lfence\n\trdtsc" : "=a" (lo), "=d" (hi) :: "memory");
+    return ((uint64_t) hi << 32) | lo;
+}
+
+static inline uint64_t latency_stop(void)
+{
+    uint32_t lo, hi;
+    asm volatile("rdtscp\n\tlfence" : "=a" (lo), "=d" (hi) :: "rcx", "memory");
+    return ((uint64_t) hi << 32) | lo;
+}
+
+void init_latency(void);
+void latency_clear(latency_hist_t *hist);
+void latency_record(latency_hist_t *hist, uint64_t start, uint64_t stop);
+uint64_t latency_percentile(latency_hist_t *hist, double percent);
+
+#endif /* __LATENCY_H_ */
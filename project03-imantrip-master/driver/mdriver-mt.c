@@ -0,0 +1,519 @@
+/*
+ * mdriver-mt.c - Multi-threaded malloc replay driver
+ *
+ * Splits each trace across N threads and replays the pieces concurrently,
+ * reporting throughput (ops / sec) for N = 1, 2, 4, ... up to a maximum
+ * (64 by default), so you can see how the allocator scales.
+ *
+ * Each thread gets a contiguous range of the trace's block ids, and replays
+ * every op on those ids in trace order, so each block's allocate, reallocate,
+ * and free ops still happen in order (although blocks in different threads
+ * interleave arbitrarily). Each thread replays its piece ITERATIONS times,
+ * freeing any blocks the trace leaves allocated at the end of each pass.
+ *
+ * With -l, it instead replays each trace once on a single thread, timing
+ * every op with the cycle counter, and reports latency percentiles for each
+ * type of op. It also samples the heap's utilization as the trace runs,
+ * which -u writes out as a CSV timeline, to show fragmentation building up.
+ *
+ * The allocator must be built thread-safe (compile mm.c with -DMM_THREAD_SAFE)
+ * and linked with memlib.c, latency.c, and -pthread.
+ */
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "config.h"
+#include "latency.h"
+#include "memlib.h"
+#include "mm.h"
+
+/* Misc constants */
+#define MAXLINE 1024        /* max string size */
+#define DEFAULT_MAX_THREADS 64
+#define DEFAULT_ITERATIONS 20
+#define TIMELINE_SAMPLES 200  /* utilization samples per trace in latency mode */
+
+/* The three types of allocator requests in a trace */
+typedef enum {ALLOC, FREE, REALLOC} traceop_type;
+#define NUM_OP_TYPES 3
+
+static char *op_names[NUM_OP_TYPES] = {"malloc", "free", "realloc"};
+
+/* One request in a trace */
+typedef struct {
+    traceop_type type; /* type of request */
+    int index;         /* index of the block in the trace's blocks */
+    size_t size;       /* byte size of alloc/realloc request */
+} traceop_t;
+
+/* A trace, read from a tracefile */
+typedef struct {
+    int num_ids;       /* number of alloc/realloc ids */
+    int num_ops;       /* number of distinct requests */
+    traceop_t *ops;    /* array of requests */
+} trace_t;
+
+/* The part of a trace that one thread replays */
+typedef struct {
+    trace_t *trace;
+    int first_id, last_id;   /* the ids this thread replays, [first_id, last_id) */
+    traceop_t *ops;          /* the ops on those ids, in trace order */
+    int num_ops;
+    void **blocks;           /* the trace's blocks, shared by all threads */
+    int iterations;
+    pthread_barrier_t *start;
+    struct timespec start_time, end_time;  /* when this thread started and finished */
+} replay_t;
+
+static char tracedir[MAXLINE] = TRACEDIR;
+static char *default_tracefiles[] = {DEFAULT_TRACEFILES, NULL};
+static char *stress_tracefiles[] = {STRESS_TRACEFILES, NULL};
+
+/* Prototypes */
+static trace_t *read_trace(char *tracedir, char *filename);
+static void free_trace(trace_t *trace);
+static void *replay(void *arg);
+static double time_replay(trace_t *trace, int num_threads, int iterations);
+static int timespec_before(struct timespec *a, struct timespec *b);
+static void latency_replay(trace_t *trace, char *name, FILE *timeline);
+static void usage(void);
+static void app_error(char *msg);
+static void unix_error(char *msg);
+
+int main(int argc, char **argv)
+{
+    char c;
+    char **tracefiles = default_tracefiles;
+    char *single_tracefile[] = {NULL, NULL};
+    int max_threads = DEFAULT_MAX_THREADS;
+    int iterations = DEFAULT_ITERATIONS;
+    int latency_mode = 0;
+    FILE *timeline = NULL;
+
+    while ((c = getopt(argc, argv, "f:t:n:i:lu:sh")) != EOF) {
+        switch (c) {
+        case 'f': /* Use one specific trace file only (not relative to the trace directory) */
+            single_tracefile[0] = optarg;
+            tracefiles = single_tracefile;
+            tracedir[0] = '\0';
+            break;
+        case 's': /* Use the stress suite instead of the default tracefiles */
+            tracefiles = stress_tracefiles;
+            break;
+        case 't': /* Directory where the traces are located */
+            if (strlen(optarg) >= MAXLINE - 1)
+                app_error("Trace directory name is too long");
+            strcpy(tracedir, optarg);
+            if (tracedir[strlen(tracedir) - 1] != '/')
+                strcat(tracedir, "/");
+            break;
+        case 'n': /* Maximum number of threads */
+            max_threads = atoi(optarg);
+            if (max_threads < 1)
+                usage();
+            break;
+        case 'i': /* Number of passes each thread makes over its part */
+            iterations = atoi(optarg);
+            if (iterations < 1)
+                usage();
+            break;
+        case 'l': /* Time each op instead of measuring scaling */
+            latency_mode = 1;
+            break;
+        case 'u': /* Write the utilization timeline to a CSV file */
+            latency_mode = 1;
+            if ((timeline = fopen(optarg, "w")) == NULL)
+                unix_error("Could not open the timeline file");
+            fprintf(timeline, "trace,op,live_bytes,peak_live_bytes,heap_bytes,utilization\n");
+            break;
+        case 'h':
+        default:
+            usage();
+        }
+    }
+
+    mem_init();
+
+    /* Read every trace up front, so file I/O isn't timed */
+    int num_tracefiles = 0;
+    while (tracefiles[num_tracefiles] != NULL)
+        num_tracefiles++;
+    trace_t **traces = malloc(num_tracefiles * sizeof(trace_t *));
+    if (traces == NULL)
+        unix_error("malloc failed in main");
+    for (int i = 0; i < num_tracefiles; i++)
+        traces[i] = read_trace(tracedir, tracefiles[i]);
+
+    /* Replay each trace once untimed, so the heap's pages are already mapped */
+    for (int i = 0; i < num_tracefiles; i++)
+        time_replay(traces[i], 1, 1);
+
+    if (latency_mode) {
+        init_latency();
+        printf("%-20s %-8s %9s %9s %9s %9s %9s %9s\n", "trace", "op", "count",
+               "mean", "p50", "p99", "p99.9", "max");
+        for (int i = 0; i < num_tracefiles; i++)
+            latency_replay(traces[i], tracefiles[i], timeline);
+        printf("(latencies in cycles)\n");
+        if (timeline != NULL)
+            fclose(timeline);
+        for (int i = 0; i < num_tracefiles; i++)
+            free_trace(traces[i]);
+        free(traces);
+        mem_deinit();
+        exit(0);
+    }
+
+    printf("%8s %14s %10s\n", "threads", "Kops/sec", "speedup");
+    double base_throughput = 0;
+    for (int num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+        double total_ops = 0, total_secs = 0;
+        for (int i = 0; i < num_tracefiles; i++) {
+            total_secs += time_replay(traces[i], num_threads, iterations);
+            total_ops += (double) traces[i]->num_ops * iterations;
+        }
+        double throughput = total_ops / total_secs;
+        if (num_threads == 1)
+            base_throughput = throughput;
+        printf("%8d %14.0f %9.2fx\n", num_threads, throughput / 1e3,
+               throughput / base_throughput);
+        /* Also measure max_threads itself if it isn't a power of 2 */
+        if (num_threads < max_threads && num_threads * 2 > max_threads)
+            num_threads = max_threads / 2;
+    }
+
+    for (int i = 0; i < num_tracefiles; i++)
+        free_trace(traces[i]);
+    free(traces);
+    mem_deinit();
+    exit(0);
+}
+
+/*
+ * time_replay - Replays a trace split across num_threads threads on a fresh heap,
+ *     returning the elapsed wall-clock time in seconds.
+ */
+static double time_replay(trace_t *trace, int num_threads, int iterations)
+{
+    replay_t *replays = calloc(num_threads, sizeof(replay_t));
+    pthread_t *threads = malloc(num_threads * sizeof(pthread_t));
+    void **blocks = calloc(trace->num_ids + 1, sizeof(void *));
+    if (replays == NULL || threads == NULL || blocks == NULL)
+        unix_error("malloc failed in time_replay");
+    pthread_barrier_t start;
+    pthread_barrier_init(&start, NULL, num_threads + 1);
+
+    /* Give each thread a contiguous range of ids, to avoid false sharing of blocks[] */
+    for (int t = 0; t < num_threads; t++) {
+        replay_t *replay = &replays[t];
+        replay->trace = trace;
+        replay->first_id = (long) trace->num_ids * t / num_threads;
+        replay->last_id = (long) trace->num_ids * (t + 1) / num_threads;
+        replay->ops = malloc(trace->num_ops * sizeof(traceop_t));
+        if (replay->ops == NULL)
+            unix_error("malloc failed in time_replay");
+        for (int i = 0; i < trace->num_ops; i++) {
+            int index = trace->ops[i].index;
+            /* The first thread also replays the ops on NULL (id -1) */
+            if ((replay->first_id <= index && index < replay->last_id) ||
+                (t == 0 && index == trace->num_ids))
+                replay->ops[replay->num_ops++] = trace->ops[i];
+        }
+        replay->blocks = blocks;
+        replay->iterations = iterations;
+        replay->start = &start;
+    }
+
+    mem_reset_brk();
+    if (!mm_init())
+        app_error("mm_init failed");
+    for (int t = 0; t < num_threads; t++) {
+        if ((errno = pthread_create(&threads[t], NULL, replay, &replays[t])) != 0)
+            unix_error("pthread_create failed");
+    }
+
+    pthread_barrier_wait(&start);
+    for (int t = 0; t < num_threads; t++)
+        pthread_join(threads[t], NULL);
+
+    /*
+     * Time from the first thread starting to the last one finishing. The threads
+     * time themselves, since this thread may not run again until they're done.
+     */
+    struct timespec *start_time = &replays[0].start_time, *end_time = &replays[0].end_time;
+    for (int t = 1; t < num_threads; t++) {
+        if (timespec_before(&replays[t].start_time, start_time))
+            start_time = &replays[t].start_time;
+        if (timespec_before(end_time, &replays[t].end_time))
+            end_time = &replays[t].end_time;
+    }
+    double secs = (end_time->tv_sec - start_time->tv_sec) +
+        (end_time->tv_nsec - start_time->tv_nsec) * 1e-9;
+
+    pthread_barrier_destroy(&start);
+    for (int t = 0; t < num_threads; t++)
+        free(replays[t].ops);
+    free(replays);
+    free(threads);
+    free(blocks);
+    return secs;
+}
+
+/*
+ * timespec_before - Whether time a is before time b
+ */
+static int timespec_before(struct timespec *a, struct timespec *b)
+{
+    return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+/*
+ * replay - Thread routine that replays one thread's part of a trace
+ */
+static void *replay(void *arg)
+{
+    replay_t *replay = arg;
+    void **blocks = replay->blocks;
+    pthread_barrier_wait(replay->start);
+    clock_gettime(CLOCK_MONOTONIC, &replay->start_time);
+
+    for (int iteration = 0; iteration < replay->iterations; iteration++) {
+        for (int i = 0; i < replay->num_ops; i++) {
+            traceop_t *op = &replay->ops[i];
+            void *p;
+            switch (op->type) {
+            case ALLOC:
+                if ((p = mm_malloc(op->size)) == NULL && op->size > 0)
+                    app_error("mm_malloc failed");
+                blocks[op->index] = p;
+                break;
+            case REALLOC:
+                if ((p = mm_realloc(blocks[op->index], op->size)) == NULL && op->size > 0)
+                    app_error("mm_realloc failed");
+                blocks[op->index] = p;
+                break;
+            case FREE:
+                mm_free(blocks[op->index]);
+                blocks[op->index] = NULL;
+                break;
+            }
+        }
+
+        /* Free anything the trace left allocated, for the next pass */
+        for (int id = replay->first_id; id < replay->last_id; id++) {
+            mm_free(blocks[id]);
+            blocks[id] = NULL;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &replay->end_time);
+    return NULL;
+}
+
+/*
+ * latency_replay - Replays a trace on a fresh heap, timing each op. Prints
+ *     the latency percentiles of each type of op, and the utilization
+ *     (peak live payload bytes / heap size) at the end of the trace. If
+ *     timeline isn't NULL, also appends TIMELINE_SAMPLES rows of
+ *     utilization over the course of the trace to it.
+ */
+static void latency_replay(trace_t *trace, char *name, FILE *timeline)
+{
+    void **blocks = calloc(trace->num_ids + 1, sizeof(void *));
+    size_t *sizes = calloc(trace->num_ids + 1, sizeof(size_t));
+    if (blocks == NULL || sizes == NULL)
+        unix_error("malloc failed in latency_replay");
+    latency_hist_t *hists = malloc(NUM_OP_TYPES * sizeof(latency_hist_t));
+    if (hists == NULL)
+        unix_error("malloc failed in latency_replay");
+    for (int type = 0; type < NUM_OP_TYPES; type++)
+        latency_clear(&hists[type]);
+    size_t live_bytes = 0, peak_live_bytes = 0;
+    int sample_interval = trace->num_ops / TIMELINE_SAMPLES;
+    if (sample_interval == 0)
+        sample_interval = 1;
+
+    mem_reset_brk();
+    if (!mm_init())
+        app_error("mm_init failed");
+    for (int i = 0; i < trace->num_ops; i++) {
+        traceop_t *op = &trace->ops[i];
+        void *p = NULL;
+        uint64_t start, stop;
+        switch (op->type) {
+        case ALLOC:
+            start = latency_start();
+            p = mm_malloc(op->size);
+            stop = latency_stop();
+            break;
+        case REALLOC:
+            start = latency_start();
+            p = mm_realloc(blocks[op->index], op->size);
+            stop = latency_stop();
+            break;
+        case FREE:
+        default:
+            start = latency_start();
+            mm_free(blocks[op->index]);
+            stop = latency_stop();
+            break;
+        }
+        latency_record(&hists[op->type], start, stop);
+
+        if (op->type != FREE && p == NULL && op->size > 0)
+            app_error("mm_malloc or mm_realloc failed");
+        live_bytes -= sizes[op->index];
+        blocks[op->index] = p;
+        sizes[op->index] = op->type == FREE ? 0 : op->size;
+        live_bytes += sizes[op->index];
+        if (live_bytes > peak_live_bytes)
+            peak_live_bytes = live_bytes;
+
+        if (timeline != NULL && (i + 1) % sample_interval == 0) {
+            size_t heap_bytes = mem_heapsize();
+            fprintf(timeline, "%s,%d,%zu,%zu,%zu,%.4f\n", name, i + 1, live_bytes,
+                    peak_live_bytes, heap_bytes,
+                    heap_bytes > 0 ? (double) live_bytes / heap_bytes : 0.0);
+        }
+    }
+    size_t heap_bytes = mem_heapsize();
+
+    for (int type = 0; type < NUM_OP_TYPES; type++) {
+        latency_hist_t *hist = &hists[type];
+        if (hist->count == 0)
+            continue;
+        printf("%-20s %-8s %9lu %9.0f %9lu %9lu %9lu %9lu\n", name, op_names[type],
+               (unsigned long) hist->count, (double) hist->total / hist->count,
+               (unsigned long) latency_percentile(hist, 50),
+               (unsigned long) latency_percentile(hist, 99),
+               (unsigned long) latency_percentile(hist, 99.9),
+               (unsigned long) hist->max);
+    }
+    printf("%-20s util %5.1f%% (peak live %zu bytes, heap %zu bytes)\n", name,
+           heap_bytes > 0 ? 100.0 * peak_live_bytes / heap_bytes : 0.0,
+           peak_live_bytes, heap_bytes);
+
+    for (int id = 0; id <= trace->num_ids; id++)
+        mm_free(blocks[id]);
+    free(hists);
+    free(blocks);
+    free(sizes);
+}
+
+/*
+ * read_trace - read a trace file and store it in memory
+ */
+static trace_t *read_trace(char *tracedir, char *filename)
+{
+    FILE *tracefile;
+    trace_t *trace;
+    char type[MAXLINE];
+    char path[MAXLINE];
+    int index, size;
+    int header, num_ids, num_ops, weight;
+    int op_index;
+
+    if ((trace = malloc(sizeof(trace_t))) == NULL)
+        unix_error("malloc failed in read_trace");
+
+    if (strlen(tracedir) + strlen(filename) + 1 > MAXLINE)
+        app_error("Trace path is too long");
+    strcpy(path, tracedir);
+    strcat(path, filename);
+    if ((tracefile = fopen(path, "r")) == NULL) {
+        sprintf(type, "Could not open %s in read_trace", path);
+        unix_error(type);
+    }
+
+    /* Read the trace file header */
+    if (fscanf(tracefile, "%d %d %d %d", &header, &num_ids, &num_ops, &weight) != 4)
+        app_error("Bogus trace file header");
+    trace->num_ids = num_ids;
+    trace->num_ops = num_ops;
+    if ((trace->ops = malloc(num_ops * sizeof(traceop_t))) == NULL)
+        unix_error("malloc failed in read_trace");
+
+    /* Read every request line in the trace file; id -1 is the NULL pointer,
+       which gets the extra slot after the trace's blocks */
+    op_index = 0;
+    while (op_index < num_ops && fscanf(tracefile, "%s", type) != EOF) {
+        traceop_t *op = &trace->ops[op_index];
+        switch (type[0]) {
+        case 'a':
+        case 'r':
+            if (fscanf(tracefile, "%d %d", &index, &size) != 2)
+                app_error("Bogus alloc/realloc request");
+            op->type = type[0] == 'a' ? ALLOC : REALLOC;
+            op->size = size;
+            break;
+        case 'f':
+            if (fscanf(tracefile, "%d", &index) != 1)
+                app_error("Bogus free request");
+            op->type = FREE;
+            op->size = 0;
+            break;
+        default:
+            fprintf(stderr, "Bogus type character (%c) in tracefile %s\n", type[0], path);
+            exit(1);
+        }
+        if (index < -1 || index >= num_ids)
+            app_error("Bogus block id in tracefile");
+        op->index = index < 0 ? num_ids : index;
+        op_index++;
+    }
+    trace->num_ops = op_index;
+    fclose(tracefile);
+    return trace;
+}
+
+/*
+ * free_trace - Free the trace record and the array it points to
+ */
+static void free_trace(trace_t *trace)
+{
+    free(trace->ops);
+    free(trace);
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: mdriver-mt [-hls] [-f <file>] [-t <dir>] [-n <threads>] [-i <iterations>]\n"
+            "                 [-u <csv file>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-f <file>        Use <file> as the trace file.\n");
+    fprintf(stderr, "\t-h               Print this message.\n");
+    fprintf(stderr, "\t-i <iterations>  Passes each thread makes over its part (default %d).\n",
+            DEFAULT_ITERATIONS);
+    fprintf(stderr, "\t-l               Report the latency of each op instead of scaling.\n");
+    fprintf(stderr, "\t-n <threads>     Scale up to <threads> threads (default %d).\n",
+            DEFAULT_MAX_THREADS);
+    fprintf(stderr, "\t-s               Use the stress suite (see config.h) as the traces.\n");
+    fprintf(stderr, "\t-t <dir>         Directory to find default traces.\n");
+    fprintf(stderr, "\t-u <csv file>    Write the heap utilization over time to <csv file> (implies -l).\n");
+    exit(1);
+}
+
+/*
+ * app_error - Report an arbitrary application error
+ */
+static void app_error(char *msg)
+{
+    printf("%s\n", msg);
+    exit(1);
+}
+
+/*
+ * unix_error - Report a Unix-style error
+ */
+static void unix_error(char *msg)
+{
+    printf("%s: %s\n", msg, strerror(errno));
+    exit(1);
+}
@@ -0,0 +1,893 @@
+/*
+ * mm.c - A segregated-fit allocator.
+ *
+ * Every block starts with a header word holding the block's size (a multiple of
+ * ALIGNMENT) and two flags: whether the block is allocated and whether the block
+ * before it is. Free blocks also end with a copy of the header (a boundary tag),
+ * so a block being freed can find and coalesce with a free block before it.
+ * Allocated blocks don't need that footer, since the next block's flag says
+ * they're allocated, which leaves all but the header word for the payload.
+ *
+ * Free blocks are kept in explicit doubly-linked lists, segregated by size:
+ * one class per size up to SMALL_CLASS_LIMIT, then one class per power of two.
+ * A bitmask of the non-empty classes lets malloc skip empty ones. Within a class,
+ * malloc picks the best fit among the first few blocks that fit.
+ *
+ * The heap ends with an epilogue: a 0-size allocated header, so the last
+ * block always has a next block to check. The heap grows in chunks proportional
+ * to its size, so a run of allocations doesn't grow it once per allocation.
+ */
+#ifdef MM_MMAP_THRESHOLD
+#define _GNU_SOURCE
+#endif
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef MM_THREAD_SAFE
+#include <pthread.h>
+#endif
+#ifdef MM_MMAP_THRESHOLD
+#include <sys/mman.h>
+#endif
+
+#include "memlib.h"
+#include "mm.h"
+
+/** The required alignment of heap payloads */
+const size_t ALIGNMENT = 2 * sizeof(size_t);
+/** The header flag for an allocated block */
+const size_t ALLOCATED = 1;
+/** The header flag for a block whose previous block is allocated */
+const size_t PREV_ALLOCATED = 2;
+/** Blocks have room for a header, two free-list links, and a footer */
+const size_t MIN_BLOCK_SIZE = 4 * sizeof(size_t);
+/** Blocks up to this size each have their own size class */
+const size_t SMALL_CLASS_LIMIT = 128;
+/** The number of size classes, where the last one holds all larger blocks */
+#define NUM_SIZE_CLASSES 24
+/** The number of additional fitting blocks that malloc looks at for a better fit */
+const size_t BEST_FIT_CANDIDATES = 8;
+/** The heap grows by at least 1 / HEAP_GROWTH_DIVISOR of its current size... */
+const size_t HEAP_GROWTH_DIVISOR = 32;
+/** ...and by at least this many bytes */
+const size_t MIN_HEAP_GROWTH = 256;
+
+/** The layout of each block allocated on the heap */
+typedef struct {
+    /** The size of the block, `ALLOCATED`, and `PREV_ALLOCATED` */
+    size_t header;
+    /**
+     * We don't know what the size of the payload will be, so we will
+     * declare it as a zero-length array. This allows us to obtain a
+     * pointer to the start of the payload.
+     */
+    uint8_t payload[];
+} block_t;
+
+/** The layout of a free block, which stores its free-list links in its payload */
+typedef struct free_block {
+    size_t header;
+    struct free_block *next;
+    struct free_block *prev;
+} free_block_t;
+
+/** The first block on the heap (which is the epilogue if the heap is empty) */
+static block_t *mm_heap_first = NULL;
+/** The 0-size allocated header at the end of the heap */
+static block_t *mm_heap_epilogue = NULL;
+/** The free list of each size class */
+static free_block_t *free_lists[NUM_SIZE_CLASSES];
+/** Bit `i` is set if `free_lists[i]` is non-empty */
+static uint32_t free_class_mask = 0;
+
+/** Rounds up `size` to the nearest multiple of `n` */
+static size_t round_up(size_t size, size_t n) {
+    return (size + (n - 1)) / n * n;
+}
+
+static size_t get_size(const void *block) {
+    return ((const block_t *) block)->header & ~(ALIGNMENT - 1);
+}
+
+static bool is_allocated(const void *block) {
+    return ((const block_t *) block)->header & ALLOCATED;
+}
+
+static bool is_prev_allocated(const void *block) {
+    return ((const block_t *) block)->header & PREV_ALLOCATED;
+}
+
+static block_t *next_block(const void *block) {
+    return (block_t *) ((uint8_t *) block + get_size(block));
+}
+
+/** Finds the block before a block, which must be free (so it has a footer) */
+static block_t *prev_block(const void *block) {
+    size_t prev_size = ((const size_t *) block)[-1] & ~(ALIGNMENT - 1);
+    return (block_t *) ((uint8_t *) block - prev_size);
+}
+
+static block_t *block_from_payload(void *ptr) {
+    return (block_t *) ((uint8_t *) ptr - offsetof(block_t, payload));
+}
+
+/** Gets the size of the block needed for a payload of `size` bytes */
+static size_t block_size_for(size_t size) {
+    size_t block_size = round_up(size + sizeof(size_t), ALIGNMENT);
+    return block_size < MIN_BLOCK_SIZE ? MIN_BLOCK_SIZE : block_size;
+}
+
+/**
+ * Sets or clears the `PREV_ALLOCATED` flag of the block after a block.
+ * The next block may be allocated and having its size read by its owner
+ * without the heap lock (see get_allocated_size()), so the header is stored
+ * atomically. A relaxed load and store compiles to plain moves.
+ */
+static void set_next_prev_allocated(block_t *block, bool prev_allocated) {
+    block_t *next = next_block(block);
+    size_t header = __atomic_load_n(&next->header, __ATOMIC_RELAXED);
+    header = prev_allocated ? header | PREV_ALLOCATED : header & ~PREV_ALLOCATED;
+    __atomic_store_n(&next->header, header, __ATOMIC_RELAXED);
+}
+
+/** Marks a block as allocated with a given size, keeping its `PREV_ALLOCATED` flag */
+static void set_allocated(block_t *block, size_t size) {
+    block->header = size | ALLOCATED | (block->header & PREV_ALLOCATED);
+    set_next_prev_allocated(block, true);
+}
+
+/** Marks a block as free with a given size and writes its footer */
+static void set_free(block_t *block, size_t size) {
+    block->header = size | (block->header & PREV_ALLOCATED);
+    ((size_t *) ((uint8_t *) block + size))[-1] = block->header;
+    set_next_prev_allocated(block, false);
+}
+
+/** Gets the size class of a block size */
+static size_t size_class(size_t size) {
+    if (size <= SMALL_CLASS_LIMIT) {
+        return size / ALIGNMENT - MIN_BLOCK_SIZE / ALIGNMENT;
+    }
+    // The first power-of-two class holds sizes up to 2 * SMALL_CLASS_LIMIT, and so on
+    size_t class = SMALL_CLASS_LIMIT / ALIGNMENT - MIN_BLOCK_SIZE / ALIGNMENT + 1 +
+                   (63 - __builtin_clzl(size - 1)) - (63 - __builtin_clzl(SMALL_CLASS_LIMIT));
+    return class < NUM_SIZE_CLASSES ? class : NUM_SIZE_CLASSES - 1;
+}
+
+static void insert_free(block_t *block) {
+    free_block_t *free_block = (free_block_t *) block;
+    size_t class = size_class(get_size(block));
+    free_block->prev = NULL;
+    free_block->next = free_lists[class];
+    if (free_lists[class] != NULL) {
+        free_lists[class]->prev = free_block;
+    }
+    free_lists[class] = free_block;
+    free_class_mask |= (uint32_t) 1 << class;
+}
+
+static void remove_free(block_t *block) {
+    free_block_t *free_block = (free_block_t *) block;
+    if (free_block->prev != NULL) {
+        free_block->prev->next = free_block->next;
+    }
+    else {
+        size_t class = size_class(get_size(block));
+        free_lists[class] = free_block->next;
+        if (free_lists[class] == NULL) {
+            free_class_mask &= ~((uint32_t) 1 << class);
+        }
+    }
+    if (free_block->next != NULL) {
+        free_block->next->prev = free_block->prev;
+    }
+}
+
+/**
+ * Merges a newly freed block with any free blocks next to it
+ * and adds the result to the free lists.
+ *
+ * @param block a block that has been marked as free but isn't in a free list
+ * @return the merged block
+ */
+static block_t *coalesce(block_t *block) {
+    size_t size = get_size(block);
+    block_t *next = next_block(block);
+    if (!is_allocated(next)) {
+        remove_free(next);
+        size += get_size(next);
+    }
+    if (!is_prev_allocated(block)) {
+        block = prev_block(block);
+        remove_free(block);
+        size += get_size(block);
+    }
+    set_free(block, size);
+    insert_free(block);
+    return block;
+}
+
+/**
+ * Shrinks an allocated block to `size` bytes, freeing the rest of it
+ * if that is big enough to be a block.
+ */
+static void split(block_t *block, size_t size) {
+    size_t remainder = get_size(block) - size;
+    if (remainder < MIN_BLOCK_SIZE) {
+        return;
+    }
+    set_allocated(block, size);
+    block_t *rest = next_block(block);
+    rest->header = PREV_ALLOCATED;
+    set_free(rest, remainder);
+    coalesce(rest);
+}
+
+/** Finds a free block of at least `size` bytes, or returns NULL if there is none */
+static block_t *find_fit(size_t size) {
+    size_t class = size_class(size);
+    uint32_t classes = free_class_mask & ~(((uint32_t) 1 << class) - 1);
+    while (classes != 0) {
+        class = __builtin_ctz(classes);
+        classes &= classes - 1;
+
+        free_block_t *best = NULL;
+        size_t best_size = SIZE_MAX, candidates = 0;
+        for (free_block_t *block = free_lists[class]; block != NULL; block = block->next) {
+            size_t block_size = get_size(block);
+            if (size <= block_size && block_size < best_size) {
+                best = block;
+                best_size = block_size;
+                if (block_size == size) {
+                    break;
+                }
+            }
+            if (best != NULL && ++candidates > BEST_FIT_CANDIDATES) {
+                break;
+            }
+        }
+        if (best != NULL) {
+            return (block_t *) best;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Grows the heap so that it ends with a free block of at least `size` bytes.
+ * If the heap already ends with a free block, only the difference is needed,
+ * but the heap grows by at least `MIN_HEAP_GROWTH` bytes and a fraction of its size.
+ *
+ * @return the free block at the end of the heap (which is in a free list),
+ *   or NULL if the heap couldn't be grown
+ */
+static block_t *extend_heap(size_t size) {
+    size_t last_size =
+        is_prev_allocated(mm_heap_epilogue) ? 0 : get_size(prev_block(mm_heap_epilogue));
+    // The new space must be big enough to be a block by itself until it is coalesced
+    size_t needed = size - last_size < MIN_BLOCK_SIZE ? MIN_BLOCK_SIZE : size - last_size;
+    size_t increment = round_up(mem_heapsize() / HEAP_GROWTH_DIVISOR, ALIGNMENT);
+    if (increment < MIN_HEAP_GROWTH) {
+        increment = MIN_HEAP_GROWTH;
+    }
+    if (increment < needed) {
+        increment = needed;
+    }
+    if (mem_sbrk(increment) == (void *) -1) {
+        // Near the heap's limit, grow by only what is needed
+        if (increment == needed || mem_sbrk(needed) == (void *) -1) {
+            return NULL;
+        }
+        increment = needed;
+    }
+
+    // The old epilogue becomes the header of the new free block
+    block_t *block = mm_heap_epilogue;
+    mm_heap_epilogue = (block_t *) ((uint8_t *) block + increment);
+    mm_heap_epilogue->header = ALLOCATED;
+    set_free(block, increment);
+    return coalesce(block);
+}
+
+/**
+ * Allocates a block from the heap, growing the heap if no free block fits.
+ *
+ * @param block_size the size of the block, from `block_size_for()`
+ * @return the block, which can be up to `MIN_BLOCK_SIZE - ALIGNMENT` bytes larger,
+ *   or NULL if the heap couldn't be grown
+ */
+static block_t *allocate_block(size_t block_size) {
+    block_t *block = find_fit(block_size);
+    if (block == NULL) {
+        block = extend_heap(block_size);
+        if (block == NULL) {
+            return NULL;
+        }
+    }
+    remove_free(block);
+    set_allocated(block, get_size(block));
+    split(block, block_size);
+    return block;
+}
+
+/** Returns an allocated block to the heap */
+static void release_block(block_t *block) {
+    set_free(block, get_size(block));
+    coalesce(block);
+}
+
+/**
+ * Tries to grow an allocated block to `size` bytes without moving it,
+ * by absorbing a free block after it or growing the heap if it is the last block.
+ *
+ * @return whether the block was grown
+ */
+static bool grow_in_place(block_t *block, size_t size) {
+    size_t block_size = get_size(block);
+    block_t *next = next_block(block);
+    bool next_free = !is_allocated(next);
+    if (block_size + (next_free ? get_size(next) : 0) < size) {
+        // Only the last block on the heap (or the one before a last free block) can grow,
+        // and then the heap ends with a free block after it that is big enough
+        if ((next_free ? next_block(next) : next) != mm_heap_epilogue ||
+            extend_heap(size - block_size) == NULL) {
+            return false;
+        }
+    }
+    remove_free(next);
+    set_allocated(block, block_size + get_size(next));
+    split(block, size);
+    return true;
+}
+
+/** Tries to shrink or grow an allocated block to `block_size` bytes without moving it */
+static bool resize_block(block_t *block, size_t block_size) {
+    if (block_size <= get_size(block)) {
+        split(block, block_size);
+        return true;
+    }
+    return grow_in_place(block, block_size);
+}
+
+#ifdef MM_THREAD_SAFE
+#define LOCK_HEAP() pthread_mutex_lock(&heap_lock)
+#define UNLOCK_HEAP() pthread_mutex_unlock(&heap_lock)
+/** Protects all the heap's blocks and free lists, and the list of huge blocks */
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+#else
+#define LOCK_HEAP()
+#define UNLOCK_HEAP()
+#endif
+
+#ifdef MM_MMAP_THRESHOLD
+
+/*
+ * Huge blocks (for payloads of at least `MM_MMAP_THRESHOLD` bytes) each get
+ * their own memory mapping, so they are returned to the OS when they are freed
+ * instead of permanently growing the heap. The lab's driver requires every
+ * payload to be inside the heap, so this is only enabled when compiling with
+ * -DMM_MMAP_THRESHOLD=<bytes>.
+ */
+
+/** The header flag for a huge block, which isn't on the heap */
+const size_t MAPPED = 4;
+
+/**
+ * The layout of a huge block's mapping. Its header is right before the payload,
+ * like any other block's, so mm_free() can tell that it is huge.
+ */
+typedef struct mapped_block {
+    /** Links in the list of huge blocks, which mm_init() unmaps */
+    struct mapped_block *next;
+    struct mapped_block *prev;
+    /** Keeps the payload aligned */
+    size_t padding;
+    /** The size of the mapping, `ALLOCATED`, and `MAPPED` */
+    size_t header;
+    uint8_t payload[];
+} mapped_block_t;
+
+static mapped_block_t *mapped_blocks = NULL;
+
+/** Checks whether an allocated block is a huge block (without the heap lock) */
+static bool is_mapped(block_t *block) {
+    return __atomic_load_n(&block->header, __ATOMIC_RELAXED) & MAPPED;
+}
+
+static mapped_block_t *mapped_from_block(block_t *block) {
+    return (mapped_block_t *) ((uint8_t *) block - offsetof(mapped_block_t, header));
+}
+
+/** Adds a huge block to the list of huge blocks, which must be locked */
+static void link_mapped(mapped_block_t *mapped) {
+    mapped->prev = NULL;
+    mapped->next = mapped_blocks;
+    if (mapped_blocks != NULL) {
+        mapped_blocks->prev = mapped;
+    }
+    mapped_blocks = mapped;
+}
+
+static void unlink_mapped(mapped_block_t *mapped) {
+    if (mapped->prev != NULL) {
+        mapped->prev->next = mapped->next;
+    }
+    else {
+        mapped_blocks = mapped->next;
+    }
+    if (mapped->next != NULL) {
+        mapped->next->prev = mapped->prev;
+    }
+}
+
+/** Gets the size of the mapping needed for a huge block with a payload of `size` bytes */
+static size_t mapping_size_for(size_t size) {
+    return round_up(offsetof(mapped_block_t, payload) + size, mem_pagesize());
+}
+
+/** Allocates a huge block in a new mapping, returning its payload or NULL */
+static void *map_huge(size_t size) {
+    size_t map_size = mapping_size_for(size);
+    mapped_block_t *mapped =
+        mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapped == MAP_FAILED) {
+        return NULL;
+    }
+    mapped->header = map_size | ALLOCATED | MAPPED;
+    LOCK_HEAP();
+    link_mapped(mapped);
+    UNLOCK_HEAP();
+    return mapped->payload;
+}
+
+static void unmap_huge(block_t *block) {
+    mapped_block_t *mapped = mapped_from_block(block);
+    LOCK_HEAP();
+    unlink_mapped(mapped);
+    UNLOCK_HEAP();
+    munmap(mapped, get_size(block));
+}
+
+/**
+ * Resizes a huge block to a payload of `size` bytes. The OS can move the pages
+ * to a new address if needed, so the payload is never copied.
+ *
+ * @return the new payload, or NULL if the mapping couldn't be resized
+ */
+static void *remap_huge(block_t *block, size_t size) {
+    mapped_block_t *mapped = mapped_from_block(block);
+    size_t map_size = mapping_size_for(size);
+    LOCK_HEAP();
+    unlink_mapped(mapped);
+    mapped_block_t *new_mapped = mremap(mapped, get_size(block), map_size, MREMAP_MAYMOVE);
+    if (new_mapped == MAP_FAILED) {
+        link_mapped(mapped);
+        UNLOCK_HEAP();
+        return NULL;
+    }
+    new_mapped->header = map_size | ALLOCATED | MAPPED;
+    link_mapped(new_mapped);
+    UNLOCK_HEAP();
+    return new_mapped->payload;
+}
+
+/** Unmaps all the huge blocks, when mm_init() resets the heap */
+static void unmap_all_huge(void) {
+    while (mapped_blocks != NULL) {
+        mapped_block_t *mapped = mapped_blocks;
+        mapped_blocks = mapped->next;
+        munmap(mapped, mapped->header & ~(ALIGNMENT - 1));
+    }
+}
+
+#endif /* MM_MMAP_THRESHOLD */
+
+#ifdef MM_THREAD_SAFE
+
+/*
+ * In the thread-safe mode, the heap is protected by `heap_lock`, and each thread
+ * caches freed blocks of the exact-size classes (up to `SMALL_CLASS_LIMIT`),
+ * so most small allocations and frees don't take any locks.
+ * Cached blocks are still allocated as far as the heap is concerned.
+ * Threads give blocks back in batches to per-class central lists, which other
+ * threads refill their caches from, and the central lists return batches
+ * of blocks to the heap when they get too long.
+ */
+
+/** The number of size classes that threads cache: the classes up to SMALL_CLASS_LIMIT */
+#define NUM_CACHED_CLASSES 7
+/** The most blocks of each class that a thread caches before giving a batch back */
+const size_t CACHE_LIMIT = 64;
+/** The number of blocks moved at once between caches, central lists, and the heap */
+const size_t CACHE_BATCH = 32;
+/** The most blocks of each class that a central list holds before returning a batch */
+const size_t CENTRAL_LIMIT = 256;
+
+/** A cached block, which stores the link to the next cached block in its payload */
+typedef struct cached_block {
+    size_t header;
+    struct cached_block *next;
+} cached_block_t;
+
+/** A stack of cached blocks of one size class */
+typedef struct {
+    cached_block_t *top;
+    size_t count;
+} block_stack_t;
+
+/** The blocks that a thread has cached */
+typedef struct {
+    /** The `heap_generation` that the blocks were allocated from */
+    uint64_t generation;
+    block_stack_t classes[NUM_CACHED_CLASSES];
+} thread_cache_t;
+
+/** Blocks that threads have given back, which any thread can take */
+typedef struct {
+    pthread_mutex_t lock;
+    block_stack_t blocks;
+} central_list_t;
+
+static central_list_t central_lists[NUM_CACHED_CLASSES] = {
+    [0 ... NUM_CACHED_CLASSES - 1] = {.lock = PTHREAD_MUTEX_INITIALIZER},
+};
+static __thread thread_cache_t thread_cache;
+/** Incremented by mm_init(), so threads drop blocks they cached from an old heap */
+static uint64_t heap_generation = 0;
+/** Gives a thread's cached blocks back when the thread exits */
+static pthread_key_t cache_key;
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Gets the size of an allocated block without holding the heap lock.
+ * Only the owner of an allocated block changes its size, but other threads
+ * can be updating its `PREV_ALLOCATED` flag.
+ */
+static size_t get_allocated_size(block_t *block) {
+    return __atomic_load_n(&block->header, __ATOMIC_RELAXED) & ~(ALIGNMENT - 1);
+}
+
+static void stack_push(block_stack_t *stack, cached_block_t *block) {
+    block->next = stack->top;
+    stack->top = block;
+    stack->count++;
+}
+
+static cached_block_t *stack_pop(block_stack_t *stack) {
+    cached_block_t *block = stack->top;
+    if (block != NULL) {
+        stack->top = block->next;
+        stack->count--;
+    }
+    return block;
+}
+
+/** Moves up to `count` blocks from the top of one stack to another */
+static void stack_move(block_stack_t *from, block_stack_t *to, size_t count) {
+    for (size_t i = 0; i < count && from->top != NULL; i++) {
+        stack_push(to, stack_pop(from));
+    }
+}
+
+/** Returns a stack of blocks to the heap, which must be locked */
+static void release_stack(block_stack_t *stack) {
+    cached_block_t *block;
+    while ((block = stack_pop(stack)) != NULL) {
+        release_block((block_t *) block);
+    }
+}
+
+/** Gives blocks back to the central list of a class, returning a batch to the heap if it is full */
+static void give_to_central(size_t class, block_stack_t *blocks, size_t count) {
+    central_list_t *central = &central_lists[class];
+    block_stack_t excess = {NULL, 0};
+    pthread_mutex_lock(&central->lock);
+    stack_move(blocks, &central->blocks, count);
+    if (central->blocks.count > CENTRAL_LIMIT) {
+        stack_move(&central->blocks, &excess, CACHE_BATCH);
+    }
+    pthread_mutex_unlock(&central->lock);
+
+    // The central list's lock is never held while taking the heap lock
+    if (excess.top != NULL) {
+        LOCK_HEAP();
+        release_stack(&excess);
+        UNLOCK_HEAP();
+    }
+}
+
+/** Gives a thread's cached blocks back when it exits */
+static void flush_cache(void *arg) {
+    thread_cache_t *cache = arg;
+    if (cache->generation != heap_generation) {
+        return;
+    }
+    for (size_t class = 0; class < NUM_CACHED_CLASSES; class++) {
+        give_to_central(class, &cache->classes[class], cache->classes[class].count);
+    }
+}
+
+static void create_cache_key(void) {
+    pthread_key_create(&cache_key, flush_cache);
+}
+
+static thread_cache_t *get_thread_cache(void) {
+    thread_cache_t *cache = &thread_cache;
+    if (cache->generation != heap_generation) {
+        // The cache is new, or holds blocks from a heap that mm_init() has reset
+        memset(cache->classes, 0, sizeof(cache->classes));
+        cache->generation = heap_generation;
+        pthread_once(&cache_key_once, create_cache_key);
+        pthread_setspecific(cache_key, cache);
+    }
+    return cache;
+}
+
+/**
+ * Refills a thread's cache of a class, from the central list if it has blocks
+ * and otherwise by carving a batch of blocks out of one large heap block.
+ *
+ * @return a block for the caller to allocate, or NULL if the heap couldn't be grown
+ */
+static block_t *refill_cache(block_stack_t *stack, size_t class, size_t block_size) {
+    central_list_t *central = &central_lists[class];
+    pthread_mutex_lock(&central->lock);
+    stack_move(&central->blocks, stack, CACHE_BATCH);
+    pthread_mutex_unlock(&central->lock);
+    if (stack->top != NULL) {
+        return (block_t *) stack_pop(stack);
+    }
+
+    LOCK_HEAP();
+    block_t *batch = allocate_block(block_size * CACHE_BATCH);
+    if (batch == NULL) {
+        UNLOCK_HEAP();
+        return NULL;
+    }
+    // Split the batch into blocks that are each allocated, except for the last one,
+    // which goes to the caller and gets any extra space at the end of the batch.
+    // This happens under the heap lock, since another thread freeing the block before
+    // the batch updates the batch's PREV_ALLOCATED bit, and mm_checkheap() walks the headers.
+    size_t batch_size = get_size(batch);
+    block_t *block = batch;
+    for (size_t i = 0; i < CACHE_BATCH - 1; i++) {
+        block->header = block_size | ALLOCATED | (i == 0 ? batch->header & PREV_ALLOCATED
+                                                         : PREV_ALLOCATED);
+        stack_push(stack, (cached_block_t *) block);
+        block = next_block(block);
+    }
+    block->header = (batch_size - block_size * (CACHE_BATCH - 1)) | ALLOCATED | PREV_ALLOCATED;
+    UNLOCK_HEAP();
+    return block;
+}
+
+static void *cache_malloc(size_t block_size) {
+    size_t class = size_class(block_size);
+    block_stack_t *stack = &get_thread_cache()->classes[class];
+    block_t *block = (block_t *) stack_pop(stack);
+    if (block == NULL) {
+        block = refill_cache(stack, class, block_size);
+        if (block == NULL) {
+            return NULL;
+        }
+    }
+    return block->payload;
+}
+
+static void cache_free(block_t *block, size_t block_size) {
+    size_t class = size_class(block_size);
+    block_stack_t *stack = &get_thread_cache()->classes[class];
+    stack_push(stack, (cached_block_t *) block);
+    if (stack->count > CACHE_LIMIT) {
+        give_to_central(class, stack, CACHE_BATCH);
+    }
+}
+
+#endif /* MM_THREAD_SAFE */
+
+/**
+ * mm_init - Initializes the allocator state
+ */
+bool mm_init(void) {
+    // We want the first payload to start at ALIGNMENT bytes from the start of the heap,
+    // with the epilogue's header right before it
+    void *padding = mem_sbrk(ALIGNMENT);
+    if (padding == (void *) -1) {
+        return false;
+    }
+
+    mm_heap_first = (block_t *) ((uint8_t *) padding + ALIGNMENT - sizeof(block_t));
+    mm_heap_epilogue = mm_heap_first;
+    mm_heap_epilogue->header = ALLOCATED | PREV_ALLOCATED;
+    memset(free_lists, 0, sizeof(free_lists));
+    free_class_mask = 0;
+#ifdef MM_MMAP_THRESHOLD
+    unmap_all_huge();
+#endif
+#ifdef MM_THREAD_SAFE
+    for (size_t class = 0; class < NUM_CACHED_CLASSES; class++) {
+        central_lists[class].blocks = (block_stack_t) {NULL, 0};
+    }
+    heap_generation++;
+#endif
+    return true;
+}
+
+/**
+ * mm_malloc - Allocates a block with the given size
+ */
+void *mm_malloc(size_t size) {
+    if (size == 0) {
+        return NULL;
+    }
+
+#ifdef MM_MMAP_THRESHOLD
+    if (size >= MM_MMAP_THRESHOLD) {
+        return map_huge(size);
+    }
+#endif
+    size_t block_size = block_size_for(size);
+#ifdef MM_THREAD_SAFE
+    if (block_size <= SMALL_CLASS_LIMIT) {
+        return cache_malloc(block_size);
+    }
+#endif
+    LOCK_HEAP();
+    block_t *block = allocate_block(block_size);
+    UNLOCK_HEAP();
+    return block == NULL ? NULL : block->payload;
+}
+
+/**
+ * mm_free - Releases a block to be reused for future allocations
+ */
+void mm_free(void *ptr) {
+    // mm_free(NULL) does nothing
+    if (ptr == NULL) {
+        return;
+    }
+
+    block_t *block = block_from_payload(ptr);
+#ifdef MM_MMAP_THRESHOLD
+    if (is_mapped(block)) {
+        unmap_huge(block);
+        return;
+    }
+#endif
+#ifdef MM_THREAD_SAFE
+    size_t block_size = get_allocated_size(block);
+    if (block_size <= SMALL_CLASS_LIMIT) {
+        cache_free(block, block_size);
+        return;
+    }
+#endif
+    LOCK_HEAP();
+    release_block(block);
+    UNLOCK_HEAP();
+}
+
+/**
+ * mm_realloc - Change the size of the block by mm_mallocing a new block,
+ *      copying its data, and mm_freeing the old block.
+ *      Blocks are shrunk and grown in place when possible.
+ */
+void *mm_realloc(void *old_ptr, size_t size) {
+    if (old_ptr == NULL) {
+        return mm_malloc(size);
+    }
+    if (size == 0) {
+        mm_free(old_ptr);
+        return NULL;
+    }
+
+    block_t *block = block_from_payload(old_ptr);
+    size_t old_size;
+#ifdef MM_MMAP_THRESHOLD
+    if (is_mapped(block)) {
+        if (size >= MM_MMAP_THRESHOLD) {
+            return remap_huge(block, size);
+        }
+        old_size = get_size(block) - offsetof(mapped_block_t, payload);
+    }
+    else
+#endif
+    {
+        LOCK_HEAP();
+        bool resized = resize_block(block, block_size_for(size));
+        old_size = get_size(block) - offsetof(block_t, payload);
+        UNLOCK_HEAP();
+        if (resized) {
+            return old_ptr;
+        }
+    }
+
+    void *new_ptr = mm_malloc(size);
+    if (new_ptr == NULL) {
+        return NULL;
+    }
+    memcpy(new_ptr, old_ptr, old_size < size ? old_size : size);
+    mm_free(old_ptr);
+    return new_ptr;
+}
+
+/**
+ * mm_calloc - Allocate the block and set it to zero.
+ */
+void *mm_calloc(size_t nmemb, size_t size) {
+    if (size != 0 && nmemb > SIZE_MAX / size) {
+        return NULL;
+    }
+    void *ptr = mm_malloc(nmemb * size);
+    if (ptr != NULL) {
+        memset(ptr, 0, nmemb * size);
+    }
+    return ptr;
+}
+
+/** Reports a heap inconsistency found by mm_checkheap() and exits */
+static void heap_error(const char *message, const void *block) {
+    fprintf(stderr, "mm_checkheap: %s (block %p)\n", message, block);
+    exit(1);
+}
+
+/**
+ * mm_checkheap - Checks the headers, footers, and free lists for consistency.
+ */
+void mm_checkheap(void) {
+    LOCK_HEAP();
+    size_t free_count = 0;
+    bool prev_allocated = true;
+    block_t *block = mm_heap_first;
+    for (; block != mm_heap_epilogue; block = next_block(block)) {
+        if ((uintptr_t) block->payload % ALIGNMENT != 0) {
+            heap_error("payload is misaligned", block);
+        }
+        if (get_size(block) < MIN_BLOCK_SIZE ||
+            (uint8_t *) next_block(block) > (uint8_t *) mem_heap_hi() + 1) {
+            heap_error("block size is invalid", block);
+        }
+        if (is_prev_allocated(block) != prev_allocated) {
+            heap_error("PREV_ALLOCATED flag is wrong", block);
+        }
+        if (!is_allocated(block)) {
+            if (!prev_allocated) {
+                heap_error("free blocks weren't coalesced", block);
+            }
+            if (((size_t *) next_block(block))[-1] != block->header) {
+                heap_error("footer doesn't match header", block);
+            }
+            free_count++;
+        }
+        prev_allocated = is_allocated(block);
+    }
+    if (!is_allocated(block) || get_size(block) != 0 ||
+        is_prev_allocated(block) != prev_allocated) {
+        heap_error("epilogue is invalid", block);
+    }
+
+    for (size_t class = 0; class < NUM_SIZE_CLASSES; class++) {
+        if ((free_lists[class] != NULL) != ((free_class_mask >> class) & 1)) {
+            heap_error("free class mask is wrong", free_lists[class]);
+        }
+        free_block_t *prev = NULL;
+        for (free_block_t *free_block = free_lists[class]; free_block != NULL;
+             free_block = free_block->next) {
+            if (is_allocated(free_block) || size_class(get_size(free_block)) != class) {
+                heap_error("free list has a block it shouldn't", free_block);
+            }
+            if (free_block->prev != prev) {
+                heap_error("free list links are inconsistent", free_block);
+            }
+            if (free_count-- == 0) {
+                heap_error("free lists have more blocks than the heap", free_block);
+            }
+            prev = free_block;
+        }
+    }
+    if (free_count != 0) {
+        heap_error("free lists are missing blocks", NULL);
+    }
+    UNLOCK_HEAP();
+}
@@ -40,9 +40,133 @@ static std::atomic<unsigned long> ticks; // # timer interrupts so far
 
 pageinfo pages[NPAGES];
 
+// Free physical pages are kept on an intrusive list: the first word of each
+// free page points to the next free page, so `kalloc` and `kfree` are O(1).
+struct free_page {
+    free_page* next;
+};
+static free_page* free_pages = nullptr;
+
+
+// spinlock
+//    Mutual exclusion between CPUs. The kernel runs with interrupts
+//    disabled, so a lock holder can't be interrupted on its own CPU.
+
+struct spinlock {
+    std::atomic_flag flag = ATOMIC_FLAG_INIT;
+
+    void lock() {
+        while (flag.test_and_set(std::memory_order_acquire)) {
+            asm volatile("pause");
+        }
+    }
+    void unlock() {
+        flag.clear(std::memory_order_release);
+    }
+};
+
+static spinlock page_lock;      // protects `pages` and `free_pages`
+static spinlock ptable_lock;    // protects process slot allocation
+static spinlock sched_lock;     // protects the run queues
+
+
+// Performance counters
+//    `stats` counts kernel entries by system call and exception, page
+//    faults by cause, and context switches. Each kernel entry also charges
+//    the cycles until the kernel returns to a process (or goes idle) to
+//    its system call or exception. `sys_getstats` copies the counters out.
+
+static kstats stats;
+static uint64_t entry_tsc;              // time-stamp counter at kernel entry
+static uint64_t* entry_cycles;          // where to charge it, or nullptr
+
+static inline uint64_t read_tsc() {
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64_t) hi << 32) | lo;
+}
+
+// stats_enter(count, cycles)
+//    Counts a kernel entry in `*count`, and starts charging kernel time to
+//    `*cycles`.
+
+static void stats_enter(uint64_t* count, uint64_t* cycles) {
+    ++*count;
+    entry_cycles = cycles;
+    entry_tsc = read_tsc();
+}
+
+// stats_leave()
+//    Stops charging kernel time for the current kernel entry.
+
+static void stats_leave() {
+    if (entry_cycles) {
+        *entry_cycles += read_tsc() - entry_tsc;
+        entry_cycles = nullptr;
+    }
+}
+
+
+// Trace buffer
+//    The last TRACE_SIZE kernel events, in a ring. Writers claim slots with
+//    an atomic counter and never wait; a slot's `seq` is written last, so a
+//    reader can tell a complete event from one being overwritten.
+
+#define TRACE_SIZE 256
+
+enum trace_type {
+    TRACE_SYSCALL,                      // arg: system call number
+    TRACE_EXCEPTION,                    // arg: interrupt number
+    TRACE_FAULT,                        // arg: faulting address
+    TRACE_SWITCH                        // arg: previous pid
+};
+static const char* const trace_names[] = {
+    "syscall", "exception", "fault", "switch"
+};
+
+struct trace_event {
+    std::atomic<uint64_t> seq;          // event number + 1; 0 if unused
+    uint64_t tsc;
+    uint64_t arg;
+    int type;
+    pid_t pid;
+};
+static trace_event trace_buf[TRACE_SIZE];
+static std::atomic<uint64_t> trace_next;
+
+// trace(type, arg)
+//    Records an event of the current process in the trace buffer.
+
+static void trace(trace_type type, uint64_t arg) {
+    uint64_t n = trace_next.fetch_add(1, std::memory_order_relaxed);
+    trace_event& e = trace_buf[n % TRACE_SIZE];
+    e.seq.store(0, std::memory_order_relaxed);
+    e.tsc = read_tsc();
+    e.arg = arg;
+    e.type = type;
+    e.pid = current ? current->pid : 0;
+    e.seq.store(n + 1, std::memory_order_release);
+}
+
+// trace_dump()
+//    Writes the trace buffer to the log, oldest event first.
+
+static void trace_dump() {
+    uint64_t end = trace_next.load(std::memory_order_relaxed);
+    uint64_t n = end > TRACE_SIZE ? end - TRACE_SIZE : 0;
+    for (; n < end; ++n) {
+        trace_event& e = trace_buf[n % TRACE_SIZE];
+        if (e.seq.load(std::memory_order_acquire) == n + 1) {
+            log_printf("trace %lu: tsc %lu pid %d %s %lu\n", n, e.tsc,
+                       e.pid, trace_names[e.type], e.arg);
+        }
+    }
+}
+
 
 [[noreturn]] void schedule();
 [[noreturn]] void run(proc* p);
+[[noreturn]] void idle();               // defined in k-exception.S
 void exception(regstate* regs);
 uintptr_t syscall(regstate* regs);
 void memshow();
@@ -56,11 +180,13 @@ extern void memdump_physical(void);
 //    string is an optional string passed from the boot loader.
 
 static void process_setup(pid_t pid, const char* program_name);
+static void init_page_allocator();
 
 void kernel_start(const char* command) {
     // initialize hardware
     init_hardware();
     log_printf("Starting WeensyOS\n");
+    init_page_allocator();
 
     ticks = 1;
     init_timer(HZ);
@@ -86,8 +212,27 @@ void kernel_start(const char* command) {
         process_setup(4, "allocator4");
     }
     
-    // Switch to the first process using run()
-    run(&ptable[1]);
+    // Switch to the first process
+    schedule();
+}
+
+
+// init_page_allocator()
+//    Puts every allocatable physical page that isn't already in use on the
+//    free list. The list is built from the top of memory down, so `kalloc`
+//    hands out pages in increasing address order, like the old linear scan.
+
+static void init_page_allocator() {
+    free_pages = nullptr;
+    for (uintptr_t pa = MEMSIZE_PHYSICAL; pa != 0; ) {
+        pa -= PAGESIZE;
+        if (allocatable_physical_address(pa)
+            && !pages[pa / PAGESIZE].used()) {
+            free_page* page = (free_page*) pa;
+            page->next = free_pages;
+            free_pages = page;
+        }
+    }
 }
 
 
@@ -95,47 +240,251 @@ void kernel_start(const char* command) {
 //    Kernel memory allocator. Allocates `sz` contiguous bytes and
 //    returns a pointer to the allocated memory, or `nullptr` on failure.
 //
-//    The returned memory is initialized to 0xCC, which corresponds to
-//    the x86 instruction `int3` (this may help you debug). You'll
-//    probably want to reset it to something more useful.
+//    The returned memory is not initialized: callers that need zeroed pages
+//    (such as `sys_page_alloc`) clear them once themselves.
 //
 //    On WeensyOS, `kalloc` is a page-based allocator: if `sz > PAGESIZE`
 //    the allocation fails; if `sz < PAGESIZE` it allocates a whole page
-//    anyway.
-//
-//    The handout code returns the next allocatable free page it can find.
-//    It checks all pages. (You could maybe make this faster!)
+//    anyway. The page starts with a reference count of 1.
 
 void* kalloc(size_t sz) {
     if (sz > PAGESIZE) {
         return nullptr;
     }
 
-    for (uintptr_t pa = 0; pa != MEMSIZE_PHYSICAL; pa += PAGESIZE) {
-        if (allocatable_physical_address(pa)
-            && !pages[pa / PAGESIZE].used()) {
-            ++pages[pa / PAGESIZE].refcount;
-            memset((void*) pa, 0xCC, PAGESIZE);
-            return (void*) pa;
-        }
+    page_lock.lock();
+    free_page* page = free_pages;
+    if (page) {
+        free_pages = page->next;
+        uintptr_t pa = (uintptr_t) page;
+        assert(!pages[pa / PAGESIZE].used());
+        pages[pa / PAGESIZE].refcount = 1;
     }
-    return nullptr;
+    page_lock.unlock();
+    return page;
 }
 
 
 // kfree(kptr)
-//    Free `kptr`, which must have been previously returned by `kalloc`.
+//    Drop a reference to `kptr`, which must have been previously returned by
+//    `kalloc`, and free the page when its last reference goes away.
 //    If `kptr == nullptr` does nothing.
 
 void kfree(void* kptr) {
-    (void) kptr;
-    assert(false); 
+    if (!kptr) {
+        return;
+    }
+
+    uintptr_t pa = (uintptr_t) kptr;
+    assert(pa % PAGESIZE == 0 && allocatable_physical_address(pa));
+    page_lock.lock();
+    assert(pages[pa / PAGESIZE].used());
+    if (--pages[pa / PAGESIZE].refcount == 0) {
+        free_page* page = (free_page*) kptr;
+        page->next = free_pages;
+        free_pages = page;
+    }
+    page_lock.unlock();
+}
+
+// Zero-fill-on-demand regions
+//    `demand_regions[pid]` lists the page-aligned address ranges [start, end)
+//    of process `pid` that are allocated only when first touched: the BSS
+//    part of each loadable segment and the stack below its first page. A
+//    region page that is already mapped, e.g. by `sys_page_alloc`, is left
+//    alone. Unused entries have `start == end`.
+
+#define NDEMAND_REGIONS 4
+#define MAX_STACK_SIZE 0x10000  // how far the stack may grow on demand
+
+struct demand_region {
+    uintptr_t start;
+    uintptr_t end;
+};
+static demand_region demand_regions[NPROC][NDEMAND_REGIONS];
+
+// demand_clear(pid)
+//    Removes all of process `pid`'s zero-fill-on-demand regions.
+
+static void demand_clear(pid_t pid) {
+    memset(demand_regions[pid], 0, sizeof(demand_regions[pid]));
+}
+
+// demand_add(pid, start, end)
+//    Makes [start, end) a zero-fill-on-demand region of process `pid`.
+//    Empty ranges are ignored.
+
+static void demand_add(pid_t pid, uintptr_t start, uintptr_t end) {
+    if (start >= end) {
+        return;
+    }
+    for (int i = 0; i < NDEMAND_REGIONS; ++i) {
+        demand_region& r = demand_regions[pid][i];
+        if (r.start == r.end) {
+            r.start = start;
+            r.end = end;
+            return;
+        }
+    }
+    panic("Process %d has too many demand-zero regions!\n", pid);
+}
+
+// handle_demand_fault(addr)
+//    Handles a user fault on a missing page. If `addr` lies in one of the
+//    current process's zero-fill-on-demand regions, maps a fresh zeroed page
+//    there. Returns false if it doesn't or there is no memory for the page.
+
+static bool handle_demand_fault(uintptr_t addr) {
+    uintptr_t va = round_down(addr, PAGESIZE);
+    for (int i = 0; i < NDEMAND_REGIONS; ++i) {
+        demand_region& r = demand_regions[current->pid][i];
+        if (va < r.start || va >= r.end) {
+            continue;
+        }
+        void* page = kalloc(PAGESIZE);
+        if (!page) {
+            return false;
+        }
+        if (memory_map(current->pagetable, va, (uintptr_t) page, PTE_PWU) < 0) {
+            kfree(page);
+            return false;
+        }
+        memset(page, 0, PAGESIZE);
+        return true;
+    }
+    return false;
+}
+
+
+// Scheduler
+//    Runnable processes wait on a multilevel feedback queue: one FIFO run
+//    queue per level, where level 0 has the highest priority. A process
+//    starts at level 0 and drops a level each time it uses up a time slice,
+//    and slices double at every level, so processes that yield early stay
+//    ahead of CPU-bound ones. Every BOOST_TICKS timer ticks all processes
+//    go back to level 0, so none starves. The running process is never on
+//    a queue. The queues are linked through `sched_info::next`, so pushing
+//    is O(1) and popping is O(NLEVELS).
+
+#define NLEVELS 3
+#define BOOST_TICKS HZ          // priority boost interval (1 sec)
+
+struct sched_info {
+    pid_t next;                 // next process on the same run queue, or 0
+    int level;                  // run queue level
+    unsigned slice;             // timer ticks left in the time slice
+    unsigned long cpu_ticks;    // timer ticks spent running
+};
+static sched_info sched[NPROC];
+static pid_t runq_head[NLEVELS];        // 0 if empty (`ptable[0]` is unused)
+static pid_t runq_tail[NLEVELS];
+
+// level_slice(level)
+//    Returns the length of a time slice at run queue level `level`, in
+//    timer ticks.
+
+static unsigned level_slice(int level) {
+    return 1U << level;
+}
+
+// runq_push(p)
+//    Appends runnable process `p` to the run queue for its level.
+
+static void runq_push(proc* p) {
+    assert(p->state == P_RUNNABLE);
+    sched_lock.lock();
+    int level = sched[p->pid].level;
+    sched[p->pid].next = 0;
+    if (runq_tail[level]) {
+        sched[runq_tail[level]].next = p->pid;
+    } else {
+        runq_head[level] = p->pid;
+    }
+    runq_tail[level] = p->pid;
+    sched_lock.unlock();
+}
+
+// runq_pop()
+//    Removes and returns the first process on the highest-priority nonempty
+//    run queue, or returns nullptr if no process is runnable.
+
+static proc* runq_pop() {
+    proc* p = nullptr;
+    sched_lock.lock();
+    for (int level = 0; !p && level < NLEVELS; ++level) {
+        pid_t pid = runq_head[level];
+        if (pid) {
+            runq_head[level] = sched[pid].next;
+            if (!runq_head[level]) {
+                runq_tail[level] = 0;
+            }
+            p = &ptable[pid];
+        }
+    }
+    sched_lock.unlock();
+    return p;
+}
+
+// sched_start(p)
+//    Marks new process `p` as runnable at the highest priority.
+
+static void sched_start(proc* p) {
+    sched[p->pid].level = 0;
+    sched[p->pid].slice = level_slice(0);
+    sched[p->pid].cpu_ticks = 0;
+    p->state = P_RUNNABLE;
+    runq_push(p);
+}
+
+// sched_tick()
+//    Charges a timer tick to the current process. Returns true if its time
+//    slice has ticks left; otherwise moves it down a level, puts it back on
+//    the run queue for that level, and returns false.
+
+static bool sched_tick() {
+    sched_info& si = sched[current->pid];
+    ++si.cpu_ticks;
+    if (--si.slice > 0) {
+        return true;
+    }
+    si.level = min(si.level + 1, NLEVELS - 1);
+    si.slice = level_slice(si.level);
+    runq_push(current);
+    return false;
+}
+
+// sched_boost()
+//    Moves every process back to level 0, keeping the queued processes in
+//    priority order.
+
+static void sched_boost() {
+    sched_lock.lock();
+    for (int level = 1; level < NLEVELS; ++level) {
+        if (!runq_head[level]) {
+            continue;
+        }
+        if (runq_tail[0]) {
+            sched[runq_tail[0]].next = runq_head[level];
+        } else {
+            runq_head[0] = runq_head[level];
+        }
+        runq_tail[0] = runq_tail[level];
+        runq_head[level] = runq_tail[level] = 0;
+    }
+    for (pid_t pid = 1; pid < NPROC; ++pid) {
+        sched[pid].level = 0;
+        sched[pid].slice = level_slice(0);
+    }
+    sched_lock.unlock();
 }
 
+
 // process_setup(pid, program_name)
 //    Load application program `program_name` as process number `pid`.
 //    This loads the application's code and data into memory, sets its
 //    %rip and %rsp, gives it a stack page, and marks it as runnable.
+//    Zero-filled memory (the BSS and the rest of the stack) is mapped
+//    lazily by `handle_demand_fault`.
 
 void process_setup(pid_t pid, const char* program_name) {
     init_process(&ptable[pid], 0);
@@ -151,28 +500,37 @@ void process_setup(pid_t pid, const char* program_name) {
     // obtain reference to the program image
     program_image pgm(program_name);
 
-    // allocate and map global memory required by loadable segments
+    // map the pages of each loadable segment that hold file data, and fault
+    // in the rest (the BSS) on demand
+    demand_clear(pid);
+    uintptr_t image_end = PROC_START_ADDR;
     for (auto seg = pgm.begin(); seg != pgm.end(); ++seg) {
-        for (uintptr_t a = round_down(seg.va(), PAGESIZE);
-             a < seg.va() + seg.size();
-             a += PAGESIZE) {
-            // (NB this is physical page allocation!)
-            void* ptr = kalloc(a / PAGESIZE);
-            memory_map(ptable[pid].pagetable, a, (uintptr_t) ptr, PTE_PWU);
+        uintptr_t data_end = seg.va() + seg.data_size();
+        uintptr_t a = round_down(seg.va(), PAGESIZE);
+        for (; a < data_end; a += PAGESIZE) {
+            // Segments may share a page, which is then mapped once
+            uintptr_t pa;
+            if (memory_permissions(ptable[pid].pagetable, a) & PTE_U) {
+                pa = (uintptr_t) memory_virtual_to_physical(ptable[pid].pagetable, a);
+            } else {
+                // (NB this is physical page allocation!)
+                pa = (uintptr_t) kalloc(PAGESIZE);
+                memset((void*) pa, 0, PAGESIZE);
+                memory_map(ptable[pid].pagetable, a, pa, PTE_PWU);
+            }
+            uintptr_t lo = max(a, seg.va());
+            uintptr_t hi = min(a + PAGESIZE, data_end);
+            memcpy((void*) (pa + (lo - a)), seg.data() + (lo - seg.va()), hi - lo);
         }
-    }
-
-    // initialize data in loadable segments
-    for (auto seg = pgm.begin(); seg != pgm.end(); ++seg) {
-        void *ptr = memory_virtual_to_physical(ptable[pid].pagetable, (uintptr_t) seg.va());
-        memset(ptr, 0, seg.size());
-        memcpy(ptr, seg.data(), seg.data_size());
+        uintptr_t seg_end = round_up(seg.va() + seg.size(), PAGESIZE);
+        demand_add(pid, a, seg_end);
+        image_end = max(image_end, seg_end);
     }
 
     // mark entry point
     ptable[pid].regs.reg_rip = pgm.entry();
 
-    // allocate and map stack segment
+    // allocate and map the top stack page; the stack grows on demand below it
     // uintptr_t stack_addr = PROC_START_ADDR + PROC_SIZE * pid - PAGESIZE;
     uintptr_t stack_addr = MEMSIZE_VIRTUAL - PAGESIZE;
     // (NB this is physical page allocation!)
@@ -180,13 +538,53 @@ void process_setup(pid_t pid, const char* program_name) {
     void* ptr = kalloc(PAGESIZE);
     memory_map(ptable[pid].pagetable, stack_addr, (uintptr_t) ptr, PTE_PWU);
     ptable[pid].regs.reg_rsp = stack_addr + PAGESIZE;
+    demand_add(pid, max(image_end, uintptr_t(MEMSIZE_VIRTUAL - MAX_STACK_SIZE)),
+               stack_addr);
 
     // mark process as runnable
-    ptable[pid].state = P_RUNNABLE;
+    sched_start(&ptable[pid]);
 }
 
 
 
+// handle_cow_fault(addr)
+//    Handles a user write fault on a copy-on-write page. Every user page is
+//    mapped writable except for pages that `sys_fork` shares, so a present,
+//    user-accessible, read-only page is always copy-on-write. The faulting
+//    process writes to a private copy of the page, or, if no other process
+//    still shares it, to the page itself. Returns false if the fault isn't a
+//    copy-on-write fault or there is no memory for the copy.
+
+static bool handle_cow_fault(uintptr_t addr) {
+    uintptr_t va = round_down(addr, PAGESIZE);
+    uintptr_t perm = memory_permissions(current->pagetable, va);
+    if ((perm & (PTE_P | PTE_W | PTE_U)) != (PTE_P | PTE_U)) {
+        return false;
+    }
+    uintptr_t pa = (uintptr_t) memory_virtual_to_physical(current->pagetable, va);
+    if (pa == CONSOLE_ADDR || !allocatable_physical_address(pa)) {
+        return false;
+    }
+
+    // Read without `page_lock`: only sharers on other CPUs can change the
+    // count, and they only lower it, so a stale count just costs a copy
+    if (pages[pa / PAGESIZE].refcount == 1) {
+        // The other sharers have already copied or freed the page
+        memory_map(current->pagetable, va, pa, PTE_PWU);
+        return true;
+    }
+    void* copy = kalloc(PAGESIZE);
+    if (!copy) {
+        return false;
+    }
+    memcpy(copy, (void*) pa, PAGESIZE);
+    // Replacing a mapping never allocates page table pages, so this can't fail
+    memory_map(current->pagetable, va, (uintptr_t) copy, PTE_PWU);
+    kfree((void*) pa);
+    return true;
+}
+
+
 // exception(regs)
 //    Exception handler (for interrupts, traps, and faults).
 //
@@ -199,9 +597,17 @@ void process_setup(pid_t pid, const char* program_name) {
 //    Note that hardware interrupts are disabled when the kernel is running.
 
 void exception(regstate* regs) {
-    // Copy the saved registers into the `current` process descriptor.
-    current->regs = *regs;
-    regs = &current->regs;
+    // An interrupt taken in `idle` belongs to no process. Otherwise,
+    // copy the saved registers into the `current` process descriptor.
+    bool from_user = (regs->reg_cs & 3) != 0;
+    if (from_user) {
+        current->regs = *regs;
+        regs = &current->regs;
+    }
+    int kind = regs->reg_intno == INT_IRQ + IRQ_TIMER ? KSTATS_TIMER
+        : regs->reg_intno == INT_PF ? KSTATS_PAGEFAULT : KSTATS_OTHER;
+    stats_enter(&stats.exceptions[kind], &stats.exception_cycles[kind]);
+    trace(TRACE_EXCEPTION, regs->reg_intno);
 
     // It can be useful to log events using `log_printf`.
     // Events logged this way are stored in the host's `log.txt` file.
@@ -236,6 +642,12 @@ void exception(regstate* regs) {
     case INT_IRQ + IRQ_TIMER:
         ++ticks;
         lapicstate::get().ack();
+        if (ticks % BOOST_TICKS == 0) {
+            sched_boost();
+        }
+        if (from_user && sched_tick()) {
+            run(current);
+        }
         schedule();
         break;                  /* will not be reached */
 
@@ -251,6 +663,19 @@ void exception(regstate* regs) {
             panic("Kernel page fault on %p (%s %s)!\n",
                   addr, operation, problem);
         }
+        trace(TRACE_FAULT, addr);
+        if ((regs->reg_errcode & PFERR_WRITE)
+            && (regs->reg_errcode & PFERR_PRESENT)
+            && handle_cow_fault(addr)) {
+            ++stats.faults[KSTATS_FAULT_COW];
+            break;
+        }
+        if (!(regs->reg_errcode & PFERR_PRESENT)
+            && handle_demand_fault(addr)) {
+            ++stats.faults[KSTATS_FAULT_DEMAND];
+            break;
+        }
+        ++stats.faults[KSTATS_FAULT_FATAL];
         console_printf(CPOS(24, 0), 0x0C00,
                        "Process %d page fault on %p (%s %s, rip=%p)!\n",
                        current->pid, addr, operation, problem, regs->reg_rip);
@@ -265,7 +690,7 @@ void exception(regstate* regs) {
 
 
     // Return to the current process (or run something else).
-    if (current->state == P_RUNNABLE) {
+    if (from_user && current->state == P_RUNNABLE) {
         run(current);
     } else {
         schedule();
@@ -282,11 +707,19 @@ void exception(regstate* regs) {
 //    Note that hardware interrupts are disabled when the kernel is running.
 
 int syscall_page_alloc(uintptr_t addr);
+int syscall_page_alloc_range(uintptr_t addr, size_t npages);
+int syscall_getstats(uintptr_t addr, int flags);
+static uintptr_t syscall_dispatch(regstate* regs);
+pid_t syscall_fork();
+[[noreturn]] void syscall_exit();
 
 uintptr_t syscall(regstate* regs) {
     // Copy the saved registers into the `current` process descriptor.
     current->regs = *regs;
     regs = &current->regs;
+    uintptr_t nr = regs->reg_rax < NSYSCALLS ? regs->reg_rax : 0;
+    stats_enter(&stats.syscalls[nr], &stats.syscall_cycles[nr]);
+    trace(TRACE_SYSCALL, regs->reg_rax);
 
     // It can be useful to log events using `log_printf`.
     // Events logged this way are stored in the host's `log.txt` file.
@@ -300,6 +733,17 @@ uintptr_t syscall(regstate* regs) {
     // If Control-C was typed, exit the virtual machine.
     check_keyboard();
 
+    uintptr_t ret = syscall_dispatch(regs);
+    stats_leave();
+    return ret;
+}
+
+
+// syscall_dispatch(regs)
+//    Handles the system call in `regs` and returns its result.
+
+static uintptr_t syscall_dispatch(regstate* regs) {
+
 
     // Actually handle the exception.
     switch (regs->reg_rax) {
@@ -311,12 +755,28 @@ uintptr_t syscall(regstate* regs) {
         return current->pid;
 
     case SYSCALL_YIELD:
+        // The process keeps its level and the rest of its time slice
         current->regs.reg_rax = 0;
+        runq_push(current);
         schedule();             // does not return
 
     case SYSCALL_PAGE_ALLOC:
         return syscall_page_alloc(current->regs.reg_rdi);
 
+    case SYSCALL_PAGE_ALLOC_RANGE:
+        return syscall_page_alloc_range(current->regs.reg_rdi,
+                                        current->regs.reg_rsi);
+
+    case SYSCALL_GETSTATS:
+        return syscall_getstats(current->regs.reg_rdi,
+                                current->regs.reg_rsi);
+
+    case SYSCALL_FORK:
+        return syscall_fork();
+
+    case SYSCALL_EXIT:
+        syscall_exit();         // does not return
+
     default:
         panic("Unexpected system call %ld!\n", regs->reg_rax);
 
@@ -327,42 +787,203 @@ uintptr_t syscall(regstate* regs) {
 
 
 // syscall_page_alloc(addr)
-//    Handles the SYSCALL_PAGE_ALLOC system call. This function
-//    should implement the specification for `sys_page_alloc`
-//    in `u-lib.hh` (but in the handout code, it does not).
+//    Handles the SYSCALL_PAGE_ALLOC system call, as a one-page range.
 
 int syscall_page_alloc(uintptr_t addr) {
-    void* ptr = kalloc(addr / PAGESIZE);
-    if (ptr == nullptr) {
+    return syscall_page_alloc_range(addr, 1) == 1 ? 0 : -1;
+}
+
+
+// syscall_page_alloc_range(addr, npages)
+//    Handles the SYSCALL_PAGE_ALLOC_RANGE system call (see
+//    `sys_page_alloc_range` in `u-lib.hh`). A single `vmiter` walks the
+//    whole range, so consecutive pages in the same page table share one
+//    page table walk.
+
+int syscall_page_alloc_range(uintptr_t addr, size_t npages) {
+    if (addr % PAGESIZE != 0 || addr < PROC_START_ADDR
+        || addr >= MEMSIZE_VIRTUAL
+        || npages > (MEMSIZE_VIRTUAL - addr) / PAGESIZE) {
         return -1;
     }
-    memory_map(current->pagetable, addr, (uintptr_t) ptr, PTE_PWU);
-    memset(memory_virtual_to_physical(current->pagetable, (uintptr_t) addr), 0, PAGESIZE);
+
+    size_t n = 0;
+    for (vmiter it(current->pagetable, addr); n < npages; ++n, it += PAGESIZE) {
+        void* ptr = kalloc(PAGESIZE);
+        if (ptr == nullptr) {
+            break;
+        }
+        // Free the page previously mapped here, if any
+        if (it.perm() & PTE_U) {
+            kfree((void*) it.pa());
+        }
+        if (it.try_map((uintptr_t) ptr, PTE_PWU) < 0) {
+            kfree(ptr);
+            break;
+        }
+        // The page is zeroed exactly once, through its kernel (identity) mapping
+        memset(ptr, 0, PAGESIZE);
+    }
+    return n;
+}
+
+
+// copy_to_user(va, src, n)
+//    Copies `n` bytes from kernel memory `src` to the current process's
+//    memory at `va`. Copy-on-write and demand-zero pages are handled as a
+//    user write would handle them. Returns 0 on success and -1 if the
+//    process can't write all of [va, va + n).
+
+static int copy_to_user(uintptr_t va, const void* src, size_t n) {
+    if (va < PROC_START_ADDR || va > MEMSIZE_VIRTUAL
+        || n > MEMSIZE_VIRTUAL - va) {
+        return -1;
+    }
+    const char* s = (const char*) src;
+    while (n > 0) {
+        uintptr_t page = round_down(va, PAGESIZE);
+        uintptr_t perm = memory_permissions(current->pagetable, page);
+        if (!(perm & PTE_P)) {
+            handle_demand_fault(page);
+        } else if (!(perm & PTE_W)) {
+            handle_cow_fault(page);
+        }
+        perm = memory_permissions(current->pagetable, page);
+        if ((perm & PTE_PWU) != PTE_PWU) {
+            return -1;
+        }
+        size_t chunk = min(n, size_t(page + PAGESIZE - va));
+        char* dst = (char*) memory_virtual_to_physical(current->pagetable, page);
+        memcpy(dst + (va - page), s, chunk);
+        va += chunk;
+        s += chunk;
+        n -= chunk;
+    }
     return 0;
 }
 
 
-// schedule
-//    Pick the next process to run and then run it.
-//    If there are no runnable processes, spins forever.
+// syscall_getstats(addr, flags)
+//    Handles the SYSCALL_GETSTATS system call (see `sys_getstats` in
+//    `u-lib.hh`).
 
-void schedule() {
-    pid_t pid = current->pid;
-    for (unsigned spins = 1; true; ++spins) {
-        pid = (pid + 1) % NPROC;
-        if (ptable[pid].state == P_RUNNABLE) {
-            run(&ptable[pid]);
+int syscall_getstats(uintptr_t addr, int flags) {
+    if (flags & KSTATS_DUMP_TRACE) {
+        trace_dump();
+    }
+    return copy_to_user(addr, &stats, sizeof(stats));
+}
+
+
+// free_process_memory(p)
+//    Drops process `p`'s references to its user pages (pages it shares with
+//    other processes stay allocated until their last user frees them), then
+//    frees its page table. The page table must not be the active one.
+
+static void free_process_memory(proc* p) {
+    for (uintptr_t va = PROC_START_ADDR; va < MEMSIZE_VIRTUAL; va += PAGESIZE) {
+        if (memory_permissions(p->pagetable, va) & PTE_U) {
+            kfree(memory_virtual_to_physical(p->pagetable, va));
         }
+    }
+    for (ptiter it(p->pagetable); !it.done(); it.next()) {
+        kfree((void*) it.pa());
+    }
+    kfree(p->pagetable);
+    p->pagetable = nullptr;
+}
+
 
-        // If Control-C was typed, exit the virtual machine.
-        check_keyboard();
+// syscall_fork()
+//    Handles the SYSCALL_FORK system call. The child shares all of the
+//    parent's user pages, and both map them read-only, so nothing is
+//    copied until one of them writes to a page (see `handle_cow_fault`).
+//    Returns the child's pid, or -1 if there is no free process slot or
+//    not enough memory for the child's page table.
 
-        // If spinning forever, show the memviewer.
-        if (spins % (1 << 12) == 0) {
-            memshow();
-            log_printf("%u\n", spins);
+pid_t syscall_fork() {
+    // Claim a free slot; the child stays blocked until it's ready to run
+    ptable_lock.lock();
+    pid_t pid = 1;
+    while (pid < NPROC && ptable[pid].state != P_FREE) {
+        ++pid;
+    }
+    if (pid < NPROC) {
+        ptable[pid].state = P_BLOCKED;
+    }
+    ptable_lock.unlock();
+    if (pid == NPROC) {
+        return -1;
+    }
+    proc* child = &ptable[pid];
+    init_process(child, 0);
+    child->state = P_BLOCKED;
+    child->pagetable = kalloc_pagetable();
+    if (!child->pagetable) {
+        child->state = P_FREE;
+        return -1;
+    }
+    memory_foreach(child->pagetable, PROC_START_ADDR, map_to_kernel_space);
+    map_to_nobody(child->pagetable, (uintptr_t)NULL);
+    map_to_user_space(child->pagetable, CONSOLE_ADDR);
+
+    for (uintptr_t va = PROC_START_ADDR; va < MEMSIZE_VIRTUAL; va += PAGESIZE) {
+        uintptr_t perm = memory_permissions(current->pagetable, va);
+        if (!(perm & PTE_U)) {
+            continue;
+        }
+        uintptr_t pa = (uintptr_t) memory_virtual_to_physical(current->pagetable, va);
+        if (memory_map(child->pagetable, va, pa, PTE_P | PTE_U) < 0) {
+            free_process_memory(child);
+            child->state = P_FREE;
+            return -1;
+        }
+        page_lock.lock();
+        ++pages[pa / PAGESIZE].refcount;
+        page_lock.unlock();
+        if (perm & PTE_W) {
+            // The parent's TLB is flushed when `run` reloads its page table
+            memory_map(current->pagetable, va, pa, PTE_P | PTE_U);
         }
     }
+
+    // Pages the parent hasn't touched yet stay on demand in the child
+    memcpy(demand_regions[pid], demand_regions[current->pid],
+           sizeof(demand_regions[pid]));
+
+    child->regs = current->regs;
+    child->regs.reg_rax = 0;
+    sched_start(child);
+    return pid;
+}
+
+
+// syscall_exit()
+//    Handles the SYSCALL_EXIT system call: frees the current process's
+//    memory and runs another process.
+
+void syscall_exit() {
+    // Stop using the process's page table before freeing it
+    set_pagetable(kernel_pagetable);
+    free_process_memory(current);
+    demand_clear(current->pid);
+    current->state = P_FREE;
+    schedule();
+}
+
+
+// schedule
+//    Pick the next process to run and then run it.
+//    If there are no runnable processes, waits for an interrupt.
+
+void schedule() {
+    if (proc* p = runq_pop()) {
+        run(p);
+    }
+    // The timer interrupt keeps checking the keyboard and showing the
+    // memviewer while the CPU is idle
+    stats_leave();
+    idle();
 }
 
 
@@ -372,7 +993,13 @@ void schedule() {
 
 void run(proc* p) {
     assert(p->state == P_RUNNABLE);
-    current = p;
+    if (p != current) {
+        ++stats.context_switches;
+        pid_t prev = current ? current->pid : 0;
+        current = p;
+        trace(TRACE_SWITCH, prev);
+    }
+    stats_leave();
 
     // Check the process's current pagetable.
     check_pagetable(p->pagetable);
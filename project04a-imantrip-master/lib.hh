@@ -210,6 +210,40 @@ inline uint32_t crc32c(const void* buf, size_t sz) {
 #define SYSCALL_PAGE_ALLOC      4
 #define SYSCALL_FORK            5
 #define SYSCALL_EXIT            6
+#define SYSCALL_PAGE_ALLOC_RANGE 7
+#define SYSCALL_GETSTATS        8
+#define NSYSCALLS               9       // all system call numbers are lower
+
+
+// Kernel statistics, as returned by `sys_getstats`. Cycle counts are
+// time-stamp counter cycles spent in the kernel, from entry until it
+// returns to a process (or goes idle).
+
+enum kstats_exception {
+    KSTATS_TIMER,                       // timer interrupts
+    KSTATS_PAGEFAULT,                   // page faults
+    KSTATS_OTHER,                       // all other exceptions
+    NKSTATS_EXCEPTIONS
+};
+
+enum kstats_fault {
+    KSTATS_FAULT_COW,                   // writes to copy-on-write pages
+    KSTATS_FAULT_DEMAND,                // touches of demand-zero pages
+    KSTATS_FAULT_FATAL,                 // faults that broke the process
+    NKSTATS_FAULTS
+};
+
+struct kstats {
+    uint64_t syscalls[NSYSCALLS];       // system calls, by number
+    uint64_t syscall_cycles[NSYSCALLS];
+    uint64_t exceptions[NKSTATS_EXCEPTIONS];
+    uint64_t exception_cycles[NKSTATS_EXCEPTIONS];
+    uint64_t faults[NKSTATS_FAULTS];    // user page faults, by cause
+    uint64_t context_switches;
+};
+
+// `sys_getstats` flag: also write the kernel's trace buffer to the log
+#define KSTATS_DUMP_TRACE       1
 
 
 // CGA console printing
@@ -100,6 +100,27 @@ inline int sys_page_alloc(void* addr) {
     return make_syscall(SYSCALL_PAGE_ALLOC, (uintptr_t) addr);
 }
 
+// sys_page_alloc_range(addr, npages)
+//    Allocate the `npages` pages starting at address `addr`, as if by
+//    calling `sys_page_alloc` on each page in turn, but in one system call.
+//    Returns the number of pages allocated, which is less than `npages` if
+//    memory runs out, or -1 on invalid argument.
+//
+//    `Addr` should be page-aligned, >= PROC_START_ADDR, and the range
+//    should end at or below MEMSIZE_VIRTUAL.
+inline int sys_page_alloc_range(void* addr, size_t npages) {
+    return make_syscall(SYSCALL_PAGE_ALLOC_RANGE, (uintptr_t) addr, npages);
+}
+
+// sys_getstats(stats, flags)
+//    Copy the kernel's performance counters into `*stats`. If `flags`
+//    includes KSTATS_DUMP_TRACE, the kernel also writes its recent trace
+//    events to the log. Returns 0 on success and -1 if `stats` isn't
+//    writable.
+inline int sys_getstats(kstats* stats, int flags = 0) {
+    return make_syscall(SYSCALL_GETSTATS, (uintptr_t) stats, flags);
+}
+
 // sys_fork()
 //    Fork the current process. On success, return the child's process ID to
 //    the parent, and return 0 to the child. On failure, return -1.
@@ -0,0 +1,198 @@
+#ifndef _CALIBRATE_H
+#define _CALIBRATE_H
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "util.h"
+
+#define CACHE_LINE_SIZE 64
+
+/**
+ * Latencies are recorded to the cycle, up to LATENCY_BUCKETS cycles.
+ * Slower reads were almost certainly interrupted, so they are rejected.
+ */
+#define LATENCY_BUCKETS 1024
+
+/**
+ * Number of lines, one page apart, read to evict a line from the L1 cache.
+ * L1 caches are indexed by the address bits within a page,
+ * so these all compete with the line for the same set.
+ * This is twice the associativity of common L1 caches,
+ * and few enough pages that the line's TLB entry survives.
+ */
+#define L1_EVICTION_LINES 24
+
+/* Cache sizes assumed when the C library doesn't report them */
+#define DEFAULT_L2_SIZE (256 * 1024)
+#define DEFAULT_LLC_SIZE (8 * 1024 * 1024)
+
+/* Samples per level taken by calibrate_hit_threshold() */
+#define HIT_CALIBRATION_SAMPLES 1000
+
+typedef enum { L1_HIT, L2_HIT, LLC_HIT, DRAM_HIT, NUM_CACHE_LEVELS } cache_level_t;
+
+static const char *const CACHE_LEVEL_NAMES[NUM_CACHE_LEVELS] = {"L1", "L2", "LLC", "DRAM"};
+
+typedef struct {
+    uint64_t counts[LATENCY_BUCKETS];
+    size_t samples;
+    size_t rejected;
+} latency_histogram_t;
+
+typedef struct {
+    latency_histogram_t histograms[NUM_CACHE_LEVELS];
+    /**
+     * thresholds[level] separates reads served by `level` (or a faster level)
+     * from reads served by the next slower level:
+     * a read taking fewer than thresholds[level] cycles was served by `level` or faster.
+     */
+    uint64_t thresholds[NUM_CACHE_LEVELS - 1];
+} calibration_t;
+
+/**
+ * Records one timed read in a histogram, unless it was interrupted.
+ */
+static inline void record_latency(latency_histogram_t *histogram, uint64_t latency) {
+    if (latency >= LATENCY_BUCKETS) {
+        histogram->rejected++;
+        return;
+    }
+    histogram->counts[latency]++;
+    histogram->samples++;
+}
+
+/**
+ * Returns the smallest latency that at least `percent` percent of a histogram's samples
+ * are no slower than.
+ */
+static inline uint64_t latency_percentile(const latency_histogram_t *histogram, double percent) {
+    size_t rank = (size_t) (percent / 100 * histogram->samples);
+    size_t seen = 0;
+    for (uint64_t latency = 0; latency < LATENCY_BUCKETS; latency++) {
+        seen += histogram->counts[latency];
+        if (seen > rank || seen == histogram->samples) {
+            return latency;
+        }
+    }
+    return LATENCY_BUCKETS - 1;
+}
+
+/**
+ * Returns the threshold that best separates the latencies of two levels:
+ * the one that misclassifies the fewest samples when reads faster than it
+ * are attributed to the faster level.
+ */
+static inline uint64_t separating_threshold(const latency_histogram_t *fast,
+                                            const latency_histogram_t *slow) {
+    // With a threshold of 0, every fast sample is misclassified
+    size_t errors = fast->samples;
+    size_t best_errors = errors;
+    uint64_t best_threshold = 0;
+    for (uint64_t threshold = 1; threshold < LATENCY_BUCKETS; threshold++) {
+        errors = errors - fast->counts[threshold - 1] + slow->counts[threshold - 1];
+        if (errors < best_errors) {
+            best_errors = errors;
+            best_threshold = threshold;
+        }
+    }
+    return best_threshold;
+}
+
+/**
+ * Reads every cache line of a buffer.
+ */
+static inline void read_lines(const uint8_t *buffer, size_t size) {
+    for (size_t offset = 0; offset < size; offset += CACHE_LINE_SIZE) {
+        force_read(&buffer[offset]);
+    }
+    _mm_mfence();
+}
+
+/**
+ * Reads lines that share `line`'s L1 set, evicting it from the L1 cache
+ * but (since there are only a few of them) not from L2.
+ */
+static inline void evict_from_l1(const uint8_t *eviction_pages, const void *line) {
+    size_t offset = (uintptr_t) line % PAGE_SIZE;
+    for (size_t i = 0; i < L1_EVICTION_LINES; i++) {
+        force_read(&eviction_pages[i * PAGE_SIZE + offset]);
+    }
+    // Don't let the eviction reads overlap the timed read
+    _mm_mfence();
+}
+
+static inline size_t cache_size(int name, size_t default_size) {
+    long size = sysconf(name);
+    return size > 0 ? (size_t) size : default_size;
+}
+
+/**
+ * Measures `samples` reads served by each level of the memory hierarchy
+ * and derives the thresholds between them.
+ * A line is brought into L1 by reading it again,
+ * into L2 by then evicting it from L1 with lines that share its L1 set,
+ * into the LLC by then reading a buffer twice the size of L2,
+ * and out to DRAM by flushing it.
+ */
+static inline void calibrate(calibration_t *calibration, size_t samples) {
+    memset(calibration, 0, sizeof(*calibration));
+
+    size_t l2_size = cache_size(_SC_LEVEL2_CACHE_SIZE, DEFAULT_L2_SIZE);
+    size_t llc_size = cache_size(_SC_LEVEL3_CACHE_SIZE, DEFAULT_LLC_SIZE);
+    // Stay well inside the LLC, so the reads evict the line only from L2
+    size_t l2_eviction_size = 2 * l2_size < llc_size / 2 ? 2 * l2_size : llc_size / 2;
+
+    // A separate page for the probed line, so the eviction buffers can't share its lines
+    uint8_t *line = aligned_alloc(PAGE_SIZE, PAGE_SIZE);
+    uint8_t *eviction_pages = aligned_alloc(PAGE_SIZE, L1_EVICTION_LINES * PAGE_SIZE);
+    uint8_t *l2_eviction = aligned_alloc(PAGE_SIZE, l2_eviction_size);
+    assert(line != NULL && eviction_pages != NULL && l2_eviction != NULL);
+    // Write to every page, so none are backed by the shared zero page
+    memset(line, 1, PAGE_SIZE);
+    memset(eviction_pages, 1, L1_EVICTION_LINES * PAGE_SIZE);
+    memset(l2_eviction, 1, l2_eviction_size);
+
+    latency_histogram_t *histograms = calibration->histograms;
+    for (size_t i = 0; i < samples; i++) {
+        force_read(line);
+        record_latency(&histograms[L1_HIT], time_read(line));
+
+        evict_from_l1(eviction_pages, line);
+        record_latency(&histograms[L2_HIT], time_read(line));
+
+        read_lines(l2_eviction, l2_eviction_size);
+        record_latency(&histograms[LLC_HIT], time_read(line));
+
+        flush_cache_line(line);
+        record_latency(&histograms[DRAM_HIT], time_read(line));
+    }
+
+    for (cache_level_t level = L1_HIT; level < DRAM_HIT; level++) {
+        calibration->thresholds[level] =
+            separating_threshold(&histograms[level], &histograms[level + 1]);
+    }
+
+    free(line);
+    free(eviction_pages);
+    free(l2_eviction);
+}
+
+/**
+ * Returns the number of cycles below which a read on this machine
+ * was served by some cache rather than by DRAM.
+ * This replaces a fixed threshold, which only fits the machine it was tuned on.
+ */
+static inline uint64_t calibrate_hit_threshold(void) {
+    calibration_t *calibration = malloc(sizeof(*calibration));
+    assert(calibration != NULL);
+    calibrate(calibration, HIT_CALIBRATION_SAMPLES);
+    uint64_t threshold = calibration->thresholds[LLC_HIT];
+    free(calibration);
+    return threshold;
+}
+
+#endif /* _CALIBRATE_H */
@@ -0,0 +1,119 @@
+#ifndef _MEMBENCH_H
+#define _MEMBENCH_H
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "calibrate.h"
+#include "util.h"
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+/* Every chase runs for at least this many loads, so short chases are timed over many laps */
+#define MIN_CHASE_STEPS (1 << 20)
+
+/**
+ * Returns the next number from a xorshift64 generator.
+ * The benchmarks are seeded with a fixed value,
+ * so every host chases the same access patterns.
+ */
+static inline uint64_t next_random(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+/**
+ * Allocates a buffer of at least `size` bytes, aligned to a huge page.
+ * It is backed by transparent huge pages if `huge` is set (and the kernel allows it),
+ * and by 4 KB pages otherwise.
+ * Every page is written, so none are backed by the shared zero page.
+ */
+static inline uint8_t *map_buffer(size_t size, bool huge) {
+    size = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    uint8_t *buffer = aligned_alloc(HUGE_PAGE_SIZE, size);
+    assert(buffer != NULL);
+    madvise(buffer, size, huge ? MADV_HUGEPAGE : MADV_NOHUGEPAGE);
+    memset(buffer, 1, size);
+    return buffer;
+}
+
+/**
+ * Returns the address of slot `slot` of a chase (see build_chase()).
+ * Staggered slots are moved to a line picked by hashing the slot number,
+ * which spreads them evenly over the sets of every cache level
+ * (a simple `slot % lines_per_page` would tie each L2 set to the L1 set).
+ */
+static inline void **chase_slot(uint8_t *buffer, size_t slot, size_t spacing, bool stagger) {
+    // Fibonacci hashing: the top bits of the product are well mixed
+    size_t line = (size_t) ((slot * 0x9E3779B97F4A7C15ull) >> 58);
+    _Static_assert(PAGE_SIZE / CACHE_LINE_SIZE == 64, "line hash yields 6 bits");
+    size_t offset = stagger ? line * CACHE_LINE_SIZE : 0;
+    return (void **) &buffer[slot * spacing + offset];
+}
+
+/**
+ * Links `count` slots of a buffer, `spacing` bytes apart, into one cycle:
+ * each slot holds the address of the next slot to visit.
+ * The slots are visited in address order, or in a random order if `shuffle` is set.
+ * If `stagger` is set, each slot is moved to a different line of its page,
+ * so that slots a page apart don't compete for the same cache set.
+ * Returns the first slot.
+ */
+static inline void **build_chase(uint8_t *buffer, size_t count, size_t spacing, bool shuffle,
+                                 bool stagger, uint64_t *rng) {
+    size_t *order = malloc(count * sizeof(*order));
+    assert(order != NULL);
+    for (size_t i = 0; i < count; i++) {
+        order[i] = i;
+    }
+    if (shuffle) {
+        for (size_t i = count - 1; i > 0; i--) {
+            size_t j = next_random(rng) % (i + 1);
+            size_t swap = order[i];
+            order[i] = order[j];
+            order[j] = swap;
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        *chase_slot(buffer, order[i], spacing, stagger) =
+            chase_slot(buffer, order[(i + 1) % count], spacing, stagger);
+    }
+    void **first = chase_slot(buffer, order[0], spacing, stagger);
+    free(order);
+    return first;
+}
+
+/**
+ * Follows a chase for `steps` dependent loads, after one untimed lap over `count` slots,
+ * and returns the average number of cycles per load.
+ */
+static inline double time_chase(void **start, size_t count, size_t steps) {
+    void **p = start;
+    for (size_t i = 0; i < count; i++) {
+        p = (void **) *p;
+    }
+    _mm_lfence();
+    uint64_t start_time = __rdtsc();
+    for (size_t i = 0; i < steps; i++) {
+        p = (void **) *p;
+    }
+    _mm_lfence();
+    uint64_t cycles = __rdtsc() - start_time;
+    // Keep the chase from being optimized away
+    asm volatile("" : : "r"(p));
+    return (double) cycles / steps;
+}
+
+static inline size_t chase_steps(size_t count) {
+    return 2 * count > MIN_CHASE_STEPS ? 2 * count : MIN_CHASE_STEPS;
+}
+
+#endif /* _MEMBENCH_H */
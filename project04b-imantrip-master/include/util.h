@@ -1,7 +1,10 @@
 #ifndef _UTIL_H
 #define _UTIL_H
 
+#include <cpuid.h>
 #include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <x86intrin.h>
 
 #define PAGE_SIZE 4096
@@ -19,12 +22,51 @@ inline void force_read(const void *address) {
 /**
  * Evicts any cache line currently storing the given address.
  * This ensures that the byte at the address is no longer in the cache.
+ * The fence waits for the flush to finish, so later reads miss.
  */
 void flush_cache_line(const void *address) {
     _mm_clflush(address);
     _mm_mfence();
-    for (volatile int i = 0; i < 10000; i++) {
+}
+
+/**
+ * Returns whether the processor has the clflushopt instruction
+ * (CPUID leaf 7, EBX bit 23).
+ */
+bool has_clflushopt(void) {
+    static int supported = -1;
+    if (supported < 0) {
+        unsigned int eax, ebx, ecx, edx;
+        supported = __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & (1 << 23));
     }
+    return supported;
+}
+
+/**
+ * Flushes lines with clflushopt, which, unlike clflush,
+ * doesn't wait for earlier flushes of other lines, so the flushes overlap.
+ */
+__attribute__((target("clflushopt"))) static void clflushopt_all(const void *const *addresses,
+                                                                   size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        _mm_clflushopt((void *) addresses[i]);
+    }
+}
+
+/**
+ * Evicts the cache lines storing each of `count` addresses.
+ * This is much faster than calling flush_cache_line() on each address:
+ * it uses clflushopt when the processor has it, and fences only once, at the end.
+ */
+void flush_cache_lines(const void *const *addresses, size_t count) {
+    if (has_clflushopt()) {
+        clflushopt_all(addresses, count);
+    } else {
+        for (size_t i = 0; i < count; i++) {
+            _mm_clflush(addresses[i]);
+        }
+    }
+    _mm_mfence();
 }
 
 /**
@@ -1,14 +1,40 @@
 #include "util.h"
 
+#include <cpuid.h>
 #include <x86intrin.h>
 
 void flush_cache_line(const void *address) {
     _mm_clflush(address);
     _mm_mfence();
-    for (volatile int i = 0; i < 10000; i++) {
+}
+
+bool has_clflushopt(void) {
+    static int supported = -1;
+    if (supported < 0) {
+        unsigned int eax, ebx, ecx, edx;
+        supported = __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & (1 << 23));
+    }
+    return supported;
+}
+
+__attribute__((target("clflushopt"))) static void clflushopt_all(const void *const *addresses,
+                                                                   size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        _mm_clflushopt((void *) addresses[i]);
     }
 }
 
+void flush_cache_lines(const void *const *addresses, size_t count) {
+    if (has_clflushopt()) {
+        clflushopt_all(addresses, count);
+    } else {
+        for (size_t i = 0; i < count; i++) {
+            _mm_clflush(addresses[i]);
+        }
+    }
+    _mm_mfence();
+}
+
 uint64_t time_read(const void *address) {
     uint64_t start = __rdtsc();
     _mm_lfence();
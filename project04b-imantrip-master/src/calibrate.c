@@ -0,0 +1,46 @@
+#include "calibrate.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+const size_t DEFAULT_SAMPLES = 10000;
+
+/**
+ * Prints the latency histogram of every cache level as CSV on stdout,
+ * and a summary of each level and the derived thresholds on stderr.
+ * The number of samples per level can be given as the only argument.
+ */
+int main(int argc, char *argv[]) {
+    size_t samples = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_SAMPLES;
+    assert(samples > 0);
+
+    calibration_t *calibration = malloc(sizeof(*calibration));
+    assert(calibration != NULL);
+    calibrate(calibration, samples);
+
+    printf("level,cycles,count\n");
+    for (cache_level_t level = L1_HIT; level < NUM_CACHE_LEVELS; level++) {
+        const latency_histogram_t *histogram = &calibration->histograms[level];
+        for (uint64_t latency = 0; latency < LATENCY_BUCKETS; latency++) {
+            if (histogram->counts[latency] > 0) {
+                printf("%s,%" PRIu64 ",%" PRIu64 "\n", CACHE_LEVEL_NAMES[level], latency,
+                       histogram->counts[latency]);
+            }
+        }
+    }
+
+    for (cache_level_t level = L1_HIT; level < NUM_CACHE_LEVELS; level++) {
+        const latency_histogram_t *histogram = &calibration->histograms[level];
+        fprintf(stderr, "%-4s  p1 %4" PRIu64 "  p50 %4" PRIu64 "  p99 %4" PRIu64 "  (%zu rejected)\n",
+                CACHE_LEVEL_NAMES[level], latency_percentile(histogram, 1),
+                latency_percentile(histogram, 50), latency_percentile(histogram, 99),
+                histogram->rejected);
+    }
+    for (cache_level_t level = L1_HIT; level < DRAM_HIT; level++) {
+        fprintf(stderr, "%s/%s threshold: %" PRIu64 " cycles\n", CACHE_LEVEL_NAMES[level],
+                CACHE_LEVEL_NAMES[level + 1], calibration->thresholds[level]);
+    }
+
+    free(calibration);
+}
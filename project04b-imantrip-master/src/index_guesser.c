@@ -4,11 +4,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "calibrate.h"
 #include "util.h"
 
 const size_t MIN_CHOICE = 1;
 const size_t MAX_CHOICE = 255;
-const size_t THRESHOLD = 200;
+
+/* Reads faster than this many cycles hit in the cache; measured at startup */
+static uint64_t hit_threshold;
 
 static inline page_t *init_pages(void) {
     page_t *pages = calloc(UINT8_MAX + 1, PAGE_SIZE);
@@ -17,14 +20,16 @@ static inline page_t *init_pages(void) {
 }
 
 static inline void flush_all_pages(page_t *pages) {
+    const void *lines[MAX_CHOICE - MIN_CHOICE + 1];
     for (size_t i = MIN_CHOICE; i <= MAX_CHOICE; i++) {
-        flush_cache_line(&pages[i]);
+        lines[i - MIN_CHOICE] = &pages[i];
     }
+    flush_cache_lines(lines, MAX_CHOICE - MIN_CHOICE + 1);
 }
 
 static inline size_t guess_accessed_page(page_t *pages) {
     for (size_t i = MIN_CHOICE; i <= MAX_CHOICE; i++) {
-        if ((time_read(&pages[i]) < THRESHOLD) && (time_read(&pages[i]) < THRESHOLD)) {
+        if ((time_read(&pages[i]) < hit_threshold) && (time_read(&pages[i]) < hit_threshold)) {
             return i;
         }
     }
@@ -32,6 +37,8 @@ static inline size_t guess_accessed_page(page_t *pages) {
 }
 
 int main() {
+    hit_threshold = calibrate_hit_threshold();
+
     page_t *pages = init_pages();
 
     flush_all_pages(pages);
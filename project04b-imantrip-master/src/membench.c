@@ -0,0 +1,123 @@
+#include "membench.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "calibrate.h"
+#include "util.h"
+
+const size_t DEFAULT_MAX_WORKING_SET_MB = 256;
+const size_t MIN_WORKING_SET = 4096;
+const size_t STRIDE_WORKING_SET = 64 * 1024 * 1024;
+const size_t MAX_STRIDE = 4096;
+const size_t MIN_TLB_PAGES = 8;
+const size_t FLUSH_RELOAD_SAMPLES = 100000;
+const size_t FLUSH_BATCH_LINES = 256;
+const uint64_t SEED = 0x5eed;
+
+static void print_result(const char *benchmark, const char *parameter, size_t value, double cycles) {
+    printf("%s,%s,%zu,%.2f\n", benchmark, parameter, value, cycles);
+    fflush(stdout);
+}
+
+/**
+ * Random pointer chasing over growing working sets,
+ * which shows the latency of each level of the hierarchy and where it ends.
+ */
+static void bench_latency(uint8_t *buffer, size_t max_working_set, uint64_t *rng) {
+    for (size_t size = MIN_WORKING_SET; size <= max_working_set; size *= 2) {
+        size_t count = size / CACHE_LINE_SIZE;
+        void **start = build_chase(buffer, count, CACHE_LINE_SIZE, true, false, rng);
+        print_result("latency", "working_set_bytes", size,
+                     time_chase(start, count, chase_steps(count)));
+    }
+}
+
+/**
+ * Chasing a working set larger than the LLC at a fixed stride, in address order and in random order.
+ * The gap between the two is what the hardware prefetchers hide.
+ */
+static void bench_stride(uint8_t *buffer, size_t working_set, uint64_t *rng) {
+    for (size_t stride = CACHE_LINE_SIZE; stride <= MAX_STRIDE; stride *= 2) {
+        size_t count = working_set / stride;
+        void **start = build_chase(buffer, count, stride, false, false, rng);
+        print_result("stride_sequential", "stride_bytes", stride,
+                     time_chase(start, count, chase_steps(count)));
+        start = build_chase(buffer, count, stride, true, false, rng);
+        print_result("stride_random", "stride_bytes", stride,
+                     time_chase(start, count, chase_steps(count)));
+    }
+}
+
+/**
+ * Random chasing with one line per 4 KB page. The lines all fit in the caches,
+ * so the latency rises only as the pages outgrow each level of the TLB.
+ * Run on a 4 KB-page buffer and on a huge-page buffer, to compare their reach.
+ */
+static void bench_tlb(const char *benchmark, uint8_t *buffer, size_t max_pages, uint64_t *rng) {
+    for (size_t pages = MIN_TLB_PAGES; pages <= max_pages; pages *= 2) {
+        void **start = build_chase(buffer, pages, PAGE_SIZE, true, true, rng);
+        print_result(benchmark, "pages", pages, time_chase(start, pages, chase_steps(pages)));
+    }
+}
+
+/**
+ * The cost of evicting a line and timing a read of it, one line at a time,
+ * and per line when a batch of lines is flushed at once.
+ */
+static void bench_flush_reload(uint8_t *buffer) {
+    uint64_t total = 0;
+    for (size_t i = 0; i < FLUSH_RELOAD_SAMPLES; i++) {
+        const void *line = &buffer[i % FLUSH_BATCH_LINES * PAGE_SIZE];
+        uint64_t start = __rdtsc();
+        flush_cache_line(line);
+        time_read(line);
+        total += __rdtsc() - start;
+    }
+    print_result("flush_reload", "lines", 1, (double) total / FLUSH_RELOAD_SAMPLES);
+
+    const void *lines[FLUSH_BATCH_LINES];
+    for (size_t i = 0; i < FLUSH_BATCH_LINES; i++) {
+        lines[i] = &buffer[i * PAGE_SIZE];
+    }
+    size_t rounds = FLUSH_RELOAD_SAMPLES / FLUSH_BATCH_LINES;
+    total = 0;
+    for (size_t round = 0; round < rounds; round++) {
+        for (size_t i = 0; i < FLUSH_BATCH_LINES; i++) {
+            force_read(lines[i]);
+        }
+        _mm_mfence();
+        uint64_t start = __rdtsc();
+        flush_cache_lines(lines, FLUSH_BATCH_LINES);
+        total += __rdtsc() - start;
+    }
+    print_result("flush_batched", "lines", FLUSH_BATCH_LINES,
+                 (double) total / (rounds * FLUSH_BATCH_LINES));
+}
+
+/**
+ * Characterizes the memory hierarchy of this machine and prints the results as CSV:
+ * one row per measurement, with the average cycles per access
+ * (or per line, for the flush benchmarks).
+ * The largest working set, in MB, can be given as the only argument.
+ */
+int main(int argc, char *argv[]) {
+    size_t max_mb = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_MAX_WORKING_SET_MB;
+    assert(max_mb > 0);
+    size_t max_working_set = max_mb * 1024 * 1024;
+    size_t buffer_size = max_working_set > STRIDE_WORKING_SET ? max_working_set : STRIDE_WORKING_SET;
+    uint64_t rng = SEED;
+
+    uint8_t *buffer = map_buffer(buffer_size, false);
+    printf("benchmark,parameter,value,cycles\n");
+    bench_latency(buffer, max_working_set, &rng);
+    bench_stride(buffer, STRIDE_WORKING_SET, &rng);
+    bench_tlb("tlb_4k", buffer, max_working_set / PAGE_SIZE, &rng);
+    bench_flush_reload(buffer);
+    free(buffer);
+
+    uint8_t *huge_buffer = map_buffer(max_working_set, true);
+    bench_tlb("tlb_huge", huge_buffer, max_working_set / PAGE_SIZE, &rng);
+    free(huge_buffer);
+}
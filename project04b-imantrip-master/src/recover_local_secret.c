@@ -4,12 +4,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "calibrate.h"
 #include "util.h"
 
 const size_t MIN_CHOICE = 'A' - 1;
 const size_t MAX_CHOICE = 'Z' + 1;
 const size_t SECRET_LENGTH = 5;
-const size_t THRESHOLD = 200;
+
+/* Reads faster than this many cycles hit in the cache; measured at startup */
+static uint64_t hit_threshold;
 
 static inline page_t *init_pages(void) {
     page_t *pages = calloc(UINT8_MAX + 1, PAGE_SIZE);
@@ -18,14 +21,16 @@ static inline page_t *init_pages(void) {
 }
 
 static inline void flush_all_pages(page_t *pages) {
+    const void *lines[MAX_CHOICE - MIN_CHOICE + 1];
     for (size_t i = MIN_CHOICE; i <= MAX_CHOICE; i++) {
-        flush_cache_line(&pages[i]);
+        lines[i - MIN_CHOICE] = &pages[i];
     }
+    flush_cache_lines(lines, MAX_CHOICE - MIN_CHOICE + 1);
 }
 
 static inline size_t guess_accessed_page(page_t *pages) {
     for (size_t i = MIN_CHOICE; i <= MAX_CHOICE; i++) {
-        if ((time_read(&pages[i]) < THRESHOLD) && (time_read(&pages[i]) < THRESHOLD)) {
+        if ((time_read(&pages[i]) < hit_threshold) && (time_read(&pages[i]) < hit_threshold)) {
             return i;
         }
     }
@@ -37,6 +42,8 @@ static inline void do_access(page_t *pages, size_t secret_index) {
 }
 
 int main() {
+    hit_threshold = calibrate_hit_threshold();
+
     page_t *pages = init_pages();
 
     for (size_t i = 0; i < SECRET_LENGTH; i++) {
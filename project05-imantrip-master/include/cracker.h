@@ -0,0 +1,66 @@
+#ifndef CRACKER_H
+#define CRACKER_H
+
+#include <stddef.h>
+
+/** The longest dictionary word the cracker mutates; longer words are skipped */
+#define MAX_WORD_LENGTH 62
+
+/**
+ * The password hashes to crack, grouped by setting (hash method and salt).
+ * Each group keeps its hashes in an open-addressing hash set,
+ * so checking a candidate against every target with its salt costs one lookup,
+ * however many targets there are.
+ */
+typedef struct target_set target_set_t;
+
+/** Called with each password that is found, and the target hash it matches */
+typedef void (*found_function_t)(const char *password, const char *hash, void *aux);
+
+/**
+ * Creates a new heap-allocated set of target hashes. The set is initially empty.
+ *
+ * @return a pointer to the new set
+ */
+target_set_t *target_set_init(void);
+
+/**
+ * Adds a target hash, in crypt()'s format (e.g. "$1$salt$hash").
+ * Hashes that are already in the set are ignored.
+ * All targets should be added before any thread calls crack_word().
+ *
+ * @param targets the set to add to
+ * @param hash the hash to crack
+ */
+void target_set_add(target_set_t *targets, const char *hash);
+
+/**
+ * Returns how many targets have not been cracked yet.
+ * This is concurrency-safe with crack_word().
+ */
+size_t target_set_remaining(target_set_t *targets);
+
+/**
+ * Frees all resources associated with a heap-allocated set of target hashes.
+ *
+ * @param targets a set returned from target_set_init()
+ */
+void target_set_free(target_set_t *targets);
+
+/**
+ * Tries each candidate made from one dictionary word, for every salt that has
+ * uncracked targets. The candidates are the word with one digit inserted
+ * at any position, built in this thread's buffers without allocating,
+ * and hashed through crypt_batch() with this thread's crypt_data.
+ * This is concurrency-safe, so many words can be cracked at once on a thread pool.
+ * The callback may run on any thread calling crack_word(),
+ * once per target, when its password is found.
+ *
+ * @param targets the hashes to crack
+ * @param word the dictionary word to mutate
+ * @param found the function to call with each password found
+ * @param aux the extra argument to pass to `found`
+ */
+void crack_word(target_set_t *targets, const char *word, found_function_t found, void *aux);
+
+#endif /* CRACKER_H */
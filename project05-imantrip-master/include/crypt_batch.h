@@ -0,0 +1,38 @@
+#ifndef CRYPT_BATCH_H
+#define CRYPT_BATCH_H
+
+#include <crypt.h>
+#include <stddef.h>
+
+/** How many keys the multi-buffer MD5 core hashes at once, one per SIMD lane */
+#define CRYPT_BATCH_LANES 16
+
+/** The longest key the multi-buffer core hashes; longer keys use crypt_r() */
+#define CRYPT_BATCH_MAX_KEY_LENGTH 15
+
+/**
+ * Hashes a batch of keys with the same setting (hash method and salt),
+ * giving the same results as calling crypt_r() on each key.
+ * MD5-crypt settings ("$1$salt$") are hashed CRYPT_BATCH_LANES keys at a time,
+ * one key per SIMD lane, with AVX-512 or AVX2 when the CPU supports them
+ * (chosen at load time through CPUID) and SSE2 otherwise.
+ * Other settings, and keys longer than CRYPT_BATCH_MAX_KEY_LENGTH, fall back to crypt_r().
+ * This is concurrency-safe as long as each thread (e.g. each thread pool worker)
+ * passes its own crypt_data.
+ *
+ * @param keys the keys (passwords) to hash
+ * @param n the number of keys
+ * @param setting the hash method and salt, e.g. "$1$salt$", or any hash made with them
+ * @param outputs where to store the hash of each key, as crypt_r() would return it
+ * @param data this thread's crypt_r() state, zeroed before its first use
+ */
+void crypt_batch(const char *const *keys, size_t n, const char *setting,
+                 char (*outputs)[CRYPT_OUTPUT_SIZE], struct crypt_data *data);
+
+/**
+ * Returns the name of the instruction set the multi-buffer core runs on this CPU:
+ * "avx512f", "avx2" or "sse2".
+ */
+const char *crypt_batch_backend(void);
+
+#endif /* CRYPT_BATCH_H */
@@ -0,0 +1,79 @@
+#ifndef FUTURE_H
+#define FUTURE_H
+
+#include "thread_pool.h"
+
+/**
+ * The result of a function submitted to a thread pool,
+ * which thread_pool_submit() returns so the caller can join on that one call.
+ */
+typedef struct future future_t;
+
+/**
+ * A set of work added to a thread pool, which can be waited on
+ * without waiting for (or shutting down) the rest of the pool.
+ * A group can be waited on and reused any number of times,
+ * so one pool can run many phases of work without being rebuilt.
+ */
+typedef struct task_group task_group_t;
+
+/** A function that can run on a thread in a thread pool and return a result */
+typedef void *(*future_function_t)(void *aux);
+
+/**
+ * Adds work to a thread pool and returns a future for its result.
+ * Each future must be passed to future_get() exactly once.
+ *
+ * @param pool the thread pool to perform the work
+ * @param function the function to call on a thread in the thread pool
+ * @param aux the argument to call the function with
+ * @return a pointer to the new future
+ */
+future_t *thread_pool_submit(thread_pool_t *pool, future_function_t function, void *aux);
+
+/**
+ * Waits for the work behind a future to finish, then frees the future.
+ * If no worker thread has started the work yet, the calling thread runs it instead,
+ * so this can safely be called from work running on the same pool.
+ *
+ * @param future a future returned from thread_pool_submit()
+ * @return the value the function returned
+ */
+void *future_get(future_t *future);
+
+/**
+ * Creates a new heap-allocated task group that adds its work to a thread pool.
+ *
+ * @param pool the thread pool to perform the group's work
+ * @return a pointer to the new task group
+ */
+task_group_t *task_group_init(thread_pool_t *pool);
+
+/**
+ * Adds work to a task group's thread pool.
+ * This is concurrency-safe, including from work already running in the group.
+ *
+ * @param group the task group the work belongs to
+ * @param function the function to call on a thread in the thread pool
+ * @param aux the argument to call the work function with
+ */
+void task_group_add_work(task_group_t *group, work_function_t function, void *aux);
+
+/**
+ * Waits for all work added to a task group to finish, including work added while waiting.
+ * The calling thread runs the group's work that no worker thread has started yet,
+ * so this can safely be called from work running on the same pool.
+ *
+ * @param group the task group to wait on
+ */
+void task_group_wait(task_group_t *group);
+
+/**
+ * Frees all resources associated with a heap-allocated task group.
+ * You may assume that task_group_wait() has been called since work was last added.
+ *
+ * @param group a task group returned from task_group_init()
+ */
+void task_group_free(task_group_t *group);
+
+#endif /* FUTURE_H */
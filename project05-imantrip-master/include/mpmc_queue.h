@@ -0,0 +1,99 @@
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * A lock-free multi-producer/multi-consumer FIFO queue.
+ * It has the same interface as queue_t, so either can back a thread pool,
+ * but enqueues and dequeues never take a lock and (apart from the unbounded
+ * variant's occasional new segment) never allocate.
+ * Any value, including NULL, can be enqueued.
+ */
+typedef struct mpmc_queue mpmc_queue_t;
+
+/** Counts of a queue's slow paths, which show where it is contended */
+typedef struct {
+    /** Enqueues and dequeues that had to try again because another thread got there first */
+    size_t retries;
+    /** Times a thread slept on the queue's futex, waiting for a value or a free slot */
+    size_t parks;
+    /** Futex wakeups issued to sleeping threads */
+    size_t wakeups;
+    /** Segments added to an unbounded queue after the first */
+    size_t segments_allocated;
+} mpmc_queue_stats_t;
+
+/**
+ * Creates a new heap-allocated bounded queue, backed by a ring buffer
+ * with a sequence number per slot.
+ *
+ * @param capacity the minimum number of values the queue can hold;
+ *   it is rounded up to a power of 2
+ * @return a pointer to the new queue
+ */
+mpmc_queue_t *mpmc_queue_init_bounded(size_t capacity);
+
+/**
+ * Creates a new heap-allocated unbounded queue, backed by a linked list
+ * of fixed-size segments. Segments are freed once no thread can still be using them.
+ *
+ * @return a pointer to the new queue
+ */
+mpmc_queue_t *mpmc_queue_init(void);
+
+/**
+ * Enqueues a value, unless the queue is bounded and full.
+ *
+ * @param queue the queue to append to
+ * @param value the value to add to the back of the queue
+ * @return whether the value was enqueued
+ */
+bool mpmc_queue_try_enqueue(mpmc_queue_t *queue, void *value);
+
+/**
+ * Enqueues a value. If the queue is bounded and full,
+ * this thread spins briefly and then blocks until another thread dequeues a value.
+ *
+ * @param queue the queue to append to
+ * @param value the value to add to the back of the queue
+ */
+void mpmc_queue_enqueue(mpmc_queue_t *queue, void *value);
+
+/**
+ * Dequeues a value, unless the queue is empty.
+ *
+ * @param queue the queue to remove from
+ * @param value where to store the value at the front of the queue
+ * @return whether a value was dequeued
+ */
+bool mpmc_queue_try_dequeue(mpmc_queue_t *queue, void **value);
+
+/**
+ * Dequeues a value. If the queue is empty, this thread spins briefly
+ * and then blocks on a futex until another thread enqueues a value.
+ *
+ * @param queue the queue to remove from
+ * @return the value at the front of the queue
+ */
+void *mpmc_queue_dequeue(mpmc_queue_t *queue);
+
+/**
+ * Reads a queue's counters. They are updated without synchronization,
+ * so while other threads are using the queue they are only approximate.
+ *
+ * @param queue the queue to read
+ * @param stats where to store the counters
+ */
+void mpmc_queue_get_stats(mpmc_queue_t *queue, mpmc_queue_stats_t *stats);
+
+/**
+ * Frees all resources associated with a heap-allocated queue.
+ * You may assume that the queue is already empty and no thread is using it.
+ *
+ * @param queue a queue returned from mpmc_queue_init() or mpmc_queue_init_bounded()
+ */
+void mpmc_queue_free(mpmc_queue_t *queue);
+
+#endif /* MPMC_QUEUE_H */
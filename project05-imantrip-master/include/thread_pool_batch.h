@@ -0,0 +1,47 @@
+#ifndef THREAD_POOL_BATCH_H
+#define THREAD_POOL_BATCH_H
+
+#include <stddef.h>
+
+#include "thread_pool.h"
+
+/** A function that runs one index of a parallel for loop */
+typedef void (*index_function_t)(size_t index, void *aux);
+
+/**
+ * Adds a batch of work to a thread pool: function(aux[i]) for each i < n.
+ * Unlike n calls to thread_pool_add_work(), this allocates once per batch
+ * and adds only a few work items to the pool (at most one per thread that can run them),
+ * which then claim indices in order from a shared counter. So adding a large batch
+ * costs about the same as adding a small one, and each task costs one atomic increment.
+ * The tasks are started in index order, as if each had been added with thread_pool_add_work().
+ * The batch may run up to 64 of its tasks at once, no matter how many threads the pool has.
+ *
+ * @param pool the thread pool to perform the work
+ * @param function the function to call on a thread in the thread pool
+ * @param aux the arguments to call the work function with, one per task.
+ *   The array is copied, so it may be freed once this returns.
+ * @param n the number of tasks
+ */
+void thread_pool_add_work_batch(thread_pool_t *pool, work_function_t function, void **aux, size_t n);
+
+/**
+ * Calls function(i, aux) for each i in [start, end) on a thread pool,
+ * then returns once every call has finished.
+ * Indices are claimed in chunks that shrink as the range runs out
+ * (each is a fraction of the remaining indices per thread),
+ * so there are few chunks, and the last ones are small enough to balance the load.
+ * The calling thread runs chunks as well, so this can safely be called
+ * from work running on the same pool.
+ *
+ * @param pool the thread pool to perform the work
+ * @param num_worker_threads the number of threads in the pool
+ * @param start the first index
+ * @param end one past the last index
+ * @param function the function to call for each index
+ * @param aux the argument to pass to each call
+ */
+void thread_pool_parallel_for(thread_pool_t *pool, size_t num_worker_threads, size_t start,
+                              size_t end, index_function_t function, void *aux);
+
+#endif /* THREAD_POOL_BATCH_H */
@@ -0,0 +1,149 @@
+#ifndef WORK_STEALING_H
+#define WORK_STEALING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "mpmc_queue.h"
+
+/**
+ * A Chase-Lev work-stealing deque.
+ * One thread (the owner) pushes and pops values at the bottom, in LIFO order,
+ * and any other thread can steal values from the top, in FIFO order.
+ * The owner's operations never take a lock or use an atomic read-modify-write,
+ * except when popping the last value. The deque grows as needed.
+ */
+typedef struct ws_deque ws_deque_t;
+
+/**
+ * A scheduler for a fixed set of worker threads, each of which owns a ws_deque_t.
+ * Work submitted by a worker goes onto that worker's own deque; work submitted
+ * by any other thread goes onto a shared injection queue.
+ * A worker without work of its own steals from the other workers, picked at random,
+ * and sleeps on a futex when there is no work anywhere.
+ * A thread pool can use it in place of its shared work queue.
+ */
+typedef struct ws_scheduler ws_scheduler_t;
+
+/** Counts of where a scheduler's workers found work, summed over all workers */
+typedef struct {
+    /** Work popped from the worker's own deque */
+    size_t local_pops;
+    /** Steals tried, and those that took a value */
+    size_t steal_attempts;
+    size_t steals;
+    /** Work taken from the injection queue */
+    size_t injection_pops;
+    /** Times a worker found no work and slept on the futex, and futex wakeups issued */
+    size_t sleeps;
+    size_t wakeups;
+    /** The injection queue's own counters */
+    mpmc_queue_stats_t injection;
+} ws_scheduler_stats_t;
+
+/**
+ * Creates a new heap-allocated deque. The deque is initially empty.
+ * The thread that calls ws_deque_push() and ws_deque_pop() becomes its owner.
+ *
+ * @return a pointer to the new deque
+ */
+ws_deque_t *ws_deque_init(void);
+
+/**
+ * Pushes a value onto the bottom of a deque. Only the owner may call this.
+ *
+ * @param deque the deque to push onto
+ * @param value the value to push; any value, including NULL, is allowed
+ */
+void ws_deque_push(ws_deque_t *deque, void *value);
+
+/**
+ * Pops the value most recently pushed onto a deque. Only the owner may call this.
+ *
+ * @param deque the deque to pop from
+ * @param value where to store the popped value
+ * @return whether a value was popped (false if the deque was empty)
+ */
+bool ws_deque_pop(ws_deque_t *deque, void **value);
+
+/**
+ * Steals the value least recently pushed onto a deque. Any thread may call this.
+ *
+ * @param deque the deque to steal from
+ * @param value where to store the stolen value
+ * @return whether a value was stolen. This is false if the deque was empty,
+ *   or if another thread took the value first, in which case the deque may not be empty.
+ */
+bool ws_deque_steal(ws_deque_t *deque, void **value);
+
+/**
+ * Returns whether a deque looked empty at some point during the call.
+ * Any thread may call this.
+ */
+bool ws_deque_is_empty(ws_deque_t *deque);
+
+/**
+ * Frees all resources associated with a heap-allocated deque.
+ * You may assume that no thread is using it.
+ *
+ * @param deque a deque returned from ws_deque_init()
+ */
+void ws_deque_free(ws_deque_t *deque);
+
+/**
+ * Creates a new heap-allocated scheduler for the given number of workers.
+ *
+ * @param num_workers the number of worker threads that will call ws_scheduler_next()
+ * @return a pointer to the new scheduler
+ */
+ws_scheduler_t *ws_scheduler_init(size_t num_workers);
+
+/**
+ * Makes the calling thread worker number `worker` of a scheduler.
+ * Each worker thread must call this once, before any other scheduler function.
+ *
+ * @param scheduler the scheduler to join
+ * @param worker the index of this worker, less than the scheduler's number of workers
+ */
+void ws_scheduler_register_worker(ws_scheduler_t *scheduler, size_t worker);
+
+/**
+ * Submits work to a scheduler, from any thread, and wakes a sleeping worker if there is one.
+ * Work submitted by a worker of this scheduler goes onto its own deque,
+ * so it is likely to run next on the same thread, while its data is still in cache.
+ *
+ * @param scheduler the scheduler to run the work
+ * @param work the work to run; any value, including NULL, is allowed
+ */
+void ws_scheduler_submit(ws_scheduler_t *scheduler, void *work);
+
+/**
+ * Returns the next work for the calling worker to run, blocking until there is some.
+ * Work is taken from the worker's own deque first, then stolen from other workers,
+ * and only then taken from the injection queue. So a value (e.g. NULL) submitted
+ * from outside the pool once per worker is a safe way to tell the workers to stop:
+ * each worker receives one only when it finds no other work.
+ *
+ * @param scheduler the scheduler the calling thread is registered with
+ * @return the work to run
+ */
+void *ws_scheduler_next(ws_scheduler_t *scheduler);
+
+/**
+ * Reads a scheduler's counters. Each worker updates its own without synchronization,
+ * so while the workers are running they are only approximate.
+ *
+ * @param scheduler the scheduler to read
+ * @param stats where to store the counters
+ */
+void ws_scheduler_get_stats(ws_scheduler_t *scheduler, ws_scheduler_stats_t *stats);
+
+/**
+ * Frees all resources associated with a heap-allocated scheduler.
+ * You may assume that all work has been taken and no thread is using it.
+ *
+ * @param scheduler a scheduler returned from ws_scheduler_init()
+ */
+void ws_scheduler_free(ws_scheduler_t *scheduler);
+
+#endif /* WORK_STEALING_H */
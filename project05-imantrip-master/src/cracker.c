@@ -0,0 +1,210 @@
+#include "cracker.h"
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "crypt_batch.h"
+
+/** Slots in a new group's hash set (a power of 2) */
+#define INITIAL_CAPACITY 16
+
+/** How many candidates are built and hashed together; a few multi-buffer batches */
+#define CANDIDATES_PER_BATCH (4 * CRYPT_BATCH_LANES)
+
+#define NUM_DIGITS 10
+
+typedef struct {
+    /** NULL if the slot is empty */
+    char *hash;
+    atomic_bool cracked;
+} entry_t;
+
+/** The targets that share a setting, and so can be checked with one hash per candidate */
+typedef struct {
+    char *setting;
+    entry_t *entries;
+    size_t capacity;
+    size_t size;
+    atomic_size_t remaining;
+} group_t;
+
+struct target_set {
+    group_t *groups;
+    size_t num_groups;
+    size_t groups_capacity;
+    atomic_size_t remaining;
+};
+
+/** FNV-1a. Hashes end in random characters, so this spreads them evenly */
+static uint64_t hash_string(const char *string) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (; *string != '\0'; string++) {
+        hash = (hash ^ (uint8_t) *string) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+/**
+ * Returns the length of a hash's setting: everything up to the last '$'
+ * for modular formats ("$id$salt$hash"), or the 2-character salt for DES.
+ */
+static size_t setting_length(const char *hash) {
+    if (hash[0] == '$') {
+        return strrchr(hash, '$') - hash + 1;
+    }
+    return strlen(hash) < 2 ? strlen(hash) : 2;
+}
+
+/** Returns the slot holding a hash, or the empty slot where it belongs */
+static entry_t *find_slot(entry_t *entries, size_t capacity, const char *hash) {
+    size_t mask = capacity - 1;
+    for (size_t index = hash_string(hash) & mask;; index = (index + 1) & mask) {
+        entry_t *entry = &entries[index];
+        if (entry->hash == NULL || strcmp(entry->hash, hash) == 0) {
+            return entry;
+        }
+    }
+}
+
+static entry_t *entries_init(size_t capacity) {
+    entry_t *entries = malloc(capacity * sizeof(entry_t));
+    assert(entries != NULL);
+    for (size_t i = 0; i < capacity; i++) {
+        entries[i].hash = NULL;
+        atomic_init(&entries[i].cracked, false);
+    }
+    return entries;
+}
+
+/** Doubles a group's hash set, keeping it at most half full */
+static void grow(group_t *group) {
+    size_t capacity = 2 * group->capacity;
+    entry_t *entries = entries_init(capacity);
+    for (size_t i = 0; i < group->capacity; i++) {
+        if (group->entries[i].hash != NULL) {
+            find_slot(entries, capacity, group->entries[i].hash)->hash = group->entries[i].hash;
+        }
+    }
+    free(group->entries);
+    group->entries = entries;
+    group->capacity = capacity;
+}
+
+target_set_t *target_set_init(void) {
+    target_set_t *targets = malloc(sizeof(target_set_t));
+    assert(targets != NULL);
+    targets->groups = NULL;
+    targets->num_groups = 0;
+    targets->groups_capacity = 0;
+    atomic_init(&targets->remaining, 0);
+    return targets;
+}
+
+static group_t *get_group(target_set_t *targets, const char *hash) {
+    size_t length = setting_length(hash);
+    for (size_t i = 0; i < targets->num_groups; i++) {
+        group_t *group = &targets->groups[i];
+        if (strlen(group->setting) == length && strncmp(group->setting, hash, length) == 0) {
+            return group;
+        }
+    }
+
+    if (targets->num_groups == targets->groups_capacity) {
+        targets->groups_capacity = targets->groups_capacity > 0 ? 2 * targets->groups_capacity : 1;
+        targets->groups = realloc(targets->groups, targets->groups_capacity * sizeof(group_t));
+        assert(targets->groups != NULL);
+    }
+    group_t *group = &targets->groups[targets->num_groups++];
+    group->setting = strndup(hash, length);
+    assert(group->setting != NULL);
+    group->capacity = INITIAL_CAPACITY;
+    group->entries = entries_init(group->capacity);
+    group->size = 0;
+    atomic_init(&group->remaining, 0);
+    return group;
+}
+
+void target_set_add(target_set_t *targets, const char *hash) {
+    group_t *group = get_group(targets, hash);
+    if (2 * (group->size + 1) > group->capacity) {
+        grow(group);
+    }
+    entry_t *entry = find_slot(group->entries, group->capacity, hash);
+    if (entry->hash != NULL) {
+        return;
+    }
+    entry->hash = strdup(hash);
+    assert(entry->hash != NULL);
+    group->size++;
+    atomic_fetch_add(&group->remaining, 1);
+    atomic_fetch_add(&targets->remaining, 1);
+}
+
+size_t target_set_remaining(target_set_t *targets) {
+    return atomic_load(&targets->remaining);
+}
+
+void target_set_free(target_set_t *targets) {
+    for (size_t i = 0; i < targets->num_groups; i++) {
+        group_t *group = &targets->groups[i];
+        for (size_t j = 0; j < group->capacity; j++) {
+            free(group->entries[j].hash);
+        }
+        free(group->entries);
+        free(group->setting);
+    }
+    free(targets->groups);
+    free(targets);
+}
+
+/** Checks a batch of hashes against a group's targets and reports the new matches */
+static void check_hashes(target_set_t *targets, group_t *group, const char *const *keys, size_t n,
+                         char (*outputs)[CRYPT_OUTPUT_SIZE], found_function_t found, void *aux) {
+    for (size_t i = 0; i < n; i++) {
+        entry_t *entry = find_slot(group->entries, group->capacity, outputs[i]);
+        // Only the first thread to crack a target reports it
+        if (entry->hash != NULL && !atomic_exchange(&entry->cracked, true)) {
+            atomic_fetch_sub(&group->remaining, 1);
+            atomic_fetch_sub(&targets->remaining, 1);
+            found(keys[i], entry->hash, aux);
+        }
+    }
+}
+
+void crack_word(target_set_t *targets, const char *word, found_function_t found, void *aux) {
+    // Kept between calls, so crypt_r() sets it up only once per thread
+    static _Thread_local struct crypt_data data;
+    char candidates[CANDIDATES_PER_BATCH][MAX_WORD_LENGTH + 2];
+    const char *keys[CANDIDATES_PER_BATCH];
+    char outputs[CANDIDATES_PER_BATCH][CRYPT_OUTPUT_SIZE];
+
+    size_t length = strlen(word);
+    if (length > MAX_WORD_LENGTH) {
+        return;
+    }
+    // Candidate c puts digit c % 10 before character c / 10 of the word
+    size_t total = (length + 1) * NUM_DIGITS;
+    for (size_t start = 0; start < total && atomic_load(&targets->remaining) > 0;
+         start += CANDIDATES_PER_BATCH) {
+        size_t n = total - start < CANDIDATES_PER_BATCH ? total - start : CANDIDATES_PER_BATCH;
+        for (size_t i = 0; i < n; i++) {
+            size_t position = (start + i) / NUM_DIGITS;
+            char *candidate = candidates[i];
+            memcpy(candidate, word, position);
+            candidate[position] = '0' + (start + i) % NUM_DIGITS;
+            memcpy(&candidate[position + 1], &word[position], length - position + 1);
+            keys[i] = candidate;
+        }
+        for (size_t i = 0; i < targets->num_groups; i++) {
+            group_t *group = &targets->groups[i];
+            if (atomic_load(&group->remaining) > 0) {
+                crypt_batch(keys, n, group->setting, outputs, &data);
+                check_hashes(targets, group, keys, n, outputs, found, aux);
+            }
+        }
+    }
+}
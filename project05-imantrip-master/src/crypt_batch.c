@@ -0,0 +1,412 @@
+#include "crypt_batch.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "MD5 words are read and written in the host's byte order, which must be little-endian"
+#endif
+
+#define MD5_BLOCK_SIZE 64
+#define MD5_DIGEST_SIZE 16
+/** The longest message that fits in one block, with its padding */
+#define MD5_MAX_SINGLE_BLOCK 55
+
+#define MD5_CRYPT_MAGIC "$1$"
+#define MD5_CRYPT_MAX_SALT 8
+#define MD5_CRYPT_ROUNDS 1000
+
+_Static_assert(2 * CRYPT_BATCH_MAX_KEY_LENGTH + MD5_CRYPT_MAX_SALT + MD5_DIGEST_SIZE
+                   <= MD5_MAX_SINGLE_BLOCK,
+               "every MD5-crypt round of a batched key must fit in one block");
+
+/** A block of an MD5 message, as bytes or as the words MD5 works on */
+typedef union {
+    uint8_t bytes[MD5_BLOCK_SIZE];
+    uint32_t words[MD5_BLOCK_SIZE / 4];
+} message_t;
+
+/** CRYPT_BATCH_LANES 32-bit words, one per key; operators act on all lanes at once */
+typedef uint32_t lanes_t __attribute__((vector_size(4 * CRYPT_BATCH_LANES)));
+
+/* The MD5 compression function, written once for both uint32_t and lanes_t */
+
+#define F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define G(x, y, z) ((y) ^ ((z) & ((x) ^ (y))))
+#define H(x, y, z) ((x) ^ (y) ^ (z))
+#define I(x, y, z) ((y) ^ ((x) | ~(z)))
+#define ROTATE(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define STEP(f, a, b, c, d, x, t, s) \
+    (a) += f((b), (c), (d)) + (x) + (t); \
+    (a) = ROTATE((a), (s)); \
+    (a) += (b);
+
+#define MD5_STEPS(m) \
+    STEP(F, a, b, c, d, m[0], 0xd76aa478u, 7) \
+    STEP(F, d, a, b, c, m[1], 0xe8c7b756u, 12) \
+    STEP(F, c, d, a, b, m[2], 0x242070dbu, 17) \
+    STEP(F, b, c, d, a, m[3], 0xc1bdceeeu, 22) \
+    STEP(F, a, b, c, d, m[4], 0xf57c0fafu, 7) \
+    STEP(F, d, a, b, c, m[5], 0x4787c62au, 12) \
+    STEP(F, c, d, a, b, m[6], 0xa8304613u, 17) \
+    STEP(F, b, c, d, a, m[7], 0xfd469501u, 22) \
+    STEP(F, a, b, c, d, m[8], 0x698098d8u, 7) \
+    STEP(F, d, a, b, c, m[9], 0x8b44f7afu, 12) \
+    STEP(F, c, d, a, b, m[10], 0xffff5bb1u, 17) \
+    STEP(F, b, c, d, a, m[11], 0x895cd7beu, 22) \
+    STEP(F, a, b, c, d, m[12], 0x6b901122u, 7) \
+    STEP(F, d, a, b, c, m[13], 0xfd987193u, 12) \
+    STEP(F, c, d, a, b, m[14], 0xa679438eu, 17) \
+    STEP(F, b, c, d, a, m[15], 0x49b40821u, 22) \
+    STEP(G, a, b, c, d, m[1], 0xf61e2562u, 5) \
+    STEP(G, d, a, b, c, m[6], 0xc040b340u, 9) \
+    STEP(G, c, d, a, b, m[11], 0x265e5a51u, 14) \
+    STEP(G, b, c, d, a, m[0], 0xe9b6c7aau, 20) \
+    STEP(G, a, b, c, d, m[5], 0xd62f105du, 5) \
+    STEP(G, d, a, b, c, m[10], 0x02441453u, 9) \
+    STEP(G, c, d, a, b, m[15], 0xd8a1e681u, 14) \
+    STEP(G, b, c, d, a, m[4], 0xe7d3fbc8u, 20) \
+    STEP(G, a, b, c, d, m[9], 0x21e1cde6u, 5) \
+    STEP(G, d, a, b, c, m[14], 0xc33707d6u, 9) \
+    STEP(G, c, d, a, b, m[3], 0xf4d50d87u, 14) \
+    STEP(G, b, c, d, a, m[8], 0x455a14edu, 20) \
+    STEP(G, a, b, c, d, m[13], 0xa9e3e905u, 5) \
+    STEP(G, d, a, b, c, m[2], 0xfcefa3f8u, 9) \
+    STEP(G, c, d, a, b, m[7], 0x676f02d9u, 14) \
+    STEP(G, b, c, d, a, m[12], 0x8d2a4c8au, 20) \
+    STEP(H, a, b, c, d, m[5], 0xfffa3942u, 4) \
+    STEP(H, d, a, b, c, m[8], 0x8771f681u, 11) \
+    STEP(H, c, d, a, b, m[11], 0x6d9d6122u, 16) \
+    STEP(H, b, c, d, a, m[14], 0xfde5380cu, 23) \
+    STEP(H, a, b, c, d, m[1], 0xa4beea44u, 4) \
+    STEP(H, d, a, b, c, m[4], 0x4bdecfa9u, 11) \
+    STEP(H, c, d, a, b, m[7], 0xf6bb4b60u, 16) \
+    STEP(H, b, c, d, a, m[10], 0xbebfbc70u, 23) \
+    STEP(H, a, b, c, d, m[13], 0x289b7ec6u, 4) \
+    STEP(H, d, a, b, c, m[0], 0xeaa127fau, 11) \
+    STEP(H, c, d, a, b, m[3], 0xd4ef3085u, 16) \
+    STEP(H, b, c, d, a, m[6], 0x04881d05u, 23) \
+    STEP(H, a, b, c, d, m[9], 0xd9d4d039u, 4) \
+    STEP(H, d, a, b, c, m[12], 0xe6db99e5u, 11) \
+    STEP(H, c, d, a, b, m[15], 0x1fa27cf8u, 16) \
+    STEP(H, b, c, d, a, m[2], 0xc4ac5665u, 23) \
+    STEP(I, a, b, c, d, m[0], 0xf4292244u, 6) \
+    STEP(I, d, a, b, c, m[7], 0x432aff97u, 10) \
+    STEP(I, c, d, a, b, m[14], 0xab9423a7u, 15) \
+    STEP(I, b, c, d, a, m[5], 0xfc93a039u, 21) \
+    STEP(I, a, b, c, d, m[12], 0x655b59c3u, 6) \
+    STEP(I, d, a, b, c, m[3], 0x8f0ccc92u, 10) \
+    STEP(I, c, d, a, b, m[10], 0xffeff47du, 15) \
+    STEP(I, b, c, d, a, m[1], 0x85845dd1u, 21) \
+    STEP(I, a, b, c, d, m[8], 0x6fa87e4fu, 6) \
+    STEP(I, d, a, b, c, m[15], 0xfe2ce6e0u, 10) \
+    STEP(I, c, d, a, b, m[6], 0xa3014314u, 15) \
+    STEP(I, b, c, d, a, m[13], 0x4e0811a1u, 21) \
+    STEP(I, a, b, c, d, m[4], 0xf7537e82u, 6) \
+    STEP(I, d, a, b, c, m[11], 0xbd3af235u, 10) \
+    STEP(I, c, d, a, b, m[2], 0x2ad7d2bbu, 15) \
+    STEP(I, b, c, d, a, m[9], 0xeb86d391u, 21)
+
+static const uint32_t MD5_INITIAL_STATE[4] = {0x67452301u, 0xefcdab89u, 0x98badcfeu, 0x10325476u};
+
+static void md5_compress(uint32_t state[4], const uint32_t m[16]) {
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    MD5_STEPS(m)
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+}
+
+/**
+ * Compresses one block per lane. The compiler emits a copy of this function
+ * for each instruction set listed, and the dynamic loader picks the best one
+ * the CPU supports (through CPUID) when the program starts.
+ */
+__attribute__((target_clones("avx512f", "avx2", "default")))
+static void md5_compress_lanes(lanes_t state[4], const lanes_t m[16]) {
+    lanes_t a = state[0], b = state[1], c = state[2], d = state[3];
+    MD5_STEPS(m)
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+}
+
+/* Scalar MD5 of arbitrary-length messages, for the start of MD5-crypt */
+
+typedef struct {
+    uint32_t state[4];
+    uint64_t length;
+    message_t buffer;
+} md5_t;
+
+static void md5_init(md5_t *md5) {
+    memcpy(md5->state, MD5_INITIAL_STATE, sizeof(md5->state));
+    md5->length = 0;
+}
+
+static void md5_update(md5_t *md5, const void *data, size_t length) {
+    const uint8_t *bytes = data;
+    while (length > 0) {
+        size_t used = md5->length % MD5_BLOCK_SIZE;
+        size_t count = MD5_BLOCK_SIZE - used < length ? MD5_BLOCK_SIZE - used : length;
+        memcpy(&md5->buffer.bytes[used], bytes, count);
+        md5->length += count;
+        bytes += count;
+        length -= count;
+        if (md5->length % MD5_BLOCK_SIZE == 0) {
+            md5_compress(md5->state, md5->buffer.words);
+        }
+    }
+}
+
+static void md5_final(md5_t *md5, uint8_t digest[MD5_DIGEST_SIZE]) {
+    uint64_t bits = md5->length * 8;
+    static const uint8_t padding[MD5_BLOCK_SIZE] = {0x80};
+    size_t used = md5->length % MD5_BLOCK_SIZE;
+    md5_update(md5, padding, (used < 56 ? 56 : 120) - used);
+    md5_update(md5, &bits, sizeof(bits));
+    memcpy(digest, md5->state, MD5_DIGEST_SIZE);
+}
+
+/* MD5-crypt, as in FreeBSD and glibc */
+
+#define NUM_PATTERNS 8
+
+typedef struct {
+    const char *key;
+    size_t key_length;
+    /** The digest carried from round to round */
+    uint8_t digest[MD5_DIGEST_SIZE];
+} lane_t;
+
+/**
+ * Computes the digest that MD5-crypt's 1000 rounds start from. This costs
+ * two MD5s of short messages, a fraction of a percent of the whole hash.
+ */
+static void md5_crypt_start(lane_t *lane, const char *salt, size_t salt_length) {
+    const char *key = lane->key;
+    size_t key_length = lane->key_length;
+    uint8_t alternate[MD5_DIGEST_SIZE];
+    md5_t md5;
+    md5_init(&md5);
+    md5_update(&md5, key, key_length);
+    md5_update(&md5, salt, salt_length);
+    md5_update(&md5, key, key_length);
+    md5_final(&md5, alternate);
+
+    md5_init(&md5);
+    md5_update(&md5, key, key_length);
+    md5_update(&md5, MD5_CRYPT_MAGIC, strlen(MD5_CRYPT_MAGIC));
+    md5_update(&md5, salt, salt_length);
+    for (size_t left = key_length; left > 0; left -= left > MD5_DIGEST_SIZE ? MD5_DIGEST_SIZE : left) {
+        md5_update(&md5, alternate, left > MD5_DIGEST_SIZE ? MD5_DIGEST_SIZE : left);
+    }
+    for (size_t bits = key_length; bits > 0; bits >>= 1) {
+        md5_update(&md5, bits & 1 ? "" : key, 1);
+    }
+    md5_final(&md5, lane->digest);
+}
+
+static inline uint8_t *append(uint8_t *end, const void *data, size_t length) {
+    memcpy(end, data, length);
+    return end + length;
+}
+
+/**
+ * Each round's message is shaped by three choices (odd round, round % 3, round % 7),
+ * so there are only 8 layouts. Returns which one a round uses.
+ */
+static inline size_t round_pattern(size_t round) {
+    return (round & 1) | (round % 3 != 0) << 1 | (round % 7 != 0) << 2;
+}
+
+/**
+ * Lays out one lane's message for rounds with a given pattern, with its padding
+ * and with zeros where the previous round's digest goes.
+ *
+ * @return the offset of the digest in the message
+ */
+static size_t lay_out_pattern(message_t *message, size_t pattern, const lane_t *lane,
+                              const char *salt, size_t salt_length) {
+    static const uint8_t no_digest[MD5_DIGEST_SIZE];
+    bool odd = pattern & 1;
+    *message = (message_t) {0};
+    uint8_t *end = message->bytes;
+    end = odd ? append(end, lane->key, lane->key_length) : append(end, no_digest, MD5_DIGEST_SIZE);
+    if (pattern & 2) {
+        end = append(end, salt, salt_length);
+    }
+    if (pattern & 4) {
+        end = append(end, lane->key, lane->key_length);
+    }
+    size_t offset = odd ? (size_t) (end - message->bytes) : 0;
+    end = odd ? append(end, no_digest, MD5_DIGEST_SIZE) : append(end, lane->key, lane->key_length);
+    uint64_t bits = (end - message->bytes) * 8;
+    *end = 0x80;
+    memcpy(&message->bytes[56], &bits, sizeof(bits));
+    return offset;
+}
+
+/**
+ * Runs MD5-crypt's rounds for a full set of lanes, CRYPT_BATCH_LANES MD5s at a time.
+ * Every lane's message for each pattern is laid out once, up front, so a round only
+ * has to put in the digest: in even rounds it starts the message and is copied
+ * a whole vector at a time, and in odd rounds it goes after the key (at an offset
+ * that differs by lane), so the few words it covers are patched one lane at a time.
+ */
+static void md5_crypt_rounds(lane_t lanes[CRYPT_BATCH_LANES], const char *salt, size_t salt_length) {
+    lanes_t templates[NUM_PATTERNS][16];
+    message_t messages[NUM_PATTERNS][CRYPT_BATCH_LANES];
+    size_t offsets[NUM_PATTERNS][CRYPT_BATCH_LANES];
+    for (size_t pattern = 0; pattern < NUM_PATTERNS; pattern++) {
+        for (size_t i = 0; i < CRYPT_BATCH_LANES; i++) {
+            message_t *message = &messages[pattern][i];
+            offsets[pattern][i] = lay_out_pattern(message, pattern, &lanes[i], salt, salt_length);
+            for (size_t word = 0; word < 16; word++) {
+                templates[pattern][word][i] = message->words[word];
+            }
+        }
+    }
+
+    lanes_t digest[4];
+    for (size_t i = 0; i < CRYPT_BATCH_LANES; i++) {
+        uint32_t words[4];
+        memcpy(words, lanes[i].digest, MD5_DIGEST_SIZE);
+        for (size_t word = 0; word < 4; word++) {
+            digest[word][i] = words[word];
+        }
+    }
+
+    lanes_t block[16];
+    for (size_t round = 0; round < MD5_CRYPT_ROUNDS; round++) {
+        size_t pattern = round_pattern(round);
+        memcpy(block, templates[pattern], sizeof(block));
+        if (pattern & 1) {
+            for (size_t i = 0; i < CRYPT_BATCH_LANES; i++) {
+                message_t *message = &messages[pattern][i];
+                size_t offset = offsets[pattern][i];
+                uint32_t words[4] = {digest[0][i], digest[1][i], digest[2][i], digest[3][i]};
+                memcpy(&message->bytes[offset], words, MD5_DIGEST_SIZE);
+                for (size_t word = offset / 4; word <= (offset + MD5_DIGEST_SIZE - 1) / 4; word++) {
+                    block[word][i] = message->words[word];
+                }
+            }
+        } else {
+            memcpy(block, digest, sizeof(digest));
+        }
+        for (size_t word = 0; word < 4; word++) {
+            digest[word] = (lanes_t) {0} + MD5_INITIAL_STATE[word];
+        }
+        md5_compress_lanes(digest, block);
+    }
+
+    for (size_t i = 0; i < CRYPT_BATCH_LANES; i++) {
+        uint32_t words[4] = {digest[0][i], digest[1][i], digest[2][i], digest[3][i]};
+        memcpy(lanes[i].digest, words, MD5_DIGEST_SIZE);
+    }
+}
+
+static const char BASE64[] = "./0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+
+static char *to64(char *output, uint32_t value, size_t characters) {
+    for (size_t i = 0; i < characters; i++) {
+        *output++ = BASE64[value & 0x3f];
+        value >>= 6;
+    }
+    return output;
+}
+
+static void md5_crypt_output(const lane_t *lane, const char *salt, size_t salt_length, char *output) {
+    const uint8_t *d = lane->digest;
+    size_t magic_length = strlen(MD5_CRYPT_MAGIC);
+    memcpy(output, MD5_CRYPT_MAGIC, magic_length);
+    memcpy(output + magic_length, salt, salt_length);
+    output += magic_length + salt_length;
+    *output++ = '$';
+    output = to64(output, (d[0] << 16) | (d[6] << 8) | d[12], 4);
+    output = to64(output, (d[1] << 16) | (d[7] << 8) | d[13], 4);
+    output = to64(output, (d[2] << 16) | (d[8] << 8) | d[14], 4);
+    output = to64(output, (d[3] << 16) | (d[9] << 8) | d[15], 4);
+    output = to64(output, (d[4] << 16) | (d[10] << 8) | d[5], 4);
+    output = to64(output, d[11], 2);
+    *output = '\0';
+}
+
+/**
+ * Hashes up to CRYPT_BATCH_LANES keys. Unused lanes repeat the first key,
+ * and their results are dropped.
+ */
+static void md5_crypt_lanes(const char *const *keys, const size_t *indices, size_t count,
+                            const char *salt, size_t salt_length,
+                            char (*outputs)[CRYPT_OUTPUT_SIZE]) {
+    lane_t lanes[CRYPT_BATCH_LANES];
+    for (size_t i = 0; i < CRYPT_BATCH_LANES; i++) {
+        const char *key = keys[indices[i < count ? i : 0]];
+        lanes[i] = (lane_t) {.key = key, .key_length = strlen(key)};
+        if (i < count) {
+            md5_crypt_start(&lanes[i], salt, salt_length);
+        } else {
+            memcpy(lanes[i].digest, lanes[0].digest, MD5_DIGEST_SIZE);
+        }
+    }
+    md5_crypt_rounds(lanes, salt, salt_length);
+    for (size_t i = 0; i < count; i++) {
+        md5_crypt_output(&lanes[i], salt, salt_length, outputs[indices[i]]);
+    }
+}
+
+static void crypt_one(const char *key, const char *setting, char *output, struct crypt_data *data) {
+    const char *hash = crypt_r(key, setting, data);
+    // crypt_r() can fail (e.g. on a malformed setting); answer as crypt_rn() does
+    strncpy(output, hash != NULL ? hash : "*0", CRYPT_OUTPUT_SIZE - 1);
+    output[CRYPT_OUTPUT_SIZE - 1] = '\0';
+}
+
+void crypt_batch(const char *const *keys, size_t n, const char *setting,
+                 char (*outputs)[CRYPT_OUTPUT_SIZE], struct crypt_data *data) {
+    size_t magic_length = strlen(MD5_CRYPT_MAGIC);
+    if (strncmp(setting, MD5_CRYPT_MAGIC, magic_length) != 0) {
+        for (size_t i = 0; i < n; i++) {
+            crypt_one(keys[i], setting, outputs[i], data);
+        }
+        return;
+    }
+
+    // The salt ends at the next '$' (if the setting is a whole hash) and is at most 8 characters
+    const char *salt = setting + magic_length;
+    size_t salt_length = strcspn(salt, "$");
+    if (salt_length > MD5_CRYPT_MAX_SALT) {
+        salt_length = MD5_CRYPT_MAX_SALT;
+    }
+
+    size_t indices[CRYPT_BATCH_LANES];
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (strlen(keys[i]) > CRYPT_BATCH_MAX_KEY_LENGTH) {
+            crypt_one(keys[i], setting, outputs[i], data);
+            continue;
+        }
+        indices[count++] = i;
+        if (count == CRYPT_BATCH_LANES) {
+            md5_crypt_lanes(keys, indices, count, salt, salt_length, outputs);
+            count = 0;
+        }
+    }
+    if (count > 0) {
+        md5_crypt_lanes(keys, indices, count, salt, salt_length, outputs);
+    }
+}
+
+const char *crypt_batch_backend(void) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return "avx512f";
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return "avx2";
+    }
+    return "sse2";
+}
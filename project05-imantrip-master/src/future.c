@@ -0,0 +1,196 @@
+#include "future.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "mpmc_queue.h"
+
+typedef enum { PENDING, RUNNING, DONE } future_state_t;
+
+struct future {
+    /** Whoever moves this from PENDING to RUNNING runs the function */
+    _Atomic future_state_t state;
+    /** The pool's work item and the caller of future_get() each hold one */
+    atomic_int references;
+    future_function_t function;
+    void *aux;
+    void *result;
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+};
+
+typedef struct {
+    work_function_t function;
+    void *aux;
+} task_t;
+
+struct task_group {
+    thread_pool_t *pool;
+    /** Work added to the group that no thread has started yet */
+    mpmc_queue_t *tasks;
+    /** Work added to the group that has not finished yet */
+    atomic_size_t unfinished;
+    /** How many tasks are in `tasks` (or about to be) */
+    atomic_size_t queued;
+    /** Threads in task_group_wait(), which must hear about newly queued tasks */
+    atomic_size_t waiters;
+    /** The group's owner and each of its work items in the pool hold one */
+    atomic_size_t references;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+};
+
+static void release_future(future_t *future) {
+    if (atomic_fetch_sub_explicit(&future->references, 1, memory_order_acq_rel) == 1) {
+        pthread_mutex_destroy(&future->lock);
+        pthread_cond_destroy(&future->done);
+        free(future);
+    }
+}
+
+/** Claims a future's work, so that only one thread runs it */
+static bool claim_future(future_t *future) {
+    future_state_t expected = PENDING;
+    return atomic_compare_exchange_strong(&future->state, &expected, RUNNING);
+}
+
+static void future_runner(void *aux) {
+    future_t *future = aux;
+    if (claim_future(future)) {
+        future->result = future->function(future->aux);
+        pthread_mutex_lock(&future->lock);
+        atomic_store(&future->state, DONE);
+        pthread_cond_signal(&future->done);
+        pthread_mutex_unlock(&future->lock);
+    }
+    release_future(future);
+}
+
+future_t *thread_pool_submit(thread_pool_t *pool, future_function_t function, void *aux) {
+    future_t *future = malloc(sizeof(future_t));
+    assert(future != NULL);
+    atomic_init(&future->state, PENDING);
+    atomic_init(&future->references, 2);
+    future->function = function;
+    future->aux = aux;
+    pthread_mutex_init(&future->lock, NULL);
+    pthread_cond_init(&future->done, NULL);
+    thread_pool_add_work(pool, future_runner, future);
+    return future;
+}
+
+void *future_get(future_t *future) {
+    void *result;
+    if (claim_future(future)) {
+        // Still queued: run it here rather than wait behind it
+        result = future->function(future->aux);
+    } else {
+        pthread_mutex_lock(&future->lock);
+        while (atomic_load(&future->state) != DONE) {
+            pthread_cond_wait(&future->done, &future->lock);
+        }
+        pthread_mutex_unlock(&future->lock);
+        result = future->result;
+    }
+    release_future(future);
+    return result;
+}
+
+task_group_t *task_group_init(thread_pool_t *pool) {
+    task_group_t *group = malloc(sizeof(task_group_t));
+    assert(group != NULL);
+    group->pool = pool;
+    group->tasks = mpmc_queue_init();
+    atomic_init(&group->unfinished, 0);
+    atomic_init(&group->queued, 0);
+    atomic_init(&group->waiters, 0);
+    atomic_init(&group->references, 1);
+    pthread_mutex_init(&group->lock, NULL);
+    pthread_cond_init(&group->changed, NULL);
+    return group;
+}
+
+static void release_group(task_group_t *group) {
+    if (atomic_fetch_sub_explicit(&group->references, 1, memory_order_acq_rel) == 1) {
+        mpmc_queue_free(group->tasks);
+        pthread_mutex_destroy(&group->lock);
+        pthread_cond_destroy(&group->changed);
+        free(group);
+    }
+}
+
+/**
+ * Takes one of a group's unstarted tasks, if there are any, and runs it.
+ *
+ * @return whether there was a task to run
+ */
+static bool run_task(task_group_t *group) {
+    void *value;
+    if (!mpmc_queue_try_dequeue(group->tasks, &value)) {
+        return false;
+    }
+    atomic_fetch_sub(&group->queued, 1);
+    task_t *task = value;
+    task->function(task->aux);
+    free(task);
+    if (atomic_fetch_sub_explicit(&group->unfinished, 1, memory_order_acq_rel) == 1) {
+        pthread_mutex_lock(&group->lock);
+        pthread_cond_broadcast(&group->changed);
+        pthread_mutex_unlock(&group->lock);
+    }
+    return true;
+}
+
+/**
+ * A group's work item in the pool. It runs whichever of the group's tasks
+ * is next, which may not be the one it was added for if that one was already run
+ * by a thread in task_group_wait().
+ */
+static void group_runner(void *aux) {
+    task_group_t *group = aux;
+    run_task(group);
+    release_group(group);
+}
+
+void task_group_add_work(task_group_t *group, work_function_t function, void *aux) {
+    task_t *task = malloc(sizeof(task_t));
+    assert(task != NULL);
+    *task = (task_t) {.function = function, .aux = aux};
+    atomic_fetch_add_explicit(&group->unfinished, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&group->references, 1, memory_order_relaxed);
+    // Pairs with task_group_wait(): either the waiter sees the task, or this sees the waiter
+    atomic_fetch_add(&group->queued, 1);
+    mpmc_queue_enqueue(group->tasks, task);
+    if (atomic_load(&group->waiters) > 0) {
+        pthread_mutex_lock(&group->lock);
+        pthread_cond_broadcast(&group->changed);
+        pthread_mutex_unlock(&group->lock);
+    }
+    thread_pool_add_work(group->pool, group_runner, group);
+}
+
+void task_group_wait(task_group_t *group) {
+    while (true) {
+        while (run_task(group)) {
+        }
+        // Every task left to wait for has been started by some running thread,
+        // so sleep until they finish or add more work to help with
+        pthread_mutex_lock(&group->lock);
+        atomic_fetch_add(&group->waiters, 1);
+        while (atomic_load(&group->unfinished) > 0 && atomic_load(&group->queued) == 0) {
+            pthread_cond_wait(&group->changed, &group->lock);
+        }
+        atomic_fetch_sub(&group->waiters, 1);
+        pthread_mutex_unlock(&group->lock);
+        if (atomic_load(&group->unfinished) == 0) {
+            return;
+        }
+    }
+}
+
+void task_group_free(task_group_t *group) {
+    release_group(group);
+}
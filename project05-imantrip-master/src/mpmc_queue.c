@@ -0,0 +1,476 @@
+#include "mpmc_queue.h"
+
+#include <assert.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define CACHE_LINE_SIZE 64
+
+/** How many times a blocked thread retries before it sleeps on a futex */
+#define SPIN_LIMIT 100
+
+/** Slots per segment of an unbounded queue */
+#define SEGMENT_SIZE 1024
+
+/** Threads that can use unbounded queues at once (each needs a hazard pointer) */
+#define MAX_THREADS 256
+
+/** How many unlinked segments an unbounded queue keeps before trying to free them */
+#define RETIRE_THRESHOLD 4
+
+/* Bounded queue: Vyukov's ring buffer */
+
+typedef struct {
+    /**
+     * Position of this slot's next enqueue (if equal to the enqueue position)
+     * or dequeue (if one more than the dequeue position).
+     */
+    atomic_size_t sequence;
+    void *value;
+} cell_t;
+
+/* Unbounded queue: a list of segments, each filled once with fetch-and-add indices */
+
+typedef struct segment segment_t;
+
+struct segment {
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t dequeue_index;
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t enqueue_index;
+    _Alignas(CACHE_LINE_SIZE) _Atomic(segment_t *) next;
+    segment_t *next_retired;
+    _Atomic(void *) items[SEGMENT_SIZE];
+};
+
+/* Markers for segment slots that were never filled, and slots whose value was taken */
+static char empty_marker, taken_marker;
+#define EMPTY ((void *) &empty_marker)
+#define TAKEN ((void *) &taken_marker)
+
+/** An event count that threads can sleep on until it changes */
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t events;
+    _Atomic uint32_t waiters;
+} parking_lot_t;
+
+struct mpmc_queue {
+    bool bounded;
+
+    size_t mask;
+    cell_t *cells;
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t enqueue_position;
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t dequeue_position;
+
+    _Alignas(CACHE_LINE_SIZE) _Atomic(segment_t *) head;
+    _Alignas(CACHE_LINE_SIZE) _Atomic(segment_t *) tail;
+    /** The segment each thread is using, so it isn't freed under the thread */
+    _Alignas(CACHE_LINE_SIZE) _Atomic(segment_t *) hazards[MAX_THREADS];
+    pthread_mutex_t retired_lock;
+    segment_t *retired;
+    size_t num_retired;
+
+    parking_lot_t not_empty;
+    parking_lot_t not_full;
+
+    /** Counters for mpmc_queue_get_stats(), only updated on slow paths */
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t retries;
+    atomic_size_t parks;
+    atomic_size_t wakeups;
+    atomic_size_t segments_allocated;
+};
+
+static inline void count(atomic_size_t *counter) {
+    atomic_fetch_add_explicit(counter, 1, memory_order_relaxed);
+}
+
+/* Futex parking */
+
+static void futex_wait(_Atomic uint32_t *address, uint32_t expected) {
+    syscall(SYS_futex, address, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+static void futex_wake(_Atomic uint32_t *address) {
+    // Each value enqueued (or slot freed) lets only one waiter proceed
+    syscall(SYS_futex, address, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+/**
+ * Wakes the threads sleeping in park(), if there are any.
+ * Called after making progress that they may be waiting for.
+ */
+static void unpark(mpmc_queue_t *queue, parking_lot_t *lot) {
+    // Pairs with the fence in park(): either the sleeper sees the progress,
+    // or this sees the sleeper
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&lot->waiters, memory_order_relaxed) > 0) {
+        atomic_fetch_add(&lot->events, 1);
+        futex_wake(&lot->events);
+        count(&queue->wakeups);
+    }
+}
+
+/**
+ * Retries an operation until it succeeds:
+ * first by spinning, then by sleeping until unpark() is called.
+ */
+static void park(parking_lot_t *lot, bool (*try_operation)(mpmc_queue_t *, void **),
+                 mpmc_queue_t *queue, void **value) {
+    for (size_t spins = 0; spins < SPIN_LIMIT; spins++) {
+        if (try_operation(queue, value)) {
+            return;
+        }
+        cpu_relax();
+    }
+    while (true) {
+        uint32_t events = atomic_load(&lot->events);
+        atomic_fetch_add(&lot->waiters, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        bool done = try_operation(queue, value);
+        if (!done) {
+            count(&queue->parks);
+            futex_wait(&lot->events, events);
+        }
+        atomic_fetch_sub(&lot->waiters, 1);
+        if (done || try_operation(queue, value)) {
+            return;
+        }
+    }
+}
+
+/* Hazard pointer slots, one per live thread */
+
+static pthread_once_t thread_slots_once = PTHREAD_ONCE_INIT;
+static pthread_key_t thread_slot_key;
+static atomic_bool thread_slot_used[MAX_THREADS];
+static _Thread_local int thread_slot = -1;
+
+static void release_thread_slot(void *slot) {
+    atomic_store(&thread_slot_used[(intptr_t) slot - 1], false);
+}
+
+static void init_thread_slots(void) {
+    int result = pthread_key_create(&thread_slot_key, release_thread_slot);
+    assert(result == 0);
+}
+
+/**
+ * Returns this thread's hazard pointer slot, claiming a free one on first use.
+ * The slot is given back when the thread exits.
+ */
+static int get_thread_slot(void) {
+    if (thread_slot < 0) {
+        pthread_once(&thread_slots_once, init_thread_slots);
+        for (int slot = 0; slot < MAX_THREADS; slot++) {
+            if (!atomic_exchange(&thread_slot_used[slot], true)) {
+                thread_slot = slot;
+                pthread_setspecific(thread_slot_key, (void *) (intptr_t) (slot + 1));
+                break;
+            }
+        }
+        assert(thread_slot >= 0);
+    }
+    return thread_slot;
+}
+
+/**
+ * Reads a segment pointer and publishes it as this thread's hazard pointer.
+ * Once published (and re-read unchanged), the segment won't be freed
+ * until the hazard pointer is cleared.
+ */
+static segment_t *protect(mpmc_queue_t *queue, _Atomic(segment_t *) *source, int slot) {
+    segment_t *segment = atomic_load(source);
+    while (true) {
+        atomic_store(&queue->hazards[slot], segment);
+        segment_t *current = atomic_load(source);
+        if (current == segment) {
+            return segment;
+        }
+        segment = current;
+    }
+}
+
+static segment_t *segment_init(void) {
+    segment_t *segment = aligned_alloc(CACHE_LINE_SIZE, sizeof(segment_t));
+    assert(segment != NULL);
+    atomic_init(&segment->dequeue_index, 0);
+    atomic_init(&segment->enqueue_index, 0);
+    atomic_init(&segment->next, NULL);
+    segment->next_retired = NULL;
+    for (size_t i = 0; i < SEGMENT_SIZE; i++) {
+        atomic_init(&segment->items[i], EMPTY);
+    }
+    return segment;
+}
+
+static bool is_hazard(mpmc_queue_t *queue, segment_t *segment) {
+    for (size_t slot = 0; slot < MAX_THREADS; slot++) {
+        if (atomic_load(&queue->hazards[slot]) == segment) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Frees a segment that has been unlinked from the queue once no thread uses it.
+ * Retired segments are collected and checked against the hazard pointers in batches.
+ */
+static void retire(mpmc_queue_t *queue, segment_t *segment) {
+    pthread_mutex_lock(&queue->retired_lock);
+    segment->next_retired = queue->retired;
+    queue->retired = segment;
+    if (++queue->num_retired >= RETIRE_THRESHOLD) {
+        segment_t **link = &queue->retired;
+        while (*link != NULL) {
+            segment_t *retired = *link;
+            if (is_hazard(queue, retired)) {
+                link = &retired->next_retired;
+            } else {
+                *link = retired->next_retired;
+                free(retired);
+                queue->num_retired--;
+            }
+        }
+    }
+    pthread_mutex_unlock(&queue->retired_lock);
+}
+
+/* Bounded operations */
+
+static bool bounded_try_enqueue(mpmc_queue_t *queue, void *value) {
+    size_t position = atomic_load_explicit(&queue->enqueue_position, memory_order_relaxed);
+    cell_t *cell;
+    while (true) {
+        cell = &queue->cells[position & queue->mask];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t difference = (intptr_t) sequence - (intptr_t) position;
+        if (difference == 0) {
+            if (atomic_compare_exchange_weak_explicit(&queue->enqueue_position, &position,
+                                                      position + 1, memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                break;
+            }
+            count(&queue->retries);
+        } else if (difference < 0) {
+            // The slot still holds the value from one lap ago
+            return false;
+        } else {
+            count(&queue->retries);
+            position = atomic_load_explicit(&queue->enqueue_position, memory_order_relaxed);
+        }
+    }
+    cell->value = value;
+    atomic_store_explicit(&cell->sequence, position + 1, memory_order_release);
+    return true;
+}
+
+static bool bounded_try_dequeue(mpmc_queue_t *queue, void **value) {
+    size_t position = atomic_load_explicit(&queue->dequeue_position, memory_order_relaxed);
+    cell_t *cell;
+    while (true) {
+        cell = &queue->cells[position & queue->mask];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t difference = (intptr_t) sequence - (intptr_t) (position + 1);
+        if (difference == 0) {
+            if (atomic_compare_exchange_weak_explicit(&queue->dequeue_position, &position,
+                                                      position + 1, memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                break;
+            }
+            count(&queue->retries);
+        } else if (difference < 0) {
+            // The slot hasn't been filled on this lap yet
+            return false;
+        } else {
+            count(&queue->retries);
+            position = atomic_load_explicit(&queue->dequeue_position, memory_order_relaxed);
+        }
+    }
+    *value = cell->value;
+    atomic_store_explicit(&cell->sequence, position + queue->mask + 1, memory_order_release);
+    return true;
+}
+
+/* Unbounded operations */
+
+static void unbounded_enqueue(mpmc_queue_t *queue, void *value) {
+    int slot = get_thread_slot();
+    while (true) {
+        segment_t *tail = protect(queue, &queue->tail, slot);
+        size_t index = atomic_fetch_add(&tail->enqueue_index, 1);
+        if (index < SEGMENT_SIZE) {
+            void *expected = EMPTY;
+            if (atomic_compare_exchange_strong(&tail->items[index], &expected, value)) {
+                break;
+            }
+            // A dequeuer gave up on this slot before the value arrived; take another
+            count(&queue->retries);
+            continue;
+        }
+
+        // The segment is full: link a new one holding the value, or help whoever did
+        segment_t *next = atomic_load(&tail->next);
+        if (next == NULL) {
+            segment_t *segment = segment_init();
+            atomic_init(&segment->items[0], value);
+            atomic_init(&segment->enqueue_index, 1);
+            if (atomic_compare_exchange_strong(&tail->next, &next, segment)) {
+                atomic_compare_exchange_strong(&queue->tail, &tail, segment);
+                count(&queue->segments_allocated);
+                break;
+            }
+            free(segment);
+        } else {
+            atomic_compare_exchange_strong(&queue->tail, &tail, next);
+        }
+    }
+    atomic_store(&queue->hazards[slot], NULL);
+}
+
+static bool unbounded_try_dequeue(mpmc_queue_t *queue, void **value) {
+    int slot = get_thread_slot();
+    bool found = false;
+    while (true) {
+        segment_t *head = protect(queue, &queue->head, slot);
+        if (atomic_load(&head->dequeue_index) >= atomic_load(&head->enqueue_index)
+            && atomic_load(&head->next) == NULL) {
+            break;
+        }
+        size_t index = atomic_fetch_add(&head->dequeue_index, 1);
+        if (index < SEGMENT_SIZE) {
+            void *item = atomic_exchange(&head->items[index], TAKEN);
+            if (item != EMPTY) {
+                *value = item;
+                found = true;
+                break;
+            }
+            // An enqueuer claimed this slot but hasn't filled it yet
+            count(&queue->retries);
+            continue;
+        }
+
+        // The segment is used up: move on to the next one
+        segment_t *next = atomic_load(&head->next);
+        if (next == NULL) {
+            break;
+        }
+        if (atomic_compare_exchange_strong(&queue->head, &head, next)) {
+            // The tail must not lag behind on the segment being freed
+            segment_t *tail = head;
+            atomic_compare_exchange_strong(&queue->tail, &tail, next);
+            atomic_store(&queue->hazards[slot], NULL);
+            retire(queue, head);
+        }
+    }
+    atomic_store(&queue->hazards[slot], NULL);
+    return found;
+}
+
+/* Public interface */
+
+mpmc_queue_t *mpmc_queue_init_bounded(size_t capacity) {
+    mpmc_queue_t *queue = aligned_alloc(CACHE_LINE_SIZE, sizeof(mpmc_queue_t));
+    assert(queue != NULL);
+    *queue = (mpmc_queue_t) {.bounded = true};
+    size_t size = 1;
+    while (size < capacity) {
+        size *= 2;
+    }
+    queue->mask = size - 1;
+    queue->cells = malloc(size * sizeof(cell_t));
+    assert(queue->cells != NULL);
+    for (size_t i = 0; i < size; i++) {
+        atomic_init(&queue->cells[i].sequence, i);
+    }
+    return queue;
+}
+
+mpmc_queue_t *mpmc_queue_init(void) {
+    mpmc_queue_t *queue = aligned_alloc(CACHE_LINE_SIZE, sizeof(mpmc_queue_t));
+    assert(queue != NULL);
+    *queue = (mpmc_queue_t) {.bounded = false};
+    segment_t *segment = segment_init();
+    atomic_init(&queue->head, segment);
+    atomic_init(&queue->tail, segment);
+    pthread_mutex_init(&queue->retired_lock, NULL);
+    return queue;
+}
+
+bool mpmc_queue_try_enqueue(mpmc_queue_t *queue, void *value) {
+    if (queue->bounded) {
+        if (!bounded_try_enqueue(queue, value)) {
+            return false;
+        }
+    } else {
+        unbounded_enqueue(queue, value);
+    }
+    unpark(queue, &queue->not_empty);
+    return true;
+}
+
+static bool try_enqueue_parked(mpmc_queue_t *queue, void **value) {
+    return bounded_try_enqueue(queue, *value);
+}
+
+void mpmc_queue_enqueue(mpmc_queue_t *queue, void *value) {
+    if (!mpmc_queue_try_enqueue(queue, value)) {
+        park(&queue->not_full, try_enqueue_parked, queue, &value);
+        unpark(queue, &queue->not_empty);
+    }
+}
+
+bool mpmc_queue_try_dequeue(mpmc_queue_t *queue, void **value) {
+    if (!queue->bounded) {
+        return unbounded_try_dequeue(queue, value);
+    }
+    if (!bounded_try_dequeue(queue, value)) {
+        return false;
+    }
+    unpark(queue, &queue->not_full);
+    return true;
+}
+
+void *mpmc_queue_dequeue(mpmc_queue_t *queue) {
+    void *value;
+    park(&queue->not_empty, mpmc_queue_try_dequeue, queue, &value);
+    return value;
+}
+
+void mpmc_queue_get_stats(mpmc_queue_t *queue, mpmc_queue_stats_t *stats) {
+    *stats = (mpmc_queue_stats_t) {
+        .retries = atomic_load_explicit(&queue->retries, memory_order_relaxed),
+        .parks = atomic_load_explicit(&queue->parks, memory_order_relaxed),
+        .wakeups = atomic_load_explicit(&queue->wakeups, memory_order_relaxed),
+        .segments_allocated = atomic_load_explicit(&queue->segments_allocated, memory_order_relaxed),
+    };
+}
+
+void mpmc_queue_free(mpmc_queue_t *queue) {
+    if (queue->bounded) {
+        free(queue->cells);
+    } else {
+        segment_t *segment = atomic_load(&queue->head);
+        while (segment != NULL) {
+            segment_t *next = atomic_load(&segment->next);
+            free(segment);
+            segment = next;
+        }
+        while (queue->retired != NULL) {
+            segment_t *next = queue->retired->next_retired;
+            free(queue->retired);
+            queue->retired = next;
+        }
+        pthread_mutex_destroy(&queue->retired_lock);
+    }
+    free(queue);
+}
@@ -0,0 +1,47 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cracker.h"
+#include "dictionary_words.h"
+#include "thread_pool.h"
+#include "thread_pool_batch.h"
+
+/** The longest line read from the hash list */
+#define MAX_HASH_LENGTH 1024
+
+static void print_password(const char *password, const char *hash, void *aux) {
+    (void) hash;
+    (void) aux;
+    // One printf() call per line, so lines from different threads don't interleave
+    printf("%s\n", password);
+}
+
+static void crack_dictionary_word(size_t index, void *aux) {
+    crack_word(aux, DICTIONARY[index], print_password, NULL);
+}
+
+/**
+ * Reads password hashes from stdin, one per line, and prints the password for each,
+ * in the order they are found. Every password is a dictionary word
+ * with one digit inserted somewhere.
+ */
+int main() {
+    target_set_t *targets = target_set_init();
+    char line[MAX_HASH_LENGTH];
+    while (fgets(line, sizeof(line), stdin) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] != '\0') {
+            target_set_add(targets, line);
+        }
+    }
+
+    long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    assert(num_threads > 0);
+    thread_pool_t *pool = thread_pool_init(num_threads);
+    thread_pool_parallel_for(pool, num_threads, 0, NUM_DICTIONARY_WORDS, crack_dictionary_word,
+                             targets);
+    thread_pool_finish(pool);
+    target_set_free(targets);
+}
@@ -0,0 +1,277 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "thread_pool.h"
+#include "work_stealing.h"
+
+#define CACHE_LINE_SIZE 64
+
+const size_t DEFAULT_TASKS = 100000;
+const uint64_t DEFAULT_WORK_NS = 1000;
+const useconds_t POLL_INTERVAL_US = 100;
+
+typedef struct {
+    uint64_t submitted;
+    uint64_t started;
+    uint64_t finished;
+} task_t;
+
+typedef struct {
+    /** Every task, in submission order */
+    task_t *tasks;
+    size_t num_tasks;
+    size_t num_threads;
+    uint64_t work_ns;
+    /** Whether tasks are submitted by one root task per thread instead of by main() */
+    bool spawn;
+    /** Root tasks that have submitted all of their share */
+    atomic_size_t roots_done;
+
+    thread_pool_t *pool;
+    ws_scheduler_t *scheduler;
+} bench_t;
+
+/** A stealing-mode worker's count of finished tasks, on its own cache line */
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t finished;
+} worker_count_t;
+
+typedef struct {
+    size_t index;
+    worker_count_t *count;
+} worker_args_t;
+
+typedef struct {
+    size_t first;
+    size_t count;
+} root_t;
+
+static bench_t bench;
+
+static uint64_t now_ns(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t) time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+/** A task: record when it started, spin for the task granularity, and record when it ended */
+static void run_task(void *aux) {
+    task_t *task = aux;
+    uint64_t start = now_ns();
+    task->started = start;
+    uint64_t end = start;
+    while (end - start < bench.work_ns) {
+        end = now_ns();
+    }
+    task->finished = end;
+}
+
+static void submit(task_t *task) {
+    task->submitted = now_ns();
+    if (bench.pool != NULL) {
+        thread_pool_add_work(bench.pool, run_task, task);
+    } else {
+        ws_scheduler_submit(bench.scheduler, task);
+    }
+}
+
+/** Submits a share of the tasks from inside the pool, so they go onto this worker's deque */
+static void run_root(void *aux) {
+    root_t *root = aux;
+    for (size_t i = 0; i < root->count; i++) {
+        submit(&bench.tasks[root->first + i]);
+    }
+    atomic_fetch_add(&bench.roots_done, 1);
+}
+
+/** Work values for the stealing scheduler: roots are tagged with the low bit */
+static void *root_work(root_t *root) {
+    return (void *) ((uintptr_t) root | 1);
+}
+
+static void *stealing_worker(void *p) {
+    worker_args_t *args = p;
+    ws_scheduler_register_worker(bench.scheduler, args->index);
+    while (true) {
+        void *work = ws_scheduler_next(bench.scheduler);
+        if (work == NULL) {
+            return NULL;
+        }
+        if ((uintptr_t) work & 1) {
+            run_root((void *) ((uintptr_t) work & ~(uintptr_t) 1));
+        } else {
+            run_task(work);
+            size_t finished = atomic_load_explicit(&args->count->finished, memory_order_relaxed);
+            atomic_store_explicit(&args->count->finished, finished + 1, memory_order_relaxed);
+        }
+    }
+}
+
+static void submit_all(root_t *roots) {
+    if (!bench.spawn) {
+        for (size_t i = 0; i < bench.num_tasks; i++) {
+            submit(&bench.tasks[i]);
+        }
+        return;
+    }
+    for (size_t i = 0; i < bench.num_threads; i++) {
+        if (bench.pool != NULL) {
+            thread_pool_add_work(bench.pool, run_root, &roots[i]);
+        } else {
+            ws_scheduler_submit(bench.scheduler, root_work(&roots[i]));
+        }
+    }
+}
+
+static void run_pool(root_t *roots) {
+    bench.pool = thread_pool_init(bench.num_threads);
+    submit_all(roots);
+    // No work may be added once the pool is finishing, so wait for the roots to submit theirs
+    while (bench.spawn && atomic_load(&bench.roots_done) < bench.num_threads) {
+        usleep(POLL_INTERVAL_US);
+    }
+    thread_pool_finish(bench.pool);
+}
+
+static void run_stealing(root_t *roots) {
+    bench.scheduler = ws_scheduler_init(bench.num_threads);
+    pthread_t *threads = malloc(bench.num_threads * sizeof(pthread_t));
+    worker_args_t *args = malloc(bench.num_threads * sizeof(worker_args_t));
+    worker_count_t *counts = aligned_alloc(CACHE_LINE_SIZE, bench.num_threads * sizeof(worker_count_t));
+    assert(threads != NULL && args != NULL && counts != NULL);
+    for (size_t i = 0; i < bench.num_threads; i++) {
+        atomic_init(&counts[i].finished, 0);
+        args[i] = (worker_args_t) {.index = i, .count = &counts[i]};
+        pthread_create(&threads[i], NULL, stealing_worker, &args[i]);
+    }
+    submit_all(roots);
+
+    // Stop the workers only once every task has run, so none leaves early
+    // while others still have tasks to be stolen
+    while (true) {
+        size_t finished = 0;
+        for (size_t i = 0; i < bench.num_threads; i++) {
+            finished += atomic_load_explicit(&counts[i].finished, memory_order_relaxed);
+        }
+        if (finished == bench.num_tasks) {
+            break;
+        }
+        usleep(POLL_INTERVAL_US);
+    }
+    for (size_t i = 0; i < bench.num_threads; i++) {
+        ws_scheduler_submit(bench.scheduler, NULL);
+    }
+    for (size_t i = 0; i < bench.num_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    ws_scheduler_stats_t stats;
+    ws_scheduler_get_stats(bench.scheduler, &stats);
+    printf("local_pops,%zu\n", stats.local_pops);
+    printf("steal_attempts,%zu\n", stats.steal_attempts);
+    printf("steals,%zu\n", stats.steals);
+    printf("injection_pops,%zu\n", stats.injection_pops);
+    printf("sleeps,%zu\n", stats.sleeps);
+    printf("futex_wakeups,%zu\n", stats.wakeups);
+    printf("injection_retries,%zu\n", stats.injection.retries);
+    printf("injection_segments_allocated,%zu\n", stats.injection.segments_allocated);
+
+    ws_scheduler_free(bench.scheduler);
+    free(counts);
+    free(args);
+    free(threads);
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t percentile(const uint64_t *sorted, size_t n, size_t percent) {
+    return sorted[(n - 1) * percent / 100];
+}
+
+static void print_results(void) {
+    uint64_t first_submitted = UINT64_MAX, last_finished = 0, busy = 0;
+    uint64_t *latencies = malloc(bench.num_tasks * sizeof(uint64_t));
+    assert(latencies != NULL);
+    for (size_t i = 0; i < bench.num_tasks; i++) {
+        task_t *task = &bench.tasks[i];
+        if (task->submitted < first_submitted) {
+            first_submitted = task->submitted;
+        }
+        if (task->finished > last_finished) {
+            last_finished = task->finished;
+        }
+        busy += task->finished - task->started;
+        latencies[i] = task->started - task->submitted;
+    }
+    qsort(latencies, bench.num_tasks, sizeof(uint64_t), compare_u64);
+
+    uint64_t wall = last_finished - first_submitted;
+    uint64_t capacity = wall * bench.num_threads;
+    uint64_t idle = capacity > busy ? capacity - busy : 0;
+    printf("wall_ns,%" PRIu64 "\n", wall);
+    printf("tasks_per_second,%.0f\n", bench.num_tasks / (wall / 1e9));
+    printf("queue_latency_p50_ns,%" PRIu64 "\n", percentile(latencies, bench.num_tasks, 50));
+    printf("queue_latency_p99_ns,%" PRIu64 "\n", percentile(latencies, bench.num_tasks, 99));
+    printf("queue_latency_max_ns,%" PRIu64 "\n", latencies[bench.num_tasks - 1]);
+    printf("idle_ns_per_thread,%" PRIu64 "\n", idle / bench.num_threads);
+    printf("idle_percent,%.1f\n", capacity > 0 ? 100.0 * idle / capacity : 0.0);
+    free(latencies);
+}
+
+/**
+ * Runs a batch of spinning tasks on a thread pool and prints, as CSV,
+ * the throughput, how long tasks waited to start, and how long the workers sat idle.
+ * Idle time is everything other than running tasks: waiting for work,
+ * contending on the queue and the pool's own overhead.
+ * Usage: pool_bench [threads] [tasks] [work_ns] [pool|stealing] [external|spawn]
+ * - pool runs on thread_pool_t; stealing runs the same tasks on ws_scheduler_t
+ *   and also prints its counters (steals, sleeps, futex wakeups, ...).
+ * - external submits every task from main(); spawn submits one root task per thread,
+ *   which submits its share of the tasks from inside the pool.
+ */
+int main(int argc, char *argv[]) {
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    bench.num_threads = argc > 1 ? strtoul(argv[1], NULL, 10) : (size_t) (online > 0 ? online : 1);
+    bench.num_tasks = argc > 2 ? strtoul(argv[2], NULL, 10) : DEFAULT_TASKS;
+    bench.work_ns = argc > 3 ? strtoull(argv[3], NULL, 10) : DEFAULT_WORK_NS;
+    bool stealing = argc > 4 && strcmp(argv[4], "stealing") == 0;
+    bench.spawn = argc > 5 && strcmp(argv[5], "spawn") == 0;
+    assert(bench.num_threads > 0 && bench.num_tasks > 0);
+
+    bench.tasks = calloc(bench.num_tasks, sizeof(task_t));
+    root_t *roots = malloc(bench.num_threads * sizeof(root_t));
+    assert(bench.tasks != NULL && roots != NULL);
+    for (size_t i = 0; i < bench.num_threads; i++) {
+        size_t first = bench.num_tasks * i / bench.num_threads;
+        size_t end = bench.num_tasks * (i + 1) / bench.num_threads;
+        roots[i] = (root_t) {.first = first, .count = end - first};
+    }
+
+    printf("metric,value\n");
+    printf("mode,%s\n", stealing ? "stealing" : "pool");
+    printf("submission,%s\n", bench.spawn ? "spawn" : "external");
+    printf("threads,%zu\n", bench.num_threads);
+    printf("tasks,%zu\n", bench.num_tasks);
+    printf("work_ns,%" PRIu64 "\n", bench.work_ns);
+    if (stealing) {
+        run_stealing(roots);
+    } else {
+        run_pool(roots);
+    }
+    print_results();
+
+    free(roots);
+    free(bench.tasks);
+}
@@ -0,0 +1,159 @@
+#include "thread_pool_batch.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CACHE_LINE_SIZE 64
+
+/** The most work items a batch adds to a pool, and so the most of its tasks that run at once */
+#define MAX_BATCH_RUNNERS 64
+
+/** A parallel for loop claims about 1 / (this * threads) of the remaining indices at a time */
+#define CHUNKS_PER_THREAD 2
+
+/**
+ * A batch of tasks, allocated together with a copy of their arguments.
+ * It is shared by all of the batch's runners and freed by the last one to finish.
+ */
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t next;
+    atomic_size_t references;
+    work_function_t function;
+    size_t n;
+    void *aux[];
+} batch_t;
+
+/** A parallel for loop, shared by the calling thread and the runners it adds */
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t next;
+    /** Indices whose calls have not finished yet */
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t unfinished;
+    atomic_size_t references;
+    index_function_t function;
+    void *aux;
+    size_t end;
+    size_t num_threads;
+    bool done;
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+} parallel_for_t;
+
+static void batch_runner(void *aux) {
+    batch_t *batch = aux;
+    while (true) {
+        size_t index = atomic_fetch_add_explicit(&batch->next, 1, memory_order_relaxed);
+        if (index >= batch->n) {
+            break;
+        }
+        batch->function(batch->aux[index]);
+    }
+    if (atomic_fetch_sub_explicit(&batch->references, 1, memory_order_acq_rel) == 1) {
+        free(batch);
+    }
+}
+
+void thread_pool_add_work_batch(thread_pool_t *pool, work_function_t function, void **aux, size_t n) {
+    if (n == 0) {
+        return;
+    }
+    // aligned_alloc() needs a whole number of cache lines
+    size_t size = sizeof(batch_t) + n * sizeof(void *);
+    size = (size + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+    batch_t *batch = aligned_alloc(CACHE_LINE_SIZE, size);
+    assert(batch != NULL);
+    size_t runners = n < MAX_BATCH_RUNNERS ? n : MAX_BATCH_RUNNERS;
+    atomic_init(&batch->next, 0);
+    atomic_init(&batch->references, runners);
+    batch->function = function;
+    batch->n = n;
+    memcpy(batch->aux, aux, n * sizeof(void *));
+    for (size_t i = 0; i < runners; i++) {
+        thread_pool_add_work(pool, batch_runner, batch);
+    }
+}
+
+/**
+ * Claims the next chunk of a parallel for loop,
+ * a fraction of the indices that remain, and runs it.
+ *
+ * @return whether there was a chunk to run
+ */
+static bool run_chunk(parallel_for_t *loop) {
+    size_t start = atomic_load_explicit(&loop->next, memory_order_relaxed);
+    size_t end;
+    do {
+        if (start >= loop->end) {
+            return false;
+        }
+        size_t size = (loop->end - start) / (CHUNKS_PER_THREAD * loop->num_threads);
+        end = start + (size > 0 ? size : 1);
+    } while (!atomic_compare_exchange_weak_explicit(&loop->next, &start, end,
+                                                    memory_order_relaxed, memory_order_relaxed));
+
+    for (size_t index = start; index < end; index++) {
+        loop->function(index, loop->aux);
+    }
+    if (atomic_fetch_sub_explicit(&loop->unfinished, end - start, memory_order_acq_rel)
+        == end - start) {
+        pthread_mutex_lock(&loop->lock);
+        loop->done = true;
+        pthread_cond_signal(&loop->finished);
+        pthread_mutex_unlock(&loop->lock);
+    }
+    return true;
+}
+
+static void release_loop(parallel_for_t *loop) {
+    if (atomic_fetch_sub_explicit(&loop->references, 1, memory_order_acq_rel) == 1) {
+        pthread_mutex_destroy(&loop->lock);
+        pthread_cond_destroy(&loop->finished);
+        free(loop);
+    }
+}
+
+static void parallel_for_runner(void *aux) {
+    parallel_for_t *loop = aux;
+    while (run_chunk(loop)) {
+    }
+    release_loop(loop);
+}
+
+void thread_pool_parallel_for(thread_pool_t *pool, size_t num_worker_threads, size_t start,
+                              size_t end, index_function_t function, void *aux) {
+    if (start >= end) {
+        return;
+    }
+    parallel_for_t *loop = aligned_alloc(CACHE_LINE_SIZE, sizeof(parallel_for_t));
+    assert(loop != NULL);
+    // The calling thread runs chunks too
+    size_t num_threads = num_worker_threads + 1;
+    size_t runners = end - start - 1 < num_worker_threads ? end - start - 1 : num_worker_threads;
+    atomic_init(&loop->next, start);
+    atomic_init(&loop->unfinished, end - start);
+    atomic_init(&loop->references, runners + 1);
+    loop->function = function;
+    loop->aux = aux;
+    loop->end = end;
+    loop->num_threads = num_threads;
+    loop->done = false;
+    pthread_mutex_init(&loop->lock, NULL);
+    pthread_cond_init(&loop->finished, NULL);
+    for (size_t i = 0; i < runners; i++) {
+        thread_pool_add_work(pool, parallel_for_runner, loop);
+    }
+
+    // Every index this thread doesn't run has been claimed by a running runner,
+    // so the wait below never depends on work still in the pool's queue
+    while (run_chunk(loop)) {
+    }
+    pthread_mutex_lock(&loop->lock);
+    while (!loop->done) {
+        pthread_cond_wait(&loop->finished, &loop->lock);
+    }
+    pthread_mutex_unlock(&loop->lock);
+    release_loop(loop);
+}
@@ -0,0 +1,346 @@
+#include "work_stealing.h"
+
+#include <assert.h>
+#include <linux/futex.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "mpmc_queue.h"
+
+#define CACHE_LINE_SIZE 64
+
+/** Slots in a new deque's array (a power of 2) */
+#define INITIAL_CAPACITY 256
+
+/** How many rounds of looking for work an idle worker makes before it sleeps */
+#define SPIN_LIMIT 100
+
+/* Deque, following Lê et al., "Correct and Efficient Work-Stealing for Weak Memory Models" */
+
+typedef struct array array_t;
+
+struct array {
+    size_t mask;
+    /** The array this one replaced, which thieves may still be reading */
+    array_t *previous;
+    _Atomic(void *) items[];
+};
+
+struct ws_deque {
+    /** Index of the oldest value; thieves advance it */
+    _Alignas(CACHE_LINE_SIZE) _Atomic int64_t top;
+    /** Index one past the newest value; only the owner changes it */
+    _Alignas(CACHE_LINE_SIZE) _Atomic int64_t bottom;
+    _Atomic(array_t *) array;
+};
+
+static array_t *array_init(size_t capacity) {
+    array_t *array = malloc(sizeof(array_t) + capacity * sizeof(_Atomic(void *)));
+    assert(array != NULL);
+    array->mask = capacity - 1;
+    array->previous = NULL;
+    return array;
+}
+
+static inline void *array_get(array_t *array, int64_t index) {
+    return atomic_load_explicit(&array->items[index & array->mask], memory_order_relaxed);
+}
+
+static inline void array_set(array_t *array, int64_t index, void *value) {
+    atomic_store_explicit(&array->items[index & array->mask], value, memory_order_relaxed);
+}
+
+/**
+ * Replaces a full array with one twice its size, holding the same values.
+ * The old array is kept until the deque is freed, since a thief may be reading it.
+ */
+static array_t *grow(ws_deque_t *deque, array_t *array, int64_t top, int64_t bottom) {
+    array_t *bigger = array_init(2 * (array->mask + 1));
+    for (int64_t i = top; i < bottom; i++) {
+        array_set(bigger, i, array_get(array, i));
+    }
+    bigger->previous = array;
+    atomic_store_explicit(&deque->array, bigger, memory_order_release);
+    return bigger;
+}
+
+ws_deque_t *ws_deque_init(void) {
+    ws_deque_t *deque = aligned_alloc(CACHE_LINE_SIZE, sizeof(ws_deque_t));
+    assert(deque != NULL);
+    atomic_init(&deque->top, 0);
+    atomic_init(&deque->bottom, 0);
+    atomic_init(&deque->array, array_init(INITIAL_CAPACITY));
+    return deque;
+}
+
+void ws_deque_push(ws_deque_t *deque, void *value) {
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    array_t *array = atomic_load_explicit(&deque->array, memory_order_relaxed);
+    if (bottom - top > (int64_t) array->mask) {
+        array = grow(deque, array, top, bottom);
+    }
+    array_set(array, bottom, value);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+}
+
+bool ws_deque_pop(ws_deque_t *deque, void **value) {
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    array_t *array = atomic_load_explicit(&deque->array, memory_order_relaxed);
+    // Claim the bottom slot before looking at top, so a thief can't take it unseen
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+    bool found = false;
+    if (top <= bottom) {
+        *value = array_get(array, bottom);
+        found = true;
+        if (top == bottom) {
+            // The last value: race the thieves for it
+            found = atomic_compare_exchange_strong_explicit(
+                &deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed);
+            atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        }
+    } else {
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    }
+    return found;
+}
+
+bool ws_deque_steal(ws_deque_t *deque, void **value) {
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+    if (top >= bottom) {
+        return false;
+    }
+    // Acquire pairs with the release in grow(), so a new array's values are visible
+    array_t *array = atomic_load_explicit(&deque->array, memory_order_acquire);
+    void *item = array_get(array, top);
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                                 memory_order_seq_cst, memory_order_relaxed)) {
+        return false;
+    }
+    *value = item;
+    return true;
+}
+
+bool ws_deque_is_empty(ws_deque_t *deque) {
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+    return top >= bottom;
+}
+
+void ws_deque_free(ws_deque_t *deque) {
+    array_t *array = atomic_load(&deque->array);
+    while (array != NULL) {
+        array_t *previous = array->previous;
+        free(array);
+        array = previous;
+    }
+    free(deque);
+}
+
+/* Scheduler */
+
+typedef struct {
+    /** Starts at 1 for a registered worker, so 0 means "not a worker" */
+    size_t worker_plus_one;
+    ws_scheduler_t *scheduler;
+    uint64_t rng;
+} worker_state_t;
+
+/** One worker's counters for ws_scheduler_get_stats(), written only by that worker */
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t local_pops;
+    atomic_size_t steal_attempts;
+    atomic_size_t steals;
+    atomic_size_t injection_pops;
+    atomic_size_t sleeps;
+} worker_counters_t;
+
+struct ws_scheduler {
+    size_t num_workers;
+    ws_deque_t **deques;
+    mpmc_queue_t *injection;
+    worker_counters_t *counters;
+
+    /** Bumped each time a sleeping worker is woken */
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t events;
+    _Atomic uint32_t sleepers;
+    atomic_size_t wakeups;
+};
+
+static _Thread_local worker_state_t current;
+
+static void futex_wait(_Atomic uint32_t *address, uint32_t expected) {
+    syscall(SYS_futex, address, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+static void futex_wake(_Atomic uint32_t *address) {
+    // Each submission is work for only one worker
+    syscall(SYS_futex, address, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+/** Adds one to a counter that only this thread writes, without a locked instruction */
+static inline void bump(atomic_size_t *counter) {
+    size_t value = atomic_load_explicit(counter, memory_order_relaxed);
+    atomic_store_explicit(counter, value + 1, memory_order_relaxed);
+}
+
+/** Returns the next number from this thread's xorshift64 generator */
+static uint64_t next_random(void) {
+    uint64_t x = current.rng;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return current.rng = x;
+}
+
+ws_scheduler_t *ws_scheduler_init(size_t num_workers) {
+    assert(num_workers > 0);
+    ws_scheduler_t *scheduler = aligned_alloc(CACHE_LINE_SIZE, sizeof(ws_scheduler_t));
+    assert(scheduler != NULL);
+    scheduler->num_workers = num_workers;
+    scheduler->deques = malloc(num_workers * sizeof(ws_deque_t *));
+    assert(scheduler->deques != NULL);
+    for (size_t i = 0; i < num_workers; i++) {
+        scheduler->deques[i] = ws_deque_init();
+    }
+    scheduler->injection = mpmc_queue_init();
+    scheduler->counters = aligned_alloc(CACHE_LINE_SIZE, num_workers * sizeof(worker_counters_t));
+    assert(scheduler->counters != NULL);
+    for (size_t i = 0; i < num_workers; i++) {
+        scheduler->counters[i] = (worker_counters_t) {0};
+    }
+    atomic_init(&scheduler->events, 0);
+    atomic_init(&scheduler->sleepers, 0);
+    atomic_init(&scheduler->wakeups, 0);
+    return scheduler;
+}
+
+void ws_scheduler_register_worker(ws_scheduler_t *scheduler, size_t worker) {
+    assert(worker < scheduler->num_workers);
+    current.scheduler = scheduler;
+    current.worker_plus_one = worker + 1;
+    // Any nonzero seed works; give each worker a different sequence of victims
+    current.rng = 0x9E3779B97F4A7C15ull * (worker + 1);
+}
+
+void ws_scheduler_submit(ws_scheduler_t *scheduler, void *work) {
+    if (current.scheduler == scheduler && current.worker_plus_one > 0) {
+        ws_deque_push(scheduler->deques[current.worker_plus_one - 1], work);
+    } else {
+        mpmc_queue_enqueue(scheduler->injection, work);
+    }
+    // Pairs with the fence in ws_scheduler_next(): either the sleeper sees the work,
+    // or this sees the sleeper
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&scheduler->sleepers, memory_order_relaxed) > 0) {
+        atomic_fetch_add(&scheduler->events, 1);
+        futex_wake(&scheduler->events);
+        atomic_fetch_add_explicit(&scheduler->wakeups, 1, memory_order_relaxed);
+    }
+}
+
+/**
+ * Makes one pass over every place work can be: this worker's deque,
+ * the other workers' deques (starting from a random one), then the injection queue.
+ */
+static bool find_work(ws_scheduler_t *scheduler, size_t self, void **work) {
+    worker_counters_t *counters = &scheduler->counters[self];
+    if (ws_deque_pop(scheduler->deques[self], work)) {
+        bump(&counters->local_pops);
+        return true;
+    }
+    size_t num_workers = scheduler->num_workers;
+    size_t start = next_random() % num_workers;
+    for (size_t i = 0; i < num_workers; i++) {
+        size_t victim = (start + i) % num_workers;
+        if (victim == self) {
+            continue;
+        }
+        bump(&counters->steal_attempts);
+        if (ws_deque_steal(scheduler->deques[victim], work)) {
+            bump(&counters->steals);
+            return true;
+        }
+    }
+    if (mpmc_queue_try_dequeue(scheduler->injection, work)) {
+        bump(&counters->injection_pops);
+        return true;
+    }
+    return false;
+}
+
+/** Whether a pass of find_work() might have missed work, e.g. by losing a steal race */
+static bool may_have_work(ws_scheduler_t *scheduler) {
+    for (size_t i = 0; i < scheduler->num_workers; i++) {
+        if (!ws_deque_is_empty(scheduler->deques[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void *ws_scheduler_next(ws_scheduler_t *scheduler) {
+    assert(current.scheduler == scheduler && current.worker_plus_one > 0);
+    size_t self = current.worker_plus_one - 1;
+    void *work;
+    for (size_t spins = 0; spins < SPIN_LIMIT; spins++) {
+        if (find_work(scheduler, self, &work)) {
+            return work;
+        }
+        cpu_relax();
+    }
+    while (true) {
+        uint32_t events = atomic_load(&scheduler->events);
+        atomic_fetch_add(&scheduler->sleepers, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        bool found = find_work(scheduler, self, &work);
+        if (!found && !may_have_work(scheduler)) {
+            bump(&scheduler->counters[self].sleeps);
+            futex_wait(&scheduler->events, events);
+        }
+        atomic_fetch_sub(&scheduler->sleepers, 1);
+        if (found || find_work(scheduler, self, &work)) {
+            return work;
+        }
+    }
+}
+
+void ws_scheduler_get_stats(ws_scheduler_t *scheduler, ws_scheduler_stats_t *stats) {
+    *stats = (ws_scheduler_stats_t) {
+        .wakeups = atomic_load_explicit(&scheduler->wakeups, memory_order_relaxed),
+    };
+    for (size_t i = 0; i < scheduler->num_workers; i++) {
+        worker_counters_t *counters = &scheduler->counters[i];
+        stats->local_pops += atomic_load_explicit(&counters->local_pops, memory_order_relaxed);
+        stats->steal_attempts += atomic_load_explicit(&counters->steal_attempts, memory_order_relaxed);
+        stats->steals += atomic_load_explicit(&counters->steals, memory_order_relaxed);
+        stats->injection_pops += atomic_load_explicit(&counters->injection_pops, memory_order_relaxed);
+        stats->sleeps += atomic_load_explicit(&counters->sleeps, memory_order_relaxed);
+    }
+    mpmc_queue_get_stats(scheduler->injection, &stats->injection);
+}
+
+void ws_scheduler_free(ws_scheduler_t *scheduler) {
+    for (size_t i = 0; i < scheduler->num_workers; i++) {
+        ws_deque_free(scheduler->deques[i]);
+    }
+    free(scheduler->deques);
+    free(scheduler->counters);
+    mpmc_queue_free(scheduler->injection);
+    free(scheduler);
+}
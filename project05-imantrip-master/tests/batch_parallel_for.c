@@ -0,0 +1,66 @@
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "thread_pool.h"
+#include "thread_pool_batch.h"
+
+const size_t NUM_THREADS = 4;
+const size_t BATCH_SIZE = 100000;
+const size_t NUM_INDICES = 1000000;
+const size_t NESTED_LOOPS = 16;
+const size_t NESTED_INDICES = 1000;
+
+static atomic_size_t batch_sum;
+static uint8_t *visits;
+static thread_pool_t *pool;
+static atomic_size_t nested_sum;
+
+static void add_value(void *aux) {
+    atomic_fetch_add(&batch_sum, (size_t) aux);
+}
+
+static void visit(size_t index, void *aux) {
+    assert(aux == &visits);
+    // Each index is visited by exactly one thread, so there is no race here
+    visits[index]++;
+}
+
+static void add_index(size_t index, void *aux) {
+    (void) aux;
+    atomic_fetch_add(&nested_sum, index);
+}
+
+/** A parallel for loop started from inside the pool must not wait on itself */
+static void nested_loop(size_t index, void *aux) {
+    (void) index;
+    (void) aux;
+    thread_pool_parallel_for(pool, NUM_THREADS, 0, NESTED_INDICES, add_index, NULL);
+}
+
+int main() {
+    pool = thread_pool_init(NUM_THREADS);
+
+    visits = calloc(NUM_INDICES, sizeof(uint8_t));
+    assert(visits != NULL);
+    thread_pool_parallel_for(pool, NUM_THREADS, 0, NUM_INDICES, visit, &visits);
+    for (size_t i = 0; i < NUM_INDICES; i++) {
+        assert(visits[i] == 1);
+    }
+    free(visits);
+
+    thread_pool_parallel_for(pool, NUM_THREADS, 0, NESTED_LOOPS, nested_loop, NULL);
+    assert(atomic_load(&nested_sum) == NESTED_LOOPS * NESTED_INDICES * (NESTED_INDICES - 1) / 2);
+
+    void **aux = malloc(BATCH_SIZE * sizeof(void *));
+    assert(aux != NULL);
+    for (size_t i = 0; i < BATCH_SIZE; i++) {
+        aux[i] = (void *) (i + 1);
+    }
+    thread_pool_add_work_batch(pool, add_value, aux, BATCH_SIZE);
+    // The batch keeps its own copy of the arguments
+    free(aux);
+    thread_pool_finish(pool);
+    assert(atomic_load(&batch_sum) == BATCH_SIZE * (BATCH_SIZE + 1) / 2);
+}
@@ -0,0 +1,61 @@
+#include <assert.h>
+#include <crypt.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "cracker.h"
+#include "thread_pool.h"
+#include "thread_pool_batch.h"
+
+const size_t NUM_THREADS = 4;
+const char *WORDS[] = {"justness", "ad", "grafter", "armada", "recompenses", "somebody",
+                       "exercycle", "jewelling", "perry", "slakes", "interdenominational"};
+/** Target passwords and the settings they are hashed with; several share a salt */
+const char *PASSWORDS[] = {"jus3tness", "0ad", "armada9", "recompe5nses", "perry1",
+                           "somebod4y", "interdenomination7al"};
+const char *SETTINGS[] = {"$1$saltsalt$", "$1$saltsalt$", "$1$saltsalt$", "$1$other$",
+                          "$1$other$", "$5$sha$", "$1$saltsalt$"};
+#define NUM_WORDS (sizeof(WORDS) / sizeof(*WORDS))
+#define NUM_PASSWORDS (sizeof(PASSWORDS) / sizeof(*PASSWORDS))
+
+static atomic_size_t times_found[NUM_PASSWORDS];
+
+static void record(const char *password, const char *hash, void *aux) {
+    (void) aux;
+    for (size_t i = 0; i < NUM_PASSWORDS; i++) {
+        if (strcmp(password, PASSWORDS[i]) == 0) {
+            struct crypt_data data = {0};
+            assert(strcmp(crypt_r(password, SETTINGS[i], &data), hash) == 0);
+            atomic_fetch_add(&times_found[i], 1);
+            return;
+        }
+    }
+    assert(false);
+}
+
+static void crack(size_t index, void *aux) {
+    crack_word(aux, WORDS[index], record, NULL);
+}
+
+int main() {
+    target_set_t *targets = target_set_init();
+    struct crypt_data data = {0};
+    for (size_t i = 0; i < NUM_PASSWORDS; i++) {
+        target_set_add(targets, crypt_r(PASSWORDS[i], SETTINGS[i], &data));
+    }
+    // A duplicate target counts once, and a hash of a word not in the list stays uncracked
+    target_set_add(targets, crypt_r(PASSWORDS[0], SETTINGS[0], &data));
+    target_set_add(targets, crypt_r("notaword5", SETTINGS[0], &data));
+    assert(target_set_remaining(targets) == NUM_PASSWORDS + 1);
+
+    thread_pool_t *pool = thread_pool_init(NUM_THREADS);
+    thread_pool_parallel_for(pool, NUM_THREADS, 0, NUM_WORDS, crack, targets);
+    thread_pool_finish(pool);
+
+    for (size_t i = 0; i < NUM_PASSWORDS; i++) {
+        assert(atomic_load(&times_found[i]) == 1);
+    }
+    assert(target_set_remaining(targets) == 1);
+    target_set_free(targets);
+}
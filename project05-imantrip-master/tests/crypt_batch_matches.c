@@ -0,0 +1,59 @@
+#include <assert.h>
+#include <crypt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "crypt_batch.h"
+#include "dictionary_words.h"
+
+const size_t NUM_WORDS = 300;
+const size_t MAX_KEY_LENGTH = 32;
+const char *SETTINGS[] = {
+    "$1$saltsalt$",
+    // A whole hash works as a setting too, and a salt shorter than 8 characters
+    "$1$ab$Cv6gGWuNODvGqq3TNxvi8.",
+    // Not MD5-crypt, so every key falls back to crypt_r()
+    "$6$saltsalt$",
+};
+
+int main() {
+    // Dictionary words with a digit inserted, as the cracker tries them,
+    // including some longer than the batched core takes
+    size_t n = NUM_WORDS + 1;
+    char (*keys)[MAX_KEY_LENGTH] = malloc(n * sizeof(*keys));
+    const char **key_pointers = malloc(n * sizeof(char *));
+    char (*outputs)[CRYPT_OUTPUT_SIZE] = malloc(n * sizeof(*outputs));
+    assert(keys != NULL && key_pointers != NULL && outputs != NULL);
+    for (size_t i = 0; i < NUM_WORDS; i++) {
+        const char *word = DICTIONARY[i * 97 % NUM_DICTIONARY_WORDS];
+        size_t length = strlen(word);
+        assert(length + 1 < MAX_KEY_LENGTH);
+        size_t position = i % (length + 1);
+        memcpy(keys[i], word, position);
+        keys[i][position] = '0' + i % 10;
+        strcpy(&keys[i][position + 1], &word[position]);
+        key_pointers[i] = keys[i];
+    }
+    strcpy(keys[NUM_WORDS], "");
+    key_pointers[NUM_WORDS] = keys[NUM_WORDS];
+
+    struct crypt_data batch_data = {0};
+    struct crypt_data data = {0};
+    for (size_t setting = 0; setting < sizeof(SETTINGS) / sizeof(*SETTINGS); setting++) {
+        crypt_batch(key_pointers, n, SETTINGS[setting], outputs, &batch_data);
+        for (size_t i = 0; i < n; i++) {
+            const char *expected = crypt_r(key_pointers[i], SETTINGS[setting], &data);
+            if (strcmp(outputs[i], expected) != 0) {
+                fprintf(stderr, "%s with %s: expected %s but got %s\n", key_pointers[i],
+                        SETTINGS[setting], expected, outputs[i]);
+                return 1;
+            }
+        }
+    }
+    printf("crypt_batch backend: %s\n", crypt_batch_backend());
+
+    free(outputs);
+    free(key_pointers);
+    free(keys);
+}
@@ -0,0 +1,85 @@
+#include <assert.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "future.h"
+#include "thread_pool.h"
+
+const size_t NUM_THREADS = 4;
+const size_t NUM_FUTURES = 1000;
+const size_t NUM_PHASES = 10;
+const size_t TASKS_PER_PHASE = 1000;
+const size_t NESTED_TASKS = 100;
+
+static atomic_size_t phase_sum;
+static atomic_size_t nested_count;
+static thread_pool_t *single_pool;
+static sem_t worker_done;
+
+static void *square(void *aux) {
+    size_t value = (size_t) aux;
+    return (void *) (value * value);
+}
+
+static void add_to_sum(void *aux) {
+    atomic_fetch_add(&phase_sum, (size_t) aux);
+}
+
+static void count_nested(void *aux) {
+    task_group_t *group = aux;
+    if (atomic_fetch_add(&nested_count, 1) + 1 < NESTED_TASKS) {
+        // Work added from inside the group while someone waits on it
+        task_group_add_work(group, count_nested, group);
+    }
+}
+
+/**
+ * Waits on a group from the only thread of a pool while the group's work is still queued.
+ * This must run the work in the waiting thread rather than deadlock.
+ */
+static void wait_from_worker(void *aux) {
+    (void) aux;
+    task_group_t *group = task_group_init(single_pool);
+    task_group_add_work(group, count_nested, group);
+    task_group_wait(group);
+    assert(atomic_load(&nested_count) == NESTED_TASKS);
+    task_group_free(group);
+
+    future_t *future = thread_pool_submit(single_pool, square, (void *) 12);
+    assert((size_t) future_get(future) == 144);
+    sem_post(&worker_done);
+}
+
+int main() {
+    thread_pool_t *pool = thread_pool_init(NUM_THREADS);
+
+    future_t *futures[NUM_FUTURES];
+    for (size_t i = 0; i < NUM_FUTURES; i++) {
+        futures[i] = thread_pool_submit(pool, square, (void *) i);
+    }
+    for (size_t i = 0; i < NUM_FUTURES; i++) {
+        assert((size_t) future_get(futures[i]) == i * i);
+    }
+
+    // One group, one warm pool, many phases
+    task_group_t *group = task_group_init(pool);
+    for (size_t phase = 0; phase < NUM_PHASES; phase++) {
+        atomic_store(&phase_sum, 0);
+        for (size_t i = 1; i <= TASKS_PER_PHASE; i++) {
+            task_group_add_work(group, add_to_sum, (void *) i);
+        }
+        task_group_wait(group);
+        assert(atomic_load(&phase_sum) == TASKS_PER_PHASE * (TASKS_PER_PHASE + 1) / 2);
+    }
+    task_group_free(group);
+    thread_pool_finish(pool);
+
+    // No work may be added once thread_pool_finish() is called, so let the worker finish first
+    sem_init(&worker_done, 0, 0);
+    single_pool = thread_pool_init(1);
+    thread_pool_add_work(single_pool, wait_from_worker, NULL);
+    sem_wait(&worker_done);
+    thread_pool_finish(single_pool);
+    sem_destroy(&worker_done);
+}
@@ -0,0 +1,90 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "mpmc_queue.h"
+
+const size_t NUM_PRODUCERS = 4;
+const size_t NUM_CONSUMERS = 4;
+const size_t VALUES_PER_PRODUCER = 200000;
+const size_t BOUNDED_CAPACITY = 64;
+
+typedef struct {
+    mpmc_queue_t *queue;
+    size_t id;
+    /** How many times each value was dequeued (consumers only) */
+    uint8_t *seen;
+} thread_args_t;
+
+static void *producer(void *p) {
+    thread_args_t *args = p;
+    for (size_t i = 0; i < VALUES_PER_PRODUCER; i++) {
+        // Producer 0 enqueues 0, so NULL must be a valid value
+        mpmc_queue_enqueue(args->queue, (void *) (args->id * VALUES_PER_PRODUCER + i));
+    }
+    return NULL;
+}
+
+static void *consumer(void *p) {
+    thread_args_t *args = p;
+    size_t *last = calloc(NUM_PRODUCERS, sizeof(size_t));
+    assert(last != NULL);
+    size_t count = NUM_PRODUCERS * VALUES_PER_PRODUCER / NUM_CONSUMERS;
+    for (size_t i = 0; i < count; i++) {
+        size_t value = (size_t) mpmc_queue_dequeue(args->queue);
+        size_t from = value / VALUES_PER_PRODUCER;
+        size_t index = value % VALUES_PER_PRODUCER + 1;
+        assert(from < NUM_PRODUCERS);
+        // Each producer's values come out in the order it enqueued them
+        assert(index > last[from]);
+        last[from] = index;
+        args->seen[value]++;
+    }
+    free(last);
+    return NULL;
+}
+
+static void test_queue(mpmc_queue_t *queue) {
+    size_t total = NUM_PRODUCERS * VALUES_PER_PRODUCER;
+    uint8_t *seen[NUM_CONSUMERS];
+    pthread_t consumers[NUM_CONSUMERS], producers[NUM_PRODUCERS];
+    thread_args_t consumer_args[NUM_CONSUMERS], producer_args[NUM_PRODUCERS];
+    for (size_t i = 0; i < NUM_CONSUMERS; i++) {
+        seen[i] = calloc(total, sizeof(uint8_t));
+        assert(seen[i] != NULL);
+        consumer_args[i] = (thread_args_t) {.queue = queue, .id = i, .seen = seen[i]};
+        pthread_create(&consumers[i], NULL, consumer, &consumer_args[i]);
+    }
+    for (size_t i = 0; i < NUM_PRODUCERS; i++) {
+        producer_args[i] = (thread_args_t) {.queue = queue, .id = i};
+        pthread_create(&producers[i], NULL, producer, &producer_args[i]);
+    }
+    for (size_t i = 0; i < NUM_PRODUCERS; i++) {
+        pthread_join(producers[i], NULL);
+    }
+    for (size_t i = 0; i < NUM_CONSUMERS; i++) {
+        pthread_join(consumers[i], NULL);
+    }
+
+    for (size_t value = 0; value < total; value++) {
+        size_t times = 0;
+        for (size_t i = 0; i < NUM_CONSUMERS; i++) {
+            times += seen[i][value];
+        }
+        assert(times == 1);
+    }
+    void *extra;
+    assert(!mpmc_queue_try_dequeue(queue, &extra));
+
+    for (size_t i = 0; i < NUM_CONSUMERS; i++) {
+        free(seen[i]);
+    }
+    mpmc_queue_free(queue);
+}
+
+int main() {
+    test_queue(mpmc_queue_init());
+    // A small ring makes producers block on a full queue as well
+    test_queue(mpmc_queue_init_bounded(BOUNDED_CAPACITY));
+}
@@ -0,0 +1,69 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "work_stealing.h"
+
+const size_t NUM_THIEVES = 3;
+const size_t NUM_VALUES = 1000000;
+/** The owner pops one value after every this many pushes, and thieves take the rest */
+const size_t PUSHES_PER_POP = 3;
+
+static ws_deque_t *deque;
+static uint8_t *seen;
+static atomic_bool done;
+
+static void take(void *value) {
+    size_t index = (size_t) value;
+    assert(index < NUM_VALUES);
+    // Each value is taken by exactly one thread, so there is no race here
+    seen[index]++;
+}
+
+static void *thief(void *aux) {
+    (void) aux;
+    void *value;
+    while (true) {
+        if (ws_deque_steal(deque, &value)) {
+            take(value);
+        } else if (atomic_load(&done) && ws_deque_is_empty(deque)) {
+            return NULL;
+        }
+    }
+}
+
+int main() {
+    deque = ws_deque_init();
+    seen = calloc(NUM_VALUES, sizeof(uint8_t));
+    assert(seen != NULL);
+    pthread_t thieves[NUM_THIEVES];
+    for (size_t i = 0; i < NUM_THIEVES; i++) {
+        pthread_create(&thieves[i], NULL, thief, NULL);
+    }
+
+    void *value;
+    for (size_t i = 0; i < NUM_VALUES; i++) {
+        // Value 0 is NULL, which must be allowed
+        ws_deque_push(deque, (void *) i);
+        if (i % PUSHES_PER_POP == 0 && ws_deque_pop(deque, &value)) {
+            take(value);
+        }
+    }
+    while (ws_deque_pop(deque, &value)) {
+        take(value);
+    }
+    atomic_store(&done, true);
+    for (size_t i = 0; i < NUM_THIEVES; i++) {
+        pthread_join(thieves[i], NULL);
+    }
+
+    for (size_t i = 0; i < NUM_VALUES; i++) {
+        assert(seen[i] == 1);
+    }
+    assert(!ws_deque_pop(deque, &value));
+    assert(!ws_deque_steal(deque, &value));
+    free(seen);
+    ws_deque_free(deque);
+}
@@ -0,0 +1,75 @@
+#include <assert.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "work_stealing.h"
+
+const size_t NUM_WORKERS = 4;
+const size_t FANOUT = 5;
+const size_t MAX_DEPTH = 5;
+
+static ws_scheduler_t *scheduler;
+static atomic_size_t tasks_run;
+static size_t total_tasks;
+static sem_t all_done;
+
+typedef struct {
+    size_t index;
+} worker_args_t;
+
+/** Work values are task depths plus one, which keeps NULL free to stop the workers */
+static void run_task(size_t depth) {
+    if (depth < MAX_DEPTH) {
+        for (size_t i = 0; i < FANOUT; i++) {
+            ws_scheduler_submit(scheduler, (void *) (depth + 2));
+        }
+    }
+    if (atomic_fetch_add(&tasks_run, 1) + 1 == total_tasks) {
+        sem_post(&all_done);
+    }
+}
+
+static void *worker(void *p) {
+    worker_args_t *args = p;
+    ws_scheduler_register_worker(scheduler, args->index);
+    while (true) {
+        void *work = ws_scheduler_next(scheduler);
+        if (work == NULL) {
+            return NULL;
+        }
+        run_task((size_t) work - 1);
+    }
+}
+
+int main() {
+    size_t tasks_at_depth = 1;
+    for (size_t depth = 0; depth <= MAX_DEPTH; depth++) {
+        total_tasks += tasks_at_depth;
+        tasks_at_depth *= FANOUT;
+    }
+    sem_init(&all_done, 0, 0);
+    scheduler = ws_scheduler_init(NUM_WORKERS);
+    pthread_t workers[NUM_WORKERS];
+    worker_args_t args[NUM_WORKERS];
+    for (size_t i = 0; i < NUM_WORKERS; i++) {
+        args[i] = (worker_args_t) {.index = i};
+        pthread_create(&workers[i], NULL, worker, &args[i]);
+    }
+
+    // Submitted from outside the pool, so the root goes through the injection queue;
+    // every other task is spawned by a worker onto its own deque
+    ws_scheduler_submit(scheduler, (void *) 1);
+    sem_wait(&all_done);
+    for (size_t i = 0; i < NUM_WORKERS; i++) {
+        ws_scheduler_submit(scheduler, NULL);
+    }
+    for (size_t i = 0; i < NUM_WORKERS; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    assert(atomic_load(&tasks_run) == total_tasks);
+
+    ws_scheduler_free(scheduler);
+    sem_destroy(&all_done);
+}